@@ -0,0 +1,294 @@
+/*
+ * channelPool.hpp
+ *
+ * 按对端地址（Node.address）缓存 gRPC 通道和存根，避免每次 RPC 都重新建立 HTTP/2 连接。
+ * 同一进程中的多个虚拟节点共用一个监听地址，节点地址写作 host:port#i（i 为虚拟节点序号，0 号不带后缀）：
+ * 通道按 host:port 复用，序号随每个请求放在 dhash-vnode 元数据中，由服务端分派到对应的虚拟节点。
+ */
+
+#ifndef INCLUDE_CHANNELPOOL_HPP_
+#define INCLUDE_CHANNELPOOL_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include <grpc/grpc.h>
+#include <grpcpp/client_context.h>
+#include <grpcpp/create_channel.h>
+#include <grpcpp/server_context.h>
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "proto/dhash.grpc.pb.h"
+
+// 请求元数据中目标虚拟节点序号的键
+static const char vnode_metadata_key[] = "dhash-vnode";
+
+// 去掉虚拟节点后缀后的监听地址
+inline std::string endpointOf(const std::string &address)
+{
+	size_t pos = address.rfind('#');
+	return pos == std::string::npos ? address : address.substr(0, pos);
+}
+
+// 虚拟节点 index 的地址，0 号就是监听地址本身
+inline std::string vnodeAddress(const std::string &endpoint, size_t index)
+{
+	return index == 0 ? endpoint : endpoint + "#" + std::to_string(index);
+}
+
+// 发往 address 的请求在发出前调用：地址带有虚拟节点后缀时，把序号写进请求元数据
+inline void routeTo(grpc::ClientContext *context, const std::string &address)
+{
+	size_t pos = address.rfind('#');
+	if (pos != std::string::npos)
+	{
+		context->AddMetadata(vnode_metadata_key, address.substr(pos + 1));
+	}
+}
+
+// 服务端取出请求的目标虚拟节点序号，没有元数据或序号不小于 n 时为 0
+inline size_t vnodeOf(const grpc::ServerContext *context, size_t n)
+{
+	auto iter = context->client_metadata().find(vnode_metadata_key);
+	if (iter == context->client_metadata().end())
+	{
+		return 0;
+	}
+	size_t index = strtoull(std::string(iter->second.data(), iter->second.size()).c_str(), NULL, 10);
+	return index < n ? index : 0;
+}
+
+class ChannelPool
+{
+public:
+	// 连接池的统计计数
+	struct Stats
+	{
+		uint64_t hits;		 // 命中已有通道的次数
+		uint64_t misses;	 // 首次连接某个地址的次数
+		uint64_t reconnects; // 通道被关闭或标记失效后重新建立的次数
+		uint64_t evictions;	 // 因空闲或显式移除而淘汰的通道数
+		uint64_t size;		 // 当前缓存的通道数
+	};
+
+private:
+	// 每个对端地址对应的一条缓存项
+	struct Entry
+	{
+		std::shared_ptr<grpc::Channel> channel;
+		std::shared_ptr<KadImpl::Stub> stub;
+		int64_t created = 0;			   // 建立的时间（毫秒）
+		std::atomic<int64_t> last_used{0}; // 最近一次使用的时间（毫秒）
+		std::atomic<bool> dead{false};	   // 被调用方标记为失效，距建立超过 reconnect_interval_ms 后的下次获取时重建
+	};
+
+	// 按地址哈希分片，每个分片独占一把锁，并按缓存行对齐避免伪共享
+	struct alignas(64) Shard
+	{
+		pthread_mutex_t mu = PTHREAD_MUTEX_INITIALIZER;
+		std::unordered_map<std::string, std::shared_ptr<Entry>> entries;
+		uint64_t acquires = 0; // 用于周期性触发空闲清理
+	};
+
+	static const int num_shards = 16;
+	static const uint64_t sweep_interval = 1024; // 每个分片每获取多少次检查一次空闲通道
+
+	Shard shards[num_shards];
+	int64_t idle_timeout_ms;
+	int64_t reconnect_interval_ms;
+
+	std::atomic<uint64_t> hits{0};
+	std::atomic<uint64_t> misses{0};
+	std::atomic<uint64_t> reconnects{0};
+	std::atomic<uint64_t> evictions{0};
+
+public:
+	/*
+	 * idle_timeout 指定通道空闲多久后被淘汰；reconnect_interval 是同一地址两次重建通道的最小间隔，
+	 * 对端不可达期间 RPC 会持续失败，间隔内的失败不重建通道，由 gRPC 自己按退避重连
+	 */
+	explicit ChannelPool(int64_t idle_timeout = 60 * 1000, int64_t reconnect_interval = 1000)
+	{
+		idle_timeout_ms = idle_timeout;
+		reconnect_interval_ms = reconnect_interval;
+	}
+
+	ChannelPool(const ChannelPool &) = delete;
+	ChannelPool &operator=(const ChannelPool &) = delete;
+
+	/*
+	 * std::shared_ptr<KadImpl::Stub> stub(const std::string &address)
+	 * 返回到 address 的存根。存根和通道都是线程安全的，可被多个线程同时使用；
+	 * 返回 shared_ptr 保证通道在使用期间即使被淘汰也不会被释放。发往虚拟节点的请求还要用 routeTo 设置元数据。
+	 */
+	std::shared_ptr<KadImpl::Stub> stub(const std::string &node_address)
+	{
+		// 同一进程中的虚拟节点共用一条通道
+		std::string address = endpointOf(node_address);
+		Shard &shard = shardOf(address);
+		int64_t now = nowMs();
+		std::shared_ptr<Entry> entry;
+		bool reconnect = false;
+
+		pthread_mutex_lock(&shard.mu);
+		if (++shard.acquires % sweep_interval == 0)
+		{
+			sweepLocked(shard, now);
+		}
+		auto iter = shard.entries.find(address);
+		if (iter != shard.entries.end())
+		{
+			entry = iter->second;
+			if (!needsReconnect(*entry, now))
+			{
+				entry->last_used.store(now, std::memory_order_relaxed);
+				pthread_mutex_unlock(&shard.mu);
+				hits.fetch_add(1, std::memory_order_relaxed);
+				return entry->stub;
+			}
+			// 需要重建的通道直接替换，旧通道在最后一个使用者释放后关闭
+			reconnect = true;
+		}
+		entry = connect(address, now);
+		shard.entries[address] = entry;
+		pthread_mutex_unlock(&shard.mu);
+
+		if (reconnect)
+		{
+			reconnects.fetch_add(1, std::memory_order_relaxed);
+		}
+		else
+		{
+			misses.fetch_add(1, std::memory_order_relaxed);
+		}
+		return entry->stub;
+	}
+
+	/*
+	 * 调用方发现 RPC 失败（如 UNAVAILABLE）时调用。通道建立不到 reconnect_interval_ms 时只做标记，
+	 * 之后的第一次获取才重新建立连接，避免对端不可达时每个失败的 RPC 都重建一次通道
+	 */
+	void markDead(const std::string &node_address)
+	{
+		std::string address = endpointOf(node_address);
+		Shard &shard = shardOf(address);
+		pthread_mutex_lock(&shard.mu);
+		auto iter = shard.entries.find(address);
+		if (iter != shard.entries.end())
+		{
+			iter->second->dead.store(true, std::memory_order_relaxed);
+		}
+		pthread_mutex_unlock(&shard.mu);
+	}
+
+	/*
+	 * 对端退出网络时调用，直接移除到该地址的通道
+	 */
+	void evict(const std::string &node_address)
+	{
+		std::string address = endpointOf(node_address);
+		Shard &shard = shardOf(address);
+		pthread_mutex_lock(&shard.mu);
+		size_t n = shard.entries.erase(address);
+		pthread_mutex_unlock(&shard.mu);
+		evictions.fetch_add(n, std::memory_order_relaxed);
+	}
+
+	/*
+	 * 淘汰所有超过 idle_timeout_ms 未使用的通道，返回淘汰的数量
+	 */
+	size_t evictIdle()
+	{
+		int64_t now = nowMs();
+		size_t n = 0;
+		for (int i = 0; i < num_shards; i++)
+		{
+			pthread_mutex_lock(&shards[i].mu);
+			n += sweepLocked(shards[i], now);
+			pthread_mutex_unlock(&shards[i].mu);
+		}
+		return n;
+	}
+
+	Stats stats()
+	{
+		Stats s;
+		s.hits = hits.load(std::memory_order_relaxed);
+		s.misses = misses.load(std::memory_order_relaxed);
+		s.reconnects = reconnects.load(std::memory_order_relaxed);
+		s.evictions = evictions.load(std::memory_order_relaxed);
+		s.size = 0;
+		for (int i = 0; i < num_shards; i++)
+		{
+			pthread_mutex_lock(&shards[i].mu);
+			s.size += shards[i].entries.size();
+			pthread_mutex_unlock(&shards[i].mu);
+		}
+		return s;
+	}
+
+private:
+	Shard &shardOf(const std::string &address)
+	{
+		return shards[std::hash<std::string>()(address) % num_shards];
+	}
+
+	static int64_t nowMs()
+	{
+		return std::chrono::duration_cast<std::chrono::milliseconds>(
+				   std::chrono::steady_clock::now().time_since_epoch())
+			.count();
+	}
+
+	/*
+	 * 通道已关闭（SHUTDOWN），或被标记失效且距建立已超过 reconnect_interval_ms 时需要重建。
+	 * TRANSIENT_FAILURE 的通道保留，gRPC 会按退避自行重连，重建只会丢掉退避状态、让连接风暴更严重
+	 */
+	bool needsReconnect(const Entry &entry, int64_t now)
+	{
+		if (entry.channel->GetState(false) == GRPC_CHANNEL_SHUTDOWN)
+		{
+			return true;
+		}
+		return entry.dead.load(std::memory_order_relaxed) && now - entry.created >= reconnect_interval_ms;
+	}
+
+	static std::shared_ptr<Entry> connect(const std::string &address, int64_t now)
+	{
+		auto entry = std::make_shared<Entry>();
+		// 值可以很大，批量读取的应答不受默认 4MB 接收上限的限制
+		grpc::ChannelArguments args;
+		args.SetMaxReceiveMessageSize(-1);
+		entry->channel = grpc::CreateCustomChannel(address, grpc::InsecureChannelCredentials(), args);
+		entry->stub = KadImpl::NewStub(entry->channel);
+		entry->created = now;
+		entry->last_used.store(now, std::memory_order_relaxed);
+		return entry;
+	}
+
+	size_t sweepLocked(Shard &shard, int64_t now)
+	{
+		size_t n = 0;
+		for (auto iter = shard.entries.begin(); iter != shard.entries.end();)
+		{
+			if (now - iter->second->last_used.load(std::memory_order_relaxed) > idle_timeout_ms)
+			{
+				iter = shard.entries.erase(iter);
+				n++;
+			}
+			else
+			{
+				++iter;
+			}
+		}
+		evictions.fetch_add(n, std::memory_order_relaxed);
+		return n;
+	}
+};
+
+#endif /* INCLUDE_CHANNELPOOL_HPP_ */
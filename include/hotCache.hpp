@@ -0,0 +1,247 @@
+/*
+ * hotCache.hpp
+ *
+ * 热点值的路径缓存：请求方查找成功后，把值缓存到路径上离键最近、但没有该值的节点。
+ * 缓存与主存储分开，有内存上限，按 LRU 淘汰；有效期由请求方按距离给出，命中越频繁延长得越多。
+ */
+
+#ifndef INCLUDE_HOTCACHE_HPP_
+#define INCLUDE_HOTCACHE_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <pthread.h>
+
+class HotCache
+{
+public:
+	struct Options
+	{
+		uint64_t capacity_bytes = 64ULL << 20; // 缓存的键和值占用的字节数上限，0 表示不接受缓存
+		double rate_unit = 10;				   // 每秒命中数每达到 rate_unit，命中时的续期倍数加 1
+		double max_boost = 16;				   // 续期倍数的上限
+	};
+
+	struct Stats
+	{
+		uint64_t hits;		  // 从缓存返回值的次数
+		uint64_t misses;	  // 缓存中没有或已过期
+		uint64_t inserts;	  // 接受的缓存写入
+		uint64_t evictions;	  // 因内存上限淘汰的缓存项
+		uint64_t expirations; // 过期后被移除的缓存项
+		uint64_t entries;	  // 当前缓存项数
+		uint64_t bytes;		  // 当前占用的字节数
+	};
+
+	// 热点报告中的一项
+	struct HotKey
+	{
+		std::string key;
+		uint64_t hits;
+		double rate; // 缓存以来平均每秒命中数
+	};
+
+private:
+	struct Entry
+	{
+		std::string key;
+		std::string value;
+		int64_t ttl_ms;	 // 请求方给出的有效期，命中时按倍数续期
+		int64_t created; // 写入缓存的时间（毫秒）
+		int64_t expires; // 过期时间（毫秒）
+		uint64_t hits;
+	};
+
+	struct alignas(64) Shard
+	{
+		pthread_mutex_t mu = PTHREAD_MUTEX_INITIALIZER;
+		std::list<Entry> lru; // 头部是最近命中的缓存项
+		std::unordered_map<std::string, std::list<Entry>::iterator> index;
+		uint64_t bytes = 0;
+	};
+
+	static const int num_shards = 16;
+
+	Shard shards[num_shards];
+	Options options;
+	uint64_t shard_bytes;
+
+	std::atomic<uint64_t> hits{0};
+	std::atomic<uint64_t> misses{0};
+	std::atomic<uint64_t> inserts{0};
+	std::atomic<uint64_t> evictions{0};
+	std::atomic<uint64_t> expirations{0};
+
+public:
+	explicit HotCache(Options opts)
+	{
+		options = opts;
+		shard_bytes = options.capacity_bytes / num_shards;
+	}
+
+	HotCache(const HotCache &) = delete;
+	HotCache &operator=(const HotCache &) = delete;
+
+	/*
+	 * 命中且未过期时把值写入 *value 并返回 true。每次命中按平均命中率延长有效期
+	 */
+	bool get(const std::string &key, std::string *value)
+	{
+		if (options.capacity_bytes == 0)
+		{
+			return false;
+		}
+		Shard &shard = shardOf(key);
+		int64_t now = nowMs();
+		bool hit = false;
+		pthread_mutex_lock(&shard.mu);
+		auto iter = shard.index.find(key);
+		if (iter != shard.index.end())
+		{
+			Entry &e = *iter->second;
+			if (e.expires > now)
+			{
+				e.hits++;
+				double boost = std::min(1 + rate(e, now) / options.rate_unit, options.max_boost);
+				e.expires = std::max(e.expires, now + (int64_t)(e.ttl_ms * boost));
+				value->assign(e.value);
+				shard.lru.splice(shard.lru.begin(), shard.lru, iter->second);
+				hit = true;
+			}
+			else
+			{
+				removeLocked(shard, iter->second);
+				expirations.fetch_add(1, std::memory_order_relaxed);
+			}
+		}
+		pthread_mutex_unlock(&shard.mu);
+		(hit ? hits : misses).fetch_add(1, std::memory_order_relaxed);
+		return hit;
+	}
+
+	// 缓存 key 的值 ttl_ms 毫秒，已缓存时替换值并保留命中计数
+	void put(const std::string &key, const std::string &value, int64_t ttl_ms)
+	{
+		uint64_t size = key.size() + value.size();
+		if (ttl_ms <= 0 || size > shard_bytes)
+		{
+			return;
+		}
+		Shard &shard = shardOf(key);
+		int64_t now = nowMs();
+		uint64_t evicted = 0;
+		pthread_mutex_lock(&shard.mu);
+		auto iter = shard.index.find(key);
+		if (iter != shard.index.end())
+		{
+			Entry &e = *iter->second;
+			shard.bytes += value.size() - e.value.size();
+			e.value = value;
+			e.ttl_ms = ttl_ms;
+			e.expires = std::max(e.expires, now + ttl_ms);
+			shard.lru.splice(shard.lru.begin(), shard.lru, iter->second);
+		}
+		else
+		{
+			shard.lru.push_front(Entry{key, value, ttl_ms, now, now + ttl_ms, 0});
+			shard.index[key] = shard.lru.begin();
+			shard.bytes += size;
+		}
+		// 超过内存上限时先淘汰最久未命中的缓存项
+		while (shard.bytes > shard_bytes && shard.lru.size() > 1)
+		{
+			removeLocked(shard, std::prev(shard.lru.end()));
+			evicted++;
+		}
+		pthread_mutex_unlock(&shard.mu);
+		inserts.fetch_add(1, std::memory_order_relaxed);
+		evictions.fetch_add(evicted, std::memory_order_relaxed);
+	}
+
+	/*
+	 * 热点报告：按命中次数返回最热的 n 个仍在缓存中的键
+	 */
+	std::vector<HotKey> hotKeys(size_t n)
+	{
+		std::vector<HotKey> all;
+		int64_t now = nowMs();
+		for (Shard &shard : shards)
+		{
+			pthread_mutex_lock(&shard.mu);
+			for (const Entry &e : shard.lru)
+			{
+				if (e.hits > 0)
+				{
+					all.push_back(HotKey{e.key, e.hits, rate(e, now)});
+				}
+			}
+			pthread_mutex_unlock(&shard.mu);
+		}
+		auto hotter = [](const HotKey &a, const HotKey &b)
+		{ return a.hits > b.hits; };
+		if (all.size() > n)
+		{
+			std::partial_sort(all.begin(), all.begin() + n, all.end(), hotter);
+			all.resize(n);
+		}
+		else
+		{
+			std::sort(all.begin(), all.end(), hotter);
+		}
+		return all;
+	}
+
+	Stats stats()
+	{
+		Stats s;
+		s.hits = hits.load(std::memory_order_relaxed);
+		s.misses = misses.load(std::memory_order_relaxed);
+		s.inserts = inserts.load(std::memory_order_relaxed);
+		s.evictions = evictions.load(std::memory_order_relaxed);
+		s.expirations = expirations.load(std::memory_order_relaxed);
+		s.entries = 0;
+		s.bytes = 0;
+		for (Shard &shard : shards)
+		{
+			pthread_mutex_lock(&shard.mu);
+			s.entries += shard.lru.size();
+			s.bytes += shard.bytes;
+			pthread_mutex_unlock(&shard.mu);
+		}
+		return s;
+	}
+
+private:
+	Shard &shardOf(const std::string &key)
+	{
+		return shards[std::hash<std::string>()(key) % num_shards];
+	}
+
+	void removeLocked(Shard &shard, std::list<Entry>::iterator iter)
+	{
+		shard.bytes -= iter->key.size() + iter->value.size();
+		shard.index.erase(iter->key);
+		shard.lru.erase(iter);
+	}
+
+	// 缓存以来的平均每秒命中数，不足 1 秒按 1 秒计
+	static double rate(const Entry &e, int64_t now)
+	{
+		return e.hits * 1000.0 / std::max<int64_t>(now - e.created, 1000);
+	}
+
+	static int64_t nowMs()
+	{
+		return std::chrono::duration_cast<std::chrono::milliseconds>(
+				   std::chrono::steady_clock::now().time_since_epoch())
+			.count();
+	}
+};
+
+#endif /* INCLUDE_HOTCACHE_HPP_ */
@@ -0,0 +1,327 @@
+/*
+ * kadId.hpp
+ *
+ * 节点 ID 和 ID 空间中的位置：位宽由模板参数决定，按 64 位字存放，最高位的字在前。
+ * 异或、比较和前导零计数都按字并行地完成，字数是编译期常量，循环会被完全展开，
+ * 64 位时生成的代码与直接使用 uint64_t 相同。
+ * 整个程序使用的位宽由 DHASH_ID_BITS 在编译期选择（64 / 128 / 160 / 256，默认 64）。
+ * 在 proto 中 ID 以定长的大端字节串传输，长度为位宽 / 8。
+ */
+
+#ifndef INCLUDE_KADID_HPP_
+#define INCLUDE_KADID_HPP_
+
+#include <algorithm>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifndef DHASH_ID_BITS
+#define DHASH_ID_BITS 64
+#endif
+
+template <int Bits>
+class KadId
+{
+	static_assert(Bits >= 64 && Bits <= 512 && Bits % 32 == 0, "ID width must be a multiple of 32 bits in [64, 512]");
+
+public:
+	static constexpr int bits = Bits;
+	static constexpr int num_words = (Bits + 63) / 64;
+	static constexpr int num_bytes = Bits / 8;
+	// 最高位的字中未使用的位数（160 位时为 32）
+	static constexpr int pad_bits = num_words * 64 - Bits;
+
+	uint64_t w[num_words]; // w[0] 是最高位的字，其中高 pad_bits 位恒为 0
+
+	KadId() : w{} {}
+
+	// 低 64 位为 v，其余为 0
+	static KadId fromU64(uint64_t v)
+	{
+		KadId id;
+		id.w[num_words - 1] = v;
+		return id;
+	}
+
+	/*
+	 * 由种子导出一个均匀分布的 ID：第 i 个字是 splitmix64 序列的第 i 个输出，
+	 * 64 位时就是 splitmix64(seed)
+	 */
+	static KadId fromSeed(uint64_t seed)
+	{
+		KadId id;
+		for (int i = 0; i < num_words; i++)
+		{
+			seed += 0x9e3779b97f4a7c15ULL;
+			uint64_t x = seed;
+			x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+			x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+			id.w[num_words - 1 - i] = x ^ (x >> 31);
+		}
+		id.clearPad();
+		return id;
+	}
+
+	// 大端字节串，长度不足 num_bytes 时高位补 0，超出时只取最后 num_bytes 个字节
+	static KadId fromBytes(std::string_view bytes)
+	{
+		unsigned char buf[num_words * 8] = {0};
+		size_t n = std::min<size_t>(bytes.size(), num_bytes);
+		memcpy(buf + sizeof(buf) - n, bytes.data() + bytes.size() - n, n);
+		KadId id;
+		for (int i = 0; i < num_words; i++)
+		{
+			uint64_t v;
+			memcpy(&v, buf + i * 8, 8);
+			id.w[i] = __builtin_bswap64(v);
+		}
+		id.clearPad();
+		return id;
+	}
+
+	void toBytes(char *out) const
+	{
+		unsigned char buf[num_words * 8];
+		for (int i = 0; i < num_words; i++)
+		{
+			uint64_t v = __builtin_bswap64(w[i]);
+			memcpy(buf + i * 8, &v, 8);
+		}
+		memcpy(out, buf + sizeof(buf) - num_bytes, num_bytes);
+	}
+
+	std::string toBytes() const
+	{
+		std::string out(num_bytes, '\0');
+		toBytes(&out[0]);
+		return out;
+	}
+
+	uint64_t low64() const
+	{
+		return w[num_words - 1];
+	}
+
+	// 最高的 64 位，用于按前缀分组
+	uint64_t high64() const
+	{
+		if constexpr (pad_bits == 0)
+		{
+			return w[0];
+		}
+		else
+		{
+			return (w[0] << pad_bits) | (w[1] >> (64 - pad_bits));
+		}
+	}
+
+	KadId operator^(const KadId &o) const
+	{
+		KadId r;
+		for (int i = 0; i < num_words; i++)
+		{
+			r.w[i] = w[i] ^ o.w[i];
+		}
+		return r;
+	}
+
+	bool operator==(const KadId &o) const
+	{
+		uint64_t diff = 0;
+		for (int i = 0; i < num_words; i++)
+		{
+			diff |= w[i] ^ o.w[i];
+		}
+		return diff == 0;
+	}
+
+	bool operator!=(const KadId &o) const
+	{
+		return !(*this == o);
+	}
+
+	// 按数值比较，即从最高位的字开始逐字比较
+	bool operator<(const KadId &o) const
+	{
+		for (int i = 0; i < num_words - 1; i++)
+		{
+			if (w[i] != o.w[i])
+			{
+				return w[i] < o.w[i];
+			}
+		}
+		return w[num_words - 1] < o.w[num_words - 1];
+	}
+
+	bool isZero() const
+	{
+		return *this == KadId();
+	}
+
+	// 前导零个数，全为 0 时返回 Bits
+	int leadingZeros() const
+	{
+		for (int i = 0; i < num_words; i++)
+		{
+			if (w[i] != 0)
+			{
+				return i * 64 + __builtin_clzll(w[i]) - pad_bits;
+			}
+		}
+		return Bits;
+	}
+
+	// 只保留最高的 n 位，其余清零
+	KadId prefix(int n) const
+	{
+		KadId r = *this;
+		int drop = Bits - std::min(std::max(n, 0), Bits);
+		for (int i = num_words - 1; i >= 0 && drop > 0; i--, drop -= 64)
+		{
+			r.w[i] &= drop >= 64 ? 0 : ~0ULL << drop;
+		}
+		return r;
+	}
+
+	// 最高位为第 i 位（从 0 起）、更低的位取自 fill 的距离，落在路由表第 i 个桶覆盖的范围内
+	static KadId bucketDistance(int i, const KadId &fill)
+	{
+		KadId r;
+		int top = num_words - 1 - i / 64;
+		uint64_t bit = 1ULL << (i % 64);
+		for (int j = top; j < num_words; j++)
+		{
+			r.w[j] = j == top ? (fill.w[j] & (bit - 1)) | bit : fill.w[j];
+		}
+		return r;
+	}
+
+	// a 是否比 b 离 target 更近（异或距离更小），不生成中间的距离值
+	static bool closer(const KadId &a, const KadId &b, const KadId &target)
+	{
+		for (int i = 0; i < num_words - 1; i++)
+		{
+			uint64_t da = a.w[i] ^ target.w[i], db = b.w[i] ^ target.w[i];
+			if (da != db)
+			{
+				return da < db;
+			}
+		}
+		return (a.w[num_words - 1] ^ target.w[num_words - 1]) < (b.w[num_words - 1] ^ target.w[num_words - 1]);
+	}
+
+	// 64 位时输出十进制（与整数 ID 的习惯一致），更宽时输出十六进制
+	std::string str() const
+	{
+		char buf[num_words * 16 + 8]; // 64 位的十进制最多 20 位
+		if (num_words == 1)
+		{
+			snprintf(buf, sizeof(buf), "%lu", (unsigned long)w[0]);
+			return buf;
+		}
+		for (int i = 0; i < num_words; i++)
+		{
+			snprintf(buf + i * 16, 17, "%016lx", (unsigned long)w[i]);
+		}
+		return std::string(buf + pad_bits / 4);
+	}
+
+	size_t hash() const
+	{
+		uint64_t h = 0;
+		for (int i = 0; i < num_words; i++)
+		{
+			h = (h ^ w[i]) * 0x9e3779b97f4a7c15ULL;
+		}
+		return h ^ (h >> 29);
+	}
+
+private:
+	void clearPad()
+	{
+		if (pad_bits != 0)
+		{
+			w[0] &= ~0ULL >> pad_bits;
+		}
+	}
+};
+
+using NodeID = KadId<DHASH_ID_BITS>;
+
+namespace std
+{
+	template <int Bits>
+	struct hash<KadId<Bits>>
+	{
+		size_t operator()(const KadId<Bits> &id) const
+		{
+			return id.hash();
+		}
+	};
+}
+
+/*
+ * 从 items 中选出离 target 最近的 n 个，按异或距离升序排列。
+ * 先按距离的最高 64 位对（前缀, 下标）做 nth_element，元素与 64 位 ID 时一样大；
+ * 只有前缀不大于第 n 个前缀的项（通常恰好 n 个）才按完整距离排序
+ */
+template <class T, int Bits, class IdOf>
+void closestK(std::vector<T> &items, const KadId<Bits> &target, size_t n, IdOf id_of)
+{
+	if (items.empty() || n == 0)
+	{
+		items.clear();
+		return;
+	}
+	n = std::min(n, items.size());
+	std::vector<std::pair<uint64_t, uint32_t>> order(items.size());
+	for (size_t i = 0; i < items.size(); i++)
+	{
+		order[i] = std::make_pair((id_of(items[i]) ^ target).high64(), (uint32_t)i);
+	}
+	auto by_prefix = [](const std::pair<uint64_t, uint32_t> &a, const std::pair<uint64_t, uint32_t> &b)
+	{ return a.first < b.first; };
+	std::nth_element(order.begin(), order.begin() + (n - 1), order.end(), by_prefix);
+	// 与第 n 个前缀相同的项都可能在最近的 n 个之内
+	uint64_t bound = order[n - 1].first;
+	auto last = std::partition(order.begin() + n, order.end(), [bound](const std::pair<uint64_t, uint32_t> &o)
+							   { return o.first == bound; });
+	order.erase(last, order.end());
+	std::sort(order.begin(), order.end(), [&](const std::pair<uint64_t, uint32_t> &a, const std::pair<uint64_t, uint32_t> &b)
+			  { return a.first != b.first ? a.first < b.first : KadId<Bits>::closer(id_of(items[a.second]), id_of(items[b.second]), target); });
+	order.resize(n);
+	std::vector<T> out;
+	out.reserve(n);
+	for (const auto &o : order)
+	{
+		out.push_back(std::move(items[o.second]));
+	}
+	items.swap(out);
+}
+
+/*
+ * proto 中的 Node.id 是定长的大端字节串。
+ * 按消息类型写成模板，本文件不依赖生成的 proto 代码，调用处已经包含了 dhash.pb.h
+ */
+template <class NodeMsg>
+inline NodeID nodeIdOf(const NodeMsg &node)
+{
+	return NodeID::fromBytes(node.id());
+}
+
+template <class NodeMsg>
+inline void setNodeId(NodeMsg *node, const NodeID &id)
+{
+	char buf[NodeID::num_bytes];
+	id.toBytes(buf);
+	node->set_id(buf, sizeof(buf));
+}
+
+#endif /* INCLUDE_KADID_HPP_ */
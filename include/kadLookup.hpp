@@ -0,0 +1,443 @@
+/*
+ * kadLookup.hpp
+ *
+ * Kademlia 迭代查找：维护一个按到目标键异或距离排序的候选列表，
+ * 同时最多向 alpha 个节点发起 find_node / find_value，直到距离最近的 k 个节点都已应答。
+ * 开启对冲时，find_value 超过对冲延迟仍未应答的节点不再占用并发名额，查找转而询问下一个候选。
+ */
+
+#ifndef INCLUDE_KADLOOKUP_HPP_
+#define INCLUDE_KADLOOKUP_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "proto/dhash.pb.h"
+#include "kadRpc.hpp"
+#include "kadId.hpp"
+
+/*
+ * HedgePolicy
+ * 记录最近 window 个 find_value RPC 的延迟，对冲延迟取其中的 percentile 分位数，
+ * 并限制在 [min_us, max_us] 之内。样本不足时使用 max_us
+ */
+class HedgePolicy
+{
+	static const int window = 1024;
+	static const int recompute_every = 128;
+
+	std::atomic<uint32_t> samples[window] = {};
+	std::atomic<uint64_t> recorded{0};
+	std::atomic<int64_t> delay_us;
+	double percentile;
+	int64_t min_us, max_us;
+
+public:
+	HedgePolicy(double p, int64_t min_delay_us, int64_t max_delay_us)
+	{
+		percentile = std::min(std::max(p, 0.0), 1.0);
+		min_us = min_delay_us;
+		max_us = std::max(max_delay_us, min_delay_us);
+		delay_us.store(max_us);
+	}
+
+	void record(uint64_t us)
+	{
+		uint64_t n = recorded.fetch_add(1, std::memory_order_relaxed);
+		samples[n % window].store((uint32_t)std::min<uint64_t>(us, UINT32_MAX), std::memory_order_relaxed);
+		// 每 recompute_every 个样本重新计算一次分位数，并发的重算只会让结果稍旧
+		if ((n + 1) % recompute_every == 0)
+		{
+			uint64_t m = std::min<uint64_t>(n + 1, window);
+			std::vector<uint32_t> copy(m);
+			for (uint64_t i = 0; i < m; i++)
+			{
+				copy[i] = samples[i].load(std::memory_order_relaxed);
+			}
+			size_t k = std::min<size_t>((size_t)(percentile * m), m - 1);
+			std::nth_element(copy.begin(), copy.begin() + k, copy.end());
+			delay_us.store(std::min(std::max<int64_t>(copy[k], min_us), max_us), std::memory_order_relaxed);
+		}
+	}
+
+	int64_t delayUs()
+	{
+		return delay_us.load(std::memory_order_relaxed);
+	}
+};
+
+class KadLookup : public std::enable_shared_from_this<KadLookup>
+{
+public:
+	enum Mode
+	{
+		FIND_NODE,
+		FIND_VALUE
+	};
+
+	struct Result
+	{
+		bool found = false;		   // FIND_VALUE 模式下是否找到了值
+		std::string value;		   // 找到的值
+		Node holder;			   // 返回值的节点
+		std::vector<Node> closest; // 已应答的最近 k 个节点（可能包含本地节点），按距离升序
+		uint64_t hops = 0;		   // 查找深度：本地路由表中的节点为第 1 跳
+		uint64_t contacted = 0;	   // 发出的 RPC 数
+		uint64_t failed = 0;	   // 失败或超时的 RPC 数
+		uint64_t hedged = 0;	   // 超过对冲延迟后改问下一个候选的次数
+		// 找到值时已应答、但没有该值的最近节点（不含本地节点），用于路径缓存
+		bool has_cache_node = false;
+		Node cache_node;
+		uint64_t cache_rank = 0; // 已应答的节点中比 cache_node 离目标更近的个数
+	};
+
+	// 每收到一个节点的应答就回调一次，用于刷新本地路由表
+	using ContactFn = std::function<void(const Node &)>;
+	using DoneFn = std::function<void(Result &)>;
+
+private:
+	enum State
+	{
+		FRESH,	  // 尚未询问
+		INFLIGHT, // 已发出请求
+		ANSWERED, // 已应答
+		FAILED	  // 请求失败
+	};
+
+	struct Candidate
+	{
+		Node node;
+		NodeID dis;
+		uint64_t depth;
+		State state;
+		bool hedged; // 已超过对冲延迟，不再占用并发名额
+	};
+
+	KadRpc *rpc;
+	Node local_node;
+	NodeID target;
+	std::string idkey; // 请求中携带的键：FIND_VALUE 时是原始键，否则是 target 的定长字节编码
+	Mode mode;
+	uint64_t alpha;
+	uint64_t k_closest;
+	ContactFn on_contact;
+	ContactFn on_suspect; // 请求失败或超时的节点，可以为空
+	DoneFn on_done;
+	int64_t timeout_ms = 0;		   // 每个 RPC 的超时，0 表示使用 KadRpc 的默认值
+	HedgePolicy *hedge = nullptr;  // 非空时对 find_value 做对冲
+
+	std::mutex mu;
+	std::vector<Candidate> shortlist; // 按 dis 升序
+	std::unordered_set<NodeID> seen;
+	uint64_t inflight = 0;
+	uint64_t hedged_inflight = 0; // inflight 中已超过对冲延迟的请求数
+	bool finished = false;
+	Result result;
+
+public:
+	// key 为 FIND_VALUE 要查找的原始键，target 是它在 ID 空间中的位置；为空时请求中携带 target
+	KadLookup(KadRpc *client, const Node &self, const NodeID &target_id, Mode m, uint64_t a, uint64_t k,
+			  const std::string &key = std::string())
+	{
+		rpc = client;
+		local_node = self;
+		target = target_id;
+		idkey = key.empty() ? target_id.toBytes() : key;
+		mode = m;
+		alpha = a;
+		k_closest = k;
+	}
+
+	// 在 start 之前调用
+	void setTimeout(int64_t ms)
+	{
+		timeout_ms = ms;
+	}
+
+	// 在 start 之前调用，只对 FIND_VALUE 生效
+	void setHedge(HedgePolicy *policy)
+	{
+		hedge = mode == FIND_VALUE ? policy : nullptr;
+	}
+
+	// 在 start 之前调用：每个请求失败或超时的节点回调一次，用于安排存活探测
+	void setSuspect(ContactFn suspect)
+	{
+		on_suspect = std::move(suspect);
+	}
+
+	/*
+	 * void start(seeds, contact, done)
+	 * 以本地路由表中离目标最近的节点为起点开始查找。查找结束时在某个 RPC 轮询线程
+	 * （或者没有可询问的节点时在当前线程）中调用 done，且只调用一次。
+	 */
+	void start(const std::vector<Node> &seeds, ContactFn contact, DoneFn done)
+	{
+		on_contact = std::move(contact);
+		on_done = std::move(done);
+		std::vector<Node> sends;
+		bool complete;
+		{
+			std::lock_guard<std::mutex> guard(mu);
+			// 本地节点视为已应答，使它参与“最近 k 个节点”的判断
+			add(local_node, 0, ANSWERED);
+			for (const Node &node : seeds)
+			{
+				add(node, 1, FRESH);
+			}
+			complete = advance(sends);
+		}
+		send(sends);
+		if (complete)
+		{
+			on_done(result);
+		}
+	}
+
+private:
+	void add(const Node &node, uint64_t depth, State state)
+	{
+		NodeID id = nodeIdOf(node);
+		if (!seen.insert(id).second)
+		{
+			return;
+		}
+		Candidate c{node, id ^ target, depth, state, false};
+		auto pos = std::upper_bound(shortlist.begin(), shortlist.end(), c,
+									[](const Candidate &a, const Candidate &b)
+									{ return a.dis < b.dis; });
+		shortlist.insert(pos, c);
+	}
+
+	/*
+	 * 持锁调用：在最近的 k 个未失败候选中挑出尚未询问的节点，补足 alpha 个并发请求。
+	 * 超过对冲延迟的请求既不占并发名额，也不算在最近的 k 个之内。
+	 * 返回 true 表示查找刚刚结束。
+	 */
+	bool advance(std::vector<Node> &sends)
+	{
+		if (finished)
+		{
+			return false;
+		}
+		uint64_t considered = 0;
+		for (Candidate &c : shortlist)
+		{
+			if (considered >= k_closest || inflight - hedged_inflight >= alpha)
+			{
+				break;
+			}
+			if (c.state == FAILED || (c.state == INFLIGHT && c.hedged))
+			{
+				continue;
+			}
+			considered++;
+			if (c.state == FRESH)
+			{
+				c.state = INFLIGHT;
+				inflight++;
+				result.contacted++;
+				sends.push_back(c.node);
+			}
+		}
+		// 超过对冲延迟的请求仍然要等它应答或超时，值可能正在它那里
+		if (inflight > 0)
+		{
+			return false;
+		}
+		// 最近的 k 个节点都已应答
+		finished = true;
+		for (const Candidate &c : shortlist)
+		{
+			if (result.closest.size() >= k_closest)
+			{
+				break;
+			}
+			if (c.state == ANSWERED)
+			{
+				result.closest.push_back(c.node);
+				result.hops = std::max(result.hops, c.depth);
+			}
+		}
+		return true;
+	}
+
+	// 持锁调用：在找到值的时刻选出路径缓存的目标节点
+	void pickCacheNode()
+	{
+		uint64_t rank = 0;
+		for (const Candidate &c : shortlist)
+		{
+			if (c.state != ANSWERED)
+			{
+				continue;
+			}
+			if (c.node.id() != local_node.id() && c.node.id() != result.holder.id())
+			{
+				result.has_cache_node = true;
+				result.cache_node = c.node;
+				result.cache_rank = rank;
+				return;
+			}
+			rank++;
+		}
+	}
+
+	void send(const std::vector<Node> &sends)
+	{
+		if (sends.empty())
+		{
+			return;
+		}
+		IDKey request;
+		request.set_idkey(idkey);
+		request.mutable_node()->CopyFrom(local_node);
+		auto self = shared_from_this();
+		for (const Node &node : sends)
+		{
+			// 候选按 proto 中的 ID 字节串匹配应答
+			std::string id = node.id();
+			if (mode == FIND_NODE)
+			{
+				rpc->call<IDKey, NodeList>(
+					node.address(), &KadImpl::Stub::PrepareAsyncfind_node, request,
+					[self, id](const grpc::Status &status, NodeList &response)
+					{
+						self->onResponse(id, status.ok(), response.resp_node(), response.nodes(), nullptr);
+					},
+					timeout_ms);
+				continue;
+			}
+			int64_t sent = rpc->nowUs();
+			rpc->call<IDKey, KV_Node_Wrapper>(
+				node.address(), &KadImpl::Stub::PrepareAsyncfind_value, request,
+				[self, id, sent](const grpc::Status &status, KV_Node_Wrapper &response)
+				{
+					if (self->hedge != nullptr)
+					{
+						// 失败的请求按它耗费的时间计入，慢节点超时也会推高对冲延迟的估计；
+						// 与对冲定时器用同一个时钟，仿真时是虚拟时间
+						self->hedge->record(std::max<int64_t>(self->rpc->nowUs() - sent, 0));
+					}
+					// 值直接从应答中移走，不再拷贝
+					KeyValue *kv = response.mode_kv() ? response.mutable_kv() : nullptr;
+					self->onResponse(id, status.ok(), response.resp_node(), response.nodes(), kv);
+				},
+				timeout_ms);
+			if (hedge != nullptr)
+			{
+				rpc->after(hedge->delayUs(), [self, id]
+						   { self->onSlow(id); });
+			}
+		}
+	}
+
+	// 对冲延迟到期：请求仍未应答时让出它的并发名额，向下一个候选发出同样的请求
+	void onSlow(const std::string &id)
+	{
+		std::vector<Node> sends;
+		bool complete = false;
+		{
+			std::lock_guard<std::mutex> guard(mu);
+			if (finished)
+			{
+				return;
+			}
+			auto iter = std::find_if(shortlist.begin(), shortlist.end(),
+									 [&id](const Candidate &c)
+									 { return c.node.id() == id; });
+			if (iter == shortlist.end() || iter->state != INFLIGHT || iter->hedged)
+			{
+				return;
+			}
+			iter->hedged = true;
+			hedged_inflight++;
+			result.hedged++;
+			complete = advance(sends);
+		}
+		send(sends);
+		if (complete)
+		{
+			on_done(result);
+		}
+	}
+
+	void onResponse(const std::string &id, bool ok, const Node &resp_node,
+					const google::protobuf::RepeatedPtrField<Node> &nodes, KeyValue *kv)
+	{
+		std::vector<Node> sends;
+		bool complete = false;
+		Node failed;
+		{
+			std::lock_guard<std::mutex> guard(mu);
+			auto iter = std::find_if(shortlist.begin(), shortlist.end(),
+									 [&id](const Candidate &c)
+									 { return c.node.id() == id; });
+			inflight--;
+			if (iter->hedged)
+			{
+				hedged_inflight--;
+			}
+			if (!ok)
+			{
+				iter->state = FAILED;
+				// 结束后 result 已交给 on_done（在锁外使用），迟到的应答不再修改它
+				if (!finished)
+				{
+					result.failed++;
+				}
+				failed = iter->node;
+			}
+			else
+			{
+				iter->state = ANSWERED;
+				if (kv != nullptr && !finished)
+				{
+					// 找到值后立即结束，其余仍在进行的请求的应答会被忽略
+					finished = true;
+					complete = true;
+					result.found = true;
+					result.value = std::move(*kv->mutable_value());
+					result.holder = iter->node;
+					result.hops = iter->depth;
+					pickCacheNode();
+				}
+				else
+				{
+					// add 会插入 shortlist，之后 iter 可能失效，先取出深度
+					uint64_t depth = iter->depth + 1;
+					for (const Node &node : nodes)
+					{
+						add(node, depth, FRESH);
+					}
+				}
+			}
+			if (!complete)
+			{
+				complete = advance(sends);
+			}
+		}
+		if (ok)
+		{
+			on_contact(resp_node);
+		}
+		else if (on_suspect)
+		{
+			on_suspect(failed);
+		}
+		send(sends);
+		if (complete)
+		{
+			on_done(result);
+		}
+	}
+};
+
+#endif /* INCLUDE_KADLOOKUP_HPP_ */
@@ -0,0 +1,328 @@
+/*
+ * kadRpc.hpp
+ *
+ * 基于完成队列（CompletionQueue）的异步 RPC 客户端：发起调用后立即返回，
+ * 响应由后台轮询线程取出并通过回调交给调用方。
+ * 设置了传输层（见 transport.hpp）时，传输层能送达的地址不经 gRPC，由传输层投递并回调。
+ */
+
+#ifndef INCLUDE_KADRPC_HPP_
+#define INCLUDE_KADRPC_HPP_
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <grpc/grpc.h>
+#include <grpcpp/alarm.h>
+#include <grpcpp/completion_queue.h>
+
+#include <pthread.h>
+
+#include "proto/dhash.grpc.pb.h"
+#include "channelPool.hpp"
+#include "transport.hpp"
+
+class KadRpc
+{
+public:
+	// 存根上 PrepareAsyncXXX 方法的指针类型，用于统一发起任意一元 RPC
+	template <class Req, class Resp>
+	using PrepareFn = std::unique_ptr<grpc::ClientAsyncResponseReader<Resp>> (KadImpl::Stub::*)(
+		grpc::ClientContext *, const Req &, grpc::CompletionQueue *);
+
+	template <class Resp>
+	using Callback = std::function<void(const grpc::Status &, Resp &)>;
+
+private:
+	// 一次进行中的调用，作为完成队列的 tag
+	struct Call
+	{
+		virtual ~Call() {}
+		virtual void done() = 0;
+	};
+
+	template <class Resp>
+	struct UnaryCall : Call
+	{
+		grpc::ClientContext context;
+		Resp response;
+		grpc::Status status;
+		std::shared_ptr<KadImpl::Stub> stub; // 保证调用完成前通道不被通道池释放
+		std::unique_ptr<grpc::ClientAsyncResponseReader<Resp>> reader;
+		std::string address;
+		ChannelPool *pool;
+		Callback<Resp> cb;
+
+		void done() override
+		{
+			if (status.error_code() == grpc::StatusCode::UNAVAILABLE)
+			{
+				pool->markDead(address);
+			}
+			cb(status, response);
+		}
+	};
+
+	// 经传输层投递的调用：请求复制一份由调用对象持有，传输层只传递指针，应答直接写在这里。
+	// 传输层要求退回 gRPC 时，用保存的地址、方法和超时重发
+	template <class Req, class Resp>
+	struct TransportCall
+	{
+		Req request;
+		Resp response;
+		Callback<Resp> cb;
+		std::string address;
+		PrepareFn<Req, Resp> method;
+		int64_t timeout;
+	};
+
+	// 定时回调，到期（或客户端关闭时被取消）后在轮询线程中执行
+	struct Timer : Call
+	{
+		grpc::Alarm alarm;
+		std::function<void()> fn;
+
+		void done() override
+		{
+			fn();
+		}
+	};
+
+	ChannelPool *pool;
+	grpc::CompletionQueue cq;
+	int num_pollers;
+	std::vector<pthread_t> pollers;
+	std::once_flag started;
+	int64_t timeout_ms;
+	Transport *transport = nullptr; // 非空时优先经传输层投递
+	Scheduler *scheduler = nullptr; // 非空时定时和计时按它的时钟，而不是真实时间
+
+public:
+	// num 为轮询线程数，timeout 为每次调用的默认超时（毫秒）
+	KadRpc(ChannelPool *channels, int num = 1, int64_t timeout = 2000)
+	{
+		pool = channels;
+		num_pollers = num;
+		timeout_ms = timeout;
+	}
+
+	~KadRpc()
+	{
+		cq.Shutdown();
+		for (pthread_t t : pollers)
+		{
+			pthread_join(t, NULL);
+		}
+	}
+
+	KadRpc(const KadRpc &) = delete;
+	KadRpc &operator=(const KadRpc &) = delete;
+
+	// 设置传输层，之后发往它能送达的地址的调用由它投递；传输层由调用方持有
+	void setTransport(Transport *t)
+	{
+		transport = t;
+	}
+
+	// 设置时钟和定时器（例如仿真网络的虚拟时间），为空时使用真实时间；由调用方持有
+	void setScheduler(Scheduler *s)
+	{
+		scheduler = s;
+	}
+
+	// 当前时间（微秒），只用于计算间隔
+	int64_t nowUs()
+	{
+		if (scheduler != nullptr)
+		{
+			return scheduler->nowUs();
+		}
+		return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	// 设置轮询线程数，只在第一次调用之前有效
+	void setPollers(int n)
+	{
+		num_pollers = std::max(n, 1);
+	}
+
+	/*
+	 * void call(address, method, request, cb, timeout)
+	 * 向 address 异步发起 method 调用，完成（成功、失败或超时）后在轮询线程中调用 cb。
+	 * timeout 为这次调用的超时（毫秒），不大于 0 时使用构造时的默认值。
+	 * 回调中不应阻塞，可以继续发起新的调用。
+	 */
+	template <class Req, class Resp>
+	void call(const std::string &address, PrepareFn<Req, Resp> method, const Req &request, Callback<Resp> cb,
+			  int64_t timeout = 0)
+	{
+		if (transport != nullptr && transport->reaches(address, methodOf(method)) &&
+			callTransport(address, method, request, cb, timeout))
+		{
+			return;
+		}
+		callGrpc(address, method, request, std::move(cb), timeout);
+	}
+
+	/*
+	 * grpc::Status callSync(address, method, request, response)
+	 * 与 call 相同，但阻塞到调用完成，应答写入 response
+	 */
+	template <class Req, class Resp>
+	grpc::Status callSync(const std::string &address, PrepareFn<Req, Resp> method, const Req &request, Resp &response,
+						  int64_t timeout = 0)
+	{
+		std::promise<grpc::Status> done;
+		call<Req, Resp>(
+			address, method, request,
+			[&done, &response](const grpc::Status &status, Resp &resp)
+			{
+				response.Swap(&resp);
+				done.set_value(status);
+			},
+			timeout);
+		return done.get_future().get();
+	}
+
+	/*
+	 * void after(us, fn)
+	 * us 微秒后在轮询线程中调用 fn，用于对冲等不需要单独线程的定时操作。fn 中不应阻塞。
+	 * 设置了 Scheduler 时改由它按自己的时钟调用
+	 */
+	void after(int64_t us, std::function<void()> fn)
+	{
+		if (scheduler != nullptr)
+		{
+			scheduler->after(us, std::move(fn));
+			return;
+		}
+		std::call_once(started, [this]
+					   { start(); });
+		Timer *t = new Timer();
+		t->fn = std::move(fn);
+		t->alarm.Set(&cq, std::chrono::system_clock::now() + std::chrono::microseconds(us), (void *)t);
+	}
+
+private:
+	// 经 gRPC 的完成队列发起调用
+	template <class Req, class Resp>
+	void callGrpc(const std::string &address, PrepareFn<Req, Resp> method, const Req &request, Callback<Resp> cb,
+				  int64_t timeout)
+	{
+		// 第一次使用时才启动轮询线程，只做路由计算的节点不会创建线程
+		std::call_once(started, [this]
+					   { start(); });
+		UnaryCall<Resp> *c = new UnaryCall<Resp>();
+		c->context.set_deadline(std::chrono::system_clock::now() + std::chrono::milliseconds(timeout > 0 ? timeout : timeout_ms));
+		routeTo(&c->context, address);
+		c->stub = pool->stub(address);
+		c->address = address;
+		c->pool = pool;
+		c->cb = std::move(cb);
+		c->reader = ((*c->stub).*method)(&c->context, request, &cq);
+		c->reader->StartCall();
+		c->reader->Finish(&c->response, &c->status, (void *)c);
+	}
+
+	/*
+	 * 经传输层投递。传输层不能送达时返回 false，由调用方改走 gRPC；
+	 * 传输层以 Transport::fallback() 完成时（例如应答装不进一个数据报），在完成回调中改用 gRPC 重发
+	 */
+	template <class Req, class Resp>
+	bool callTransport(const std::string &address, PrepareFn<Req, Resp> method, const Req &request, Callback<Resp> &cb,
+					   int64_t timeout)
+	{
+		TransportCall<Req, Resp> *c = new TransportCall<Req, Resp>();
+		c->request = request;
+		c->cb = std::move(cb);
+		c->address = address;
+		c->method = method;
+		c->timeout = timeout;
+		if (!transport->send(address, methodOf(method), &c->request, &c->response, [this, c](const grpc::Status &status)
+							 {
+								 if (Transport::isFallback(status))
+								 {
+									 callGrpc(c->address, c->method, c->request, std::move(c->cb), c->timeout);
+								 }
+								 else
+								 {
+									 c->cb(status, c->response);
+								 }
+								 delete c; }))
+		{
+			cb = std::move(c->cb);
+			delete c;
+			return false;
+		}
+		return true;
+	}
+
+	// 存根方法到传输层方法的对应，按请求和应答类型重载，类型相同的 exit 和 ping 再比较方法指针
+	static KadMethod methodOf(PrepareFn<IDKey, NodeList>)
+	{
+		return KadMethod::FIND_NODE;
+	}
+
+	static KadMethod methodOf(PrepareFn<IDKey, KV_Node_Wrapper>)
+	{
+		return KadMethod::FIND_VALUE;
+	}
+
+	static KadMethod methodOf(PrepareFn<KeyValue, IDKey>)
+	{
+		return KadMethod::STORE;
+	}
+
+	static KadMethod methodOf(PrepareFn<IDKey, IDKey> method)
+	{
+		return method == &KadImpl::Stub::PrepareAsyncping ? KadMethod::PING : KadMethod::EXIT;
+	}
+
+	static KadMethod methodOf(PrepareFn<KeyValueBatch, BatchAck>)
+	{
+		return KadMethod::STORE_BATCH;
+	}
+
+	static KadMethod methodOf(PrepareFn<IDKeyBatch, KeyValueBatch>)
+	{
+		return KadMethod::FIND_VALUE_BATCH;
+	}
+
+	static KadMethod methodOf(PrepareFn<StatsRequest, StatsReply>)
+	{
+		return KadMethod::STATS;
+	}
+
+	void start()
+	{
+		for (int i = 0; i < num_pollers; i++)
+		{
+			pthread_t t;
+			pthread_create(&t, NULL, poll, (void *)this);
+			pollers.push_back(t);
+		}
+	}
+
+	static void *poll(void *para)
+	{
+		KadRpc *rpc = (KadRpc *)para;
+		void *tag;
+		bool ok;
+		// Finish 总会投递一次完成事件，失败也通过 status 体现；定时器到期或被取消时也投递一次
+		while (rpc->cq.Next(&tag, &ok))
+		{
+			Call *c = (Call *)tag;
+			c->done();
+			delete c;
+		}
+		return NULL;
+	}
+};
+
+#endif /* INCLUDE_KADRPC_HPP_ */
@@ -0,0 +1,424 @@
+/*
+ * kadServer.hpp
+ *
+ * 基于完成队列的异步 gRPC 服务端。请求不再独占同步线程池中的线程，
+ * 而是由少量绑定到 CPU 核心的轮询线程处理，处理逻辑与同步服务共用 KadCore。
+ * 一个服务端可以承载多个虚拟节点，请求按 dhash-vnode 元数据分派到对应的 KadCore。
+ */
+
+#ifndef INCLUDE_KADSERVER_HPP_
+#define INCLUDE_KADSERVER_HPP_
+
+#include <memory>
+#include <vector>
+
+#include <grpcpp/alarm.h>
+#include <grpcpp/server_builder.h>
+#include <grpcpp/server_context.h>
+
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "nodeKadImpl.hpp"
+
+class KadAsyncServer
+{
+public:
+	struct Options
+	{
+		int num_cqs = 2;		   // 完成队列数量
+		int pollers_per_cq = 1;	   // 每个完成队列的轮询线程数
+		int calls_per_method = 16; // 每个完成队列上为每个方法预先挂起的请求数
+		bool pin_cores = true;	   // 是否把轮询线程绑定到 CPU 核心
+	};
+
+private:
+	// 完成队列上的 tag，事件到达时推进对应调用的状态
+	struct Tag
+	{
+		virtual ~Tag() {}
+		virtual void proceed(bool ok) = 0;
+	};
+
+	using Cores = std::vector<KadCore *>;
+
+	// 请求到达后按元数据选出处理它的虚拟节点
+	static KadCore *route(const grpc::ServerContext &context, const Cores *cores)
+	{
+		return (*cores)[vnodeOf(&context, cores->size())];
+	}
+
+	/*
+	 * 一次一元调用的生命周期：挂起等待请求 -> 请求到达后先挂起一个新的等待，再调用处理函数并回复 -> 回复完成后释放
+	 */
+	template <class Req, class Resp>
+	class UnaryCall : public Tag
+	{
+	public:
+		using RequestFn = void (KadImpl::AsyncService::*)(grpc::ServerContext *, Req *,
+														  grpc::ServerAsyncResponseWriter<Resp> *,
+														  grpc::CompletionQueue *, grpc::ServerCompletionQueue *, void *);
+		using HandleFn = grpc::Status (KadCore::*)(const Req *, Resp *);
+
+	private:
+		KadImpl::AsyncService *service;
+		grpc::ServerCompletionQueue *cq;
+		const Cores *cores;
+		RequestFn request_fn;
+		HandleFn handle_fn;
+		grpc::ServerContext context;
+		Req request;
+		Resp response;
+		grpc::ServerAsyncResponseWriter<Resp> responder;
+		bool replied = false;
+
+	public:
+		UnaryCall(KadImpl::AsyncService *s, grpc::ServerCompletionQueue *q, const Cores *c, RequestFn r, HandleFn h)
+			: service(s), cq(q), cores(c), request_fn(r), handle_fn(h), responder(&context)
+		{
+			(service->*request_fn)(&context, &request, &responder, cq, cq, this);
+		}
+
+		void proceed(bool ok) override
+		{
+			// 服务端关闭时挂起的请求以 ok == false 返回
+			if (!ok || replied)
+			{
+				delete this;
+				return;
+			}
+			new UnaryCall(service, cq, cores, request_fn, handle_fn);
+			grpc::Status status = (route(context, cores)->*handle_fn)(&request, &response);
+			replied = true;
+			responder.Finish(response, status, this);
+		}
+	};
+
+	/*
+	 * 双向流调用：读取一个批次 -> 调用处理函数 -> 写回一条应答 -> 继续读取，客户端结束写入后关闭流
+	 */
+	template <class Req, class Resp>
+	class StreamCall : public Tag
+	{
+	public:
+		using RequestFn = void (KadImpl::AsyncService::*)(grpc::ServerContext *,
+														  grpc::ServerAsyncReaderWriter<Resp, Req> *,
+														  grpc::CompletionQueue *, grpc::ServerCompletionQueue *, void *);
+		using HandleFn = grpc::Status (KadCore::*)(const Req *, Resp *);
+
+	private:
+		enum State
+		{
+			WAIT_CALL,
+			READING,
+			WRITING,
+			FINISHING
+		};
+
+		KadImpl::AsyncService *service;
+		grpc::ServerCompletionQueue *cq;
+		const Cores *cores;
+		KadCore *core = nullptr; // 请求到达后选出
+		RequestFn request_fn;
+		HandleFn handle_fn;
+		grpc::ServerContext context;
+		Req request;
+		Resp response;
+		grpc::ServerAsyncReaderWriter<Resp, Req> stream;
+		State state = WAIT_CALL;
+
+	public:
+		StreamCall(KadImpl::AsyncService *s, grpc::ServerCompletionQueue *q, const Cores *c, RequestFn r, HandleFn h)
+			: service(s), cq(q), cores(c), request_fn(r), handle_fn(h), stream(&context)
+		{
+			(service->*request_fn)(&context, &stream, cq, cq, this);
+		}
+
+		void proceed(bool ok) override
+		{
+			switch (state)
+			{
+			case WAIT_CALL:
+				if (!ok)
+				{
+					delete this;
+					return;
+				}
+				new StreamCall(service, cq, cores, request_fn, handle_fn);
+				core = route(context, cores);
+				state = READING;
+				stream.Read(&request, this);
+				break;
+			case READING:
+				if (!ok)
+				{
+					// 客户端已经 WritesDone
+					state = FINISHING;
+					stream.Finish(grpc::Status::OK, this);
+					break;
+				}
+				response.Clear();
+				{
+					grpc::Status status = (core->*handle_fn)(&request, &response);
+					if (!status.ok())
+					{
+						state = FINISHING;
+						stream.Finish(status, this);
+						break;
+					}
+				}
+				state = WRITING;
+				stream.Write(response, this);
+				break;
+			case WRITING:
+				if (!ok)
+				{
+					state = FINISHING;
+					stream.Finish(grpc::Status(grpc::StatusCode::CANCELLED, "write failed"), this);
+					break;
+				}
+				request.Clear();
+				state = READING;
+				stream.Read(&request, this);
+				break;
+			case FINISHING:
+				delete this;
+				break;
+			}
+		}
+	};
+
+	/*
+	 * transfer_range 服务端流：每写完一块再填充下一块，当前段的键发送完后才遍历存储的下一段（见 KadCore::scanRange），
+	 * 一个事件最多遍历一段；遍历出的段中没有要发送的键时用立即到期的 Alarm 让出轮询线程再继续。
+	 * 限速需要等待时同样用 Alarm 推迟下一次写入，不占用轮询线程
+	 */
+	class RangeCall : public Tag
+	{
+		enum State
+		{
+			WAIT_CALL,
+			SCANNING,
+			PACING,
+			WRITING,
+			FINISHING
+		};
+
+		KadImpl::AsyncService *service;
+		grpc::ServerCompletionQueue *cq;
+		const Cores *cores;
+		KadCore *core = nullptr; // 请求到达后选出
+		grpc::ServerContext context;
+		RangeRequest request;
+		KeyValueBatch batch;
+		grpc::ServerAsyncWriter<KeyValueBatch> writer;
+		grpc::Alarm alarm;
+		KadCore::RangeCursor cursor;
+		std::unique_ptr<Pacer> pacer;
+		State state = WAIT_CALL;
+
+	public:
+		RangeCall(KadImpl::AsyncService *s, grpc::ServerCompletionQueue *q, const Cores *c)
+			: service(s), cq(q), cores(c), writer(&context)
+		{
+			service->Requesttransfer_range(&context, &request, &writer, cq, cq, this);
+		}
+
+		void proceed(bool ok) override
+		{
+			switch (state)
+			{
+			case WAIT_CALL:
+				if (!ok)
+				{
+					delete this;
+					return;
+				}
+				new RangeCall(service, cq, cores);
+				core = route(context, cores);
+				core->openRange(&request, &cursor);
+				pacer.reset(new Pacer(core->transferRate(request.max_bytes_per_sec())));
+				next();
+				break;
+			case SCANNING:
+			case PACING:
+				// 服务端关闭时 Alarm 被取消
+				if (!ok)
+				{
+					state = FINISHING;
+					writer.Finish(grpc::Status(grpc::StatusCode::CANCELLED, "transfer_range: server shutting down"), this);
+					break;
+				}
+				if (state == SCANNING)
+				{
+					next();
+					break;
+				}
+				state = WRITING;
+				writer.Write(batch, this);
+				break;
+			case WRITING:
+				if (!ok)
+				{
+					state = FINISHING;
+					writer.Finish(grpc::Status(grpc::StatusCode::CANCELLED, "write failed"), this);
+					break;
+				}
+				next();
+				break;
+			case FINISHING:
+				delete this;
+				break;
+			}
+		}
+
+	private:
+		// 填充下一块：当前段发送完时遍历下一段，所有段都遍历过后结束流；未到限速允许的时刻时先等待 Alarm
+		void next()
+		{
+			if (core->fillRange(&cursor, &batch) == 0)
+			{
+				if (!core->scanRange(&cursor))
+				{
+					state = FINISHING;
+					writer.Finish(grpc::Status::OK, this);
+					return;
+				}
+				if (core->fillRange(&cursor, &batch) == 0)
+				{
+					state = SCANNING;
+					alarm.Set(cq, std::chrono::system_clock::now(), this);
+					return;
+				}
+			}
+			std::chrono::steady_clock::time_point at = pacer->reserve(batch.ByteSizeLong());
+			std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+			if (at > now)
+			{
+				// Alarm 只接受系统时钟的截止时间
+				state = PACING;
+				alarm.Set(cq, std::chrono::time_point_cast<std::chrono::system_clock::duration>(std::chrono::system_clock::now() + (at - now)), this);
+				return;
+			}
+			state = WRITING;
+			writer.Write(batch, this);
+		}
+	};
+
+	struct Poller
+	{
+		KadAsyncServer *server;
+		grpc::ServerCompletionQueue *cq;
+		int core;
+	};
+
+	KadImpl::AsyncService service;
+	Cores cores; // 按虚拟节点序号排列，只有一个节点时所有请求都由 cores[0] 处理
+	Options options;
+	std::vector<std::unique_ptr<grpc::ServerCompletionQueue>> cqs;
+	std::vector<Poller> pollers;
+	std::vector<pthread_t> threads;
+
+public:
+	KadAsyncServer(KadCore *c, Options opts)
+	{
+		cores.push_back(c);
+		options = opts;
+	}
+
+	// 承载同一进程中的多个虚拟节点，第 i 个对应地址后缀 #i
+	KadAsyncServer(const std::vector<KadCore *> &vnodes, Options opts)
+	{
+		cores = vnodes;
+		options = opts;
+	}
+
+	/*
+	 * 在 BuildAndStart 之前调用：注册异步服务并创建完成队列
+	 */
+	void registerWith(grpc::ServerBuilder &builder)
+	{
+		builder.RegisterService(&service);
+		for (int i = 0; i < options.num_cqs; i++)
+		{
+			cqs.push_back(builder.AddCompletionQueue());
+		}
+	}
+
+	/*
+	 * 在 BuildAndStart 之后调用：挂起初始请求并启动轮询线程
+	 */
+	void start()
+	{
+		long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		for (int i = 0; i < options.num_cqs; i++)
+		{
+			grpc::ServerCompletionQueue *cq = cqs[i].get();
+			for (int j = 0; j < options.calls_per_method; j++)
+			{
+				new UnaryCall<IDKey, NodeList>(&service, cq, &cores, &KadImpl::AsyncService::Requestfind_node, &KadCore::serveFindNode);
+				new UnaryCall<IDKey, KV_Node_Wrapper>(&service, cq, &cores, &KadImpl::AsyncService::Requestfind_value, &KadCore::serveFindValue);
+				new UnaryCall<KeyValue, IDKey>(&service, cq, &cores, &KadImpl::AsyncService::Requeststore, &KadCore::serveStore);
+				new UnaryCall<IDKey, IDKey>(&service, cq, &cores, &KadImpl::AsyncService::Requestexit, &KadCore::serveExit);
+				new UnaryCall<KeyValueBatch, BatchAck>(&service, cq, &cores, &KadImpl::AsyncService::Requeststore_batch, &KadCore::serveStoreBatch);
+				new UnaryCall<IDKeyBatch, KeyValueBatch>(&service, cq, &cores, &KadImpl::AsyncService::Requestfind_value_batch, &KadCore::serveFindValueBatch);
+				new StreamCall<KeyValueBatch, BatchAck>(&service, cq, &cores, &KadImpl::AsyncService::Requeststore_stream, &KadCore::serveStoreBatch);
+				new StreamCall<IDKeyBatch, KeyValueBatch>(&service, cq, &cores, &KadImpl::AsyncService::Requestfind_value_stream, &KadCore::serveFindValueBatch);
+				new UnaryCall<StatsRequest, StatsReply>(&service, cq, &cores, &KadImpl::AsyncService::Requeststats, &KadCore::serveStats);
+				new UnaryCall<IDKey, IDKey>(&service, cq, &cores, &KadImpl::AsyncService::Requestping, &KadCore::servePing);
+				new RangeCall(&service, cq, &cores);
+			}
+			for (int j = 0; j < options.pollers_per_cq; j++)
+			{
+				int n = pollers.size();
+				pollers.push_back({this, cq, options.pin_cores ? (int)(n % num_cpus) : -1});
+			}
+		}
+		// pollers 不再扩容后再取元素地址
+		for (Poller &p : pollers)
+		{
+			pthread_t t;
+			pthread_create(&t, NULL, poll, (void *)&p);
+			threads.push_back(t);
+		}
+	}
+
+	/*
+	 * 在 server->Shutdown() 之后调用：关闭完成队列并等待轮询线程退出
+	 */
+	void shutdown()
+	{
+		for (auto &cq : cqs)
+		{
+			cq->Shutdown();
+		}
+		for (pthread_t t : threads)
+		{
+			pthread_join(t, NULL);
+		}
+		threads.clear();
+	}
+
+private:
+	static void *poll(void *para)
+	{
+		Poller *p = (Poller *)para;
+		if (p->core >= 0)
+		{
+			cpu_set_t set;
+			CPU_ZERO(&set);
+			CPU_SET(p->core, &set);
+			pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+		}
+		void *tag;
+		bool ok;
+		while (p->cq->Next(&tag, &ok))
+		{
+			((Tag *)tag)->proceed(ok);
+		}
+		return NULL;
+	}
+};
+
+#endif /* INCLUDE_KADSERVER_HPP_ */
@@ -0,0 +1,727 @@
+/*
+ * kvPersist.hpp
+ *
+ * 存储引擎的持久化层：DurableKVStore 包装任意 ValueStore，所有修改先写入预写日志（WAL），
+ * 后台线程按批次刷盘（组提交），并定期生成可以直接 mmap 的二进制快照。
+ * 启动时先加载最新快照，再重放快照之后的 WAL。
+ *
+ * 目录布局：
+ *   wal-<seq>.log        WAL 段，每条记录是 16 字节的头部加上按 8 字节对齐的键和值
+ *   snapshot-<seq>.snap  快照，恢复时从 wal-<seq>.log 开始重放
+ */
+
+#ifndef INCLUDE_KVPERSIST_HPP_
+#define INCLUDE_KVPERSIST_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <errno.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "logger.hpp"
+#include "valueStore.hpp"
+
+class DurableKVStore : public ValueStore
+{
+public:
+	struct Options
+	{
+		std::string dir;						   // 数据目录，不存在时自动创建
+		int64_t sync_interval_ms = 10;			   // 组提交窗口：最多等待多久刷一次盘
+		uint64_t sync_bytes = 1 << 20;			   // 缓冲的日志达到该大小时立即刷盘
+		bool wait_for_sync = false;				   // 写操作是否等到所在批次 fsync 完成再返回
+		int64_t snapshot_interval_ms = 60 * 1000;  // 定期生成快照的间隔，0 表示不按时间触发
+		uint64_t snapshot_wal_bytes = 256ULL << 20; // WAL 超过该大小时生成快照，0 表示不按大小触发
+		int load_threads = 4;					   // 加载快照时的并行线程数
+	};
+
+	// 启动恢复的统计
+	struct RecoveryStats
+	{
+		uint64_t snapshot_keys = 0; // 从快照加载的键数
+		uint64_t wal_records = 0;	// 重放的 WAL 记录数
+		uint64_t wal_segments = 0;	// 重放的 WAL 段数
+		double snapshot_ms = 0;		// 加载快照耗时
+		double replay_ms = 0;		// 重放 WAL 耗时
+		double total_ms = 0;		// 恢复总耗时
+	};
+
+private:
+	enum Op : uint32_t
+	{
+		OP_PUT = 1,
+		OP_ERASE = 2
+	};
+
+	// WAL 记录头，后面紧跟键和值，各自补零到 8 字节对齐；checksum 覆盖 op、长度、键和值
+	struct Record
+	{
+		uint32_t checksum;
+		uint32_t op;
+		uint32_t key_len;
+		uint32_t value_len;
+	};
+	static_assert(sizeof(Record) == 16, "WAL record layout");
+
+	// 快照文件头，后面紧跟 count 个表项，每个表项是 {key_len, value_len} 加上对齐后的键和值
+	struct SnapshotHeader
+	{
+		char magic[8];
+		uint64_t version;
+		uint64_t count;
+		uint64_t checksum; // 所有表项的校验和
+	};
+
+	struct Entry
+	{
+		uint32_t key_len;
+		uint32_t value_len;
+	};
+
+	static const uint64_t version = 2;
+	static const int num_stripes = 64;
+	static const uint64_t snapshot_chunk = 1 << 20; // 快照按块写出，避免先把整个存储拷贝到内存
+
+	ValueStore *inner;
+	Options options;
+	RecoveryStats recovery;
+
+	// 同一个键的“修改内存 + 追加日志”必须与日志顺序一致，按键哈希分条加锁
+	pthread_mutex_t stripes[num_stripes];
+	// 写操作持共享锁，切换 WAL 段时持排他锁，保证快照之前的修改都已进入内存
+	pthread_rwlock_t rotate_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+	std::mutex mu;
+	std::condition_variable flush_cv; // 唤醒后台线程
+	std::condition_variable sync_cv;  // 通知等待刷盘的写者，也用于等待正在进行的刷盘结束
+	std::vector<char> buffer;		  // 尚未写入文件的日志
+	uint64_t appended_lsn = 0;		  // 已追加到缓冲区的记录数
+	uint64_t durable_lsn = 0;		  // 已 fsync 的记录数
+	uint64_t failed_lsn = 0;		  // 最近一次写盘失败的批次中最大的记录号，等待这些记录的写者以失败返回
+	std::atomic<bool> log_failed{false}; // 最近一次写盘失败且尚未重试成功，期间拒绝新的修改
+	uint64_t wal_seq = 0;			  // 当前 WAL 段序号
+	uint64_t wal_bytes = 0;			  // 当前 WAL 段大小
+	int wal_fd = -1;
+	bool flushing = false;			  // 同一时刻只允许一个线程写盘，保证批次按顺序落到文件中
+	bool stopping = false;
+	std::thread background;
+	std::atomic<uint64_t> snapshots{0};
+	std::mutex snapshot_mu; // 串行化快照
+
+public:
+	/*
+	 * 构造时完成恢复：加载最新快照、重放之后的 WAL，然后开启一个新的 WAL 段并启动后台线程
+	 */
+	DurableKVStore(ValueStore *store, Options opts)
+	{
+		inner = store;
+		options = opts;
+		for (int i = 0; i < num_stripes; i++)
+		{
+			pthread_mutex_init(&stripes[i], NULL);
+		}
+		mkdir(options.dir.c_str(), 0755);
+		recover();
+		openSegment(wal_seq);
+		background = std::thread([this]
+								 { run(); });
+	}
+
+	~DurableKVStore()
+	{
+		{
+			std::lock_guard<std::mutex> guard(mu);
+			stopping = true;
+		}
+		flush_cv.notify_all();
+		background.join();
+		if (wal_fd >= 0)
+		{
+			close(wal_fd);
+		}
+	}
+
+	DurableKVStore(const DurableKVStore &) = delete;
+	DurableKVStore &operator=(const DurableKVStore &) = delete;
+
+	bool get(std::string_view key, std::string *value) override
+	{
+		return inner->get(key, value);
+	}
+
+	// 日志处于失败状态时不修改内存并返回 false；wait_for_sync 时所在批次刷盘失败也返回 false
+	bool put(std::string_view key, std::string_view value) override
+	{
+		return write(OP_PUT, key, value);
+	}
+
+	bool erase(std::string_view key) override
+	{
+		return write(OP_ERASE, key, std::string_view());
+	}
+
+	uint64_t size() override
+	{
+		return inner->size();
+	}
+
+	void memoryStats(uint64_t &reserved, uint64_t &used) override
+	{
+		inner->memoryStats(reserved, used);
+	}
+
+	void forEach(const std::function<void(std::string_view, std::string_view)> &fn) override
+	{
+		inner->forEach(fn);
+	}
+
+	uint64_t partitions() override
+	{
+		return inner->partitions();
+	}
+
+	void forEachIn(uint64_t part, const std::function<void(std::string_view, std::string_view)> &fn) override
+	{
+		inner->forEachIn(part, fn);
+	}
+
+	RecoveryStats recoveryStats()
+	{
+		return recovery;
+	}
+
+	uint64_t snapshotCount()
+	{
+		return snapshots.load(std::memory_order_relaxed);
+	}
+
+	// 最近一次写盘是否失败（之后重试成功时恢复为 false）
+	bool logFailed()
+	{
+		return log_failed.load(std::memory_order_relaxed);
+	}
+
+	/*
+	 * 立即生成一次快照，完成后删除快照之前的 WAL 段和旧快照
+	 */
+	void snapshot()
+	{
+		std::lock_guard<std::mutex> serial(snapshot_mu);
+		// 切换到新的 WAL 段：之后的修改都写入新段，旧段中的修改此时都已进入内存
+		pthread_rwlock_wrlock(&rotate_lock);
+		uint64_t seq;
+		{
+			std::unique_lock<std::mutex> lock(mu);
+			flushLocked(lock);
+			seq = wal_seq + 1;
+			close(wal_fd);
+			openSegment(seq);
+		}
+		pthread_rwlock_unlock(&rotate_lock);
+
+		// 遍历期间仍有并发写入，快照可能包含新段中的部分修改；重放新段时按顺序覆盖，结果不变
+		std::string tmp = path("snapshot", seq, ".tmp");
+		int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0)
+		{
+			DLOG(ERROR, "snapshot: creating %s failed: %s", tmp.c_str(), strerror(errno));
+			return;
+		}
+		// 先写占位的文件头，表项写完后再回填数量和校验和
+		SnapshotHeader header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, "DHSNAP02", 8);
+		header.version = version;
+		bool ok = writeAll(fd, &header, sizeof(header));
+		std::vector<char> chunk;
+		chunk.reserve(snapshot_chunk);
+		uint64_t sum = 0;
+		inner->forEach([&](std::string_view key, std::string_view value)
+					   {
+						   size_t start = chunk.size();
+						   Entry entry{(uint32_t)key.size(), (uint32_t)value.size()};
+						   append(chunk, &entry, sizeof(entry));
+						   appendPadded(chunk, key);
+						   appendPadded(chunk, value);
+						   sum = checksum(chunk.data() + start, chunk.size() - start, sum);
+						   header.count++;
+						   if (chunk.size() >= snapshot_chunk)
+						   {
+							   ok = ok && writeAll(fd, chunk.data(), chunk.size());
+							   chunk.clear();
+						   } });
+		header.checksum = sum;
+		ok = ok && writeAll(fd, chunk.data(), chunk.size()) &&
+			 pwrite(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header) &&
+			 fdatasync(fd) == 0;
+		close(fd);
+		if (!ok || rename(tmp.c_str(), path("snapshot", seq, ".snap").c_str()) != 0)
+		{
+			DLOG(ERROR, "snapshot: writing snapshot %lu failed: %s", seq, strerror(errno));
+			unlink(tmp.c_str());
+			return;
+		}
+		syncDir();
+		snapshots.fetch_add(1, std::memory_order_relaxed);
+
+		// 快照已经落盘，之前的快照和 WAL 段都不再需要
+		for (uint64_t old : listFiles("snapshot-", ".snap"))
+		{
+			if (old < seq)
+			{
+				unlink(path("snapshot", old, ".snap").c_str());
+			}
+		}
+		for (uint64_t old : listFiles("wal-", ".log"))
+		{
+			if (old < seq)
+			{
+				unlink(path("wal", old, ".log").c_str());
+			}
+		}
+	}
+
+private:
+	bool write(Op op, std::string_view key, std::string_view value)
+	{
+		Record rec{0, op, (uint32_t)key.size(), (uint32_t)value.size()};
+		// 校验和在加锁之前算好，临界区内只做拷贝
+		rec.checksum = recordChecksum(rec, key.data(), value.data());
+		pthread_mutex_t *stripe = &stripes[(keyId(key) * 0x9e3779b97f4a7c15ULL) >> 58];
+		uint64_t lsn;
+		bool changed = true;
+
+		// 日志写不进去时拒绝修改，否则内存中的状态在重启后会丢失
+		if (log_failed.load(std::memory_order_relaxed))
+		{
+			return false;
+		}
+		pthread_rwlock_rdlock(&rotate_lock);
+		pthread_mutex_lock(stripe);
+		if (op == OP_PUT)
+		{
+			// 内层存储拒绝的记录不写日志，否则恢复时会重放出内存中没有的状态
+			if (!inner->put(key, value))
+			{
+				pthread_mutex_unlock(stripe);
+				pthread_rwlock_unlock(&rotate_lock);
+				return false;
+			}
+		}
+		else
+		{
+			changed = inner->erase(key);
+		}
+		{
+			std::lock_guard<std::mutex> guard(mu);
+			append(buffer, &rec, sizeof(rec));
+			appendPadded(buffer, key);
+			appendPadded(buffer, value);
+			lsn = ++appended_lsn;
+			if (buffer.size() >= options.sync_bytes)
+			{
+				flush_cv.notify_one();
+			}
+		}
+		pthread_mutex_unlock(stripe);
+		pthread_rwlock_unlock(&rotate_lock);
+
+		if (options.wait_for_sync)
+		{
+			// 组提交：同一个刷盘窗口内的写者共享一次 fsync
+			std::unique_lock<std::mutex> lock(mu);
+			sync_cv.wait(lock, [this, lsn]
+						 { return durable_lsn >= lsn || failed_lsn >= lsn || stopping; });
+			// 所在批次刷盘失败：内存中已经修改，之后的重试成功后才会持久化，这里如实报告没有落盘
+			return changed && durable_lsn >= lsn;
+		}
+		return changed;
+	}
+
+	// 后台线程：按组提交窗口刷盘，并按时间或 WAL 大小触发快照
+	void run()
+	{
+		auto last_snapshot = std::chrono::steady_clock::now();
+		std::unique_lock<std::mutex> lock(mu);
+		while (!stopping)
+		{
+			flush_cv.wait_for(lock, std::chrono::milliseconds(options.sync_interval_ms));
+			flushLocked(lock);
+
+			auto now = std::chrono::steady_clock::now();
+			bool by_time = options.snapshot_interval_ms > 0 &&
+						   now - last_snapshot >= std::chrono::milliseconds(options.snapshot_interval_ms);
+			bool by_size = options.snapshot_wal_bytes > 0 && wal_bytes >= options.snapshot_wal_bytes;
+			if ((by_time || by_size) && !stopping)
+			{
+				lock.unlock();
+				snapshot();
+				last_snapshot = std::chrono::steady_clock::now();
+				lock.lock();
+			}
+		}
+		flushLocked(lock);
+	}
+
+	/*
+	 * 持有 mu 时调用：把缓冲区写入当前 WAL 段并 fdatasync。写盘期间释放 mu，新的写入可以继续进入缓冲区。
+	 * 失败时把段截回写入前的长度，批次放回缓冲区开头等下一轮重试，durable_lsn 不变，
+	 * 日志进入失败状态并唤醒等待这个批次的写者；重新写入整个批次再 fdatasync，不依赖失败后的页缓存状态
+	 */
+	void flushLocked(std::unique_lock<std::mutex> &lock)
+	{
+		sync_cv.wait(lock, [this]
+					 { return !flushing; });
+		if (buffer.empty())
+		{
+			return;
+		}
+		flushing = true;
+		std::vector<char> batch;
+		batch.swap(buffer);
+		uint64_t lsn = appended_lsn;
+		uint64_t offset = wal_bytes;
+		int fd = wal_fd;
+		lock.unlock();
+		int err = 0;
+		if (fd < 0)
+		{
+			err = EBADF;
+		}
+		else if (!writeAll(fd, batch.data(), batch.size()) || fdatasync(fd) != 0)
+		{
+			err = errno;
+			if (ftruncate(fd, offset) != 0)
+			{
+				DLOG_SAMPLED(ERROR, 1, "wal: truncating segment %lu back to %lu bytes failed: %s", wal_seq, offset, strerror(errno));
+			}
+		}
+		lock.lock();
+		if (err != 0)
+		{
+			DLOG_SAMPLED(ERROR, 1, "wal: writing %lu bytes to segment %lu failed: %s", (uint64_t)batch.size(), wal_seq, strerror(err));
+			batch.insert(batch.end(), buffer.begin(), buffer.end());
+			buffer.swap(batch);
+			failed_lsn = std::max(failed_lsn, lsn);
+			log_failed.store(true, std::memory_order_relaxed);
+		}
+		else
+		{
+			if (log_failed.load(std::memory_order_relaxed))
+			{
+				DLOG(WARN, "wal: segment %lu writable again, %lu records durable", wal_seq, lsn);
+			}
+			wal_bytes += batch.size();
+			durable_lsn = std::max(durable_lsn, lsn);
+			log_failed.store(false, std::memory_order_relaxed);
+		}
+		flushing = false;
+		sync_cv.notify_all();
+	}
+
+	void openSegment(uint64_t seq)
+	{
+		wal_seq = seq;
+		wal_bytes = 0;
+		wal_fd = open(path("wal", seq, ".log").c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+		if (wal_fd < 0)
+		{
+			DLOG(ERROR, "wal: opening segment %lu failed: %s", seq, strerror(errno));
+		}
+		syncDir();
+	}
+
+	void recover()
+	{
+		auto start = std::chrono::steady_clock::now();
+		std::vector<uint64_t> snaps = listFiles("snapshot-", ".snap");
+		std::vector<uint64_t> wals = listFiles("wal-", ".log");
+		uint64_t from = 0;
+		// 从最新的快照开始尝试，损坏的快照跳过
+		for (auto iter = snaps.rbegin(); iter != snaps.rend(); ++iter)
+		{
+			if (loadSnapshot(*iter))
+			{
+				from = *iter;
+				break;
+			}
+		}
+		auto loaded = std::chrono::steady_clock::now();
+		for (uint64_t seq : wals)
+		{
+			if (seq >= from)
+			{
+				recovery.wal_records += replay(seq);
+				recovery.wal_segments++;
+			}
+		}
+		auto end = std::chrono::steady_clock::now();
+		recovery.snapshot_ms = std::chrono::duration<double, std::milli>(loaded - start).count();
+		recovery.replay_ms = std::chrono::duration<double, std::milli>(end - loaded).count();
+		recovery.total_ms = std::chrono::duration<double, std::milli>(end - start).count();
+		// 不在可能残缺的旧段后面追加，总是从新段开始
+		wal_seq = std::max(from, wals.empty() ? 0 : wals.back()) + 1;
+	}
+
+	// 通过 mmap 读取快照：先顺序扫描一遍校验并记下每个表项的位置，再用多个线程并行插入
+	bool loadSnapshot(uint64_t seq)
+	{
+		std::string file = path("snapshot", seq, ".snap");
+		int fd = open(file.c_str(), O_RDONLY);
+		if (fd < 0)
+		{
+			return false;
+		}
+		struct stat st;
+		fstat(fd, &st);
+		if ((size_t)st.st_size < sizeof(SnapshotHeader))
+		{
+			close(fd);
+			return false;
+		}
+		void *addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (addr == MAP_FAILED)
+		{
+			return false;
+		}
+		madvise(addr, st.st_size, MADV_SEQUENTIAL);
+		const SnapshotHeader *header = (const SnapshotHeader *)addr;
+		const char *base = (const char *)addr;
+		size_t end = st.st_size;
+		bool ok = memcmp(header->magic, "DHSNAP02", 8) == 0 && header->version == version;
+		std::vector<size_t> offsets;
+		uint64_t sum = 0;
+		for (size_t pos = sizeof(SnapshotHeader); ok && pos < end;)
+		{
+			size_t len = entryLength(base + pos, end - pos, sizeof(Entry));
+			if (len == 0)
+			{
+				ok = false;
+				break;
+			}
+			sum = checksum(base + pos, len, sum);
+			offsets.push_back(pos);
+			pos += len;
+		}
+		ok = ok && offsets.size() == header->count && sum == header->checksum;
+		if (ok)
+		{
+			uint64_t count = offsets.size();
+			int n = std::max(1, options.load_threads);
+			std::vector<std::thread> loaders;
+			for (int t = 0; t < n; t++)
+			{
+				loaders.emplace_back([this, base, &offsets, count, n, t]
+									 {
+										 for (uint64_t i = count * t / n; i < count * (t + 1) / n; i++)
+										 {
+											 const Entry *entry = (const Entry *)(base + offsets[i]);
+											 const char *key = (const char *)(entry + 1);
+											 inner->put(std::string_view(key, entry->key_len),
+														std::string_view(key + padded(entry->key_len), entry->value_len));
+										 } });
+			}
+			for (std::thread &t : loaders)
+			{
+				t.join();
+			}
+			recovery.snapshot_keys = count;
+		}
+		munmap(addr, st.st_size);
+		return ok;
+	}
+
+	// 重放一个 WAL 段，遇到校验失败或不完整的记录（崩溃时写了一半）即停止
+	uint64_t replay(uint64_t seq)
+	{
+		int fd = open(path("wal", seq, ".log").c_str(), O_RDONLY);
+		if (fd < 0)
+		{
+			return 0;
+		}
+		struct stat st;
+		fstat(fd, &st);
+		if (st.st_size == 0)
+		{
+			close(fd);
+			return 0;
+		}
+		void *addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (addr == MAP_FAILED)
+		{
+			return 0;
+		}
+		madvise(addr, st.st_size, MADV_SEQUENTIAL);
+		const char *base = (const char *)addr;
+		size_t end = st.st_size;
+		uint64_t n = 0;
+		for (size_t pos = 0; pos < end;)
+		{
+			size_t len = entryLength(base + pos + offsetof(Record, key_len), end - pos, sizeof(Record));
+			const Record *rec = (const Record *)(base + pos);
+			const char *key = (const char *)(rec + 1);
+			const char *value = key + (len ? padded(rec->key_len) : 0);
+			if (len == 0 || rec->checksum != recordChecksum(*rec, key, value))
+			{
+				break;
+			}
+			if (rec->op == OP_PUT)
+			{
+				inner->put(std::string_view(key, rec->key_len), std::string_view(value, rec->value_len));
+			}
+			else
+			{
+				inner->erase(std::string_view(key, rec->key_len));
+			}
+			pos += len;
+			n++;
+		}
+		munmap(addr, st.st_size);
+		return n;
+	}
+
+	std::string path(const char *prefix, uint64_t seq, const char *suffix)
+	{
+		char name[64];
+		snprintf(name, sizeof(name), "/%s-%016lx%s", prefix, seq, suffix);
+		return options.dir + name;
+	}
+
+	// 返回目录中形如 prefix<seq>suffix 的文件序号，升序
+	std::vector<uint64_t> listFiles(const char *prefix, const char *suffix)
+	{
+		std::vector<uint64_t> seqs;
+		DIR *dir = opendir(options.dir.c_str());
+		if (dir == NULL)
+		{
+			return seqs;
+		}
+		size_t plen = strlen(prefix), slen = strlen(suffix);
+		struct dirent *ent;
+		while ((ent = readdir(dir)) != NULL)
+		{
+			size_t len = strlen(ent->d_name);
+			if (len > plen + slen && strncmp(ent->d_name, prefix, plen) == 0 &&
+				strcmp(ent->d_name + len - slen, suffix) == 0)
+			{
+				seqs.push_back(strtoull(ent->d_name + plen, NULL, 16));
+			}
+		}
+		closedir(dir);
+		std::sort(seqs.begin(), seqs.end());
+		return seqs;
+	}
+
+	void syncDir()
+	{
+		int fd = open(options.dir.c_str(), O_RDONLY | O_DIRECTORY);
+		if (fd >= 0)
+		{
+			fsync(fd);
+			close(fd);
+		}
+	}
+
+	static bool writeAll(int fd, const void *data, size_t len)
+	{
+		const char *p = (const char *)data;
+		while (len > 0)
+		{
+			ssize_t n = ::write(fd, p, len);
+			if (n < 0)
+			{
+				return false;
+			}
+			p += n;
+			len -= n;
+		}
+		return true;
+	}
+
+	static uint64_t padded(uint64_t len)
+	{
+		return (len + 7) & ~7ULL;
+	}
+
+	/*
+	 * lens 指向 {key_len, value_len}，header 为这两个长度之前（含）的头部大小。
+	 * 返回整个表项或记录的长度，超出剩余的 avail 字节（文件被截断）时返回 0
+	 */
+	static size_t entryLength(const char *lens, size_t avail, size_t header)
+	{
+		if (avail < header)
+		{
+			return 0;
+		}
+		Entry entry;
+		memcpy(&entry, lens, sizeof(entry));
+		size_t len = header + padded(entry.key_len) + padded(entry.value_len);
+		return len <= avail ? len : 0;
+	}
+
+	static void append(std::vector<char> &buf, const void *data, size_t len)
+	{
+		const char *p = (const char *)data;
+		buf.insert(buf.end(), p, p + len);
+	}
+
+	// 追加数据并补零到 8 字节对齐
+	static void appendPadded(std::vector<char> &buf, std::string_view data)
+	{
+		buf.insert(buf.end(), data.begin(), data.end());
+		buf.resize(buf.size() + padded(data.size()) - data.size(), 0);
+	}
+
+	// 按 8 字节为单位的乘法哈希，足以发现截断和位翻转，开销远小于逐字节 CRC。
+	// 可以用上一段的结果作为 seed 串联多段数据，末尾不足 8 字节的部分补零计算
+	static uint64_t checksum(const void *data, size_t len, uint64_t seed = 0)
+	{
+		const char *p = (const char *)data;
+		uint64_t h = 0xcbf29ce484222325ULL ^ seed ^ len;
+		uint64_t w;
+		size_t i = 0;
+		for (; i + 8 <= len; i += 8)
+		{
+			memcpy(&w, p + i, 8);
+			h = (h ^ w) * 0x100000001b3ULL;
+			h ^= h >> 29;
+		}
+		if (i < len)
+		{
+			w = 0;
+			memcpy(&w, p + i, len - i);
+			h = (h ^ w) * 0x100000001b3ULL;
+			h ^= h >> 29;
+		}
+		return h;
+	}
+
+	static uint32_t recordChecksum(const Record &rec, const char *key, const char *value)
+	{
+		uint64_t words[2] = {rec.op, ((uint64_t)rec.key_len << 32) | rec.value_len};
+		uint64_t h = checksum(words, sizeof(words));
+		h = checksum(key, rec.key_len, h);
+		h = checksum(value, rec.value_len, h);
+		// 避免全零的记录（例如预分配的空间）恰好通过校验
+		return (uint32_t)(h ^ (h >> 32)) | 1;
+	}
+};
+
+#endif /* INCLUDE_KVPERSIST_HPP_ */
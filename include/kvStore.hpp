@@ -0,0 +1,437 @@
+/*
+ * kvStore.hpp
+ *
+ * 定长 64 位键值的存储引擎。ValueStore 用它保存键 ID 到记录地址的索引。
+ */
+
+#ifndef INCLUDE_KVSTORE_HPP_
+#define INCLUDE_KVSTORE_HPP_
+
+#include <atomic>
+#include <functional>
+#include <utility>
+#include <vector>
+
+#include <pthread.h>
+#include <stdint.h>
+
+/*
+ * 存储引擎接口：gRPC 处理线程和本地 put/get 会并发调用，实现必须是线程安全的
+ */
+class KVStore
+{
+public:
+	virtual ~KVStore() {}
+	virtual bool get(uint64_t key, uint64_t &value) = 0;
+	virtual void put(uint64_t key, uint64_t value) = 0;
+	virtual bool erase(uint64_t key) = 0;
+	virtual uint64_t size() = 0;
+	// 遍历所有键值对，遍历期间逐个分片阻塞写入
+	virtual void forEach(const std::function<void(uint64_t, uint64_t)> &fn) = 0;
+};
+
+/*
+ * ShardedKVStore
+ * 按键的哈希分成 N 个分片，每个分片是一张线性探测的开放寻址表，每个表项只有 16 字节（键 + 值）。
+ * 写入按分片加锁（条带化写锁）；读取不加锁，依靠每个分片的序列号（seqlock）做乐观校验：
+ * 只有删除和扩容会改变探测链，因此只有它们会推进序列号，普通插入和覆盖不会让读者重试。
+ */
+class ShardedKVStore : public KVStore
+{
+	static const uint64_t EMPTY = ~0ULL;		 // 空槽
+	static const uint64_t TOMBSTONE = ~0ULL - 1; // 已删除的槽
+	static const uint64_t min_capacity = 64;
+
+	struct Slot
+	{
+		std::atomic<uint64_t> key;
+		std::atomic<uint64_t> value;
+	};
+	static_assert(sizeof(Slot) == 16, "each slot must hold exactly a key and a value");
+
+	struct Table
+	{
+		uint64_t mask; // 容量 - 1，容量总是 2 的幂
+		Slot *slots;
+	};
+
+	// 每个分片独占缓存行，避免不同分片的写锁和序列号互相伪共享
+	struct alignas(64) Shard
+	{
+		std::atomic<uint64_t> seq{0}; // 奇数表示有写者正在修改探测链
+		std::atomic<Table *> table{nullptr};
+		pthread_mutex_t mu = PTHREAD_MUTEX_INITIALIZER;
+		uint64_t used = 0; // 已占用的槽（含墓碑），用于决定何时扩容
+		std::atomic<uint64_t> count{0};
+		// 与哨兵值相同的两个键单独存放
+		std::atomic<bool> special_present[2] = {{false}, {false}};
+		std::atomic<uint64_t> special_value[2] = {{0}, {0}};
+		// 扩容后被替换的旧表：无锁读者可能仍在访问，延迟到析构时释放。
+		// 只有容量翻倍时才换表，旧表的总容量小于当前表，占用的内存有上界
+		std::vector<Table *> retired;
+	};
+
+	Shard *shards;
+	uint64_t num_shards;
+	int shard_shift;
+
+public:
+	// num 为分片数量，会向上取整为 2 的幂
+	explicit ShardedKVStore(uint64_t num = 64)
+	{
+		num_shards = 1;
+		shard_shift = 64;
+		while (num_shards < num)
+		{
+			num_shards <<= 1;
+			shard_shift--;
+		}
+		shards = new Shard[num_shards];
+		for (uint64_t i = 0; i < num_shards; i++)
+		{
+			shards[i].table.store(newTable(min_capacity), std::memory_order_relaxed);
+		}
+	}
+
+	~ShardedKVStore()
+	{
+		for (uint64_t i = 0; i < num_shards; i++)
+		{
+			freeTable(shards[i].table.load(std::memory_order_relaxed));
+			for (Table *t : shards[i].retired)
+			{
+				freeTable(t);
+			}
+		}
+		delete[] shards;
+	}
+
+	ShardedKVStore(const ShardedKVStore &) = delete;
+	ShardedKVStore &operator=(const ShardedKVStore &) = delete;
+
+	bool get(uint64_t key, uint64_t &value) override
+	{
+		uint64_t h = mix(key);
+		Shard &shard = shardOf(h);
+		if (key >= TOMBSTONE)
+		{
+			int i = key - TOMBSTONE;
+			// 与写者的“先写值再以 release 发布存在标记”配对
+			if (!shard.special_present[i].load(std::memory_order_acquire))
+			{
+				return false;
+			}
+			value = shard.special_value[i].load(std::memory_order_relaxed);
+			return true;
+		}
+		while (true)
+		{
+			uint64_t s1 = shard.seq.load(std::memory_order_acquire);
+			if (s1 & 1)
+			{
+				continue;
+			}
+			bool found = false;
+			uint64_t v = 0;
+			Table *t = shard.table.load(std::memory_order_acquire);
+			uint64_t i = h & t->mask;
+			for (uint64_t n = 0; n <= t->mask; n++)
+			{
+				uint64_t k = t->slots[i].key.load(std::memory_order_acquire);
+				if (k == key)
+				{
+					// 与覆盖时的 release 配对：值可能是指向其他数据的句柄
+					v = t->slots[i].value.load(std::memory_order_acquire);
+					found = true;
+					break;
+				}
+				if (k == EMPTY)
+				{
+					break;
+				}
+				i = (i + 1) & t->mask;
+			}
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (shard.seq.load(std::memory_order_relaxed) == s1)
+			{
+				if (found)
+				{
+					value = v;
+				}
+				return found;
+			}
+		}
+	}
+
+	void put(uint64_t key, uint64_t value) override
+	{
+		uint64_t h = mix(key);
+		Shard &shard = shardOf(h);
+		pthread_mutex_lock(&shard.mu);
+		if (key >= TOMBSTONE)
+		{
+			int i = key - TOMBSTONE;
+			shard.special_value[i].store(value, std::memory_order_relaxed);
+			if (!shard.special_present[i].exchange(true, std::memory_order_release))
+			{
+				shard.count.fetch_add(1, std::memory_order_relaxed);
+			}
+			pthread_mutex_unlock(&shard.mu);
+			return;
+		}
+		Table *t = shard.table.load(std::memory_order_relaxed);
+		// 负载因子（含墓碑）超过 3/4 时重建
+		if ((shard.used + 1) * 4 > (t->mask + 1) * 3)
+		{
+			t = rehash(shard, t);
+		}
+		uint64_t i = h & t->mask;
+		int64_t reuse = -1;
+		while (true)
+		{
+			uint64_t k = t->slots[i].key.load(std::memory_order_relaxed);
+			if (k == key)
+			{
+				// 覆盖已有的值，读者看到旧值或新值都是合法的
+				t->slots[i].value.store(value, std::memory_order_release);
+				pthread_mutex_unlock(&shard.mu);
+				return;
+			}
+			if (k == TOMBSTONE && reuse < 0)
+			{
+				reuse = i;
+			}
+			if (k == EMPTY)
+			{
+				break;
+			}
+			i = (i + 1) & t->mask;
+		}
+		if (reuse >= 0)
+		{
+			i = reuse;
+		}
+		else
+		{
+			shard.used++;
+		}
+		// 先写值，再以 release 语义发布键，读者读到键时一定能看到对应的值
+		t->slots[i].value.store(value, std::memory_order_relaxed);
+		t->slots[i].key.store(key, std::memory_order_release);
+		shard.count.fetch_add(1, std::memory_order_relaxed);
+		pthread_mutex_unlock(&shard.mu);
+	}
+
+	bool erase(uint64_t key) override
+	{
+		uint64_t h = mix(key);
+		Shard &shard = shardOf(h);
+		bool erased = false;
+		pthread_mutex_lock(&shard.mu);
+		if (key >= TOMBSTONE)
+		{
+			erased = shard.special_present[key - TOMBSTONE].exchange(false, std::memory_order_release);
+		}
+		else
+		{
+			Table *t = shard.table.load(std::memory_order_relaxed);
+			uint64_t i = h & t->mask;
+			while (true)
+			{
+				uint64_t k = t->slots[i].key.load(std::memory_order_relaxed);
+				if (k == key)
+				{
+					// 墓碑之后该槽可能被别的键复用，必须让正在读它的读者重试
+					writeBegin(shard);
+					t->slots[i].key.store(TOMBSTONE, std::memory_order_relaxed);
+					writeEnd(shard);
+					erased = true;
+					break;
+				}
+				if (k == EMPTY)
+				{
+					break;
+				}
+				i = (i + 1) & t->mask;
+			}
+		}
+		if (erased)
+		{
+			shard.count.fetch_sub(1, std::memory_order_relaxed);
+		}
+		pthread_mutex_unlock(&shard.mu);
+		return erased;
+	}
+
+	uint64_t size() override
+	{
+		uint64_t n = 0;
+		for (uint64_t i = 0; i < num_shards; i++)
+		{
+			n += shards[i].count.load(std::memory_order_relaxed);
+		}
+		return n;
+	}
+
+	void forEach(const std::function<void(uint64_t, uint64_t)> &fn) override
+	{
+		for (uint64_t s = 0; s < num_shards; s++)
+		{
+			forEachInShard(s, fn);
+		}
+	}
+
+	uint64_t shardCount()
+	{
+		return num_shards;
+	}
+
+	// 只遍历第 s 个分片，遍历期间持有该分片的锁
+	void forEachInShard(uint64_t s, const std::function<void(uint64_t, uint64_t)> &fn)
+	{
+		Shard &shard = shards[s];
+		pthread_mutex_lock(&shard.mu);
+		Table *t = shard.table.load(std::memory_order_relaxed);
+		for (uint64_t i = 0; i <= t->mask; i++)
+		{
+			uint64_t k = t->slots[i].key.load(std::memory_order_relaxed);
+			if (k < TOMBSTONE)
+			{
+				fn(k, t->slots[i].value.load(std::memory_order_relaxed));
+			}
+		}
+		for (int i = 0; i < 2; i++)
+		{
+			if (shard.special_present[i].load(std::memory_order_relaxed))
+			{
+				fn(TOMBSTONE + i, shard.special_value[i].load(std::memory_order_relaxed));
+			}
+		}
+		pthread_mutex_unlock(&shard.mu);
+	}
+
+private:
+	// splitmix64 的终结函数，高位选分片，低位选槽
+	static uint64_t mix(uint64_t x)
+	{
+		x ^= x >> 30;
+		x *= 0xbf58476d1ce4e5b9ULL;
+		x ^= x >> 27;
+		x *= 0x94d049bb133111ebULL;
+		x ^= x >> 31;
+		return x;
+	}
+
+	Shard &shardOf(uint64_t h)
+	{
+		return shards[shard_shift == 64 ? 0 : h >> shard_shift];
+	}
+
+	static Table *newTable(uint64_t capacity)
+	{
+		Table *t = new Table;
+		t->mask = capacity - 1;
+		t->slots = new Slot[capacity];
+		for (uint64_t i = 0; i < capacity; i++)
+		{
+			t->slots[i].key.store(EMPTY, std::memory_order_relaxed);
+			t->slots[i].value.store(0, std::memory_order_relaxed);
+		}
+		return t;
+	}
+
+	static void freeTable(Table *t)
+	{
+		delete[] t->slots;
+		delete t;
+	}
+
+	static void writeBegin(Shard &shard)
+	{
+		shard.seq.store(shard.seq.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+	}
+
+	static void writeEnd(Shard &shard)
+	{
+		shard.seq.store(shard.seq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	/*
+	 * 持有分片写锁时调用：存活的键超过容量一半时把它们搬到两倍大的新表并发布；
+	 * 否则只是墓碑太多，在原表上就地清理，不产生需要延迟释放的旧表
+	 */
+	Table *rehash(Shard &shard, Table *old)
+	{
+		uint64_t live = shard.count.load(std::memory_order_relaxed);
+		// 特殊键不在表内
+		for (int i = 0; i < 2; i++)
+		{
+			live -= shard.special_present[i].load(std::memory_order_relaxed);
+		}
+		uint64_t capacity = old->mask + 1;
+		if ((live + 1) * 2 <= capacity)
+		{
+			cleanup(shard, old, live);
+			return old;
+		}
+		Table *t = newTable(capacity << 1);
+		for (uint64_t i = 0; i <= old->mask; i++)
+		{
+			uint64_t k = old->slots[i].key.load(std::memory_order_relaxed);
+			if (k < TOMBSTONE)
+			{
+				insertFresh(t, k, old->slots[i].value.load(std::memory_order_relaxed));
+			}
+		}
+		writeBegin(shard);
+		shard.table.store(t, std::memory_order_release);
+		writeEnd(shard);
+		shard.retired.push_back(old);
+		shard.used = live;
+		return t;
+	}
+
+	/*
+	 * 就地清除墓碑：先取出存活的键值，再清空整张表后重新插入。
+	 * 整个过程处于序列号为奇数的写区间内，期间的读者都会重试
+	 */
+	void cleanup(Shard &shard, Table *t, uint64_t live)
+	{
+		std::vector<std::pair<uint64_t, uint64_t>> kept;
+		kept.reserve(live);
+		for (uint64_t i = 0; i <= t->mask; i++)
+		{
+			uint64_t k = t->slots[i].key.load(std::memory_order_relaxed);
+			if (k < TOMBSTONE)
+			{
+				kept.push_back(std::make_pair(k, t->slots[i].value.load(std::memory_order_relaxed)));
+			}
+		}
+		writeBegin(shard);
+		for (uint64_t i = 0; i <= t->mask; i++)
+		{
+			t->slots[i].key.store(EMPTY, std::memory_order_relaxed);
+		}
+		for (const auto &kv : kept)
+		{
+			insertFresh(t, kv.first, kv.second);
+		}
+		writeEnd(shard);
+		shard.used = kept.size();
+	}
+
+	// 插入到只有空槽和存活键、且一定不含 key 的表中
+	static void insertFresh(Table *t, uint64_t key, uint64_t value)
+	{
+		uint64_t j = mix(key) & t->mask;
+		while (t->slots[j].key.load(std::memory_order_relaxed) != EMPTY)
+		{
+			j = (j + 1) & t->mask;
+		}
+		t->slots[j].value.store(value, std::memory_order_relaxed);
+		t->slots[j].key.store(key, std::memory_order_relaxed);
+	}
+};
+
+#endif /* INCLUDE_KVSTORE_HPP_ */
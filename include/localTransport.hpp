@@ -0,0 +1,269 @@
+/*
+ * localTransport.hpp
+ *
+ * 进程内传输：同一进程中的节点之间不经过 protobuf 序列化和回环 HTTP/2，
+ * 请求以消息对象指针的形式放进目标节点所属工作线程的无锁多生产者单消费者队列，
+ * 工作线程直接调用目标节点的处理函数，把应答写进调用方的应答对象后回调。
+ */
+
+#ifndef INCLUDE_LOCALTRANSPORT_HPP_
+#define INCLUDE_LOCALTRANSPORT_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "transport.hpp"
+
+/*
+ * MpscQueue
+ * Vyukov 的侵入式无锁队列：任意线程都可以 push（一次 exchange 加一次 store），
+ * 只有一个消费者线程 pop。生产者在两步之间被打断时，消费者暂时看不到它之后的元素，pop 返回空，稍后重试即可
+ */
+class MpscQueue
+{
+public:
+	struct Item
+	{
+		std::atomic<Item *> next{nullptr};
+	};
+
+private:
+	std::atomic<Item *> head; // 最后入队的元素，生产者一侧
+	Item *tail;				  // 下一个出队的元素，只由消费者访问
+	Item stub;				  // 队列为空时占位
+
+public:
+	MpscQueue() : head(&stub), tail(&stub) {}
+
+	MpscQueue(const MpscQueue &) = delete;
+	MpscQueue &operator=(const MpscQueue &) = delete;
+
+	void push(Item *item)
+	{
+		item->next.store(nullptr, std::memory_order_relaxed);
+		Item *prev = head.exchange(item, std::memory_order_seq_cst);
+		prev->next.store(item, std::memory_order_release);
+	}
+
+	// 只能由消费者线程调用，没有可取的元素时返回空
+	Item *pop()
+	{
+		Item *t = tail;
+		Item *next = t->next.load(std::memory_order_acquire);
+		if (t == &stub)
+		{
+			if (next == nullptr)
+			{
+				return nullptr;
+			}
+			tail = next;
+			t = next;
+			next = next->next.load(std::memory_order_acquire);
+		}
+		if (next != nullptr)
+		{
+			tail = next;
+			return t;
+		}
+		// t 是最后一个元素：还有生产者在入队时先等它完成
+		if (t != head.load(std::memory_order_acquire))
+		{
+			return nullptr;
+		}
+		push(&stub);
+		next = t->next.load(std::memory_order_acquire);
+		if (next != nullptr)
+		{
+			tail = next;
+			return t;
+		}
+		return nullptr;
+	}
+
+	// 只能由消费者线程调用：队列中没有元素，也没有正在入队的生产者
+	bool empty()
+	{
+		return tail->next.load(std::memory_order_acquire) == nullptr && head.load(std::memory_order_seq_cst) == tail;
+	}
+};
+
+class LocalTransport : public Transport
+{
+public:
+	struct Stats
+	{
+		uint64_t delivered; // 交给本进程节点处理的请求数
+		size_t peers;		// 登记的节点数
+	};
+
+private:
+	// 一次投递，处理完后由工作线程释放
+	struct Task : MpscQueue::Item
+	{
+		LocalPeer *peer;
+		KadMethod method;
+		const google::protobuf::Message *request;
+		google::protobuf::Message *response;
+		Done done;
+	};
+
+	// 一个工作线程及其队列；空闲时先让出几次 CPU，再睡眠到有新的投递
+	struct Worker
+	{
+		MpscQueue queue;
+		std::mutex mu;
+		std::condition_variable cv;
+		std::atomic<bool> sleeping{false};
+		std::thread thread;
+	};
+
+	static const int spins = 64;
+
+	struct Peer
+	{
+		LocalPeer *peer;
+		Worker *worker;
+	};
+
+	std::shared_mutex mu; // 保护 peers
+	std::unordered_map<std::string, Peer> peers;
+	std::vector<Worker *> workers;
+	size_t next_worker = 0;
+	std::atomic<bool> stopping{false};
+	std::atomic<uint64_t> delivered{0};
+
+public:
+	// 每个节点固定由一个工作线程处理，登记时轮流分配到 num_workers 个工作线程上
+	explicit LocalTransport(int num_workers = 1)
+	{
+		for (int i = 0; i < std::max(num_workers, 1); i++)
+		{
+			Worker *w = new Worker();
+			w->thread = std::thread([this, w]
+									{ run(w); });
+			workers.push_back(w);
+		}
+	}
+
+	~LocalTransport()
+	{
+		stopping.store(true);
+		for (Worker *w : workers)
+		{
+			wake(w, true);
+			w->thread.join();
+			delete w;
+		}
+	}
+
+	LocalTransport(const LocalTransport &) = delete;
+	LocalTransport &operator=(const LocalTransport &) = delete;
+
+	bool attach(const std::string &address, LocalPeer *peer) override
+	{
+		std::unique_lock<std::shared_mutex> lock(mu);
+		peers[address] = Peer{peer, workers[next_worker++ % workers.size()]};
+		return true;
+	}
+
+	void detach(const std::string &address) override
+	{
+		std::unique_lock<std::shared_mutex> lock(mu);
+		peers.erase(address);
+	}
+
+	bool reaches(const std::string &address, KadMethod) override
+	{
+		std::shared_lock<std::shared_mutex> lock(mu);
+		return peers.find(address) != peers.end();
+	}
+
+	bool send(const std::string &address, KadMethod method, const google::protobuf::Message *request,
+			  google::protobuf::Message *response, Done done) override
+	{
+		Peer target;
+		{
+			std::shared_lock<std::shared_mutex> lock(mu);
+			auto it = peers.find(address);
+			if (it == peers.end())
+			{
+				return false;
+			}
+			target = it->second;
+		}
+		Task *task = new Task();
+		task->peer = target.peer;
+		task->method = method;
+		task->request = request;
+		task->response = response;
+		task->done = std::move(done);
+		target.worker->queue.push(task);
+		wake(target.worker, false);
+		return true;
+	}
+
+	Stats stats()
+	{
+		Stats s;
+		s.delivered = delivered.load(std::memory_order_relaxed);
+		std::shared_lock<std::shared_mutex> lock(mu);
+		s.peers = peers.size();
+		return s;
+	}
+
+private:
+	// 与消费者的 sleeping 标志配合：入队后消费者要么在睡眠前看到新元素，要么被这里唤醒
+	static void wake(Worker *w, bool always)
+	{
+		if (always || w->sleeping.load(std::memory_order_seq_cst))
+		{
+			std::lock_guard<std::mutex> guard(w->mu);
+			w->cv.notify_one();
+		}
+	}
+
+	void run(Worker *w)
+	{
+		int idle = 0;
+		while (true)
+		{
+			Task *task = static_cast<Task *>(w->queue.pop());
+			if (task != nullptr)
+			{
+				idle = 0;
+				grpc::Status status = task->peer->serveLocal(task->method, task->request, task->response);
+				delivered.fetch_add(1, std::memory_order_relaxed);
+				task->done(status);
+				delete task;
+				continue;
+			}
+			if (stopping.load() && w->queue.empty())
+			{
+				break;
+			}
+			if (++idle < spins)
+			{
+				std::this_thread::yield();
+				continue;
+			}
+			std::unique_lock<std::mutex> lock(w->mu);
+			w->sleeping.store(true, std::memory_order_seq_cst);
+			if (w->queue.empty() && !stopping.load())
+			{
+				w->cv.wait_for(lock, std::chrono::milliseconds(100));
+			}
+			w->sleeping.store(false, std::memory_order_relaxed);
+			idle = 0;
+		}
+	}
+};
+
+#endif /* INCLUDE_LOCALTRANSPORT_HPP_ */
@@ -0,0 +1,258 @@
+/*
+ * locationCache.hpp
+ *
+ * 键位置缓存：记录最近一次 find_value / store 成功时应答的节点，
+ * 下次读取同一个键（或同一个 ID 前缀）时直接向该节点发一次 find_value，跳过迭代查找；
+ * 应答中没有值时退回到查找。写入不使用缓存，总是写到查找得到的最近节点。
+ */
+
+#ifndef INCLUDE_LOCATIONCACHE_HPP_
+#define INCLUDE_LOCATIONCACHE_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <list>
+#include <unordered_map>
+
+#include <pthread.h>
+
+#include "routingTable.hpp"
+
+class LocationCache
+{
+public:
+	struct Options
+	{
+		uint64_t capacity = 1 << 16; // 最多缓存的键（前缀）数，0 表示关闭缓存
+		int64_t ttl_ms = 30 * 1000;	 // 缓存项的有效期
+		int prefix_bits = NodeID::bits; // 按 ID 的前多少位缓存，等于 ID 位宽时按完整的键 ID
+	};
+
+	struct Stats
+	{
+		uint64_t hits;			// 命中且未过期
+		uint64_t misses;		// 未命中或已过期
+		uint64_t invalidations; // 因对端退出或应答中没有值而失效的缓存项
+		uint64_t expirations;	// 因超过有效期而失效的缓存项
+		uint64_t evictions;		// 因容量不足淘汰的缓存项
+		uint64_t size;			// 当前缓存项数
+	};
+
+private:
+	struct Entry
+	{
+		NodeID prefix;
+		RoutingTable::Contact owner; // 持有地址的一个引用，从缓存中删除时 release
+		int64_t expires; // 过期时间（毫秒）
+	};
+
+	// 每个分片是一个 LRU：链表头部是最近使用的缓存项
+	struct alignas(64) Shard
+	{
+		pthread_mutex_t mu = PTHREAD_MUTEX_INITIALIZER;
+		std::list<Entry> lru;
+		std::unordered_map<NodeID, std::list<Entry>::iterator> index;
+	};
+
+	static const int num_shards = 16;
+
+	Shard shards[num_shards];
+	Options options;
+	uint64_t shard_capacity;
+
+	std::atomic<uint64_t> hits{0};
+	std::atomic<uint64_t> misses{0};
+	std::atomic<uint64_t> invalidations{0};
+	std::atomic<uint64_t> expirations{0};
+	std::atomic<uint64_t> evictions{0};
+
+public:
+	explicit LocationCache(Options opts)
+	{
+		options = opts;
+		options.prefix_bits = std::min(std::max(options.prefix_bits, 1), NodeID::bits);
+		shard_capacity = (options.capacity + num_shards - 1) / num_shards;
+	}
+
+	~LocationCache()
+	{
+		for (Shard &shard : shards)
+		{
+			for (Entry &entry : shard.lru)
+			{
+				entry.owner.release();
+			}
+		}
+	}
+
+	LocationCache(const LocationCache &) = delete;
+	LocationCache &operator=(const LocationCache &) = delete;
+
+	bool enabled()
+	{
+		return options.capacity > 0;
+	}
+
+	/*
+	 * 查找 id 所在前缀最近一次的应答节点，命中且未过期时写入 owner 并返回 true。
+	 * owner 不持有地址的引用，只能在本次调用中使用（需要保留时转换成 Node）
+	 */
+	bool lookup(const NodeID &id, RoutingTable::Contact &owner)
+	{
+		if (!enabled())
+		{
+			return false;
+		}
+		NodeID prefix = prefixOf(id);
+		Shard &shard = shardOf(prefix);
+		int64_t now = nowMs();
+		bool hit = false, expired = false;
+		pthread_mutex_lock(&shard.mu);
+		auto iter = shard.index.find(prefix);
+		if (iter != shard.index.end())
+		{
+			if (iter->second->expires > now)
+			{
+				owner = iter->second->owner;
+				shard.lru.splice(shard.lru.begin(), shard.lru, iter->second);
+				hit = true;
+			}
+			else
+			{
+				iter->second->owner.release();
+				shard.lru.erase(iter->second);
+				shard.index.erase(iter);
+				expired = true;
+			}
+		}
+		pthread_mutex_unlock(&shard.mu);
+		(hit ? hits : misses).fetch_add(1, std::memory_order_relaxed);
+		if (expired)
+		{
+			expirations.fetch_add(1, std::memory_order_relaxed);
+		}
+		return hit;
+	}
+
+	// 记录 id 所在前缀的应答节点，并重新开始计算有效期
+	void insert(const NodeID &id, const Node &node)
+	{
+		if (!enabled())
+		{
+			return;
+		}
+		Entry entry;
+		entry.prefix = prefixOf(id);
+		entry.owner = RoutingTable::Contact::of(node);
+		entry.expires = nowMs() + options.ttl_ms;
+
+		Shard &shard = shardOf(entry.prefix);
+		uint64_t evicted = 0;
+		pthread_mutex_lock(&shard.mu);
+		auto iter = shard.index.find(entry.prefix);
+		if (iter != shard.index.end())
+		{
+			iter->second->owner.release();
+			*iter->second = entry;
+			shard.lru.splice(shard.lru.begin(), shard.lru, iter->second);
+		}
+		else
+		{
+			shard.lru.push_front(entry);
+			shard.index[entry.prefix] = shard.lru.begin();
+			while (shard.lru.size() > shard_capacity)
+			{
+				shard.lru.back().owner.release();
+				shard.index.erase(shard.lru.back().prefix);
+				shard.lru.pop_back();
+				evicted++;
+			}
+		}
+		pthread_mutex_unlock(&shard.mu);
+		evictions.fetch_add(evicted, std::memory_order_relaxed);
+	}
+
+	// 缓存的节点应答中没有该键（mode_kv = false）或 RPC 失败时调用
+	void invalidate(const NodeID &id)
+	{
+		NodeID prefix = prefixOf(id);
+		Shard &shard = shardOf(prefix);
+		pthread_mutex_lock(&shard.mu);
+		auto iter = shard.index.find(prefix);
+		bool found = iter != shard.index.end();
+		if (found)
+		{
+			iter->second->owner.release();
+			shard.lru.erase(iter->second);
+			shard.index.erase(iter);
+		}
+		pthread_mutex_unlock(&shard.mu);
+		invalidations.fetch_add(found, std::memory_order_relaxed);
+	}
+
+	/*
+	 * 节点 node_id 退出网络或从路由表删除时调用，移除所有指向它的缓存项。需要遍历整个缓存，但退出很少发生
+	 */
+	void invalidateNode(const NodeID &node_id)
+	{
+		uint64_t n = 0;
+		for (Shard &shard : shards)
+		{
+			pthread_mutex_lock(&shard.mu);
+			for (auto iter = shard.lru.begin(); iter != shard.lru.end();)
+			{
+				if (iter->owner.id == node_id)
+				{
+					iter->owner.release();
+					shard.index.erase(iter->prefix);
+					iter = shard.lru.erase(iter);
+					n++;
+				}
+				else
+				{
+					++iter;
+				}
+			}
+			pthread_mutex_unlock(&shard.mu);
+		}
+		invalidations.fetch_add(n, std::memory_order_relaxed);
+	}
+
+	Stats stats()
+	{
+		Stats s;
+		s.hits = hits.load(std::memory_order_relaxed);
+		s.misses = misses.load(std::memory_order_relaxed);
+		s.invalidations = invalidations.load(std::memory_order_relaxed);
+		s.expirations = expirations.load(std::memory_order_relaxed);
+		s.evictions = evictions.load(std::memory_order_relaxed);
+		s.size = 0;
+		for (Shard &shard : shards)
+		{
+			pthread_mutex_lock(&shard.mu);
+			s.size += shard.lru.size();
+			pthread_mutex_unlock(&shard.mu);
+		}
+		return s;
+	}
+
+private:
+	NodeID prefixOf(const NodeID &id)
+	{
+		return id.prefix(options.prefix_bits);
+	}
+
+	Shard &shardOf(const NodeID &prefix)
+	{
+		return shards[(prefix.hash() * 0x9e3779b97f4a7c15ULL) >> 60];
+	}
+
+	static int64_t nowMs()
+	{
+		return std::chrono::duration_cast<std::chrono::milliseconds>(
+				   std::chrono::steady_clock::now().time_since_epoch())
+			.count();
+	}
+};
+
+#endif /* INCLUDE_LOCATIONCACHE_HPP_ */
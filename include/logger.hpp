@@ -0,0 +1,337 @@
+/*
+ * logger.hpp
+ *
+ * 异步分级日志：调用线程只把格式化好的一行写进自己的环形缓冲区（单生产者单消费者，不加锁），
+ * 后台线程每 10ms 把所有缓冲区按时间排序后一次写到 stdout。
+ * 低于 DHASH_LOG_LEVEL 的日志在编译期就被去掉；每个请求都会打印的日志用 DLOG_SAMPLED 限制每秒条数。
+ *
+ * 用法：DLOG(INFO, "put done %lu", n);  DLOG_SAMPLED(DEBUG, 10, "find_node %lu", id);
+ */
+
+#ifndef INCLUDE_LOGGER_HPP_
+#define INCLUDE_LOGGER_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DHASH_LOG_TRACE 0
+#define DHASH_LOG_DEBUG 1
+#define DHASH_LOG_INFO 2
+#define DHASH_LOG_WARN 3
+#define DHASH_LOG_ERROR 4
+
+// 编译期的最低级别，低于它的 DLOG 不生成任何代码
+#ifndef DHASH_LOG_LEVEL
+#ifdef DHASH_DEBUG
+#define DHASH_LOG_LEVEL DHASH_LOG_DEBUG
+#else
+#define DHASH_LOG_LEVEL DHASH_LOG_INFO
+#endif
+#endif
+
+class Logger
+{
+	static const int ring_size = 1024; // 每个线程缓冲的行数，写满时丢弃新的日志
+	static const int text_bytes = 240; // 每行最多的字节数，超出部分截断
+
+	struct Record
+	{
+		int64_t ts_ns; // 相对日志启动的时间
+		uint32_t tid;  // 写入线程的缓冲区编号
+		uint16_t level;
+		uint16_t len;
+		char text[text_bytes];
+	};
+
+	// 单生产者（拥有它的线程）单消费者（后台线程）的环形缓冲区
+	struct Ring
+	{
+		alignas(64) std::atomic<uint64_t> head{0}; // 生产者写入的位置
+		alignas(64) std::atomic<uint64_t> tail{0}; // 消费者读到的位置
+		std::atomic<uint64_t> dropped{0};		   // 缓冲区满时丢弃的行数
+		std::atomic<bool> owned{true};			   // 线程退出后置为 false，供新线程复用
+		uint32_t tid;
+		Record records[ring_size];
+	};
+
+	// 线程退出时归还缓冲区，尚未写出的行仍由后台线程写出
+	struct RingHolder
+	{
+		Ring *ring = nullptr;
+
+		~RingHolder()
+		{
+			if (ring != nullptr)
+			{
+				ring->owned.store(false, std::memory_order_release);
+			}
+		}
+	};
+
+	std::mutex rings_mu; // 只在线程第一次写日志和后台线程取缓冲区列表时使用
+	std::vector<Ring *> rings;
+	std::mutex drain_mu; // 后台线程和 flush 不能同时写出
+	std::mutex wake_mu;
+	std::condition_variable wake;
+	std::atomic<int> min_level{DHASH_LOG_LEVEL};
+	std::chrono::steady_clock::time_point start;
+	FILE *out;
+	std::thread writer;
+
+	Logger()
+	{
+		start = std::chrono::steady_clock::now();
+		out = stdout;
+		writer = std::thread(&Logger::run, this);
+		writer.detach();
+		// 进程正常退出时写出剩余的日志
+		atexit([]
+			   { instance().flush(); });
+	}
+
+public:
+	Logger(const Logger &) = delete;
+	Logger &operator=(const Logger &) = delete;
+
+	// 进程内唯一的实例，不会析构，其他线程在进程退出前写日志也是安全的
+	static Logger &instance()
+	{
+		static Logger *logger = new Logger();
+		return *logger;
+	}
+
+	// 运行时的最低级别，只能比编译期的级别更高
+	void setLevel(int level)
+	{
+		min_level.store(level, std::memory_order_relaxed);
+	}
+
+	bool enabled(int level)
+	{
+		return level >= min_level.load(std::memory_order_relaxed);
+	}
+
+	__attribute__((format(printf, 3, 4))) void log(int level, const char *fmt, ...)
+	{
+		va_list ap;
+		va_start(ap, fmt);
+		vlog(level, 0, fmt, ap);
+		va_end(ap);
+	}
+
+	// suppressed 为采样时上次输出之后被丢弃的同类日志数，非 0 时附在行尾
+	__attribute__((format(printf, 4, 5))) void logSampled(int level, uint64_t suppressed, const char *fmt, ...)
+	{
+		va_list ap;
+		va_start(ap, fmt);
+		vlog(level, suppressed, fmt, ap);
+		va_end(ap);
+	}
+
+	// 同步写出所有缓冲区中的日志
+	void flush()
+	{
+		drain();
+	}
+
+private:
+	void vlog(int level, uint64_t suppressed, const char *fmt, va_list ap)
+	{
+		if (!enabled(level))
+		{
+			return;
+		}
+		Ring *r = localRing();
+		uint64_t h = r->head.load(std::memory_order_relaxed);
+		if (h - r->tail.load(std::memory_order_acquire) >= ring_size)
+		{
+			r->dropped.fetch_add(1, std::memory_order_relaxed);
+			wake.notify_one();
+			return;
+		}
+		Record &rec = r->records[h % ring_size];
+		rec.ts_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+		rec.tid = r->tid;
+		rec.level = level;
+		int n = vsnprintf(rec.text, text_bytes, fmt, ap);
+		n = std::min(std::max(n, 0), text_bytes - 1);
+		if (suppressed > 0 && n < text_bytes - 1)
+		{
+			int m = snprintf(rec.text + n, text_bytes - n, " [%lu similar suppressed]", suppressed);
+			n = std::min(n + std::max(m, 0), text_bytes - 1);
+		}
+		rec.len = n;
+		r->head.store(h + 1, std::memory_order_release);
+		// 警告以上或缓冲区过半时立即唤醒后台线程
+		if (level >= DHASH_LOG_WARN || h + 1 - r->tail.load(std::memory_order_relaxed) >= ring_size / 2)
+		{
+			wake.notify_one();
+		}
+	}
+
+	Ring *localRing()
+	{
+		thread_local RingHolder holder;
+		if (holder.ring == nullptr)
+		{
+			std::lock_guard<std::mutex> guard(rings_mu);
+			for (Ring *r : rings)
+			{
+				bool free = false;
+				if (r->owned.compare_exchange_strong(free, true, std::memory_order_acquire))
+				{
+					holder.ring = r;
+					break;
+				}
+			}
+			if (holder.ring == nullptr)
+			{
+				holder.ring = new Ring();
+				holder.ring->tid = rings.size();
+				rings.push_back(holder.ring);
+			}
+		}
+		return holder.ring;
+	}
+
+	void run()
+	{
+		while (true)
+		{
+			{
+				std::unique_lock<std::mutex> lock(wake_mu);
+				wake.wait_for(lock, std::chrono::milliseconds(10));
+			}
+			drain();
+		}
+	}
+
+	// 取出所有缓冲区中的行，按时间排序后一次写出
+	void drain()
+	{
+		std::lock_guard<std::mutex> drain_guard(drain_mu);
+		std::vector<Ring *> snapshot;
+		{
+			std::lock_guard<std::mutex> guard(rings_mu);
+			snapshot = rings;
+		}
+		std::vector<const Record *> batch;
+		std::vector<std::pair<Ring *, uint64_t>> consumed;
+		uint64_t dropped = 0;
+		for (Ring *r : snapshot)
+		{
+			uint64_t t = r->tail.load(std::memory_order_relaxed);
+			uint64_t h = r->head.load(std::memory_order_acquire);
+			for (uint64_t i = t; i < h; i++)
+			{
+				batch.push_back(&r->records[i % ring_size]);
+			}
+			consumed.push_back(std::make_pair(r, h));
+			dropped += r->dropped.exchange(0, std::memory_order_relaxed);
+		}
+		std::stable_sort(batch.begin(), batch.end(), [](const Record *a, const Record *b)
+						 { return a->ts_ns < b->ts_ns; });
+		std::string buf;
+		char prefix[48];
+		for (const Record *rec : batch)
+		{
+			snprintf(prefix, sizeof(prefix), "%c %lu.%06lu %u] ", "TDIWE"[rec->level],
+					 rec->ts_ns / 1000000000, rec->ts_ns / 1000 % 1000000, rec->tid);
+			buf += prefix;
+			buf.append(rec->text, rec->len);
+			buf += '\n';
+		}
+		if (dropped > 0)
+		{
+			snprintf(prefix, sizeof(prefix), "W logger dropped %lu lines\n", dropped);
+			buf += prefix;
+		}
+		// 行已拷贝出来之后再归还缓冲区的空间
+		for (auto &c : consumed)
+		{
+			c.first->tail.store(c.second, std::memory_order_release);
+		}
+		if (!buf.empty())
+		{
+			fwrite(buf.data(), 1, buf.size(), out);
+			fflush(out);
+		}
+	}
+};
+
+/*
+ * LogLimiter
+ * 每个调用点一个，限制每秒最多输出 per_second 条，其余只计数
+ */
+class LogLimiter
+{
+	uint64_t per_second;
+	std::atomic<int64_t> window{-1};
+	std::atomic<uint64_t> count{0};
+	std::atomic<uint64_t> suppressed{0};
+
+public:
+	explicit LogLimiter(uint64_t n)
+	{
+		per_second = n;
+	}
+
+	// 允许输出时返回 true，并在 skipped 中给出上次输出后被丢弃的条数
+	bool allow(uint64_t &skipped)
+	{
+		int64_t now = std::chrono::duration_cast<std::chrono::seconds>(
+						  std::chrono::steady_clock::now().time_since_epoch())
+						  .count();
+		int64_t w = window.load(std::memory_order_relaxed);
+		if (w != now && window.compare_exchange_strong(w, now, std::memory_order_relaxed))
+		{
+			count.store(0, std::memory_order_relaxed);
+		}
+		if (count.fetch_add(1, std::memory_order_relaxed) < per_second)
+		{
+			skipped = suppressed.exchange(0, std::memory_order_relaxed);
+			return true;
+		}
+		suppressed.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+};
+
+// 常量条件为假时整个分支被编译器去掉，参数仍会做类型检查
+#define DLOG(level, fmt, ...) \
+	do \
+	{ \
+		if (DHASH_LOG_##level >= DHASH_LOG_LEVEL) \
+		{ \
+			Logger::instance().log(DHASH_LOG_##level, fmt, ##__VA_ARGS__); \
+		} \
+	} while (0)
+
+// 同一个调用点每秒最多输出 per_second 条，用于每个请求都会经过的路径
+#define DLOG_SAMPLED(level, per_second, fmt, ...) \
+	do \
+	{ \
+		if (DHASH_LOG_##level >= DHASH_LOG_LEVEL && Logger::instance().enabled(DHASH_LOG_##level)) \
+		{ \
+			static LogLimiter dlog_limiter_(per_second); \
+			uint64_t dlog_skipped_; \
+			if (dlog_limiter_.allow(dlog_skipped_)) \
+			{ \
+				Logger::instance().logSampled(DHASH_LOG_##level, dlog_skipped_, fmt, ##__VA_ARGS__); \
+			} \
+		} \
+	} while (0)
+
+#endif /* INCLUDE_LOGGER_HPP_ */
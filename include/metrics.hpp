@@ -0,0 +1,297 @@
+/*
+ * metrics.hpp
+ *
+ * 节点内部的指标：每个 RPC 处理函数和客户端操作的延迟直方图、失败计数，以及查找跳数等分布。
+ * 计数分散在 16 个按线程选择的条带上，记录时只有几次无竞争的原子加法，不加锁；
+ * 读取时把各条带相加。导出为 StatsReply 中的样本列表，也可以格式化为 Prometheus 文本。
+ */
+
+#ifndef INCLUDE_METRICS_HPP_
+#define INCLUDE_METRICS_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <string>
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "proto/dhash.pb.h"
+
+class Metrics
+{
+public:
+	// 计时的操作：前半部分是服务端处理函数，后半部分是本节点作为客户端发起的操作
+	enum Op
+	{
+		FIND_NODE,
+		FIND_VALUE,
+		STORE,
+		EXIT,
+		STORE_BATCH,
+		FIND_VALUE_BATCH,
+		STATS,
+		TRANSFER_RANGE,
+		PING,
+		GET,
+		PUT,
+		JOIN,
+		MULTI_PUT,
+		MULTI_GET,
+		num_ops
+	};
+
+	// 非延迟的分布
+	enum Dist
+	{
+		LOOKUP_HOPS,	  // 每次查找的跳数
+		LOOKUP_CONTACTED, // 每次查找联系的节点数
+		num_dists
+	};
+
+	// 第 i 个桶统计小于 2^i 的值（第 0 个桶只有 0），最后一个桶包含所有更大的值
+	static const int num_buckets = 28;
+
+	struct Snapshot
+	{
+		uint64_t count;
+		uint64_t sum;
+		uint64_t buckets[num_buckets];
+	};
+
+	static const char *opName(int op)
+	{
+		static const char *names[num_ops] = {"find_node", "find_value", "store", "exit", "store_batch",
+											 "find_value_batch", "stats", "transfer_range", "ping", "get", "put", "join", "multi_put", "multi_get"};
+		return names[op];
+	}
+
+	static bool isServerOp(int op)
+	{
+		return op < GET;
+	}
+
+private:
+	struct Histogram
+	{
+		std::atomic<uint64_t> count{0};
+		std::atomic<uint64_t> sum{0};
+		std::atomic<uint64_t> buckets[num_buckets] = {};
+
+		void record(uint64_t v)
+		{
+			int i = v == 0 ? 0 : 64 - __builtin_clzll(v);
+			buckets[i < num_buckets ? i : num_buckets - 1].fetch_add(1, std::memory_order_relaxed);
+			count.fetch_add(1, std::memory_order_relaxed);
+			sum.fetch_add(v, std::memory_order_relaxed);
+		}
+	};
+
+	struct alignas(64) Stripe
+	{
+		Histogram latency_us[num_ops];
+		std::atomic<uint64_t> failures[num_ops] = {};
+		Histogram dists[num_dists];
+	};
+
+	static const int num_stripes = 16;
+
+	Stripe *stripes;
+
+	// 每个线程第一次记录时分到一个条带，之后固定使用它
+	static Stripe &stripeOf(Stripe *stripes)
+	{
+		static std::atomic<int> next_thread{0};
+		thread_local int index = next_thread.fetch_add(1, std::memory_order_relaxed) % num_stripes;
+		return stripes[index];
+	}
+
+public:
+	Metrics()
+	{
+		stripes = new Stripe[num_stripes];
+	}
+
+	~Metrics()
+	{
+		delete[] stripes;
+	}
+
+	Metrics(const Metrics &) = delete;
+	Metrics &operator=(const Metrics &) = delete;
+
+	void recordLatency(Op op, uint64_t ns)
+	{
+		stripeOf(stripes).latency_us[op].record(ns / 1000);
+	}
+
+	// 操作失败（例如 get 没有找到、put 未达到写仲裁）
+	void recordFailure(Op op)
+	{
+		stripeOf(stripes).failures[op].fetch_add(1, std::memory_order_relaxed);
+	}
+
+	void observe(Dist dist, uint64_t v)
+	{
+		stripeOf(stripes).dists[dist].record(v);
+	}
+
+	Snapshot latency(Op op)
+	{
+		Snapshot s = {};
+		for (int i = 0; i < num_stripes; i++)
+		{
+			add(s, stripes[i].latency_us[op]);
+		}
+		return s;
+	}
+
+	Snapshot distribution(Dist dist)
+	{
+		Snapshot s = {};
+		for (int i = 0; i < num_stripes; i++)
+		{
+			add(s, stripes[i].dists[dist]);
+		}
+		return s;
+	}
+
+	uint64_t failures(Op op)
+	{
+		uint64_t n = 0;
+		for (int i = 0; i < num_stripes; i++)
+		{
+			n += stripes[i].failures[op].load(std::memory_order_relaxed);
+		}
+		return n;
+	}
+
+	/*
+	 * 把所有操作的延迟、失败计数和分布追加到 reply 中，labels 是每个样本都带的标签（例如 node="3"）
+	 */
+	void exportTo(StatsReply *reply, const std::string &labels)
+	{
+		for (int op = 0; op < num_ops; op++)
+		{
+			const char *family = isServerOp(op) ? "dhash_rpc_duration_seconds" : "dhash_client_duration_seconds";
+			std::string l = labels + (isServerOp(op) ? ",method=\"" : ",op=\"") + opName(op) + "\"";
+			addHistogram(reply, family, l, latency((Op)op), 1e-6, op == 0 || op == GET);
+		}
+		for (int op = GET; op < num_ops; op++)
+		{
+			addSample(reply, "dhash_client_failures_total", labels + ",op=\"" + opName(op) + "\"",
+					  failures((Op)op), op == GET ? "counter" : "");
+		}
+		addHistogram(reply, "dhash_lookup_hops", labels, distribution(LOOKUP_HOPS), 1, true);
+		addHistogram(reply, "dhash_lookup_contacted", labels, distribution(LOOKUP_CONTACTED), 1, true);
+	}
+
+	/*
+	 * 追加一个样本。type 非空时表示这是一个指标族的第一个样本，格式化时在它前面输出 # TYPE
+	 */
+	static void addSample(StatsReply *reply, const std::string &name, const std::string &labels, double value,
+						  const char *type = "")
+	{
+		Metric *m = reply->add_metrics();
+		m->set_name(name);
+		m->set_labels(labels);
+		m->set_value(value);
+		m->set_type(type);
+	}
+
+	// 按 Prometheus 的约定展开为累积的 _bucket、_sum 和 _count 样本，scale 把值换算为导出的单位
+	static void addHistogram(StatsReply *reply, const std::string &family, const std::string &labels,
+							 const Snapshot &s, double scale, bool first)
+	{
+		uint64_t cumulative = 0;
+		char le[32];
+		for (int i = 0; i < num_buckets; i++)
+		{
+			cumulative += s.buckets[i];
+			if (i + 1 < num_buckets)
+			{
+				// 整数分布的桶上界是 2^i - 1，延迟按 2^i 微秒换算
+				double bound = scale == 1 ? (1ULL << i) - 1 : (1ULL << i) * scale;
+				snprintf(le, sizeof(le), "%g", bound);
+			}
+			else
+			{
+				snprintf(le, sizeof(le), "+Inf");
+			}
+			addSample(reply, family + "_bucket", labels + ",le=\"" + le + "\"", cumulative,
+					  first && i == 0 ? "histogram" : "");
+		}
+		addSample(reply, family + "_sum", labels, s.sum * scale);
+		addSample(reply, family + "_count", labels, s.count);
+	}
+
+	/*
+	 * Prometheus 文本格式（0.0.4）
+	 */
+	static std::string formatPrometheus(const StatsReply &reply)
+	{
+		std::string out;
+		char value[32];
+		for (const Metric &m : reply.metrics())
+		{
+			if (!m.type().empty())
+			{
+				std::string family = m.name();
+				if (m.type() == "histogram")
+				{
+					family = family.substr(0, family.rfind("_bucket"));
+				}
+				out += "# TYPE " + family + " " + m.type() + "\n";
+			}
+			snprintf(value, sizeof(value), "%.17g", m.value());
+			out += m.name();
+			if (!m.labels().empty())
+			{
+				out += "{" + m.labels() + "}";
+			}
+			out += " ";
+			out += value;
+			out += "\n";
+		}
+		return out;
+	}
+
+private:
+	static void add(Snapshot &s, const Histogram &h)
+	{
+		s.count += h.count.load(std::memory_order_relaxed);
+		s.sum += h.sum.load(std::memory_order_relaxed);
+		for (int i = 0; i < num_buckets; i++)
+		{
+			s.buckets[i] += h.buckets[i].load(std::memory_order_relaxed);
+		}
+	}
+};
+
+/*
+ * MetricTimer
+ * 在作用域结束时记录一次操作的延迟
+ */
+class MetricTimer
+{
+	Metrics *metrics;
+	Metrics::Op op;
+	std::chrono::steady_clock::time_point start;
+
+public:
+	MetricTimer(Metrics *m, Metrics::Op o)
+	{
+		metrics = m;
+		op = o;
+		start = std::chrono::steady_clock::now();
+	}
+
+	~MetricTimer()
+	{
+		metrics->recordLatency(op, std::chrono::duration_cast<std::chrono::nanoseconds>(
+									   std::chrono::steady_clock::now() - start)
+									   .count());
+	}
+};
+
+#endif /* INCLUDE_METRICS_HPP_ */
@@ -8,15 +8,30 @@
 
 #include <map>
 #include <deque>
-#include <iostream>
+#include <condition_variable>
+#include <future>
+#include <random>
+#include <thread>
 #include <grpc/grpc.h>
 #include <grpcpp/create_channel.h>
 
-#include <math.h>
 #include <pthread.h>
 
 #include "proto/dhash.pb.h"
 #include "proto/dhash.grpc.pb.h"
+#include "channelPool.hpp"
+#include "valueStore.hpp"
+#include "placement.hpp"
+#include "kadId.hpp"
+#include "routingTable.hpp"
+#include "kadRpc.hpp"
+#include "transport.hpp"
+#include "kadLookup.hpp"
+#include "peerProber.hpp"
+#include "locationCache.hpp"
+#include "hotCache.hpp"
+#include "metrics.hpp"
+#include "logger.hpp"
 
 template <class K, class V>
 using map = std::unordered_map<K, V>;
@@ -30,23 +45,11 @@ using vector = std::vector<T>;
 template <class T>
 using deque = std::deque<T>;
 
-uint64_t id_distance(uint64_t xId, uint64_t yId)
+NodeID id_distance(const NodeID &xId, const NodeID &yId)
 {
 	return xId ^ yId;
 }
 
-// 这个函数用于计算输入的无符号 64 位整数在二进制表示中从最高位到最低位的距离
-uint64_t k_id_distance(uint64_t dis)
-{
-	int i = 0;
-	while (dis)
-	{
-		dis = dis >> 1;
-		i = i + 1;
-	}
-	return i - 1;
-}
-
 // 将字符串中的二进制数据按照字节进行复制，并将其解释为一个64位无符号整数。
 uint64_t str2u64(const std::string data)
 {
@@ -62,82 +65,99 @@ namespace std
 	{
 		size_t operator()(const Node &__x) const
 		{
-			return __x.id();
+			return nodeIdOf(__x).hash();
 		}
 	};
 }
 
-class Lock
+/*
+ * Pacer
+ * 按字节数限速：发送每一块之前用 reserve 取得最早可以发送的时刻，bytes_per_sec 为 0 时不限速
+ */
+class Pacer
 {
-	// 用于存储一组互斥锁的指针
-	pthread_mutex_t *lock_;
-	// 记录互斥锁的数量
-	int num_locks;
+	uint64_t bytes_per_sec;
+	uint64_t sent = 0;
+	std::chrono::steady_clock::time_point start;
 
 public:
-	// 构造函数，接受一个整数参数 num，用于指定要创建的互斥锁的数量
-	Lock(int num)
+	explicit Pacer(uint64_t rate)
 	{
-		// 将传入的数量赋值给成员变量 num_locks
-		num_locks = num;
-		// 动态分配一组互斥锁的内存，并将指针存储在成员变量 lock_ 中
-		lock_ = new pthread_mutex_t[num_locks];
-		// 循环初始化每个互斥锁
-		for (int i = 0; i < num_locks; i++)
-		{
-			// 使用 PTHREAD_MUTEX_INITIALIZER 初始化互斥锁
-			lock_[i] = PTHREAD_MUTEX_INITIALIZER;
-		}
+		bytes_per_sec = rate;
+		start = std::chrono::steady_clock::now();
 	}
 
-	// lock 方法，接受一个整数参数 k，用于指定要锁定的互斥锁的索引
-	void lock(int k)
+	std::chrono::steady_clock::time_point reserve(uint64_t bytes)
 	{
-		// 如果传入的索引 k 大于等于互斥锁的数量
-		if (k >= num_locks)
+		if (bytes_per_sec == 0)
 		{
-			// 重置索引 k 为 0，以防止越界访问
-			k = 0;
+			return start;
 		}
+		std::chrono::steady_clock::time_point at = start + std::chrono::nanoseconds((uint64_t)(sent * 1e9 / bytes_per_sec));
+		sent += bytes;
+		return at;
+	}
+};
+
+/*
+ * WaitGroup
+ * 等待一组异步回调全部完成：构造时给出回调数，每个回调中调用 done，发起线程调用 wait
+ */
+class WaitGroup
+{
+	std::mutex mu;
+	std::condition_variable cv;
+	uint64_t left;
 
-		// 使用 pthread_mutex_lock 锁定指定索引 k 的互斥锁
-		pthread_mutex_lock(lock_ + k);
+public:
+	explicit WaitGroup(uint64_t n)
+	{
+		left = n;
 	}
 
-	// unlock 方法，接受一个整数参数 k，用于指定要解锁的互斥锁的索引
-	void unlock(int k)
+	void done()
 	{
-		// 如果传入的索引 k 大于等于互斥锁的数量
-		if (k >= num_locks)
+		std::lock_guard<std::mutex> guard(mu);
+		if (--left == 0)
 		{
-			// 重置索引 k 为 0，以防止越界访问
-			k = 0;
+			cv.notify_all();
 		}
-		// 使用 pthread_mutex_unlock 解锁指定索引 k 的互斥锁
-		pthread_mutex_unlock(lock_ + k);
+	}
+
+	void wait()
+	{
+		std::unique_lock<std::mutex> lock(mu);
+		cv.wait(lock, [this]
+				{ return left == 0; });
 	}
 };
 
-class NodeKadImpl : public KadImpl::Service
+/*
+ * KadCore
+ * 节点的路由表、本地存储以及 RPC 处理逻辑。处理函数与 gRPC 的服务端模型无关，
+ * 同步服务（NodeKadImpl）和异步服务（KadAsyncServer）都调用这里的 serveXXX。
+ */
+class KadCore : public LocalPeer
 {
-
+protected:
 	using Status = grpc::Status;							// 使用别名 Status 代表 grpc::Status 类型
-	using ServerContext = grpc::ServerContext;				// 使用别名 ServerContext 代表 grpc::ServerContext 类型
-	using ClientContext = grpc::ClientContext;				// 使用别名 ClientContext 代表 grpc::ClientContext 类型
 	using Nodes = google::protobuf::RepeatedPtrField<Node>; // 使用别名 Nodes 代表 google::protobuf::RepeatedPtrField<Node> 类型
 	std::string local_address = "";							// 字符串类型变量 local_address，用于存储本地地址
-	uint64_t local_nodeId = 0;								// 64 位无符号整数变量 local_nodeId，用于存储本地节点的唯一标识
+	NodeID local_nodeId;									// 本地节点的唯一标识，位宽由 DHASH_ID_BITS 决定
 	uint64_t k_closest = 2;									// 64 位无符号整数变量 k_closest，用于表示 k-最近邻（k-closest）的数量
-	uint64_t num_buckets = 4;								// 64 位无符号整数变量 num_buckets，用于表示桶的数量
 	Node local_node;										// Node 类型变量 local_node，用于存储本地节点的信息
-	deque<Node> **nodetable;								// 双端队列（deque）指针数组 nodetable，用于表示节点表
+	RoutingTable *table;									// 每个 ID 位一个 k 桶组成的路由表，读取不加锁
 	vector<Node> *sbuff_, *cbuff_;							// Node 类型指针数组 sbuff_ 和 cbuff_，用于存储节点信息的缓冲区
-	map<uint64_t, uint64_t> *_db;							// 64 位整数对的map，用于表示数据库
-	Lock *lock;												// Lock 类型指针变量 lock，用于管理互斥锁
+	ValueStore *_db;										// 线程安全的字节键值存储，用于表示数据库
+	HotCache *hot;											// 其他节点查找成功后写入的热点值缓存，与 _db 分开
+	Placement *placement;									// 键在 ID 空间中的位置，网络中所有节点必须一致
+	Metrics *metrics;										// 处理函数和客户端操作的延迟、失败计数等指标
+	uint64_t transfer_bytes_per_sec = 0;					// 键迁移（transfer_range 和退出时的移交）的限速，0 表示不限速
+	uint64_t transfer_chunk_bytes = 1 << 20;				// 键迁移时每条消息携带的键值字节数
 
 public:
-	// NodeKadImpl 构造函数，接受地址、节点ID和 k-最近邻的参数
-	NodeKadImpl(std::string address, uint64_t id, uint64_t k = 2)
+	// KadCore 构造函数，接受地址、节点ID和 k-最近邻的参数；store 为空时使用内存中的分片存储引擎
+	KadCore(std::string address, const NodeID &id, uint64_t k = 2, ValueStore *store = nullptr)
 	{
 		// 将传入的地址存储到本地地址变量 local_address
 		local_address = address;
@@ -146,55 +166,49 @@ public:
 		// 设置本地节点的地址为传入的地址
 		local_node.set_address(local_address);
 		// 设置本地节点的ID为传入的节点ID
-		local_node.set_id(local_nodeId);
+		setNodeId(&local_node, local_nodeId);
 		// 设置 k_closest 变量为传入的 k 值
 		k_closest = k;
-		// 根据 k 值计算 num_buckets（桶的数量），并存储到 num_buckets 变量
-		num_buckets = pow(2, k);
-		// 创建一个 Lock 对象，用于管理互斥锁，锁的数量为 num_buckets
-		lock = new Lock(num_buckets);
-		// 动态分配存储节点信息的双端队列指针数组 nodetable
-		nodetable = new deque<Node> *[num_buckets];
-		// 初始化 nodetable 中的每个桶（deque）
-		for (int i = 0; i < num_buckets; i++)
-		{
-			nodetable[i] = new deque<Node>();
-		}
-		// 动态分配一个map，用于表示数据库
-		_db = new map<uint64_t, uint64_t>();
+		// 创建路由表：ID 空间的每一位对应一个桶，每个桶最多 k 个节点
+		table = new RoutingTable(local_nodeId, k_closest);
+		// 使用传入的存储（例如带持久化的 DurableKVStore），或创建基于 slab 内存池的存储，用于表示数据库
+		_db = store ? store : new ArenaValueStore();
+		// 创建热点值缓存，只接受带 cache_ttl_ms 的 store 请求
+		hot = new HotCache(HotCache::Options());
+		// 默认把键哈希到 ID 空间，连续的键不会集中到一个节点
+		placement = new HashPlacement();
+		// 创建指标，记录时不加锁
+		metrics = new Metrics();
 		// 动态分配存储节点信息的向量 sbuff_
 		sbuff_ = new vector<Node>();
 		// 动态分配存储节点信息的向量 cbuff_
 		cbuff_ = new vector<Node>();
 	}
 
-	// 函数 find_node 用于处理查找节点操作，接收 gRPC 请求并返回 gRPC 响应
-	Status find_node(ServerContext *context, const IDKey *request, NodeList *response)
+	virtual ~KadCore() {}
+
+	// 函数 serveFindNode 用于处理查找节点操作，由同步和异步服务端共用
+	Status serveFindNode(const IDKey *request, NodeList *response)
 	{
-		printf("find_node 1 %lu\n", local_nodeId);
+		MetricTimer timer(metrics, Metrics::FIND_NODE);
+		// 每个请求都会经过这里，只按采样输出，默认的编译级别下不生成代码
+		DLOG_SAMPLED(DEBUG, 10, "find_node %s from %s", local_nodeId.str().c_str(), nodeIdOf(request->node()).str().c_str());
 
-		// 解析请求中的目标 ID，并将其转换为 64 位整数
-		uint64_t target_id = str2u64(request->idkey);
+		// 解析请求中的目标 ID（定长的大端字节串）
+		NodeID target_id = NodeID::fromBytes(request->idkey());
 
 		// 调用 findCloseById 函数查找最接近目标 ID 的节点
-		deque<Node> nodes = findCloseById(target_id);
+		vector<RoutingTable::Contact> nodes = findCloseById(target_id);
 
 		// 将本地节点的信息添加到响应中
 		response->mutable_resp_node()->CopyFrom(local_node);
 
-		printf("find_node 2 %lu\n", local_nodeId);
-
 		// 将查找到的节点信息添加到响应中
-		for (Node node_ : nodes)
+		for (const RoutingTable::Contact &c : nodes)
 		{
-			Node *node = response->add_nodes();
-			node->set_address(node_.address());
-			node->set_id(node_.id());
+			c.fill(response->add_nodes());
 		}
 
-		// 打印调试信息，显示当前节点的唯一标识
-		printf("find_node 3 %lu\n", local_nodeId);
-
 		// 调用 freshNode 函数，用于更新节点信息
 		freshNode(request->node());
 
@@ -202,51 +216,38 @@ public:
 		return Status::OK;
 	}
 
-	// 函数 find_value 用于处理查找键值对操作，接收 gRPC 请求并返回 gRPC 响应
-	Status find_value(ServerContext *context, const IDKey *request, KV_Node_Wrapper *response)
+	// 函数 serveFindValue 用于处理查找键值对操作，由同步和异步服务端共用
+	Status serveFindValue(const IDKey *request, KV_Node_Wrapper *response)
 	{
-		// 从请求中提取键（key）并将其转换为 64 位整数
-		uint64_t key = str2u64(request->idkey());
-
-		// 在数据库中查找键对应的值
-		auto iter = _db->find(key);
+		MetricTimer timer(metrics, Metrics::FIND_VALUE);
+		// 请求中的 idkey 是原始键，它在 ID 空间中的位置由放置策略计算
+		const std::string &key = request->idkey();
 
 		// 将本地节点的信息添加到响应中
 		response->mutable_resp_node()->CopyFrom(local_node);
 
-		// 如果在数据库中找到了对应键的值
-		if (iter != _db->end())
+		// 值从存储中直接拷贝到应答的 kv.value 字段，不经过临时的 KeyValue
+		KeyValue *kv = response->mutable_kv();
+		// 本地存储中没有时再查热点缓存，命中会按请求频率延长缓存项的有效期
+		if (_db->get(key, kv->mutable_value()) || hot->get(key, kv->mutable_value()))
 		{
-			// 获取键值对的值
-			uint64_t value = iter->second;
-
 			// 将响应模式设置为键值对模式
 			response->set_mode_kv(true);
-			// 创建 KeyValue 消息，包含键和值的信息
-			KeyValue kv;
-			kv.mutable_node()->CopyFrom(local_node);
-
-			// 将键和值分别设置为二进制数据
-			kv.set_key((char *)(&key), sizeof(uint64_t));
-			kv.set_value((char *)(&value), sizeof(uint64_t));
-
-			// 将 KeyValue 消息添加到响应中
-			response->mutable_kv()->CopyFrom(kv);
+			kv->set_key(key);
 		}
 		else
 		{
 			// 如果在数据库中未找到对应键的值，将响应模式设置为非键值对模式
+			response->clear_kv();
 			response->set_mode_kv(false);
 
 			// 查找最接近键的节点
-			deque<Node> nodes = findCloseById(key);
+			vector<RoutingTable::Contact> nodes = findCloseById(placement->place(key));
 
 			// 将这些节点的信息添加到响应中
-			for (Node node_ : nodes)
+			for (const RoutingTable::Contact &c : nodes)
 			{
-				Node *node = response->add_nodes();
-				node->set_address(node_.address());
-				node->set_id(node_.id());
+				c.fill(response->add_nodes());
 			}
 		}
 
@@ -257,21 +258,33 @@ public:
 		return Status::OK;
 	}
 
-	// 函数 store 用于处理存储键值对操作，接收 gRPC 请求并返回 gRPC 响应
-	Status store(ServerContext *context, const KeyValue *request, IDKey *response)
+	// 函数 serveStore 用于处理存储键值对操作，由同步和异步服务端共用
+	Status serveStore(const KeyValue *request, IDKey *response)
 	{
-		// 从请求中提取键和值，并将它们转换为 64 位整数
-		uint64_t key = str2u64(request->key());
-		uint64_t value = str2u64(request->value());
-
-		// 将键值对存储到数据库中
-		(*_db)[key] = value;
+		MetricTimer timer(metrics, Metrics::STORE);
+		bool stored = true;
+		if (request->cache_ttl_ms() != 0)
+		{
+			// 路径缓存写入只进热点缓存，过期或被淘汰后即消失，不影响副本和持久化
+			hot->put(request->key(), request->value(), request->cache_ttl_ms());
+		}
+		else
+		{
+			// 将键值对存储到数据库中，键和值直接从请求拷贝到存储的内存池
+			stored = _db->put(request->key(), request->value());
+		}
 
 		// 调用 freshNode 函数，用于更新节点信息
 		freshNode(request->node());
 
+		// 存储拒绝了这条记录（过大、内存不足或日志写入失败），让调用方把这个副本计为失败
+		if (!stored)
+		{
+			return Status(grpc::StatusCode::RESOURCE_EXHAUSTED, "store: record rejected by the local store");
+		}
+
 		// 将本地节点的唯一标识添加到响应中
-		response->set_idkey((char *)(&local_nodeId), sizeof(uint64_t));
+		response->set_idkey(local_nodeId.toBytes());
 
 		// 将本地节点的信息添加到响应中
 		response->mutable_node()->CopyFrom(local_node);
@@ -280,17 +293,20 @@ public:
 		return Status::OK;
 	}
 
-	// 函数 exit 用于处理退出节点操作，接收 gRPC 请求并返回 gRPC 响应
-	Status exit(ServerContext *context, const IDKey *request, IDKey *response)
+	// 函数 serveExit 用于处理退出节点操作，由同步和异步服务端共用
+	Status serveExit(const IDKey *request, IDKey *response)
 	{
-		// 从请求中提取目标 ID，并将其转换为 64 位整数
-		uint64_t target_id = str2u64(request->idkey());
+		MetricTimer timer(metrics, Metrics::EXIT);
+		// 从请求中提取目标 ID
+		NodeID target_id = NodeID::fromBytes(request->idkey());
 
 		// 调用 removeById 函数，用于从系统中删除指定 ID 的节点
 		removeById(target_id);
+		// 通知子类对端已离开
+		onPeerExit(request->node());
 
 		// 将本地节点的唯一标识添加到响应中
-		response->set_idkey((char *)(&local_nodeId), sizeof(uint64_t));
+		response->set_idkey(local_nodeId.toBytes());
 
 		// 将本地节点的信息添加到响应中
 		response->mutable_node()->CopyFrom(local_node);
@@ -299,404 +315,2086 @@ public:
 		return Status::OK;
 	}
 
-	void join(std::string address)
+	// 函数 serveStoreBatch 用于处理批量存储，一次请求写入多个键值对
+	Status serveStoreBatch(const KeyValueBatch *request, BatchAck *response)
 	{
-		// 创建 gRPC 通道，连接到指定的地址
-		auto channel = grpc::CreateChannel(address, grpc::InsecureChannelCredentials());
-		// 创建 KadImpl 服务的存根（Stub）对象
-		std::unique_ptr<KadImpl::Stub> stub = KadImpl::NewStub(channel);
-		// 创建客户端上下文
-		ClientContext context;
-		// 创建 IDKey 请求消息，用于发起节点加入操作
-		IDKey request;
-		// 设置 IDKey 消息中的 idkey 字段为本地节点的唯一标识
-		request.set_idkey((char *)(&local_nodeId), sizeof(uint64_t));
-		// 将本地节点信息添加到请求消息中
-		request.mutable_node()->CopyFrom(local_node);
-		// 创建 NodeList 响应消息，用于接收远程节点的响应
-		NodeList response;
-		// 调用 find_node RPC 方法，发起节点查找操作，并获取状态
-		Status status = stub->find_node(&context, request, &response);
-		// 从响应中获取响应节点信息
-		Node resp_node = response.resp_node();
-		// 从响应中获取远程节点列表
-		Nodes remote_nodes = response.nodes();
-#ifdef DHASH_DEBUG
-		// 打印节点表的调试信息
-		printNodeTable();
-#endif
-		// 调用 freshNode 函数，用于更新本地节点信息
-		freshNode(resp_node);
-		// 遍历远程节点列表，调用 freshNode 函数更新远程节点信息
-		for (const auto &node : remote_nodes)
+		MetricTimer timer(metrics, Metrics::STORE_BATCH);
+		uint64_t stored = 0;
+		for (const KeyValue &kv : request->kvs())
 		{
-			freshNode(node);
+			stored += _db->put(kv.key(), kv.value());
 		}
-#ifdef DHASH_DEBUG
-		// 打印节点表的调试信息
-		printNodeTable();
-#endif
+		// 整个批次只刷新一次发送方
+		freshNode(request->node());
+		response->mutable_node()->CopyFrom(local_node);
+		response->set_count(stored);
+		// 有记录被拒绝时整批失败，调用方会逐个重写，已经写入的键重写一次没有副作用
+		if (stored < (uint64_t)request->kvs_size())
+		{
+			return Status(grpc::StatusCode::RESOURCE_EXHAUSTED, "store_batch: record rejected by the local store");
+		}
+		return Status::OK;
 	}
 
-	/*
-	 * bool get(uint64_t key, uint64_t &value)
-	 * 这个函数的主要目的是在接收到查找值的请求后，根据目标键查找键值对的值。
-	 * 如果在本地数据库找到，则直接返回；否则，从最接近的节点开始查找，直到找到目标键值对或遍历所有可选节点。
-	 */
-	bool get(uint64_t key, uint64_t &value)
+	// 函数 serveFindValueBatch 用于处理批量查找，响应中只包含本地找到的键值对
+	Status serveFindValueBatch(const IDKeyBatch *request, KeyValueBatch *response)
 	{
-		// 初始化变量，表示是否找到目标键值对
-		bool found = false;
-		// 在本地数据库中查找键值对
-		auto iter = _db->find(key);
-		if (iter != _db->end())
-		{
-			value = iter->second;
-			return true;
-		}
-		// 创建一个集合，用于记录已经访问过的节点的唯一标识
-		set<uint64_t> nodes_;
-		// 开始循环查找键值对
-		while (true)
+		MetricTimer timer(metrics, Metrics::FIND_VALUE_BATCH);
+		response->mutable_node()->CopyFrom(local_node);
+		for (const std::string &idkey : request->idkeys())
 		{
-			// 下一个节点信息
-			Node next_node;
-			// 查找离目标键最近的节点列表
-			deque<Node> nodes = closeNodes();
-			// 从节点列表中选择下一个节点，如果没有可选节点则退出循环
-			if (pickNode(next_node, nodes, nodes_) == false)
+			KeyValue *kv = response->add_kvs();
+			if (_db->get(idkey, kv->mutable_value()) || hot->get(idkey, kv->mutable_value()))
 			{
-				break;
-			}
-			// 创建 gRPC 通道，连接到下一个节点的地址
-			auto channel = grpc::CreateChannel(next_node.address(), grpc::InsecureChannelCredentials());
-			std::unique_ptr<KadImpl::Stub> stub = KadImpl::NewStub(channel);
-			ClientContext context;
-			// 创建 IDKey 请求消息，用于发起查找值操作
-			IDKey request;
-			request.set_idkey((char *)(&key), sizeof(uint64_t));
-			request.mutable_node()->CopyFrom(local_node);
-			// 创建 KV_Node_Wrapper 响应消息，用于接收远程节点的响应
-			KV_Node_Wrapper response;
-			// 调用 find_value RPC 方法，发起查找值操作，并获取状态
-			Status status = stub->find_value(&context, request, &response);
-			// 检查是否找到目标键值对
-			found = response.mode_kv();
-			if (found)
-			{
-				// 从响应中获取响应节点信息和键值对的值，并更新本地节点信息
-				Node resp_node = response.resp_node();
-				std::string val = response.kv().value();
-				memcpy(&value, val.c_str(), sizeof(uint64_t));
-				freshNode(resp_node);
-				break;
+				kv->set_key(idkey);
 			}
 			else
 			{
-				// 如果未找到目标键值对，则更新已访问节点的信息
-				for (const auto &node : response.nodes())
-				{
-					freshNode(node);
-				}
+				response->mutable_kvs()->RemoveLast();
 			}
-			nodes_.insert(next_node.id());
 		}
-		// 返回是否找到目标键值对
-		return found;
+		freshNode(request->node());
+		return Status::OK;
 	}
 
-	/*
-	 * void put(uint64_t key, uint64_t value)
-	 * 这个函数的主要目的是在接收到存储键值对的请求后，找到离键最近的节点，然后将键值对存储在该节点或本地数据库中。
-	 */
-	void put(uint64_t key, uint64_t value)
+	// 函数 serveStats 用于导出本节点的指标，prometheus 为 true 时同时给出文本格式
+	Status serveStats(const StatsRequest *request, StatsReply *response)
 	{
-		// 初始化目标节点为本地节点
-		Node target_node = local_node;
-		// 计算目标节点与键之间的距离
-		uint64_t target_dis = id_distance(local_nodeId, key);
-#ifdef DHASH_DEBUG
-		// 打印节点表的调试信息
-		printNodeTable();
-#endif
-		// 遍历所有存储桶，以查找距离键最近的节点
-		for (uint64_t i = 0; i < num_buckets; i++)
-		{
-			// 锁定当前存储桶，防止并发访问
-			lock->lock(i);
-			// 遍历当前存储桶中的所有节点
-			for (auto node : *(nodetable[i]))
-			{
-				// 计算当前节点与键之间的距离
-				uint64_t dis = id_distance(node.id(), key);
-				// 如果当前节点更接近键，更新目标节点和距离
-				if (dis < target_dis)
-				{
-					target_dis = dis;
-					target_node = node;
-				}
-			}
-			// 解锁当前存储桶
-			lock->unlock(i);
+		MetricTimer timer(metrics, Metrics::STATS);
+		response->mutable_node()->CopyFrom(local_node);
+		collectStats(response);
+		if (request->prometheus())
+		{
+			response->set_prometheus(Metrics::formatPrometheus(*response));
 		}
-		// 如果目标节点是本地节点，则将键值对存储在本地数据库
-		if (local_nodeId == target_node.id())
+		return Status::OK;
+	}
+
+	// 函数 servePing 用于存活探测，应答中只带本节点的信息
+	Status servePing(const IDKey *request, IDKey *response)
+	{
+		MetricTimer timer(metrics, Metrics::PING);
+		response->set_idkey(local_nodeId.toBytes());
+		response->mutable_node()->CopyFrom(local_node);
+		freshNode(request->node());
+		return Status::OK;
+	}
+
+	// 进程内传输直接调用的入口：按方法把消息对象转成具体类型，交给与 gRPC 服务端相同的处理函数
+	Status serveLocal(KadMethod method, const google::protobuf::Message *request, google::protobuf::Message *response) override
+	{
+		switch (method)
 		{
-			_db->insert_or_assign(key, value); // 如果有该key，则替换velue；如果没有该key值，直接插入
+		case KadMethod::FIND_NODE:
+			return serveFindNode(static_cast<const IDKey *>(request), static_cast<NodeList *>(response));
+		case KadMethod::FIND_VALUE:
+			return serveFindValue(static_cast<const IDKey *>(request), static_cast<KV_Node_Wrapper *>(response));
+		case KadMethod::STORE:
+			return serveStore(static_cast<const KeyValue *>(request), static_cast<IDKey *>(response));
+		case KadMethod::EXIT:
+			return serveExit(static_cast<const IDKey *>(request), static_cast<IDKey *>(response));
+		case KadMethod::STORE_BATCH:
+			return serveStoreBatch(static_cast<const KeyValueBatch *>(request), static_cast<BatchAck *>(response));
+		case KadMethod::FIND_VALUE_BATCH:
+			return serveFindValueBatch(static_cast<const IDKeyBatch *>(request), static_cast<KeyValueBatch *>(response));
+		case KadMethod::STATS:
+			return serveStats(static_cast<const StatsRequest *>(request), static_cast<StatsReply *>(response));
+		case KadMethod::PING:
+			return servePing(static_cast<const IDKey *>(request), static_cast<IDKey *>(response));
 		}
-		else // 如果目标节点是远端节点，则对远端节点发送请求
+		return Status(grpc::StatusCode::UNIMPLEMENTED, "unknown method");
+	}
+
+	/*
+	 * 一次 transfer_range 的遍历状态。存储分段遍历（见 ValueStore::partitions），每一步只遍历一段、选出其中的键，
+	 * 这些键分块发送完后再遍历下一段，大存储的遍历不会长时间占用处理请求的线程
+	 */
+	struct RangeCursor
+	{
+		NodeID requester;
+		uint64_t replicas = 1;
+		vector<NodeID> others;	  // 路由表中除请求方以外的节点，加上本节点
+		uint64_t part = 0;		  // 下一个要遍历的段
+		vector<std::string> keys; // 当前段中选出的键，值在分块发送时再读取
+		size_t pos = 0;			  // keys 中下一个要发送的键
+	};
+
+	void openRange(const RangeRequest *request, RangeCursor *cursor)
+	{
+		cursor->requester = nodeIdOf(request->node());
+		cursor->replicas = std::max<uint64_t>(request->replicas(), 1);
+		for (const RoutingTable::Contact &c : table->snapshot())
 		{
-			// 创建 gRPC 通道，连接到目标节点的地址
-			auto channel = grpc::CreateChannel(target_node.address(), grpc::InsecureChannelCredentials());
-			std::unique_ptr<KadImpl::Stub> stub = KadImpl::NewStub(channel);
-			ClientContext context;
-			// 创建 KeyValue 请求消息，包含键值对信息
-			KeyValue request;
-			request.mutable_node()->CopyFrom(local_node);
-			request.set_key((char *)(&key), sizeof(uint64_t));
-			request.set_value((char *)(&value), sizeof(uint64_t));
-			// 创建 IDKey 响应消息，用于接收远程节点的响应
-			IDKey response;
-			// 调用 store RPC 方法，发起存储键值对操作，并获取状态
-			Status status = stub->store(&context, request, &response);
-			// 更新本地节点信息
-			freshNode(response.node());
+			if (c.id != cursor->requester)
+			{
+				cursor->others.push_back(c.id);
+			}
 		}
-#ifdef DHASH_DEBUG
-		// 打印节点表的调试信息
-		printNodeTable();
-#endif
+		cursor->others.push_back(local_nodeId);
+		freshNode(request->node());
 	}
 
 	/*
-	 * void exit()
-	 * 这个函数的主要目的是在本地节点准备退出时，通知其他节点，告知它们本地节点即将离开。
-	 * 函数通过迭代遍历所有存储桶中的节点，创建 gRPC 通道，并调用 exit RPC 方法，以通知每个节点本地节点的退出。
+	 * 遍历下一段，选出请求方应当保存的键：按本地路由表（加上本节点），比请求方离键更近的节点少于 replicas 个。
+	 * 遍历存储时不做任何阻塞操作。所有段都已遍历过时返回 false
 	 */
-	void exit()
+	bool scanRange(RangeCursor *cursor)
 	{
-		// 创建 IDKey 请求消息，用于通知其他节点本地节点即将退出
-		IDKey request, response;
-		request.set_idkey((char *)(&local_nodeId), sizeof(uint64_t));
-		request.mutable_node()->CopyFrom(local_node);
-		// 遍历所有存储桶，以通知每个存储桶中的节点本地节点即将退出
-		for (uint64_t i = 0; i < num_buckets; i++)
+		if (cursor->part >= _db->partitions())
+		{
+			return false;
+		}
+		MetricTimer timer(metrics, Metrics::TRANSFER_RANGE);
+		cursor->keys.clear();
+		cursor->pos = 0;
+		_db->forEachIn(cursor->part++, [this, cursor](std::string_view key, std::string_view value)
+					   {
+						   NodeID id = placement->place(key);
+						   NodeID d = id_distance(id, cursor->requester);
+						   uint64_t closer = 0;
+						   for (const NodeID &n : cursor->others)
+						   {
+							   if (id_distance(n, id) < d && ++closer >= cursor->replicas)
+							   {
+								   return;
+							   }
+						   }
+						   cursor->keys.emplace_back(key); });
+		return true;
+	}
+
+	// 从当前段中下一个未发送的键开始填充一个约 transfer_chunk_bytes 字节的批次，返回批次中的键数，为 0 时表示这一段已发送完；期间被删除的键跳过
+	int fillRange(RangeCursor *cursor, KeyValueBatch *batch)
+	{
+		batch->Clear();
+		batch->mutable_node()->CopyFrom(local_node);
+		uint64_t bytes = 0;
+		while (cursor->pos < cursor->keys.size() && bytes < transfer_chunk_bytes)
 		{
-			// 锁定当前存储桶，防止并发访问
-			lock->lock(i);
-			// 遍历当前存储桶中的所有节点
-			for (auto node : *(nodetable[i]))
+			const std::string &key = cursor->keys[cursor->pos++];
+			KeyValue *kv = batch->add_kvs();
+			if (_db->get(key, kv->mutable_value()))
 			{
-				// 创建 gRPC 通道，连接到当前节点的地址
-				auto channel = grpc::CreateChannel(node.address(), grpc::InsecureChannelCredentials());
-				std::unique_ptr<KadImpl::Stub> stub = KadImpl::NewStub(channel);
-				ClientContext context;
-				// 调用 exit RPC 方法，通知当前节点本地节点即将退出
-				stub->exit(&context, request, &response);
+				kv->set_key(key);
+				bytes += key.size() + kv->value().size();
+			}
+			else
+			{
+				batch->mutable_kvs()->RemoveLast();
 			}
-			// 解锁当前存储桶
-			lock->unlock(i);
 		}
+		return batch->kvs_size();
 	}
 
-	bool find_node(uint64_t nodeId)
+	// 一次迁移的限速：本节点的限速和对方要求的限速中较小的非 0 值
+	uint64_t transferRate(uint64_t requested)
 	{
-		return false;
+		if (transfer_bytes_per_sec == 0 || requested == 0)
+		{
+			return std::max(transfer_bytes_per_sec, requested);
+		}
+		return std::min(transfer_bytes_per_sec, requested);
 	}
 
-	uint64_t nodeId()
+	const NodeID &nodeId()
 	{
 		return local_nodeId;
 	}
 
-private:
+	// 路由表中所有节点的快照（不含替换缓存），不发出 RPC，用于检查路由表的收敛情况
+	vector<RoutingTable::Contact> contacts()
+	{
+		return table->snapshot();
+	}
+
 	/*
-	 * void freshNode(const Node node)
-	 * 此方法用于维护节点表中的节点信息，通过计算节点之间的异或距离并将其插入到适当的位置，
-	 * 以确保节点表包含距离本地节点最近的节点。
+	 * 把每个桶的容量改为 n，与查找返回的最近节点数 k 分开设置；清空路由表，应在加入网络之前调用
 	 */
-	void freshNode(const Node node)
+	void setBucketSize(uint64_t n)
 	{
-		// 获取目标节点的ID
-		uint64_t target_id = node.id();
-		// 如果目标节点ID与本地节点ID相同，直接返回，无需更新
-		if (target_id == local_nodeId)
-		{
-			return;
-		}
-		// 计算目标节点与本地节点的异或距离
-		uint64_t dis = id_distance(target_id, local_nodeId);
-		// 计算异或距离对应的位数
-		uint64_t k_dis = k_id_distance(dis);
-		uint64_t i;
-		// 获取互斥锁，锁定对应的位数
-		lock->lock(k_dis);
-		// 获取当前节点表中的节点数量
-		uint64_t size = nodetable[k_dis]->size();
-		// 查找目标节点是否已存在于节点表中
-		for (i = 0; i < size; i++)
+		delete table;
+		table = new RoutingTable(local_nodeId, n);
+	}
+
+	uint64_t storeSize()
+	{
+		return _db->size();
+	}
+
+	// 本节点处理过的请求数（所有服务端方法，不含 stats）
+	uint64_t requestsServed()
+	{
+		uint64_t n = 0;
+		for (int op = 0; Metrics::isServerOp(op); op++)
 		{
-			if ((*nodetable[k_dis])[i].id() == target_id)
+			if (op != Metrics::STATS)
 			{
-				break;
+				n += metrics->latency((Metrics::Op)op).count;
 			}
 		}
-		// 如果目标节点已存在，将其从节点表中删除
-		if (i < size)
-		{
-			nodetable[k_dis]->erase(nodetable[k_dis]->begin() + i);
-		}
-		// 将目标节点插入到节点表的开头
-		nodetable[k_dis]->push_front(node);
-		// 获取更新后的节点表大小
-		size = nodetable[k_dis]->size();
-		// 如果节点表超过了设定的最大节点数（k_closest），将多余的节点从末尾删除
-		for (i = size - 1; i >= k_closest; i--)
-		{
-			nodetable[k_dis]->pop_back();
-		}
-		// 解锁互斥锁
-		lock->unlock(k_dis);
+		return n;
+	}
+
+	/*
+	 * 设置键迁移的限速（字节/秒，0 表示不限速）和每条消息的大小
+	 */
+	void setTransfer(uint64_t bytes_per_sec, uint64_t chunk_bytes = 1 << 20)
+	{
+		transfer_bytes_per_sec = bytes_per_sec;
+		transfer_chunk_bytes = std::max<uint64_t>(chunk_bytes, 1);
+	}
+
+	/*
+	 * 替换键的放置策略，本节点接管 p。网络中所有节点必须使用同一种策略，应在节点开始服务之前调用
+	 */
+	void setPlacement(Placement *p)
+	{
+		delete placement;
+		placement = p;
+	}
+
+	const Placement *keyPlacement()
+	{
+		return placement;
+	}
+
+	/*
+	 * 替换热点缓存的配置（capacity_bytes 为 0 时不接受缓存写入），应在节点开始服务之前调用
+	 */
+	void setHotCache(HotCache::Options opts)
+	{
+		delete hot;
+		hot = new HotCache(opts);
+	}
+
+	HotCache::Stats hotCacheStats()
+	{
+		return hot->stats();
+	}
+
+	// 热点报告：本节点缓存中命中次数最多的 n 个键
+	std::vector<HotCache::HotKey> hotKeys(size_t n)
+	{
+		return hot->hotKeys(n);
+	}
+
+	// Prometheus 文本格式的全部指标
+	std::string prometheusText()
+	{
+		StatsReply reply;
+		collectStats(&reply);
+		return Metrics::formatPrometheus(reply);
 	}
 
+protected:
+	// 对端通过 exit 通知离开后调用，子类可以在这里释放与该对端相关的资源
+	virtual void onPeerExit(const Node &node) {}
+
+	// 新节点所在的桶已满时调用，stale 是桶中最久未联系的节点；子类探测它，不在线时 removeById 让新节点补入
+	virtual void onBucketFull(const RoutingTable::Contact &stale) {}
+
 	/*
-	 * deque<Node> closeNodes()
-	 * 此方法用于从本地节点的存储桶中选择最接近的节点，以便进行后续操作，
-	 * 在已达到或超过 k_closest 数量的节点之后，方法将返回节点列表。
+	 * 收集指标：操作延迟和分布，以及路由表、存储和热点缓存的即时值。
+	 * 路由表只读取各桶的计数，不加桶锁。子类可以追加自己的指标
 	 */
-	deque<Node> closeNodes()
+	virtual void collectStats(StatsReply *reply)
 	{
-		// 创建一个节点列表来存储最近的节点
-		deque<Node> nodes;
-		// 用于记录已添加的节点数
-		uint64_t num_nodes = 0;
-		// 遍历每个存储桶
-		for (uint64_t i = 0; i < num_buckets; i++)
+		std::string labels = "node=\"" + local_nodeId.str() + "\"";
+		metrics->exportTo(reply, labels);
+
+		Metrics::addSample(reply, "dhash_routing_table_nodes", labels, table->size(), "gauge");
+		bool first = true;
+		for (int i = 0; i < RoutingTable::num_buckets; i++)
 		{
-			// 锁定当前存储桶，以确保线程安全
-			lock->lock(i);
-			// 遍历当前存储桶中的每个节点
-			for (auto node : *(nodetable[i]))
+			uint64_t n = table->bucketSize(i);
+			if (n > 0)
 			{
-				// 将节点添加到节点列表中
-				nodes.push_back(node);
-				// 增加已添加节点的计数
-				num_nodes = num_nodes + 1;
-				// 如果已添加足够数量的节点，则退出并解锁当前存储桶
-				if (num_nodes >= k_closest)
-				{
-					lock->unlock(i);
-					return nodes;
-				}
+				Metrics::addSample(reply, "dhash_bucket_nodes", labels + ",bucket=\"" + std::to_string(i) + "\"", n,
+								   first ? "gauge" : "");
+				first = false;
 			}
-			// 解锁当前存储桶，允许其他线程访问
-			lock->unlock(i);
 		}
-		// 返回收集到的节点列表
-		return nodes;
+
+		uint64_t reserved, used;
+		_db->memoryStats(reserved, used);
+		Metrics::addSample(reply, "dhash_store_keys", labels, _db->size(), "gauge");
+		Metrics::addSample(reply, "dhash_store_reserved_bytes", labels, reserved, "gauge");
+		Metrics::addSample(reply, "dhash_store_used_bytes", labels, used, "gauge");
+
+		HotCache::Stats hs = hot->stats();
+		Metrics::addSample(reply, "dhash_hot_cache_entries", labels, hs.entries, "gauge");
+		Metrics::addSample(reply, "dhash_hot_cache_bytes", labels, hs.bytes, "gauge");
+		Metrics::addSample(reply, "dhash_hot_cache_hits_total", labels, hs.hits, "counter");
+		Metrics::addSample(reply, "dhash_hot_cache_misses_total", labels, hs.misses, "counter");
+		Metrics::addSample(reply, "dhash_hot_cache_evictions_total", labels, hs.evictions, "counter");
 	}
 
 	/*
-	 * 从一个待处理的节点队列中选择一个尚未被访问的节点
+	 * void freshNode(const Node &node)
+	 * 此方法用于维护节点表中的节点信息：把节点移到它所在 k 桶的最前面。
+	 * 桶已满时不挤掉在线的老节点，新节点先进入替换缓存，再由 onBucketFull 探测最久未联系的节点。
 	 */
-	bool pickNode(Node &node, deque<Node> waitq, set<uint64_t> visited)
+	void freshNode(const Node &node)
 	{
-		// 遍历待处理节点队列中的每个节点
-		for (Node node_ : waitq)
+		RoutingTable::Contact stale = {};
+		if (!table->update(node, &stale) && stale.address != nullptr)
 		{
-			// 检查该节点的ID是否在已访问节点的集合中
-			auto iter = visited.find(node_.id());
-			// 如果节点的ID没有在已访问节点中，选择该节点
-			if (iter == visited.end())
-			{
-				node = node_;
-				return true;
-			}
+			onBucketFull(stale);
 		}
-		// 如果没有可用的节点可选，则返回 false
-		return false;
 	}
 
 	/*
-	 * 查找距离给定目标ID最近的节点，并将这些最近的节点存储在一个deque中返回。
+	 * 查找距离给定目标ID最近的 k_closest 个节点，按距离升序返回。
+	 */
+	vector<RoutingTable::Contact> findCloseById(const NodeID &target_id)
+	{
+		return table->closest(target_id, k_closest);
+	}
+
+	/*
+	 * 该方法主要用于从节点表中删除具有给定目标ID的节点
 	 */
-	deque<Node> findCloseById(uint64_t target_id)
+	void removeById(const NodeID &target_id)
 	{
-		deque<Node> nodes;						 // 用于存储最近的节点
-		deque<std::pair<uint64_t, Node>> sorted; // 存储节点及其到目标ID的距离
-		// 遍历各个桶（桶的数量由 num_buckets 决定）
-		for (uint64_t i = 0; i < num_buckets; i++)
+		table->remove(target_id);
+	}
+
+	// 以 DEBUG 级别输出路由表中每个非空的桶
+	void printNodeTable()
+	{
+		DLOG(DEBUG, "%s node table =========================================", local_nodeId.str().c_str());
+		for (int i = 0; i < RoutingTable::num_buckets; i++)
 		{
-			lock->lock(i); // 锁定当前桶，以防止其他线程同时操作
-			// 遍历当前桶内的所有节点
-			for (auto node : *(nodetable[i]))
+			vector<RoutingTable::Contact> bucket = table->bucket(i);
+			if (bucket.empty())
 			{
-				// 计算当前节点到目标ID的距离
-				uint64_t dis = id_distance(node.id(), target_id);
-				// 将节点和其距离存入 sorted 列表
-				sorted.push_back(std::make_pair(dis, node));
+				continue;
 			}
-			lock->unlock(i); // 解锁当前桶
-			// 对 sorted 列表中的节点按照距离进行升序排序
-			std::sort(sorted.begin(), sorted.end(),
-					  [](std::pair<uint64_t, Node> const &a,
-						 std::pair<uint64_t, Node> const &b)
-					  {
-						  return a.first < b.first;
-					  });
-			// 将排序后的最近节点添加到返回节点队列中，最多添加 k_closest 个节点
-			for (uint64_t i = 0; i < sorted.size() && i < k_closest; i++)
+			std::string line = std::to_string(i) + " ";
+			for (const RoutingTable::Contact &c : bucket)
 			{
-				nodes.push_back(sorted[i].second);
+				line += c.id.str() + ":" + std::string(c.addr()) + ", ";
 			}
+			DLOG(DEBUG, "%s", line.c_str());
 		}
-		// 返回距离目标ID最近的节点队列
-		return nodes;
 	}
+};
+
+/*
+ * NodeKadImpl
+ * 同步 gRPC 服务以及节点作为客户端的操作（join / get / put / exit）。
+ */
+class NodeKadImpl : public KadCore, public KadImpl::Service
+{
+	using ServerContext = grpc::ServerContext;				// 使用别名 ServerContext 代表 grpc::ServerContext 类型
+	using ClientContext = grpc::ClientContext;				// 使用别名 ClientContext 代表 grpc::ClientContext 类型
+	ChannelPool *pool;										// 按对端地址复用的 gRPC 通道池
+	KadRpc *rpc;											// 异步 RPC 客户端，供并行查找使用
+	LocationCache *locations;								// 键 ID 到最近一次应答节点的缓存
+	uint64_t alpha = 3;										// 迭代查找时的并发请求数
+	uint64_t batch_size = 4096;								// 批量 RPC 中每条消息最多携带的键数
+	uint64_t batch_bytes = 1 << 20;							// 批量 RPC 中每条消息最多携带的键值字节数
+	uint64_t replicas = 1;									// 每个键的副本数 R
+	uint64_t write_quorum = 1;								// 写仲裁 W：收到多少个副本确认后 put 返回
+	uint64_t read_quorum = 1;								// 读仲裁：收到多少个副本应答后 get 返回
+	int64_t quorum_timeout_ms = 2000;						// 等待仲裁的超时时间
+	int64_t path_cache_ttl_ms = 0;							// 路径缓存的基准有效期，0 表示查找成功后不做路径缓存
+	std::atomic<uint64_t> path_cache_stores{0};				// 发出的路径缓存写入数
+	std::atomic<uint64_t> keys_pulled{0};					// 加入时从邻居拉取并写入本地的键数
+	std::atomic<uint64_t> keys_handed_off{0};				// 退出时成功移交给新的最近节点的键副本数
+	int64_t join_timeout_ms = 3000;							// 所有种子都没有应答时，join 重试的时间上限
+	std::unique_ptr<HedgePolicy> hedge;						// 非空时 find_value 查找做对冲
+	std::atomic<uint64_t> store_retries{0};					// 副本写入失败后改写到下一个最近节点的次数
+	std::atomic<uint64_t> hedged_requests{0};				// 查找中因超过对冲延迟而改问下一个候选的次数
+	std::atomic<uint64_t> exit_failures{0};					// 未送达的退出通知数
+	PeerProber *prober;										// 桶满和 RPC 失败时探测对端是否在线
+	std::atomic<uint64_t> peers_evicted{0};					// 探测失败后从路由表删除的节点数
+	vector<NodeID> siblings;								// 同一进程中共用存储的其他虚拟节点
+	Transport *transport = nullptr;							// 非空时本节点登记在这个进程内传输上
+	bool owns_store = true;									// 退出时是否负责移交共用存储中的键
 
+public:
 	/*
-	 * 该方法主要用于从节点表中删除具有给定目标ID的节点
+	 * 各类客户端 RPC 的超时（毫秒）。超时或失败的 RPC 都按失败处理：查找改问其他候选，
+	 * 副本写入改写到下一个最近节点，批量请求退回到逐个读写
 	 */
-	void removeById(uint64_t target_id)
+	struct Deadlines
+	{
+		int64_t find_ms = 2000;		 // 查找中的每个 find_node / find_value，以及读仲裁中的读取
+		int64_t store_ms = 2000;	 // 每个副本的 store
+		int64_t batch_ms = 10000;	 // multi_put / multi_get 中的一个批次
+		int64_t exit_ms = 500;		 // 每个退出通知
+		int64_t transfer_ms = 60000; // 加入时从一个邻居拉取键，退出时移交的一个批次
+		int64_t ping_ms = 500;		 // 存活探测的 ping
+		uint64_t store_retries = 2;	 // 一个副本写入失败后最多改写到下一个最近节点的次数
+	};
+
+private:
+	Deadlines deadlines;
+	std::atomic<uint64_t> quorum_timeouts{0};				// 超时仍未达到仲裁的次数
+	std::atomic<uint64_t> quorum_failures{0};				// 未超时、但失败的副本太多而达不到仲裁的次数
+	std::atomic<uint64_t> stale_reads{0};					// 读仲裁中缺少该值或值不一致的副本数
+	std::atomic<uint64_t> replica_lag_samples{0};			// 仲裁达成后才写入成功的副本数
+	std::atomic<uint64_t> replica_lag_us{0};				// 这些副本晚于仲裁达成的时间之和（微秒）
+	std::atomic<uint64_t> replica_lag_max_us{0};			// 这些副本晚于仲裁达成的最大时间（微秒）
+
+public:
+	// NodeKadImpl 构造函数，接受地址、节点ID和 k-最近邻的参数；
+	// channels 为空时节点自建一个通道池，否则与其他节点共享传入的通道池；store 见 KadCore
+	NodeKadImpl(std::string address, const NodeID &id, uint64_t k = 2, ChannelPool *channels = nullptr, ValueStore *store = nullptr)
+		: KadCore(address, id, k, store)
+	{
+		// 使用共享的通道池，或为本节点创建一个
+		pool = channels ? channels : new ChannelPool();
+		// 创建异步 RPC 客户端，轮询线程在第一次查找时才启动
+		rpc = new KadRpc(pool);
+		locations = new LocationCache(LocationCache::Options());
+		// 探测由 KadRpc 的定时器驱动，不单独占用线程
+		prober = new PeerProber(rpc, local_node, [this](const Node &node, bool alive)
+								{ onProbe(node, alive); }, PeerProber::Options());
+	}
+
+	// 同步服务端：每个请求占用一个 gRPC 同步线程，直接调用 KadCore 中的处理逻辑
+	Status find_node(ServerContext *context, const IDKey *request, NodeList *response) override
+	{
+		return serveFindNode(request, response);
+	}
+
+	Status find_value(ServerContext *context, const IDKey *request, KV_Node_Wrapper *response) override
+	{
+		return serveFindValue(request, response);
+	}
+
+	Status store(ServerContext *context, const KeyValue *request, IDKey *response) override
+	{
+		return serveStore(request, response);
+	}
+
+	Status exit(ServerContext *context, const IDKey *request, IDKey *response) override
+	{
+		return serveExit(request, response);
+	}
+
+	Status store_batch(ServerContext *context, const KeyValueBatch *request, BatchAck *response) override
+	{
+		return serveStoreBatch(request, response);
+	}
+
+	Status find_value_batch(ServerContext *context, const IDKeyBatch *request, KeyValueBatch *response) override
+	{
+		return serveFindValueBatch(request, response);
+	}
+
+	// 双向流：客户端持续发送批次，服务端对每个批次回复一条消息
+	Status store_stream(ServerContext *context, grpc::ServerReaderWriter<BatchAck, KeyValueBatch> *stream) override
+	{
+		return serveStream(stream, &KadCore::serveStoreBatch);
+	}
+
+	Status find_value_stream(ServerContext *context, grpc::ServerReaderWriter<KeyValueBatch, IDKeyBatch> *stream) override
+	{
+		return serveStream(stream, &KadCore::serveFindValueBatch);
+	}
+
+	Status stats(ServerContext *context, const StatsRequest *request, StatsReply *response) override
 	{
-		// 计算当前节点到目标ID的距离
-		uint64_t dis = id_distance(local_nodeId, target_id);
-		// 根据距离计算 k 桶的索引
-		uint64_t k_dis = k_id_distance(dis);
-		uint64_t i;
-		lock->lock(k_dis); // 锁定 k 桶
-		uint64_t size = nodetable[k_dis]->size();
-		// 遍历 k 桶内的节点
-		for (i = 0; i < size; i++)
+		return serveStats(request, response);
+	}
+
+	Status ping(ServerContext *context, const IDKey *request, IDKey *response) override
+	{
+		return servePing(request, response);
+	}
+
+	// 服务端流：按限速把请求方应当保存的键分块发出，发送期间占用这个同步线程
+	Status transfer_range(ServerContext *context, const RangeRequest *request, grpc::ServerWriter<KeyValueBatch> *writer) override
+	{
+		RangeCursor cursor;
+		openRange(request, &cursor);
+		Pacer pacer(transferRate(request->max_bytes_per_sec()));
+		KeyValueBatch batch;
+		while (true)
 		{
-			// 如果找到具有目标ID的节点，就退出循环
-			if ((*nodetable[k_dis])[i].id() == target_id)
+			// 当前段已发送完时遍历下一段，所有段都遍历过后结束
+			if (fillRange(&cursor, &batch) == 0)
 			{
-				break;
+				if (!scanRange(&cursor))
+				{
+					break;
+				}
+				continue;
+			}
+			std::this_thread::sleep_until(pacer.reserve(batch.ByteSizeLong()));
+			if (!writer->Write(batch))
+			{
+				return Status(grpc::StatusCode::CANCELLED, "transfer_range: client closed the stream");
 			}
 		}
-		// 如果找到了具有目标ID的节点
-		if (i < size)
-		{
-			// 从 k 桶中移除该节点
-			nodetable[k_dis]->erase(nodetable[k_dis]->begin() + i);
-		}
-		lock->unlock(k_dis); // 解锁 k 桶
+		return Status::OK;
 	}
 
-	void printNodeTable()
+	/*
+	 * bool join(const vector<std::string> &seeds)
+	 * 加入网络：先向所有种子节点发 find_node（都没有应答时每 100ms 重试，直到 join_timeout_ms），
+	 * 再以本节点 ID 为目标做一次迭代查找，找到离本节点最近的邻居；然后并行刷新比最近邻居更远的每个桶，
+	 * 使路由表在加入后就接近完整。最后从邻居拉取本节点应当保存的键。没有种子应答时返回 false
+	 */
+	bool join(const vector<std::string> &seeds)
 	{
-		printf("=========================================\n");
-		for (uint64_t i = 0; i < num_buckets; i++)
+		MetricTimer timer(metrics, Metrics::JOIN);
+		auto start = std::chrono::steady_clock::now();
+		JoinStats js = {};
+		while (true)
 		{
-			std::cout << i << " ";
-			for (auto node : *(nodetable[i]))
+			js.seeds_answered = askSeeds(seeds);
+			if (js.seeds_answered > 0 || sinceMs(start) >= join_timeout_ms)
 			{
-				std::cout << node.id() << ":" << node.address() << ", ";
+				break;
 			}
-			std::cout << std::endl;
+			// 种子可能还没有启动
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		}
+		js.seed_ms = sinceMs(start);
+		if (js.seeds_answered == 0)
+		{
+			metrics->recordFailure(Metrics::JOIN);
+			DLOG(WARN, "%s join failed: none of %lu seeds answered", local_nodeId.str().c_str(), seeds.size());
+			join_stats = js;
+			return false;
+		}
+#ifdef DHASH_DEBUG
+		// 打印节点表的调试信息
+		printNodeTable();
+#endif
+		// 自查找：沿途应答的节点都会加入路由表，结束时已知离本节点最近的 k 个节点
+		auto step = std::chrono::steady_clock::now();
+		lookup(local_nodeId, KadLookup::FIND_NODE);
+		js.self_lookup_ms = sinceMs(step);
+		step = std::chrono::steady_clock::now();
+		js.buckets_refreshed = refreshBuckets();
+		js.refresh_ms = sinceMs(step);
+		js.total_ms = sinceMs(start);
+		js.table_size = table->size();
+#ifdef DHASH_DEBUG
+		// 打印节点表的调试信息
+		printNodeTable();
+#endif
+		// 本节点加入后成为一部分键的最近节点，从邻居拉取这些键，之后的 get 不必再落到旧的节点上
+		step = std::chrono::steady_clock::now();
+		pullRange();
+		js.pull_ms = sinceMs(step);
+		join_stats = js;
+		return true;
+	}
+
+	bool join(const std::string &address)
+	{
+		return join(vector<std::string>{address});
+	}
+
+	/*
+	 * void async_join(const vector<std::string> &seeds, std::function<void(bool)> done)
+	 * 不阻塞的 join：询问种子、自查找和桶刷新都由回调串起来，结束时调用 done(是否有种子应答)。
+	 * 种子都没有应答时不重试，也不从邻居拉取键（键迁移经 gRPC 流），用于由事件驱动的场景，例如仿真网络。
+	 * joinStats 中的时间按 KadRpc 的时钟计算，设置了 Scheduler 时是它的时间
+	 */
+	void async_join(const vector<std::string> &seeds, std::function<void(bool)> done)
+	{
+		auto js = std::make_shared<JoinStats>();
+		int64_t start = rpc->nowUs();
+		size_t num_seeds = seeds.size();
+		startAskSeeds(seeds, [this, js, start, num_seeds, done](uint64_t answered)
+					  {
+						  js->seeds_answered = answered;
+						  js->seed_ms = (rpc->nowUs() - start) / 1000.0;
+						  if (answered == 0)
+						  {
+							  metrics->recordFailure(Metrics::JOIN);
+							  DLOG(WARN, "%s join failed: none of %lu seeds answered", local_nodeId.str().c_str(), num_seeds);
+							  join_stats = *js;
+							  done(false);
+							  return;
+						  }
+						  // 自查找结束后刷新更远的桶，与 join 的步骤相同
+						  int64_t step = rpc->nowUs();
+						  startLookup(local_nodeId, KadLookup::FIND_NODE, std::string(),
+									  [this, js, start, step, done](KadLookup::Result &)
+									  {
+										  js->self_lookup_ms = (rpc->nowUs() - step) / 1000.0;
+										  int64_t refresh = rpc->nowUs();
+										  startRefresh([this, js, start, refresh, done](uint64_t n)
+													   {
+														   js->buckets_refreshed = n;
+														   js->refresh_ms = (rpc->nowUs() - refresh) / 1000.0;
+														   js->total_ms = (rpc->nowUs() - start) / 1000.0;
+														   js->table_size = table->size();
+														   join_stats = *js;
+														   done(true);
+													   });
+									  });
+					  });
+	}
+
+	struct JoinStats
+	{
+		uint64_t seeds_answered;	// 应答的种子数
+		uint64_t buckets_refreshed; // 并行刷新的桶数
+		uint64_t table_size;		// 刷新完成时路由表中的节点数
+		double seed_ms;				// 询问种子（含重试）的时间
+		double self_lookup_ms;		// 自查找的时间
+		double refresh_ms;			// 桶刷新的时间
+		double total_ms;			// 从开始加入到路由表刷新完成的时间
+		double pull_ms;				// 从邻居拉取键的时间
+	};
+
+private:
+	JoinStats join_stats = {}; // 最近一次 join 的统计，由调用 join 的线程写入
+
+public:
+
+	// 最近一次 join 的各阶段耗时
+	JoinStats joinStats()
+	{
+		return join_stats;
+	}
+
+	/*
+	 * 刷新比最近邻居所在桶更远的每个桶：在每个桶覆盖的 ID 范围内随机取一个目标，
+	 * 同时发起所有查找并等待全部结束。查找中应答的节点都会刷新到路由表，返回刷新的桶数
+	 */
+	uint64_t refreshBuckets()
+	{
+		std::promise<uint64_t> done;
+		startRefresh([&done](uint64_t n)
+					 { done.set_value(n); });
+		return done.get_future().get();
+	}
+
+	// 不阻塞的 refreshBuckets，全部查找结束后调用 done(刷新的桶数)
+	void startRefresh(std::function<void(uint64_t)> done)
+	{
+		vector<RoutingTable::Contact> nearest = table->closest(local_nodeId, 1);
+		if (nearest.empty())
+		{
+			done(0);
+			return;
+		}
+		int first = RoutingTable::bucketOf(nearest[0].id ^ local_nodeId) + 1;
+		uint64_t n = RoutingTable::num_buckets - first;
+		if (n == 0)
+		{
+			done(0);
+			return;
+		}
+		auto remaining = std::make_shared<std::atomic<uint64_t>>(n);
+		// 种子取自 KadRpc 的时钟，仿真中同样的输入得到同样的目标
+		std::mt19937_64 rng(local_nodeId.hash() ^ rpc->nowUs());
+		for (int i = first; i < RoutingTable::num_buckets; i++)
+		{
+			// 第 i 个桶中的节点与本节点的距离在 [2^i, 2^(i+1)) 之内
+			NodeID target = local_nodeId ^ NodeID::bucketDistance(i, NodeID::fromSeed(rng()));
+			startLookup(target, KadLookup::FIND_NODE, std::string(), [remaining, n, done](KadLookup::Result &result)
+						{
+							if (remaining->fetch_sub(1) == 1)
+							{
+								done(n);
+							} });
+		}
+	}
+
+	/*
+	 * bool get(const std::string &key, std::string &value)
+	 * 这个函数的主要目的是在接收到查找值的请求后，根据目标键查找键值对的值。键可以是任意字节串。
+	 * 如果在本地数据库找到，则直接返回。read_quorum 为 1 时以键为目标发起并行迭代查找，
+	 * 最先应答的副本返回值即结束；否则先找到 replicas 个副本，再并行读取并在收到 read_quorum 个应答后结束。
+	 * 阻塞到 async_get 完成为止。
+	 */
+	bool get(const std::string &key, std::string &value, KadLookup::Result *stats = nullptr)
+	{
+		std::promise<bool> done;
+		startGet(key, [&done, &value, stats](bool found, std::string &v, KadLookup::Result *result)
+				 {
+					 if (found)
+					 {
+						 value = std::move(v);
+					 }
+					 if (stats != nullptr && result != nullptr)
+					 {
+						 *stats = std::move(*result);
+					 }
+					 done.set_value(found); });
+		return done.get_future().get();
+	}
+
+	/*
+	 * bool put(const std::string &key, const std::string &value)
+	 * 这个函数的主要目的是在接收到存储键值对的请求后，通过迭代查找找到网络中离键的位置最近的 replicas 个节点，
+	 * 并行写入这些副本（本地节点在其中时直接写本地数据库），收到 write_quorum 个确认后返回 true。
+	 * 超时仍未达到写仲裁时返回 false，未完成的副本写入继续在后台进行。阻塞到 async_put 完成为止。
+	 */
+	bool put(const std::string &key, const std::string &value, KadLookup::Result *stats = nullptr)
+	{
+		std::promise<bool> done;
+		startPut(key, value, [&done, stats](bool ok, KadLookup::Result *result)
+				 {
+					 if (stats != nullptr && result != nullptr)
+					 {
+						 *stats = std::move(*result);
+					 }
+					 done.set_value(ok); });
+		return done.get_future().get();
+	}
+
+	// async_get 的结果
+	struct GetResult
+	{
+		bool found = false;
+		std::string value;
+	};
+
+	using GetFn = std::function<void(bool found, std::string &value)>;
+	using PutFn = std::function<void(bool ok)>;
+
+	/*
+	 * void async_get(const std::string &key, GetFn done)
+	 * 不阻塞的 get：立即返回，完成后调用 done。本地存储命中时在调用线程中回调，否则在 RPC 轮询线程中回调，
+	 * done 中不应阻塞，可以继续发起新的 async_get / async_put。
+	 * 查找、副本读取和仲裁等待都由 RPC 客户端的少量轮询线程推进，一个线程就能同时挂起成千上万个请求
+	 */
+	void async_get(const std::string &key, GetFn done)
+	{
+		startGet(key, [done](bool found, std::string &value, KadLookup::Result *result)
+				 { done(found, value); });
+	}
+
+	// 返回 future 的 async_get
+	std::future<GetResult> async_get(const std::string &key)
+	{
+		auto done = std::make_shared<std::promise<GetResult>>();
+		std::future<GetResult> result = done->get_future();
+		async_get(key, [done](bool found, std::string &value)
+				  {
+					  GetResult r;
+					  r.found = found;
+					  r.value = std::move(value);
+					  done->set_value(std::move(r)); });
+		return result;
+	}
+
+	/*
+	 * void async_put(const std::string &key, const std::string &value, PutFn done)
+	 * 不阻塞的 put：达到写仲裁或超时后调用 done，回调所在的线程与 async_get 相同
+	 */
+	void async_put(const std::string &key, const std::string &value, PutFn done)
+	{
+		startPut(key, value, [done](bool ok, KadLookup::Result *result)
+				 { done(ok); });
+	}
+
+	// 返回 future 的 async_put
+	std::future<bool> async_put(const std::string &key, const std::string &value)
+	{
+		auto done = std::make_shared<std::promise<bool>>();
+		std::future<bool> result = done->get_future();
+		async_put(key, value, [done](bool ok)
+				  { done->set_value(ok); });
+		return result;
+	}
+
+	/*
+	 * void multi_put(const vector<std::pair<std::string, std::string>> &kvs)
+	 * 批量写入：按本地路由表把键分配给离它最近的节点，每个对端一组，所有组的所有批次都经 RPC 客户端用 store_batch 并行发出。
+	 * 发送失败的组退回到逐个 async_put，由迭代查找重新确定存放节点。阻塞到所有写入完成为止。
+	 */
+	void multi_put(const vector<std::pair<std::string, std::string>> &kvs)
+	{
+		MetricTimer timer(metrics, Metrics::MULTI_PUT);
+		map<NodeID, PeerGroup<KeyValueBatch, BatchAck>> groups;
+		// 先批量算出所有键的位置
+		vector<std::string_view> views;
+		for (const auto &kv : kvs)
+		{
+			views.push_back(kv.first);
+		}
+		vector<NodeID> ids(kvs.size());
+		placement->placeBatch(views.data(), views.size(), ids.data());
+		for (size_t i = 0; i < kvs.size(); i++)
+		{
+			const auto &kv = kvs[i];
+			// 每个键写入 replicas 个副本
+			for (const Node &owner : ownersOf(ids[i], replicas))
+			{
+				if (isLocal(nodeIdOf(owner)))
+				{
+					_db->put(kv.first, kv.second);
+					continue;
+				}
+				PeerGroup<KeyValueBatch, BatchAck> &group = groups[nodeIdOf(owner)];
+				group.peer = owner;
+				KeyValue *entry = appendBatch(group, kv.first.size() + kv.second.size())->add_kvs();
+				entry->set_key(kv.first);
+				entry->set_value(kv.second);
+			}
+		}
+		exchangeAll(groups, &KadImpl::Stub::PrepareAsyncstore_batch);
+		auto retry = std::make_shared<Latch>();
+		for (auto &item : groups)
+		{
+			if (item.second.ok)
+			{
+				continue;
+			}
+			for (const KeyValueBatch &batch : item.second.batches)
+			{
+				retry->add(batch.kvs_size());
+				for (const KeyValue &kv : batch.kvs())
+				{
+					async_put(kv.key(), kv.value(), [retry](bool ok)
+							  { retry->countDown(); });
+				}
+			}
+		}
+		retry->wait();
+	}
+
+	/*
+	 * uint64_t multi_get(const vector<std::string> &keys, map<std::string, std::string> &values)
+	 * 批量读取：分组方式与 multi_put 相同，批次用 find_value_batch 并行发出。在预期节点上没有找到的键再逐个 async_get，
+	 * 返回 keys 中找到的不同键数，结果写入 values。values 中原有的项不算作找到，同名的项会被覆盖。阻塞到所有读取完成为止。
+	 */
+	uint64_t multi_get(const vector<std::string> &keys, map<std::string, std::string> &values)
+	{
+		MetricTimer timer(metrics, Metrics::MULTI_GET);
+		map<NodeID, PeerGroup<IDKeyBatch, KeyValueBatch>> groups;
+		set<std::string> found; // 这次调用实际读到的键，与调用方 values 中原有的项无关
+		std::string value;
+		for (const std::string &key : keys)
+		{
+			if (_db->get(key, &value))
+			{
+				values[key] = std::move(value);
+				found.insert(key);
+				continue;
+			}
+			Node owner = ownersOf(placement->place(key), 1)[0];
+			if (isLocal(nodeIdOf(owner)))
+			{
+				continue;
+			}
+			PeerGroup<IDKeyBatch, KeyValueBatch> &group = groups[nodeIdOf(owner)];
+			group.peer = owner;
+			appendBatch(group, key.size())->add_idkeys(key);
+		}
+		exchangeAll(groups, &KadImpl::Stub::PrepareAsyncfind_value_batch);
+		for (auto &item : groups)
+		{
+			for (KeyValueBatch &resp : item.second.responses)
+			{
+				// 键和值直接从应答中移走
+				for (KeyValue &kv : *resp.mutable_kvs())
+				{
+					found.insert(kv.key());
+					values[std::move(*kv.mutable_key())] = std::move(*kv.mutable_value());
+				}
+			}
+		}
+		// 路由表可能已过期，未命中的键通过迭代查找再试一次，回调在轮询线程中执行，写 values 和 found 时持有 retry 的锁
+		vector<std::string> missing;
+		set<std::string> queued; // keys 中可能有重复的键，每个只重试一次
+		for (const std::string &key : keys)
+		{
+			if (found.count(key) == 0 && queued.insert(key).second)
+			{
+				missing.push_back(key);
+			}
+		}
+		auto retry = std::make_shared<Latch>();
+		retry->add(missing.size());
+		for (const std::string &key : missing)
+		{
+			async_get(key, [retry, &values, &found, key](bool ok, std::string &v)
+					  {
+						  if (ok)
+						  {
+							  std::lock_guard<std::mutex> guard(retry->mu);
+							  values[key] = std::move(v);
+							  found.insert(key);
+						  }
+						  retry->countDown(); });
+		}
+		retry->wait();
+		return found.size();
+	}
+
+	/*
+	 * void exit()
+	 * 这个函数的主要目的是在本地节点准备退出时，通知其他节点，告知它们本地节点即将离开。
+	 * 函数通过迭代遍历所有存储桶中的节点，创建 gRPC 通道，并调用 exit RPC 方法，以通知每个节点本地节点的退出。
+	 */
+	void exit()
+	{
+		// 先把本地的键移交给新的最近节点，移交期间本节点仍在路由表中，可以继续应答查找
+		if (owns_store)
+		{
+			handoff();
+		}
+		// 创建 IDKey 请求消息，用于通知其他节点本地节点即将退出
+		IDKey request;
+		request.set_idkey(local_nodeId.toBytes());
+		request.mutable_node()->CopyFrom(local_node);
+		// 并行通知路由表中的每个节点本地节点即将退出，发 RPC 时不持有路由表的锁
+		vector<RoutingTable::Contact> contacts = table->snapshot();
+		auto wg = std::make_shared<WaitGroup>(contacts.size());
+		for (const RoutingTable::Contact &c : contacts)
+		{
+			NodeID id = c.id;
+			rpc->call<IDKey, IDKey>(
+				std::string(c.addr()), &KadImpl::Stub::PrepareAsyncexit, request,
+				[this, wg, id](const Status &status, IDKey &response)
+				{
+					// 没有收到通知的节点要等到下次联系本节点失败时才会发现它已离开
+					if (!status.ok())
+					{
+						exit_failures.fetch_add(1, std::memory_order_relaxed);
+						DLOG(WARN, "%s exit notice to %s failed: %s", local_nodeId.str().c_str(), id.str().c_str(), status.error_message().c_str());
+					}
+					wg->done();
+				},
+				deadlines.exit_ms);
+		}
+		wg->wait();
+	}
+
+	/*
+	 * 在网络中查找 ID 为 nodeId 的节点，找到时返回 true
+	 */
+	bool find_node(const NodeID &nodeId)
+	{
+		KadLookup::Result result = lookup(nodeId, KadLookup::FIND_NODE);
+		return !result.closest.empty() && nodeIdOf(result.closest[0]) == nodeId;
+	}
+
+	/*
+	 * KadLookup::Result lookup(const NodeID &target, KadLookup::Mode mode, const std::string &key)
+	 * 以 target 为目标做一次 alpha 并发的迭代查找，阻塞直到查找结束。FIND_VALUE 时 key 为要查找的原始键。
+	 * 查找过程中应答的节点都会刷新到本地路由表。
+	 */
+	KadLookup::Result lookup(const NodeID &target, KadLookup::Mode mode, const std::string &key = std::string())
+	{
+		std::promise<KadLookup::Result> done;
+		startLookup(target, mode, key, [&done](KadLookup::Result &result)
+					{ done.set_value(result); });
+		return done.get_future().get();
+	}
+
+	/*
+	 * void async_lookup(const NodeID &target, KadLookup::Mode mode, KadLookup::DoneFn done)
+	 * 不阻塞的 lookup，结束时在 RPC 轮询线程（或传输层、Scheduler 的回调）中调用 done
+	 */
+	void async_lookup(const NodeID &target, KadLookup::Mode mode, KadLookup::DoneFn done)
+	{
+		startLookup(target, mode, std::string(), std::move(done));
+	}
+
+	void setAlpha(uint64_t a)
+	{
+		alpha = a;
+	}
+
+	/*
+	 * 把本节点登记到传输层 t（例如进程内的 LocalTransport），同一传输层上的节点之间的一元 RPC
+	 * 不再经过 gRPC；批量流、键迁移和发往其他进程的 RPC 仍走 gRPC。t 由调用方持有，可以被多个节点共享，
+	 * 为空时注销。t 不能登记本节点（例如 UDP 没能绑定本节点的地址）时不使用它并返回 false
+	 */
+	bool setTransport(Transport *t)
+	{
+		if (transport != nullptr)
+		{
+			transport->detach(local_address);
+		}
+		transport = t;
+		if (transport != nullptr && !transport->attach(local_address, this))
+		{
+			// 传输层收不到发往本节点的请求，对端经它发来的请求都会丢失，不使用它
+			DLOG(ERROR, "%s transport cannot serve %s", local_nodeId.str().c_str(), local_address.c_str());
+			transport = nullptr;
+		}
+		rpc->setTransport(transport);
+		return transport == t;
+	}
+
+	/*
+	 * 设置时钟和定时器（见 transport.hpp），之后查找、仲裁和存活探测的超时与定时都按它推进；
+	 * 与仿真网络一起使用时，节点的所有操作都在仿真的事件循环中完成。s 由调用方持有
+	 */
+	void setScheduler(Scheduler *s)
+	{
+		rpc->setScheduler(s);
+	}
+
+	// 设置推进查找、副本读写和 async_get / async_put 的 RPC 轮询线程数，须在节点发出第一个请求之前调用
+	void setRpcThreads(int n)
+	{
+		rpc->setPollers(n);
+	}
+
+	/*
+	 * 设置副本数 R、写仲裁 W 和读仲裁，W 和读仲裁会被限制在 [1, R] 之内
+	 */
+	void setReplication(uint64_t r, uint64_t w, uint64_t r_read, int64_t timeout_ms = 2000)
+	{
+		replicas = std::max<uint64_t>(r, 1);
+		write_quorum = std::min(std::max<uint64_t>(w, 1), replicas);
+		read_quorum = std::min(std::max<uint64_t>(r_read, 1), replicas);
+		quorum_timeout_ms = timeout_ms;
+	}
+
+	struct ReplicationStats
+	{
+		uint64_t quorum_timeouts; // 超时仍未达到仲裁的读写次数
+		uint64_t quorum_failures; // 未超时、但失败的副本太多而达不到仲裁的读写次数
+		uint64_t stale_reads;	  // 读仲裁中缺少该值或值不一致的副本数
+		double avg_lag_ms;		  // 仲裁达成后才写入成功的副本平均晚了多久
+		double max_lag_ms;		  // 仲裁达成后才写入成功的副本最多晚了多久
+	};
+
+	ReplicationStats replicationStats()
+	{
+		ReplicationStats rs;
+		uint64_t samples = replica_lag_samples.load(std::memory_order_relaxed);
+		rs.quorum_timeouts = quorum_timeouts.load(std::memory_order_relaxed);
+		rs.quorum_failures = quorum_failures.load(std::memory_order_relaxed);
+		rs.stale_reads = stale_reads.load(std::memory_order_relaxed);
+		rs.avg_lag_ms = samples ? replica_lag_us.load(std::memory_order_relaxed) / 1000.0 / samples : 0;
+		rs.max_lag_ms = replica_lag_max_us.load(std::memory_order_relaxed) / 1000.0;
+		return rs;
+	}
+
+	struct RetryStats
+	{
+		uint64_t store_retries; // 副本写入失败后改写到下一个最近节点的次数
+		uint64_t hedged;		// 查找中超过对冲延迟后改问下一个候选的次数
+		uint64_t exit_failures; // 未送达的退出通知数
+		double hedge_delay_ms;	// 当前的对冲延迟，未开启时为 0
+	};
+
+	struct LivenessStats
+	{
+		uint64_t pings;			// 发出的 ping 数
+		uint64_t ping_failures; // 没有应答的 ping 数
+		uint64_t coalesced;		// 与等待中、探测中或刚确认在线的对端合并掉的探测请求数
+		uint64_t evicted;		// 探测失败后从路由表删除的节点数
+		uint64_t promoted;		// 从替换缓存补入桶中的节点数
+		uint64_t spares;		// 当前替换缓存中的节点数
+	};
+
+	LivenessStats livenessStats()
+	{
+		PeerProber::Stats ps = prober->stats();
+		LivenessStats ls;
+		ls.pings = ps.sent;
+		ls.ping_failures = ps.failed;
+		ls.coalesced = ps.coalesced;
+		ls.evicted = peers_evicted.load(std::memory_order_relaxed);
+		ls.promoted = table->promoted();
+		ls.spares = table->spareSize();
+		return ls;
+	}
+
+	RetryStats retryStats()
+	{
+		RetryStats rs;
+		rs.store_retries = store_retries.load(std::memory_order_relaxed);
+		rs.hedged = hedged_requests.load(std::memory_order_relaxed);
+		rs.exit_failures = exit_failures.load(std::memory_order_relaxed);
+		rs.hedge_delay_ms = hedge != nullptr ? hedge->delayUs() / 1000.0 : 0;
+		return rs;
+	}
+
+	/*
+	 * 开启路径缓存：get 经 find_value 查找成功后，把值缓存到已应答、但没有该值的最近节点上。
+	 * 有效期为 ttl_ms，缓存节点与键之间每多隔一个已应答的节点减半；ttl_ms 为 0 时关闭
+	 */
+	void setPathCache(int64_t ttl_ms)
+	{
+		path_cache_ttl_ms = std::max<int64_t>(ttl_ms, 0);
+	}
+
+	uint64_t pathCacheStores()
+	{
+		return path_cache_stores.load(std::memory_order_relaxed);
+	}
+
+	/*
+	 * 同一进程中的虚拟节点共用一个存储：写往兄弟节点的副本直接写本地存储，移交和拉取键时跳过它们。
+	 * primary 为 false 时退出不移交键，由主节点统一移交。应在 join 之前调用
+	 */
+	void setSiblings(const vector<NodeID> &ids, bool primary)
+	{
+		siblings = ids;
+		owns_store = primary;
+	}
+
+	void setDeadlines(const Deadlines &d)
+	{
+		deadlines = d;
+		prober->setTimeout(d.ping_ms);
+	}
+
+	/*
+	 * 开启 find_value 对冲：请求超过最近延迟的 percentile 分位数（限制在 [min_us, max_us]）仍未应答时，
+	 * 向下一个最近的候选发出同样的请求，取最先到达的值。percentile 不大于 0 时不开启。应在开始读写之前调用；
+	 * 进行中的查找直接使用对冲策略，开启后不能再替换或关闭，再次开启的调用被忽略并返回 false
+	 */
+	bool setHedge(double percentile, int64_t min_us = 200, int64_t max_us = 50000)
+	{
+		if (percentile <= 0)
+		{
+			return hedge == nullptr;
+		}
+		if (hedge != nullptr)
+		{
+			DLOG(WARN, "%s hedging is already enabled, ignoring the new policy", local_nodeId.str().c_str());
+			return false;
+		}
+		hedge.reset(new HedgePolicy(percentile, min_us, max_us));
+		return true;
+	}
+
+	// 加入时拉取的键数和退出时移交的键副本数
+	void transferStats(uint64_t &pulled, uint64_t &handed_off)
+	{
+		pulled = keys_pulled.load(std::memory_order_relaxed);
+		handed_off = keys_handed_off.load(std::memory_order_relaxed);
+	}
+
+	/*
+	 * 替换键位置缓存的配置（容量为 0 时关闭），应在节点开始读写之前调用
+	 */
+	void setLocationCache(LocationCache::Options opts)
+	{
+		delete locations;
+		locations = new LocationCache(opts);
+	}
+
+	LocationCache::Stats locationStats()
+	{
+		return locations->stats();
+	}
+
+	ChannelPool::Stats poolStats()
+	{
+		return pool->stats();
+	}
+
+	// 返回查找次数，以及平均每次查找的跳数和联系的节点数
+	void lookupStats(uint64_t &count, double &avg_hops, double &avg_contacted)
+	{
+		Metrics::Snapshot hops = metrics->distribution(Metrics::LOOKUP_HOPS);
+		Metrics::Snapshot contacted = metrics->distribution(Metrics::LOOKUP_CONTACTED);
+		count = hops.count;
+		avg_hops = count ? (double)hops.sum / count : 0;
+		avg_contacted = count ? (double)contacted.sum / count : 0;
+	}
+
+private:
+	// get / put 内部的完成回调，result 指向这次操作的查找结果，没有发起查找（本地或键位置缓存命中）时为空
+	using FindFn = std::function<void(bool found, std::string &value, KadLookup::Result *result)>;
+	using StoreFn = std::function<void(bool ok, KadLookup::Result *result)>;
+
+	// get 的入口：完成时记录延迟和失败数，再交给 done
+	void startGet(const std::string &key, FindFn done)
+	{
+		auto start = std::chrono::steady_clock::now();
+		findValue(key, [this, start, done](bool found, std::string &value, KadLookup::Result *result)
+				  {
+					  finishOp(Metrics::GET, start, found);
+					  done(found, value, result); });
+	}
+
+	void startPut(const std::string &key, const std::string &value, StoreFn done)
+	{
+		auto start = std::chrono::steady_clock::now();
+		storeValue(key, value, [this, start, done](bool ok, KadLookup::Result *result)
+				   {
+					   finishOp(Metrics::PUT, start, ok);
+					   done(ok, result); });
+	}
+
+	void finishOp(Metrics::Op op, std::chrono::steady_clock::time_point start, bool ok)
+	{
+		metrics->recordLatency(op, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+		if (!ok)
+		{
+			metrics->recordFailure(op);
+		}
+	}
+
+	// get 的实现：依次查本地存储、键位置缓存，再发起查找
+	void findValue(const std::string &key, FindFn done)
+	{
+		// 在本地数据库中查找键值对，本节点也可能缓存了其他节点的热点值
+		std::string value;
+		if (_db->get(key, &value) || hot->get(key, &value))
+		{
+			done(true, value, nullptr);
+			return;
+		}
+		NodeID id = placement->place(key);
+		// 最近查找过的键直接问上次返回值的节点
+		if (read_quorum <= 1 && cachedGet(key, id, done))
+		{
+			return;
+		}
+		lookupValue(key, id, done);
+	}
+
+	// 向网络发起 find_value 查找；需要读仲裁时先找到副本节点再并行读取
+	void lookupValue(const std::string &key, const NodeID &id, FindFn done)
+	{
+		if (read_quorum > 1)
+		{
+			startLookup(id, KadLookup::FIND_NODE, std::string(), [this, key, done](KadLookup::Result &found)
+						{
+							auto result = std::make_shared<KadLookup::Result>(std::move(found));
+							quorumGet(key, distinctHosts(result->closest), [done, result](bool hit, std::string &value)
+									  { done(hit, value, result.get()); }); });
+			return;
+		}
+		startLookup(id, KadLookup::FIND_VALUE, key, [this, key, id, done](KadLookup::Result &result)
+					{
+						if (result.found)
+						{
+							if (!isLocal(nodeIdOf(result.holder)))
+							{
+								locations->insert(id, result.holder);
+							}
+							if (path_cache_ttl_ms > 0 && result.has_cache_node)
+							{
+								cacheAlongPath(key, result.value, result);
+							}
+						}
+						// 返回是否找到目标键值对
+						done(result.found, result.value, &result); });
+	}
+
+	// put 的实现：找到 replicas 个最近节点，并行写入并等待写仲裁
+	void storeValue(const std::string &key, const std::string &value, StoreFn done)
+	{
+#ifdef DHASH_DEBUG
+		// 打印节点表的调试信息
+		printNodeTable();
+#endif
+		// 创建 KeyValue 请求消息，包含键值对信息；重试在 RPC 回调中发起，请求由各个回调共享
+		auto request = std::make_shared<KeyValue>();
+		request->mutable_node()->CopyFrom(local_node);
+		request->set_key(key);
+		request->set_value(value);
+		// 写入总是经过查找，不用键位置缓存：缓存的节点可能已不在最近的节点之中（例如更近的节点加入并拉走了这段键），
+		// 写到它那里的值按正确路由读取的节点看不到，也不会被迁回
+		storeReplicas(request, placement->place(key), done);
+	}
+
+	void storeReplicas(std::shared_ptr<KeyValue> request, const NodeID &id, StoreFn done)
+	{
+		// 查找离键最近的节点，结果中包含本地节点
+		startLookup(id, KadLookup::FIND_NODE, std::string(), [this, request, id, done](KadLookup::Result &found)
+					{
+						auto result = std::make_shared<KadLookup::Result>(std::move(found));
+						// 同一进程的多个虚拟节点只算一个副本
+						vector<Node> closest = distinctHosts(result->closest);
+						if (closest.empty())
+						{
+							closest.push_back(local_node);
+						}
+						uint64_t n = std::min<uint64_t>(replicas, closest.size());
+						auto write = std::make_shared<ReplicaWrite>(closest, n);
+						auto quorum = std::make_shared<Quorum>(n, std::min(write_quorum, n), [this, write, n, id, result, done](bool ok, bool expired)
+															   {
+																   if (!ok)
+																   {
+																	   (expired ? quorum_timeouts : quorum_failures).fetch_add(1, std::memory_order_relaxed);
+																   }
+																   else if (n == 1 && write->next.load() == n && !isLocal(nodeIdOf(write->candidates[0])))
+																   {
+																	   locations->insert(id, write->candidates[0]);
+																   }
+#ifdef DHASH_DEBUG
+																   printNodeTable();
+#endif
+																   done(ok, result.get()); });
+						// 超时仍未达到写仲裁时以失败结束，未完成的副本写入继续在后台进行
+						rpc->after(quorum_timeout_ms * 1000, [quorum]
+								   { quorum->expire(); });
+						for (uint64_t i = 0; i < n; i++)
+						{
+							storeReplica(write, i, request, quorum, deadlines.store_retries);
+						} });
+	}
+
+	// 发往同一个对端的一组批次及其应答
+	template <class Req, class Resp>
+	struct PeerGroup
+	{
+		Node peer;
+		vector<Req> batches;
+		vector<Resp> responses;
+		uint64_t tail_bytes = 0; // 最后一个批次中键值的字节数
+		bool ok = false;
+	};
+
+	// 等待一组异步调用：发起前 add，每个调用完成时 countDown，发起方在 wait 中阻塞到计数归零。
+	// mu 也用来保护回调共同写入的结果
+	struct Latch
+	{
+		std::mutex mu;
+		std::condition_variable cv;
+		uint64_t pending = 0;
+
+		void add(uint64_t n)
+		{
+			std::lock_guard<std::mutex> guard(mu);
+			pending += n;
+		}
+
+		void countDown()
+		{
+			std::lock_guard<std::mutex> guard(mu);
+			if (--pending == 0)
+			{
+				cv.notify_all();
+			}
+		}
+
+		void wait()
+		{
+			std::unique_lock<std::mutex> lock(mu);
+			cv.wait(lock, [this]
+					{ return pending == 0; });
+		}
+	};
+
+	// 服务端流处理：逐条读取批次，交给 handle 处理后回复
+	template <class Req, class Resp>
+	Status serveStream(grpc::ServerReaderWriter<Resp, Req> *stream, Status (KadCore::*handle)(const Req *, Resp *))
+	{
+		Req request;
+		Resp response;
+		while (stream->Read(&request))
+		{
+			response.Clear();
+			Status status = (this->*handle)(&request, &response);
+			if (!status.ok())
+			{
+				return status;
+			}
+			if (!stream->Write(response))
+			{
+				break;
+			}
+		}
+		return Status::OK;
+	}
+
+	// 返回可以继续追加 bytes 字节的批次，最后一个批次的键数或字节数已满时新建一个
+	template <class Req, class Resp>
+	Req *appendBatch(PeerGroup<Req, Resp> &group, uint64_t bytes)
+	{
+		vector<Req> &batches = group.batches;
+		if (batches.empty() || batchSize(batches.back()) >= batch_size ||
+			(group.tail_bytes > 0 && group.tail_bytes + bytes > batch_bytes))
+		{
+			batches.emplace_back();
+			batches.back().mutable_node()->CopyFrom(local_node);
+			group.tail_bytes = 0;
+		}
+		group.tail_bytes += bytes;
+		return &batches.back();
+	}
+
+	static int batchSize(const KeyValueBatch &batch)
+	{
+		return batch.kvs_size();
+	}
+
+	static int batchSize(const IDKeyBatch &batch)
+	{
+		return batch.idkeys_size();
+	}
+
+	/*
+	 * 发起一次不阻塞的迭代查找，结束时在 RPC 轮询线程中调用 done
+	 */
+	void startLookup(const NodeID &target, KadLookup::Mode mode, const std::string &key, KadLookup::DoneFn done)
+	{
+		vector<Node> seeds;
+		for (const RoutingTable::Contact &c : findCloseById(target))
+		{
+			seeds.push_back(c.toNode());
+		}
+		// 需要的副本数多于 k 时扩大查找结果，保证能拿到 replicas 个最近节点
+		auto search = std::make_shared<KadLookup>(rpc, local_node, target, mode, alpha, std::max(k_closest, replicas), key);
+		search->setTimeout(deadlines.find_ms);
+		search->setHedge(hedge.get());
+		search->setSuspect([this](const Node &node)
+						   { suspect(node); });
+		search->start(seeds,
+					  [this](const Node &node)
+					  { freshNode(node); },
+					  [this, done](KadLookup::Result &result)
+					  {
+						  metrics->observe(Metrics::LOOKUP_HOPS, result.hops);
+						  metrics->observe(Metrics::LOOKUP_CONTACTED, result.contacted);
+						  if (result.hedged > 0)
+						  {
+							  hedged_requests.fetch_add(result.hedged, std::memory_order_relaxed);
+						  }
+						  done(result);
+					  });
+	}
+
+	/*
+	 * 同时向所有种子节点发 find_node，把应答的节点和它们返回的节点加入路由表，返回应答的种子数。
+	 * 失败时应答为空，不能把空节点加入路由表；KadRpc 会让下次重试重新建立连接
+	 */
+	uint64_t askSeeds(const vector<std::string> &seeds)
+	{
+		std::promise<uint64_t> done;
+		startAskSeeds(seeds, [&done](uint64_t answered)
+					  { done.set_value(answered); });
+		return done.get_future().get();
+	}
+
+	// 不阻塞的 askSeeds，所有种子应答或失败后调用 done(应答的种子数)
+	void startAskSeeds(const vector<std::string> &seeds, std::function<void(uint64_t)> done)
+	{
+		if (seeds.empty())
+		{
+			done(0);
+			return;
+		}
+		auto remaining = std::make_shared<std::atomic<uint64_t>>(seeds.size());
+		auto answered = std::make_shared<std::atomic<uint64_t>>(0);
+		IDKey request;
+		request.set_idkey(local_nodeId.toBytes());
+		request.mutable_node()->CopyFrom(local_node);
+		for (const std::string &address : seeds)
+		{
+			rpc->call<IDKey, NodeList>(
+				address, &KadImpl::Stub::PrepareAsyncfind_node, request,
+				[this, remaining, answered, address, done](const Status &status, NodeList &response)
+				{
+					if (status.ok())
+					{
+						freshNode(response.resp_node());
+						for (const Node &node : response.nodes())
+						{
+							freshNode(node);
+						}
+						answered->fetch_add(1);
+					}
+					else
+					{
+						DLOG(DEBUG, "%s seed %s failed: %s", local_nodeId.str().c_str(), address.c_str(), status.error_message().c_str());
+					}
+					if (remaining->fetch_sub(1) == 1)
+					{
+						done(answered->load());
+					}
+				},
+				deadlines.find_ms);
+		}
+	}
+
+	/*
+	 * 对端的 RPC 失败或超时后调用：仍在路由表中时交给探测器 ping 一次，不在线时再删除。
+	 * 失败可能只是一时的拥塞，不直接删除
+	 */
+	void suspect(const Node &node)
+	{
+		if (table->contains(nodeIdOf(node)))
+		{
+			prober->probe(node);
+		}
+	}
+
+	// ping 的结果：在线的节点移到桶的最前面；不在线时删除，替换缓存中的节点补入，并释放到它的通道和位置缓存
+	void onProbe(const Node &node, bool alive)
+	{
+		if (alive)
+		{
+			freshNode(node);
+			return;
+		}
+		NodeID id = nodeIdOf(node);
+		if (table->remove(id))
+		{
+			peers_evicted.fetch_add(1, std::memory_order_relaxed);
+			DLOG(INFO, "%s removed unresponsive peer %s (%s)", local_nodeId.str().c_str(), id.str().c_str(), node.address().c_str());
+		}
+		pool->evict(node.address());
+		locations->invalidateNode(id);
+	}
+
+	static double sinceMs(std::chrono::steady_clock::time_point start)
+	{
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	/*
+	 * 通过 transfer_range 从离本节点最近的邻居拉取本节点现在应当保存的键。
+	 * 本地已有的键不覆盖（它们可能是加入之后直接写到本节点的新值），返回写入本地存储的键数
+	 */
+	uint64_t pullRange()
+	{
+		RangeRequest request;
+		request.mutable_node()->CopyFrom(local_node);
+		request.set_replicas(replicas);
+		request.set_max_bytes_per_sec(transfer_bytes_per_sec);
+		uint64_t pulled = 0;
+		std::string existing;
+		for (const RoutingTable::Contact &c : table->closest(local_nodeId, std::max(k_closest, replicas)))
+		{
+			// 兄弟节点的键已经在共用的存储中
+			if (isLocal(c.id))
+			{
+				continue;
+			}
+			std::shared_ptr<KadImpl::Stub> stub = pool->stub(std::string(c.addr()));
+			ClientContext context;
+			routeTo(&context, std::string(c.addr()));
+			context.set_deadline(std::chrono::system_clock::now() + std::chrono::milliseconds(deadlines.transfer_ms));
+			std::unique_ptr<grpc::ClientReader<KeyValueBatch>> reader = stub->transfer_range(&context, request);
+			KeyValueBatch batch;
+			while (reader->Read(&batch))
+			{
+				for (const KeyValue &kv : batch.kvs())
+				{
+					if (!_db->get(kv.key(), &existing) && _db->put(kv.key(), kv.value()))
+					{
+						pulled++;
+					}
+				}
+			}
+			Status status = reader->Finish();
+			if (!status.ok())
+			{
+				DLOG(WARN, "%s transfer_range from %s failed: %s", local_nodeId.str().c_str(), c.id.str().c_str(), status.error_message().c_str());
+				suspect(c.toNode());
+			}
+		}
+		keys_pulled.fetch_add(pulled, std::memory_order_relaxed);
+		if (pulled > 0)
+		{
+			DLOG(INFO, "%s pulled %lu keys from neighbors", local_nodeId.str().c_str(), pulled);
+		}
+		return pulled;
+	}
+
+	/*
+	 * 退出前按本地路由表把每个键推给除本节点外最近的 replicas 个节点。每个目标的键攒满
+	 * transfer_chunk_bytes 后发一次 store_batch，按限速发送，同一时刻只缓冲每个目标的一个批次。
+	 * 失败的批次只记录日志，返回成功移交的键副本数
+	 */
+	uint64_t handoff()
+	{
+		struct Target
+		{
+			Node node;
+			KeyValueBatch batch;
+			uint64_t bytes = 0;
+		};
+		vector<std::string> keys;
+		_db->forEach([&keys](std::string_view key, std::string_view value)
+					 { keys.emplace_back(key); });
+		if (keys.empty())
+		{
+			return 0;
+		}
+		map<NodeID, Target> targets;
+		Pacer pacer(transfer_bytes_per_sec);
+		uint64_t sent = 0, failed = 0;
+		auto flush = [&](Target &t)
+		{
+			if (t.batch.kvs_size() == 0)
+			{
+				return;
+			}
+			std::this_thread::sleep_until(pacer.reserve(t.bytes));
+			ClientContext context;
+			context.set_deadline(std::chrono::system_clock::now() + std::chrono::milliseconds(deadlines.transfer_ms));
+			routeTo(&context, t.node.address());
+			BatchAck ack;
+			Status status = pool->stub(t.node.address())->store_batch(&context, t.batch, &ack);
+			if (status.ok())
+			{
+				sent += t.batch.kvs_size();
+			}
+			else
+			{
+				failed += t.batch.kvs_size();
+				DLOG(WARN, "%s handoff to %s failed: %s", local_nodeId.str().c_str(), nodeIdOf(t.node).str().c_str(), status.error_message().c_str());
+			}
+			t.batch.clear_kvs();
+			t.bytes = 0;
+		};
+		std::string value;
+		for (const std::string &key : keys)
+		{
+			if (!_db->get(key, &value))
+			{
+				continue;
+			}
+			uint64_t n = 0;
+			for (const Node &owner : ownersOf(placement->place(key), replicas + 1 + siblings.size()))
+			{
+				// 兄弟节点和本节点一起离开
+				if (isLocal(nodeIdOf(owner)))
+				{
+					continue;
+				}
+				if (n++ == replicas)
+				{
+					break;
+				}
+				Target &t = targets[nodeIdOf(owner)];
+				if (!t.batch.has_node())
+				{
+					t.node = owner;
+					t.batch.mutable_node()->CopyFrom(local_node);
+				}
+				KeyValue *kv = t.batch.add_kvs();
+				kv->set_key(key);
+				kv->set_value(value);
+				t.bytes += key.size() + value.size();
+				if (t.bytes >= transfer_chunk_bytes)
+				{
+					flush(t);
+				}
+			}
+		}
+		for (auto &t : targets)
+		{
+			flush(t.second);
+		}
+		keys_handed_off.fetch_add(sent, std::memory_order_relaxed);
+		DLOG(INFO, "%s handed off %lu keys to %lu nodes, %lu failed", local_nodeId.str().c_str(), sent, targets.size(), failed);
+		return sent;
+	}
+
+	// 本节点或同一进程中的兄弟虚拟节点，它们的键都在本地存储中
+	bool isLocal(const NodeID &id)
+	{
+		return id == local_nodeId || std::find(siblings.begin(), siblings.end(), id) != siblings.end();
+	}
+
+	// 按顺序保留每个进程（监听地址）的第一个节点，副本不会落在同一进程的多个虚拟节点上
+	static vector<Node> distinctHosts(const vector<Node> &nodes)
+	{
+		vector<Node> out;
+		vector<std::string> hosts;
+		for (const Node &node : nodes)
+		{
+			std::string host = endpointOf(node.address());
+			if (std::find(hosts.begin(), hosts.end(), host) == hosts.end())
+			{
+				hosts.push_back(host);
+				out.push_back(node);
+			}
+		}
+		return out;
+	}
+
+	// 按本地路由表返回离 key 最近的 n 个节点（可能包含本地节点），按距离升序
+	vector<Node> ownersOf(const NodeID &key, uint64_t n)
+	{
+		vector<Node> owners;
+		for (const RoutingTable::Contact &c : findCloseById(key))
+		{
+			owners.push_back(c.toNode());
+		}
+		owners.push_back(local_node);
+		std::sort(owners.begin(), owners.end(), [&key](const Node &a, const Node &b)
+				  { return NodeID::closer(nodeIdOf(a), nodeIdOf(b), key); });
+		owners.erase(std::unique(owners.begin(), owners.end(), [](const Node &a, const Node &b)
+								 { return a.id() == b.id(); }),
+					 owners.end());
+		owners.resize(std::min<uint64_t>(std::max<uint64_t>(n, 1), owners.size()));
+		return owners;
+	}
+
+	/*
+	 * 向 result.cache_node 异步写入一条路径缓存，不等待应答。离键越远（中间隔的已应答节点越多）有效期越短，
+	 * 这样远处的缓存很快过期，热点键的缓存会沿着查找路径逐渐向外扩散
+	 */
+	void cacheAlongPath(const std::string &key, const std::string &value, const KadLookup::Result &result)
+	{
+		KeyValue request;
+		request.mutable_node()->CopyFrom(local_node);
+		request.set_key(key);
+		request.set_value(value);
+		request.set_cache_ttl_ms(std::max<int64_t>(path_cache_ttl_ms >> std::min<uint64_t>(result.cache_rank, 16), 1));
+		rpc->call<KeyValue, IDKey>(
+			result.cache_node.address(), &KadImpl::Stub::PrepareAsyncstore, request,
+			[](const grpc::Status &status, IDKey &response) {}, deadlines.store_ms);
+		path_cache_stores.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	/*
+	 * 键位置缓存命中时直接向缓存的节点发 find_value，返回 true 表示已接手这次读取。应答中没有值（mode_kv = false）
+	 * 或 RPC 失败时使缓存项失效，退回到迭代查找。没有缓存项时返回 false
+	 */
+	bool cachedGet(const std::string &key, const NodeID &id, FindFn done)
+	{
+		RoutingTable::Contact owner;
+		if (!locations->lookup(id, owner))
+		{
+			return false;
+		}
+		IDKey request;
+		request.set_idkey(key);
+		request.mutable_node()->CopyFrom(local_node);
+		rpc->call<IDKey, KV_Node_Wrapper>(
+			std::string(owner.addr()), &KadImpl::Stub::PrepareAsyncfind_value, request,
+			[this, key, id, peer = owner.toNode(), done](const Status &status, KV_Node_Wrapper &response)
+			{
+				if (!status.ok() || !response.mode_kv())
+				{
+					locations->invalidate(id);
+					if (!status.ok())
+					{
+						suspect(peer);
+					}
+					lookupValue(key, id, done);
+					return;
+				}
+				freshNode(response.resp_node());
+				done(true, *response.mutable_kv()->mutable_value(), nullptr);
+			},
+			deadlines.find_ms);
+		return true;
+	}
+
+	/*
+	 * 一次副本写入的仲裁状态，由各个 RPC 回调共享。达到仲裁、所有副本都已应答或超时后调用一次 done(ok, expired)，
+	 * expired 表示因超时结束。之后写入成功的副本各自记录一次晚于仲裁达成的时间。
+	 */
+	struct Quorum
+	{
+		std::mutex mu;
+		uint64_t total, needed;
+		uint64_t acks = 0, fails = 0;
+		int64_t quorum_at_us = 0;			  // 仲裁达成的时间，取自 rpc->nowUs()
+		std::function<void(bool, bool)> done; // 结束后置空
+
+		Quorum(uint64_t n, uint64_t w, std::function<void(bool, bool)> fn) : total(n), needed(w), done(std::move(fn)) {}
+
+		void respond(bool ok, NodeKadImpl *node)
+		{
+			std::function<void(bool, bool)> fn;
+			bool reached;
+			int64_t now = node->rpc->nowUs();
+			{
+				std::lock_guard<std::mutex> guard(mu);
+				ok ? acks++ : fails++;
+				reached = acks >= needed;
+				if (ok && acks == needed)
+				{
+					quorum_at_us = now;
+				}
+				else if (ok && acks > needed)
+				{
+					node->recordReplicaLag(now - quorum_at_us);
+				}
+				if (reached || acks + fails == total)
+				{
+					fn.swap(done);
+				}
+			}
+			// 回调在锁外执行，其中可以继续发起 RPC
+			if (fn)
+			{
+				fn(reached, false);
+			}
+		}
+
+		// 超时：仍未结束时以失败结束
+		void expire()
+		{
+			std::function<void(bool, bool)> fn;
+			{
+				std::lock_guard<std::mutex> guard(mu);
+				fn.swap(done);
+			}
+			if (fn)
+			{
+				fn(false, true);
+			}
+		}
+	};
+
+	void recordReplicaLag(int64_t lag_us)
+	{
+		uint64_t us = std::max<int64_t>(lag_us, 0);
+		replica_lag_samples.fetch_add(1, std::memory_order_relaxed);
+		replica_lag_us.fetch_add(us, std::memory_order_relaxed);
+		uint64_t prev = replica_lag_max_us.load(std::memory_order_relaxed);
+		while (us > prev && !replica_lag_max_us.compare_exchange_weak(prev, us, std::memory_order_relaxed))
+		{
+		}
+	}
+
+	// 一次 put 的候选副本节点，next 是下一个可以改写的候选（前 n 个是首选的副本）
+	struct ReplicaWrite
+	{
+		vector<Node> candidates;
+		std::atomic<uint64_t> next;
+
+		ReplicaWrite(const vector<Node> &closest, uint64_t n) : candidates(closest), next(n) {}
+	};
+
+	/*
+	 * 把一个副本写到 candidates[index]（本地节点直接写本地存储）。失败或超时后，
+	 * 还有重试次数时改写到下一个尚未使用的最近节点，否则向仲裁报告失败
+	 */
+	void storeReplica(std::shared_ptr<ReplicaWrite> write, uint64_t index, std::shared_ptr<KeyValue> request,
+					  std::shared_ptr<Quorum> quorum, uint64_t retries)
+	{
+		const Node &target = write->candidates[index];
+		if (isLocal(nodeIdOf(target)))
+		{
+			quorum->respond(_db->put(request->key(), request->value()), this);
+			return;
+		}
+		rpc->call<KeyValue, IDKey>(
+			target.address(), &KadImpl::Stub::PrepareAsyncstore, *request,
+			[this, write, index, request, quorum, retries](const Status &status, IDKey &response)
+			{
+				if (status.ok())
+				{
+					freshNode(response.node());
+					quorum->respond(true, this);
+					return;
+				}
+				suspect(write->candidates[index]);
+				uint64_t next = retries > 0 ? write->next.fetch_add(1) : write->candidates.size();
+				if (next < write->candidates.size())
+				{
+					store_retries.fetch_add(1, std::memory_order_relaxed);
+					storeReplica(write, next, request, quorum, retries - 1);
+					return;
+				}
+				quorum->respond(false, this);
+			},
+			deadlines.store_ms);
+	}
+
+	// 一次读仲裁的状态，由发起方和各个 RPC 回调共享
+	struct ReplicaRead
+	{
+		std::mutex mu;
+		uint64_t total, needed;
+		uint64_t responses = 0, failures = 0;
+		vector<std::string> values; // 各个成功应答中的值，未找到记为空
+		vector<bool> found;
+		std::function<void(bool, std::string &)> done; // 结束后置空
+	};
+
+	/*
+	 * 并行读取 replicas 个副本，收到 read_quorum 个应答、所有副本都已应答或超时后调用 done。
+	 * 任一应答带有值即视为找到；已应答但没有该值或值不同的副本计入 stale_reads。
+	 */
+	void quorumGet(const std::string &key, const vector<Node> &closest, std::function<void(bool, std::string &)> done)
+	{
+		auto read = std::make_shared<ReplicaRead>();
+		uint64_t n = std::min<uint64_t>(replicas, closest.size());
+		read->total = n;
+		read->needed = std::min(read_quorum, n);
+		read->done = std::move(done);
+		IDKey request;
+		request.set_idkey(key);
+		request.mutable_node()->CopyFrom(local_node);
+		for (uint64_t i = 0; i < n; i++)
+		{
+			if (isLocal(nodeIdOf(closest[i])))
+			{
+				std::string v;
+				bool hit = _db->get(key, &v);
+				std::unique_lock<std::mutex> lock(read->mu);
+				read->responses++;
+				read->values.push_back(std::move(v));
+				read->found.push_back(hit);
+				settleRead(read, lock, false);
+				continue;
+			}
+			rpc->call<IDKey, KV_Node_Wrapper>(
+				closest[i].address(), &KadImpl::Stub::PrepareAsyncfind_value, request,
+				[this, read, peer = closest[i]](const Status &status, KV_Node_Wrapper &response)
+				{
+					if (!status.ok())
+					{
+						suspect(peer);
+					}
+					std::unique_lock<std::mutex> lock(read->mu);
+					if (!status.ok())
+					{
+						read->failures++;
+					}
+					else
+					{
+						read->responses++;
+						read->found.push_back(response.mode_kv());
+						read->values.push_back(std::move(*response.mutable_kv()->mutable_value()));
+					}
+					settleRead(read, lock, false);
+				},
+				deadlines.find_ms);
+		}
+		rpc->after(quorum_timeout_ms * 1000, [this, read]
+				   {
+					   std::unique_lock<std::mutex> lock(read->mu);
+					   settleRead(read, lock, true); });
+	}
+
+	/*
+	 * 在持有 read->mu 时调用：达到读仲裁、所有副本都已应答或 timeout 时结束这次读取，
+	 * 解锁后调用 done。已经结束的读取不再处理
+	 */
+	void settleRead(std::shared_ptr<ReplicaRead> read, std::unique_lock<std::mutex> &lock, bool timeout)
+	{
+		if (!read->done || (!timeout && read->responses < read->needed && read->responses + read->failures < read->total))
+		{
+			return;
+		}
+		if (read->responses < read->needed)
+		{
+			(timeout ? quorum_timeouts : quorum_failures).fetch_add(1, std::memory_order_relaxed);
+		}
+		bool hit = false;
+		std::string value;
+		for (size_t i = 0; i < read->found.size(); i++)
+		{
+			if (read->found[i] && !hit)
+			{
+				hit = true;
+				value = read->values[i];
+			}
+		}
+		for (size_t i = 0; hit && i < read->found.size(); i++)
+		{
+			if (!read->found[i] || read->values[i] != value)
+			{
+				stale_reads.fetch_add(1, std::memory_order_relaxed);
+			}
+		}
+		std::function<void(bool, std::string &)> done;
+		done.swap(read->done);
+		lock.unlock();
+		done(hit, value);
+	}
+
+	/*
+	 * 所有组的所有批次都经 rpc 异步发出，不为对端单独起线程，阻塞到全部应答或超时。
+	 * 一组中任一批次失败时整组视为失败（ok 为 false、丢弃应答），由调用方退回到逐个读写
+	 */
+	template <class Req, class Resp>
+	void exchangeAll(map<NodeID, PeerGroup<Req, Resp>> &groups, KadRpc::PrepareFn<Req, Resp> method)
+	{
+		auto latch = std::make_shared<Latch>();
+		for (auto &item : groups)
+		{
+			PeerGroup<Req, Resp> *group = &item.second;
+			group->ok = true;
+			group->responses.resize(group->batches.size());
+			latch->add(group->batches.size());
+		}
+		for (auto &item : groups)
+		{
+			PeerGroup<Req, Resp> *group = &item.second;
+			for (size_t i = 0; i < group->batches.size(); i++)
+			{
+				rpc->call<Req, Resp>(
+					group->peer.address(), method, group->batches[i],
+					[this, latch, group, i](const Status &status, Resp &response)
+					{
+						bool first_failure = false;
+						{
+							std::lock_guard<std::mutex> guard(latch->mu);
+							if (status.ok())
+							{
+								group->responses[i].Swap(&response);
+							}
+							else
+							{
+								first_failure = group->ok;
+								group->ok = false;
+							}
+						}
+						if (first_failure)
+						{
+							suspect(group->peer);
+						}
+						latch->countDown();
+					},
+					deadlines.batch_ms);
+			}
+		}
+		latch->wait();
+		for (auto &item : groups)
+		{
+			if (!item.second.ok)
+			{
+				item.second.responses.clear();
+			}
+		}
+	}
+
+protected:
+	void onPeerExit(const Node &node) override
+	{
+		// 对端已离开，关闭到它的通道，并丢弃指向它的键位置缓存
+		pool->evict(node.address());
+		locations->invalidateNode(nodeIdOf(node));
+	}
+
+	void onBucketFull(const RoutingTable::Contact &stale) override
+	{
+		prober->probe(stale.toNode());
+	}
+
+	// 在 KadCore 的指标之外，追加键位置缓存、通道池、副本仲裁和存活探测的计数
+	void collectStats(StatsReply *reply) override
+	{
+		KadCore::collectStats(reply);
+		std::string labels = "node=\"" + local_nodeId.str() + "\"";
+		LocationCache::Stats ls = locations->stats();
+		Metrics::addSample(reply, "dhash_location_cache_hits_total", labels, ls.hits, "counter");
+		Metrics::addSample(reply, "dhash_location_cache_misses_total", labels, ls.misses, "counter");
+		Metrics::addSample(reply, "dhash_location_cache_entries", labels, ls.size, "gauge");
+		ChannelPool::Stats ps = pool->stats();
+		Metrics::addSample(reply, "dhash_channel_pool_hits_total", labels, ps.hits, "counter");
+		Metrics::addSample(reply, "dhash_channel_pool_misses_total", labels, ps.misses, "counter");
+		Metrics::addSample(reply, "dhash_channel_pool_reconnects_total", labels, ps.reconnects, "counter");
+		Metrics::addSample(reply, "dhash_quorum_timeouts_total", labels, quorum_timeouts.load(std::memory_order_relaxed), "counter");
+		Metrics::addSample(reply, "dhash_quorum_failures_total", labels, quorum_failures.load(std::memory_order_relaxed), "counter");
+		Metrics::addSample(reply, "dhash_stale_reads_total", labels, stale_reads.load(std::memory_order_relaxed), "counter");
+		Metrics::addSample(reply, "dhash_path_cache_stores_total", labels, path_cache_stores.load(std::memory_order_relaxed), "counter");
+		Metrics::addSample(reply, "dhash_keys_pulled_total", labels, keys_pulled.load(std::memory_order_relaxed), "counter");
+		Metrics::addSample(reply, "dhash_keys_handed_off_total", labels, keys_handed_off.load(std::memory_order_relaxed), "counter");
+		Metrics::addSample(reply, "dhash_store_retries_total", labels, store_retries.load(std::memory_order_relaxed), "counter");
+		Metrics::addSample(reply, "dhash_hedged_requests_total", labels, hedged_requests.load(std::memory_order_relaxed), "counter");
+		Metrics::addSample(reply, "dhash_exit_failures_total", labels, exit_failures.load(std::memory_order_relaxed), "counter");
+		LivenessStats live = livenessStats();
+		Metrics::addSample(reply, "dhash_pings_total", labels, live.pings, "counter");
+		Metrics::addSample(reply, "dhash_ping_failures_total", labels, live.ping_failures, "counter");
+		Metrics::addSample(reply, "dhash_probes_coalesced_total", labels, live.coalesced, "counter");
+		Metrics::addSample(reply, "dhash_peers_evicted_total", labels, live.evicted, "counter");
+		Metrics::addSample(reply, "dhash_replacements_promoted_total", labels, live.promoted, "counter");
+		Metrics::addSample(reply, "dhash_replacement_cache_nodes", labels, live.spares, "gauge");
+		if (hedge != nullptr)
+		{
+			Metrics::addSample(reply, "dhash_hedge_delay_seconds", labels, hedge->delayUs() * 1e-6, "gauge");
 		}
-		printf("=========================================\n");
 	}
 };
 
@@ -0,0 +1,199 @@
+/*
+ * peerProber.hpp
+ *
+ * 对端存活探测：桶满时最久未联系的节点，以及客户端 RPC 失败的节点都交给这里，每隔一段时间成批发 ping。
+ * 探测轮次由 KadRpc 的定时器驱动，不占用单独的线程，设置了 Scheduler（例如仿真网络）时按它的时钟推进。
+ * 同一个对端在等待、探测中或最近刚确认在线时不会重复探测，多次请求合并为一次 ping；
+ * 结果通过回调交给调用方，由它刷新或删除路由表中的节点。
+ */
+
+#ifndef INCLUDE_PEERPROBER_HPP_
+#define INCLUDE_PEERPROBER_HPP_
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <stdint.h>
+
+#include "proto/dhash.pb.h"
+#include "kadRpc.hpp"
+#include "kadId.hpp"
+
+class PeerProber
+{
+public:
+	struct Options
+	{
+		int64_t interval_ms = 50;  // 第一个探测请求到达后等多久发出这一轮 ping，期间到达的请求合并
+		int64_t timeout_ms = 500;  // 每个 ping 的超时
+		int64_t recheck_ms = 1000; // 对端 ping 成功后，这段时间内不再探测它
+	};
+
+	struct Stats
+	{
+		uint64_t requested; // 调用 probe 的次数
+		uint64_t coalesced; // 因已在等待、探测中或刚确认在线而合并掉的次数
+		uint64_t sent;		// 发出的 ping 数
+		uint64_t failed;	// 失败或应答方 ID 不符的 ping 数
+	};
+
+	// ping 结束时在 RPC 轮询线程中调用：alive 为 false 时 node 已不可达，或者该地址上已换成了别的节点
+	using ResultFn = std::function<void(const Node &node, bool alive)>;
+
+private:
+	KadRpc *rpc;
+	Node local_node;
+	Options opts;
+	ResultFn on_result;
+
+	std::mutex mu;
+	std::unordered_map<NodeID, Node> pending;	  // 等待下一轮探测的对端
+	std::unordered_set<NodeID> inflight;		  // 已发出 ping、尚未应答的对端
+	std::unordered_map<NodeID, int64_t> verified; // 最近 ping 成功的对端及其时间（毫秒）
+	bool scheduled = false;						  // 已设置下一轮的定时器
+	bool stopping = false;
+
+	std::atomic<uint64_t> requested{0};
+	std::atomic<uint64_t> coalesced{0};
+	std::atomic<uint64_t> sent{0};
+	std::atomic<uint64_t> failed{0};
+
+public:
+	PeerProber(KadRpc *client, const Node &self, ResultFn result, Options o)
+	{
+		rpc = client;
+		local_node = self;
+		on_result = std::move(result);
+		opts = o;
+	}
+
+	// 已设置的定时器仍会回调到这里，探测器应与它使用的 KadRpc 同生命周期
+	~PeerProber()
+	{
+		std::lock_guard<std::mutex> guard(mu);
+		stopping = true;
+	}
+
+	PeerProber(const PeerProber &) = delete;
+	PeerProber &operator=(const PeerProber &) = delete;
+
+	void setTimeout(int64_t ms)
+	{
+		std::lock_guard<std::mutex> guard(mu);
+		opts.timeout_ms = ms;
+	}
+
+	/*
+	 * 请求在下一轮探测 node。不阻塞，没有等待中的一轮时设置定时器，interval_ms 后发出
+	 */
+	void probe(const Node &node)
+	{
+		requested.fetch_add(1, std::memory_order_relaxed);
+		NodeID id = nodeIdOf(node);
+		int64_t interval;
+		{
+			std::lock_guard<std::mutex> guard(mu);
+			auto v = verified.find(id);
+			if (pending.count(id) || inflight.count(id) ||
+				(v != verified.end() && nowMs() - v->second < opts.recheck_ms))
+			{
+				coalesced.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+			pending.emplace(id, node);
+			if (scheduled)
+			{
+				return;
+			}
+			scheduled = true;
+			interval = opts.interval_ms;
+		}
+		rpc->after(interval * 1000, [this]
+				   { round(); });
+	}
+
+	Stats stats()
+	{
+		Stats s;
+		s.requested = requested.load(std::memory_order_relaxed);
+		s.coalesced = coalesced.load(std::memory_order_relaxed);
+		s.sent = sent.load(std::memory_order_relaxed);
+		s.failed = failed.load(std::memory_order_relaxed);
+		return s;
+	}
+
+private:
+	// 一轮探测：对这一轮等待中的所有对端发 ping
+	void round()
+	{
+		std::vector<Node> batch;
+		int64_t timeout;
+		{
+			std::lock_guard<std::mutex> guard(mu);
+			scheduled = false;
+			if (stopping || pending.empty())
+			{
+				return;
+			}
+			// 丢掉过期的确认记录，它们不再阻止探测
+			int64_t now = nowMs();
+			for (auto iter = verified.begin(); iter != verified.end();)
+			{
+				iter = now - iter->second >= opts.recheck_ms ? verified.erase(iter) : std::next(iter);
+			}
+			for (auto &item : pending)
+			{
+				inflight.insert(item.first);
+				batch.push_back(std::move(item.second));
+			}
+			pending.clear();
+			timeout = opts.timeout_ms;
+		}
+		// 发 RPC 时不持有锁，回调可能立即执行
+		for (const Node &node : batch)
+		{
+			ping(node, timeout);
+		}
+	}
+
+	void ping(const Node &node, int64_t timeout)
+	{
+		NodeID id = nodeIdOf(node);
+		IDKey request;
+		request.set_idkey(id.toBytes());
+		request.mutable_node()->CopyFrom(local_node);
+		sent.fetch_add(1, std::memory_order_relaxed);
+		rpc->call<IDKey, IDKey>(
+			node.address(), &KadImpl::Stub::PrepareAsyncping, request,
+			[this, node, id](const grpc::Status &status, IDKey &response)
+			{
+				// 同一地址上重启的节点 ID 不同，对原来的节点来说等同于已离开
+				bool alive = status.ok() && response.node().id() == node.id();
+				{
+					std::lock_guard<std::mutex> guard(mu);
+					inflight.erase(id);
+					if (alive)
+					{
+						verified[id] = nowMs();
+					}
+				}
+				if (!alive)
+				{
+					failed.fetch_add(1, std::memory_order_relaxed);
+				}
+				on_result(node, alive);
+			},
+			timeout);
+	}
+
+	int64_t nowMs()
+	{
+		return rpc->nowUs() / 1000;
+	}
+};
+
+#endif /* INCLUDE_PEERPROBER_HPP_ */
@@ -0,0 +1,220 @@
+/*
+ * placement.hpp
+ *
+ * 键的放置策略：把用户的键映射到 ID 空间中的位置，DHT 按这个位置与节点 ID 的异或距离决定由谁存放。
+ * 直接使用键本身（identity）时，连续的整数键都挤在 ID 空间的一角，总是落到同一个节点上；
+ * 哈希放置把键打散到整个 ID 空间。网络中所有节点必须使用同一种放置策略，否则查找会找错节点。
+ * 另外提供离线的负载分析：给定节点 ID 集合和键流，统计每个节点分到的键数和不均衡系数。
+ */
+
+#ifndef INCLUDE_PLACEMENT_HPP_
+#define INCLUDE_PLACEMENT_HPP_
+
+#include <algorithm>
+#include <math.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <stdint.h>
+
+#include "valueStore.hpp"
+#include "kadId.hpp"
+
+class Placement
+{
+public:
+	virtual ~Placement() {}
+
+	// 键在 ID 空间中的位置
+	virtual NodeID place(std::string_view key) const = 0;
+
+	// 批量计算 n 个键的位置，写入 ids[0..n)
+	virtual void placeBatch(const std::string_view *keys, size_t n, NodeID *ids) const
+	{
+		for (size_t i = 0; i < n; i++)
+		{
+			ids[i] = place(keys[i]);
+		}
+	}
+
+	virtual const char *name() const = 0;
+
+	// 按名字（identity / hash）创建放置策略，名字未知时返回空指针
+	static Placement *create(const std::string &name);
+};
+
+/*
+ * IdentityPlacement
+ * 键的位置就是 keyId：8 字节的键直接解释为 64 位整数（ID 更宽时放在低 64 位），与此前的行为一致。
+ * 适合本身已经均匀分布的键，或者需要按键值控制存放位置的测试
+ */
+class IdentityPlacement : public Placement
+{
+public:
+	NodeID place(std::string_view key) const override
+	{
+		return NodeID::fromU64(keyId(key));
+	}
+
+	const char *name() const override
+	{
+		return "identity";
+	}
+};
+
+/*
+ * HashPlacement
+ * 在 keyId 之上再做一次 murmur3 的 fmix64：连续的整数键也会均匀地分布到整个 ID 空间。
+ * ID 宽于 64 位时，第 i 个字混合 keyId 与 i 个黄金比例常数之和，各字互不相关。
+ * 批量版本先逐个取出 keyId，再对整个数组做混合；混合循环只有乘法、移位和异或，
+ * 没有分支和跨迭代依赖，编译器可以把它向量化
+ */
+class HashPlacement : public Placement
+{
+	uint64_t seed;
+
+public:
+	explicit HashPlacement(uint64_t s = 0)
+	{
+		seed = s;
+	}
+
+	static inline uint64_t mix(uint64_t x)
+	{
+		x ^= x >> 33;
+		x *= 0xff51afd7ed558ccdULL;
+		x ^= x >> 33;
+		x *= 0xc4ceb9fe1a85ec53ULL;
+		x ^= x >> 33;
+		return x;
+	}
+
+	NodeID place(std::string_view key) const override
+	{
+		uint64_t h = keyId(key) ^ seed;
+		NodeID id;
+		for (int i = 0; i < NodeID::num_words; i++)
+		{
+			id.w[NodeID::num_words - 1 - i] = mix(h + i * 0x9e3779b97f4a7c15ULL);
+		}
+		id.w[0] &= ~0ULL >> NodeID::pad_bits;
+		return id;
+	}
+
+	void placeBatch(const std::string_view *keys, size_t n, NodeID *ids) const override
+	{
+		std::vector<uint64_t> h(n);
+		for (size_t j = 0; j < n; j++)
+		{
+			h[j] = keyId(keys[j]) ^ seed;
+		}
+		// 按字逐列混合：内层循环对 n 个键做同样的运算
+		for (int i = 0; i < NodeID::num_words; i++)
+		{
+			uint64_t offset = i * 0x9e3779b97f4a7c15ULL;
+			for (size_t j = 0; j < n; j++)
+			{
+				ids[j].w[NodeID::num_words - 1 - i] = mix(h[j] + offset);
+			}
+		}
+		for (size_t j = 0; j < n; j++)
+		{
+			ids[j].w[0] &= ~0ULL >> NodeID::pad_bits;
+		}
+	}
+
+	const char *name() const override
+	{
+		return "hash";
+	}
+};
+
+inline Placement *Placement::create(const std::string &name)
+{
+	if (name == "hash")
+	{
+		return new HashPlacement();
+	}
+	if (name == "identity")
+	{
+		return new IdentityPlacement();
+	}
+	return nullptr;
+}
+
+/*
+ * 负载分析的结果。counts[i] 是第 i 个组分到的键数（一个键的每个副本各算一次），
+ * imbalance 是最大值与平均值之比，1 表示完全均匀
+ */
+struct LoadReport
+{
+	std::vector<uint64_t> counts;
+	double mean = 0;
+	double imbalance = 0; // 最大值 / 平均值
+	double min_share = 0; // 最小值 / 平均值
+	double cv = 0;		  // 变异系数：标准差 / 平均值
+	size_t hottest = 0;	  // 键数最多的组
+};
+
+/*
+ * LoadReport analyzeLoad(const std::vector<NodeID> &node_ids, const std::vector<size_t> &groups,
+ *                        const NodeID *positions, size_t n, size_t replicas)
+ * 离线计算每个键由哪些节点存放：对 positions 中的每个位置，取异或距离最近的 replicas 个节点，
+ * 按 groups（节点下标到组号，例如虚拟节点所属的进程；为空时每个节点自成一组）累计。
+ * 与网络中的路由结果一致的前提是各节点的路由表完整
+ */
+inline LoadReport analyzeLoad(const std::vector<NodeID> &node_ids, const std::vector<size_t> &groups,
+							  const NodeID *positions, size_t n, size_t replicas)
+{
+	LoadReport report;
+	size_t num_groups = groups.empty() ? node_ids.size() : *std::max_element(groups.begin(), groups.end()) + 1;
+	report.counts.assign(num_groups, 0);
+	if (node_ids.empty())
+	{
+		return report;
+	}
+	replicas = std::min(std::max<size_t>(replicas, 1), node_ids.size());
+	// 最近的 replicas 个节点按距离升序保存在 best 中，逐个节点插入
+	std::vector<std::pair<NodeID, size_t>> best(replicas);
+	for (size_t k = 0; k < n; k++)
+	{
+		size_t filled = 0;
+		for (size_t i = 0; i < node_ids.size(); i++)
+		{
+			NodeID d = node_ids[i] ^ positions[k];
+			if (filled == replicas && !(d < best[replicas - 1].first))
+			{
+				continue;
+			}
+			size_t j = filled < replicas ? filled++ : replicas - 1;
+			for (; j > 0 && d < best[j - 1].first; j--)
+			{
+				best[j] = best[j - 1];
+			}
+			best[j] = std::make_pair(d, i);
+		}
+		for (size_t j = 0; j < replicas; j++)
+		{
+			report.counts[groups.empty() ? best[j].second : groups[best[j].second]]++;
+		}
+	}
+
+	double sum = 0, sq = 0;
+	for (uint64_t c : report.counts)
+	{
+		sum += c;
+		sq += (double)c * c;
+	}
+	report.mean = sum / num_groups;
+	report.hottest = std::max_element(report.counts.begin(), report.counts.end()) - report.counts.begin();
+	if (report.mean > 0)
+	{
+		report.imbalance = report.counts[report.hottest] / report.mean;
+		report.min_share = *std::min_element(report.counts.begin(), report.counts.end()) / report.mean;
+		report.cv = sqrt(std::max(sq / num_groups - report.mean * report.mean, 0.0)) / report.mean;
+	}
+	return report;
+}
+
+#endif /* INCLUDE_PLACEMENT_HPP_ */
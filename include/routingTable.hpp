@@ -0,0 +1,592 @@
+/*
+ * routingTable.hpp
+ *
+ * Kademlia 路由表：B 位 ID 空间固定分成 B 个 k 桶，第 i 个桶存放与本地节点异或距离最高位为 i 的节点，
+ * 桶号由前导零计数直接得到。每个表项是定长结构：ID 加上驻留地址的指针（地址本身存放在 AddressTable 中，长度不受限制），
+ * 写者按桶加锁，读者不加锁，用每个桶的序列号（seqlock）校验读到的是一致的快照。
+ * 桶的表项在第一次插入时才分配：N 个节点的网络中通常只有约 log2(N) 个桶不为空。
+ * 桶满时不直接挤掉旧节点：新节点进入该桶的替换缓存，由调用方探测最久未联系的节点，
+ * 探测失败后 remove 它，替换缓存中最近联系过的节点随即补入桶中。
+ */
+
+#ifndef INCLUDE_ROUTINGTABLE_HPP_
+#define INCLUDE_ROUTINGTABLE_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "proto/dhash.pb.h"
+#include "kadId.hpp"
+
+/*
+ * 节点地址的驻留表：每个不同的地址只保存一份并计数引用，路由表和位置缓存的表项只保存它的指针，
+ * 读者拿到指针后可以不加锁地读取地址。存放表项的容器（桶、替换缓存、位置缓存）各持有一个引用，
+ * 引用数降为 0 后地址先保留 grace_ms 再释放：读者拷贝出的表项不持有引用，只在一次调用内使用，
+ * 宽限期保证它们读到的地址仍然有效。因此驻留的地址数与当前各表中的节点数同阶，
+ * 对端不断换用新地址时，多出的只是宽限期内被换下的地址。进程内的所有路由表共用一张
+ */
+class AddressTable
+{
+	static const int num_shards = 16;
+	static const int64_t grace_ms = 10 * 1000;
+
+	struct Entry
+	{
+		uint64_t refs = 0;
+		int64_t retired_ms = 0; // 引用数最近一次降为 0 的时间
+		bool queued = false;	// 在 retired 队列中
+	};
+
+	struct alignas(64) Shard
+	{
+		pthread_mutex_t mu = PTHREAD_MUTEX_INITIALIZER;
+		std::unordered_map<std::string, Entry> addresses; // 基于节点的容器，扩容不移动元素
+		std::deque<const std::string *> retired;		   // 引用数降为 0 的地址，大致按时间排序
+	};
+
+	Shard shards[num_shards];
+
+public:
+	// 不析构：静态对象析构之后可能还有路由表在释放引用
+	static AddressTable &instance()
+	{
+		static AddressTable *table = new AddressTable();
+		return *table;
+	}
+
+	// 返回与 address 相等的驻留字符串并增加一个引用，用完后调用 release
+	const std::string *acquire(std::string_view address)
+	{
+		Shard &shard = shardOf(address);
+		pthread_mutex_lock(&shard.mu);
+		auto iter = shard.addresses.try_emplace(std::string(address)).first;
+		iter->second.refs++;
+		sweep(shard);
+		pthread_mutex_unlock(&shard.mu);
+		return &iter->first;
+	}
+
+	void release(const std::string *address)
+	{
+		Shard &shard = shardOf(*address);
+		pthread_mutex_lock(&shard.mu);
+		Entry &entry = shard.addresses.find(*address)->second;
+		if (--entry.refs == 0)
+		{
+			entry.retired_ms = nowMs();
+			if (!entry.queued)
+			{
+				entry.queued = true;
+				shard.retired.push_back(address);
+			}
+		}
+		sweep(shard);
+		pthread_mutex_unlock(&shard.mu);
+	}
+
+	// 驻留的地址数，包括宽限期内尚未释放的
+	uint64_t size()
+	{
+		uint64_t n = 0;
+		for (Shard &shard : shards)
+		{
+			pthread_mutex_lock(&shard.mu);
+			n += shard.addresses.size();
+			pthread_mutex_unlock(&shard.mu);
+		}
+		return n;
+	}
+
+private:
+	Shard &shardOf(std::string_view address)
+	{
+		return shards[std::hash<std::string_view>()(address) % num_shards];
+	}
+
+	/*
+	 * 持锁调用：从队首释放宽限期已过且没有重新被引用的地址，重新被引用的出队。
+	 * 队首的地址后来又降为 0 时时间较新，后面的地址要等它过期，最多多等一个宽限期
+	 */
+	void sweep(Shard &shard)
+	{
+		int64_t now = -1;
+		while (!shard.retired.empty())
+		{
+			auto iter = shard.addresses.find(*shard.retired.front());
+			if (iter->second.refs > 0)
+			{
+				iter->second.queued = false;
+				shard.retired.pop_front();
+				continue;
+			}
+			if (now < 0)
+			{
+				now = nowMs();
+			}
+			if (iter->second.retired_ms + grace_ms > now)
+			{
+				break;
+			}
+			shard.retired.pop_front();
+			shard.addresses.erase(iter);
+		}
+	}
+
+	static int64_t nowMs()
+	{
+		return std::chrono::duration_cast<std::chrono::milliseconds>(
+				   std::chrono::steady_clock::now().time_since_epoch())
+			.count();
+	}
+};
+
+class RoutingTable
+{
+public:
+	static const int num_buckets = NodeID::bits;
+
+	// 路由表中的一个节点：定长、可以按字拷贝
+	struct Contact
+	{
+		NodeID id;
+		const std::string *address; // 驻留在 AddressTable 中的地址，nullptr 表示空表项
+
+		// 返回的表项持有地址的一个引用，由存放它的容器在丢弃表项时 release
+		static Contact of(const Node &node)
+		{
+			Contact c;
+			memset((void *)&c, 0, sizeof(c));
+			c.id = nodeIdOf(node);
+			c.address = AddressTable::instance().acquire(node.address());
+			return c;
+		}
+
+		void release() const
+		{
+			if (address != nullptr)
+			{
+				AddressTable::instance().release(address);
+			}
+		}
+
+		std::string_view addr() const
+		{
+			return address == nullptr ? std::string_view() : std::string_view(*address);
+		}
+
+		void fill(Node *node) const
+		{
+			setNodeId(node, id);
+			node->set_address(std::string(addr()));
+		}
+
+		Node toNode() const
+		{
+			Node node;
+			fill(&node);
+			return node;
+		}
+	};
+	static_assert(sizeof(Contact) % sizeof(uint64_t) == 0, "a contact must be copyable word by word");
+
+private:
+	static const int words_per_contact = sizeof(Contact) / sizeof(uint64_t);
+	static const int id_words = NodeID::num_words; // 表项的前 id_words 个字是 ID
+
+	// 按字存放的表项，读者可以在写者修改时无数据竞争地拷贝，再由序列号判断是否有效
+	struct Slot
+	{
+		std::atomic<uint64_t> words[words_per_contact];
+	};
+
+	struct alignas(64) Bucket
+	{
+		std::atomic<uint64_t> seq{0}; // 奇数表示有写者正在修改
+		std::atomic<uint64_t> count{0};
+		pthread_mutex_t mu = PTHREAD_MUTEX_INITIALIZER;
+		std::atomic<Slot *> slots{nullptr}; // 最近联系过的节点在前，第一次插入时分配，之后不变
+		std::atomic<uint64_t> spare_count{0};
+		Contact *spares = nullptr; // 替换缓存：桶满时联系到的新节点，最近的在后，只在持有 mu 时访问
+	};
+
+	NodeID self_id;
+	uint64_t k;
+	Bucket buckets[num_buckets];
+	std::atomic<uint64_t> promotions{0}; // 从替换缓存补入桶中的节点数
+
+public:
+	// self 为本地节点 ID，k 为每个桶（以及每个桶的替换缓存）最多容纳的节点数
+	RoutingTable(const NodeID &self, uint64_t k_size)
+	{
+		self_id = self;
+		k = std::max<uint64_t>(k_size, 1);
+	}
+
+	~RoutingTable()
+	{
+		for (Bucket &b : buckets)
+		{
+			Slot *slots = b.slots.load(std::memory_order_relaxed);
+			for (uint64_t i = 0; i < b.count.load(std::memory_order_relaxed); i++)
+			{
+				slotContact(slots[i]).release();
+			}
+			for (uint64_t i = 0; i < b.spare_count.load(std::memory_order_relaxed); i++)
+			{
+				b.spares[i].release();
+			}
+			delete[] slots;
+			delete[] b.spares;
+		}
+	}
+
+	RoutingTable(const RoutingTable &) = delete;
+	RoutingTable &operator=(const RoutingTable &) = delete;
+
+	// 异或距离最高位的位置，dis 不能为 0
+	static int bucketOf(const NodeID &dis)
+	{
+		return NodeID::bits - 1 - dis.leadingZeros();
+	}
+
+	/*
+	 * 把 node 移到所在桶的最前面；不在表中时插入。桶已满时 node 放进替换缓存（缓存满时丢弃其中最旧的），
+	 * 桶不变并返回 false，stale 非空时填入桶中最久未联系的节点，由调用方探测它是否还在线。
+	 * 桶和替换缓存中的每个表项持有地址的一个引用，被覆盖或丢弃的表项在这里 release
+	 */
+	bool update(const Node &node, Contact *stale = nullptr)
+	{
+		if (nodeIdOf(node) == self_id)
+		{
+			return true;
+		}
+		Contact c = Contact::of(node);
+
+		Bucket &b = buckets[bucketOf(c.id ^ self_id)];
+		pthread_mutex_lock(&b.mu);
+		Slot *slots = b.slots.load(std::memory_order_relaxed);
+		if (slots == nullptr)
+		{
+			b.spares = new Contact[k];
+			slots = new Slot[k];
+			b.slots.store(slots, std::memory_order_release);
+		}
+		uint64_t n = b.count.load(std::memory_order_relaxed);
+		uint64_t i = 0;
+		while (i < n && !slotHasId(slots[i], c.id))
+		{
+			i++;
+		}
+		// 已经在最前面且地址没变时不需要修改，读者也不用重试
+		if (i == 0 && n > 0 && sameContact(slots[0], c))
+		{
+			pthread_mutex_unlock(&b.mu);
+			c.release();
+			return true;
+		}
+		if (i == n && n == k)
+		{
+			addSpare(b, c);
+			if (stale != nullptr)
+			{
+				loadSlot(slots[n - 1], *stale);
+			}
+			pthread_mutex_unlock(&b.mu);
+			return false;
+		}
+		// 节点已在桶中时，它原来的表项被前移覆盖，地址可能已经改变
+		Contact replaced = {};
+		if (i < n)
+		{
+			loadSlot(slots[i], replaced);
+		}
+		writeBegin(b);
+		if (i == n)
+		{
+			b.count.store(++n, std::memory_order_relaxed);
+		}
+		// 找到时前移 [0, i)，否则前移整个桶
+		for (uint64_t j = std::min(i, n - 1); j > 0; j--)
+		{
+			copySlot(slots[j], slots[j - 1]);
+		}
+		storeSlot(slots[0], c);
+		writeEnd(b);
+		pthread_mutex_unlock(&b.mu);
+		replaced.release();
+		return true;
+	}
+
+	/*
+	 * 删除 ID 为 id 的节点，返回它是否在桶中。替换缓存不为空时，其中最近联系过的节点补到桶的末尾；
+	 * id 只在替换缓存中时从缓存删除
+	 */
+	bool remove(const NodeID &id)
+	{
+		if (id == self_id)
+		{
+			return false;
+		}
+		Bucket &b = buckets[bucketOf(id ^ self_id)];
+		bool found = false;
+		pthread_mutex_lock(&b.mu);
+		Slot *slots = b.slots.load(std::memory_order_relaxed);
+		uint64_t n = b.count.load(std::memory_order_relaxed);
+		for (uint64_t i = 0; i < n; i++)
+		{
+			if (slotHasId(slots[i], id))
+			{
+				slotContact(slots[i]).release();
+				writeBegin(b);
+				for (uint64_t j = i; j + 1 < n; j++)
+				{
+					copySlot(slots[j], slots[j + 1]);
+				}
+				uint64_t spares = b.spare_count.load(std::memory_order_relaxed);
+				if (spares > 0)
+				{
+					storeSlot(slots[n - 1], b.spares[spares - 1]);
+					b.spare_count.store(spares - 1, std::memory_order_relaxed);
+					promotions.fetch_add(1, std::memory_order_relaxed);
+				}
+				else
+				{
+					b.count.store(n - 1, std::memory_order_relaxed);
+				}
+				writeEnd(b);
+				found = true;
+				break;
+			}
+		}
+		if (!found)
+		{
+			removeSpare(b, id);
+		}
+		pthread_mutex_unlock(&b.mu);
+		return found;
+	}
+
+	// id 是否在桶中（不含替换缓存），不加锁
+	bool contains(const NodeID &id)
+	{
+		if (id == self_id)
+		{
+			return false;
+		}
+		for (const Contact &c : bucket(bucketOf(id ^ self_id)))
+		{
+			if (c.id == id)
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	/*
+	 * 返回离 target 最近的 n 个节点，按异或距离升序。先把所有桶拷贝到一个平坦数组，再用 closestK 选出前 n 个
+	 */
+	std::vector<Contact> closest(const NodeID &target, uint64_t n)
+	{
+		std::vector<Contact> all = snapshot();
+		closestK(all, target, n, [](const Contact &c) -> const NodeID &
+				 { return c.id; });
+		return all;
+	}
+
+	// 所有桶中节点的一致快照（每个桶各自一致），按桶号升序
+	std::vector<Contact> snapshot()
+	{
+		std::vector<Contact> all;
+		for (int i = 0; i < num_buckets; i++)
+		{
+			readBucket(i, all);
+		}
+		return all;
+	}
+
+	// 单个桶的快照，最近联系过的节点在前
+	std::vector<Contact> bucket(int i)
+	{
+		std::vector<Contact> out;
+		readBucket(i, out);
+		return out;
+	}
+
+	// 第 i 个桶中的节点数，不加锁
+	uint64_t bucketSize(int i)
+	{
+		return buckets[i].count.load(std::memory_order_relaxed);
+	}
+
+	uint64_t size()
+	{
+		uint64_t n = 0;
+		for (Bucket &b : buckets)
+		{
+			n += b.count.load(std::memory_order_relaxed);
+		}
+		return n;
+	}
+
+	// 所有替换缓存中的节点数，不加锁
+	uint64_t spareSize()
+	{
+		uint64_t n = 0;
+		for (Bucket &b : buckets)
+		{
+			n += b.spare_count.load(std::memory_order_relaxed);
+		}
+		return n;
+	}
+
+	uint64_t promoted()
+	{
+		return promotions.load(std::memory_order_relaxed);
+	}
+
+private:
+	// 把 c 放到替换缓存的末尾（c 的地址引用转交给缓存），已在缓存中时先删除旧的一项，缓存满时丢弃最旧的一项。调用方持有 mu
+	void addSpare(Bucket &b, const Contact &c)
+	{
+		removeSpare(b, c.id);
+		uint64_t n = b.spare_count.load(std::memory_order_relaxed);
+		if (n == k)
+		{
+			b.spares[0].release();
+			std::copy(b.spares + 1, b.spares + n, b.spares);
+			n--;
+		}
+		b.spares[n] = c;
+		b.spare_count.store(n + 1, std::memory_order_relaxed);
+	}
+
+	void removeSpare(Bucket &b, const NodeID &id)
+	{
+		uint64_t n = b.spare_count.load(std::memory_order_relaxed);
+		uint64_t kept = 0;
+		for (uint64_t i = 0; i < n; i++)
+		{
+			if (b.spares[i].id == id)
+			{
+				b.spares[i].release();
+			}
+			else
+			{
+				b.spares[kept++] = b.spares[i];
+			}
+		}
+		b.spare_count.store(kept, std::memory_order_relaxed);
+	}
+
+	void readBucket(int i, std::vector<Contact> &out)
+	{
+		Bucket &b = buckets[i];
+		Slot *slots = b.slots.load(std::memory_order_acquire);
+		if (slots == nullptr || b.count.load(std::memory_order_relaxed) == 0)
+		{
+			return;
+		}
+		size_t base = out.size();
+		while (true)
+		{
+			uint64_t s1 = b.seq.load(std::memory_order_acquire);
+			if (s1 & 1)
+			{
+				continue;
+			}
+			uint64_t n = std::min(b.count.load(std::memory_order_relaxed), k);
+			out.resize(base + n);
+			for (uint64_t j = 0; j < n; j++)
+			{
+				loadSlot(slots[j], out[base + j]);
+			}
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (b.seq.load(std::memory_order_relaxed) == s1)
+			{
+				return;
+			}
+			out.resize(base);
+		}
+	}
+
+	static void loadSlot(const Slot &s, Contact &c)
+	{
+		uint64_t *w = (uint64_t *)&c;
+		for (int i = 0; i < words_per_contact; i++)
+		{
+			w[i] = s.words[i].load(std::memory_order_relaxed);
+		}
+	}
+
+	static Contact slotContact(const Slot &s)
+	{
+		Contact c;
+		loadSlot(s, c);
+		return c;
+	}
+
+	static void storeSlot(Slot &s, const Contact &c)
+	{
+		const uint64_t *w = (const uint64_t *)&c;
+		for (int i = 0; i < words_per_contact; i++)
+		{
+			s.words[i].store(w[i], std::memory_order_relaxed);
+		}
+	}
+
+	static void copySlot(Slot &dst, const Slot &src)
+	{
+		for (int i = 0; i < words_per_contact; i++)
+		{
+			dst.words[i].store(src.words[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+		}
+	}
+
+	// 表项的 ID 是否为 id，只读 ID 所在的字
+	static bool slotHasId(const Slot &s, const NodeID &id)
+	{
+		uint64_t diff = 0;
+		for (int i = 0; i < id_words; i++)
+		{
+			diff |= s.words[i].load(std::memory_order_relaxed) ^ id.w[i];
+		}
+		return diff == 0;
+	}
+
+	static bool sameContact(const Slot &s, const Contact &c)
+	{
+		const uint64_t *w = (const uint64_t *)&c;
+		for (int i = 0; i < words_per_contact; i++)
+		{
+			if (s.words[i].load(std::memory_order_relaxed) != w[i])
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	static void writeBegin(Bucket &b)
+	{
+		b.seq.store(b.seq.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+	}
+
+	static void writeEnd(Bucket &b)
+	{
+		b.seq.store(b.seq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+};
+
+#endif /* INCLUDE_ROUTINGTABLE_HPP_ */
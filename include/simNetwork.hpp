@@ -0,0 +1,321 @@
+/*
+ * simNetwork.hpp
+ *
+ * 确定性的进程内网络仿真：同一进程中成千上万个节点的一元 RPC 经仿真网络投递，
+ * 消息的到达、应答、超时以及节点的定时器（存活探测、仲裁超时等）都是离散事件，
+ * 按虚拟时间的先后（同一时刻按加入顺序）在调用 run 的线程中依次执行，不使用其他线程。
+ * 链路时延由两端的监听地址决定（基准加上按链路固定的偏移，再加每个消息的随机抖动），可以逐条覆盖；
+ * 请求和应答分别按链路的丢失率丢弃，丢失或对端不在线的调用在 timeout_ms 后以超时失败。
+ * 所有随机数都来自一个以 seed 初始化的生成器，同样的配置和同样的调用顺序得到同样的结果。
+ * 每个节点通过 endpoint(address) 取得自己的传输层（调用方需要知道发送方来计算链路），
+ * 并把仿真网络设为它的 Scheduler。
+ */
+
+#ifndef INCLUDE_SIMNETWORK_HPP_
+#define INCLUDE_SIMNETWORK_HPP_
+
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <stdint.h>
+
+#include "channelPool.hpp"
+#include "transport.hpp"
+
+class SimNetwork : public Scheduler
+{
+public:
+	static const int num_methods = (int)KadMethod::PING + 1;
+
+	struct Options
+	{
+		int64_t latency_us = 20000;		   // 单向时延的基准
+		int64_t latency_spread_us = 30000; // 每条链路在基准之上固定增加 [0, spread] 的时延，由两端的地址决定
+		int64_t jitter_us = 2000;		   // 每个消息再随机增加 [0, jitter] 的时延
+		double loss = 0;				   // 每个请求和应答各自丢失的概率
+		int64_t timeout_ms = 2000;		   // 调用发出后这么久还没有应答时以超时失败
+		uint64_t seed = 1;				   // 随机数种子
+	};
+
+	// 覆盖一条链路（两个方向相同）的时延和丢失率
+	struct Link
+	{
+		int64_t latency_us;
+		double loss;
+	};
+
+	struct Stats
+	{
+		uint64_t events;			   // 执行的事件数
+		uint64_t sent[num_methods];	   // 按方法统计的请求数
+		uint64_t messages;			   // 请求和应答的总数（不含丢失的应答）
+		uint64_t lost;				   // 丢失的请求和应答数
+		uint64_t unreachable;		   // 发往不在线或不存在的节点的请求数
+		uint64_t timeouts;			   // 以超时失败的调用数
+	};
+
+private:
+	struct Event
+	{
+		int64_t at;
+		uint64_t seq;
+		std::function<void()> fn;
+	};
+
+	// 堆顶是最早的事件，同一时刻先加入的在前
+	struct Later
+	{
+		bool operator()(const Event &a, const Event &b) const
+		{
+			return a.at != b.at ? a.at > b.at : a.seq > b.seq;
+		}
+	};
+
+	struct Peer
+	{
+		LocalPeer *peer;
+		bool up;
+	};
+
+	// 一个节点的传输层：记住发送方的地址，其余交给仿真网络
+	class Endpoint : public Transport
+	{
+		SimNetwork *net;
+		std::string address;
+
+	public:
+		Endpoint(SimNetwork *n, const std::string &a) : net(n), address(a) {}
+
+		bool attach(const std::string &a, LocalPeer *peer) override
+		{
+			net->attach(a, peer);
+			return true;
+		}
+
+		void detach(const std::string &a) override
+		{
+			net->peers.erase(a);
+		}
+
+		// 仿真中所有地址都经仿真网络，不存在的地址按不在线处理
+		bool reaches(const std::string &, KadMethod) override
+		{
+			return true;
+		}
+
+		bool send(const std::string &to, KadMethod method, const google::protobuf::Message *request,
+				  google::protobuf::Message *response, Done done) override
+		{
+			net->deliver(address, to, method, request, response, std::move(done));
+			return true;
+		}
+	};
+
+	Options opts;
+	std::mt19937_64 rng;
+	int64_t now = 0;
+	uint64_t next_seq = 0;
+	std::vector<Event> queue; // 按 Later 组织的堆
+	std::unordered_map<std::string, Peer> peers;
+	std::unordered_map<std::string, std::unique_ptr<Endpoint>> endpoints;
+	std::map<std::pair<std::string, std::string>, Link> links; // 按两端的监听地址排序后的键
+	Stats stats_ = {};
+
+public:
+	explicit SimNetwork(const Options &o) : opts(o), rng(o.seed) {}
+
+	SimNetwork(const SimNetwork &) = delete;
+	SimNetwork &operator=(const SimNetwork &) = delete;
+
+	int64_t nowUs() override
+	{
+		return now;
+	}
+
+	void after(int64_t us, std::function<void()> fn) override
+	{
+		push(now + std::max<int64_t>(us, 0), std::move(fn));
+	}
+
+	// 监听 address 的节点使用的传输层，由仿真网络持有
+	Transport *endpoint(const std::string &address)
+	{
+		std::unique_ptr<Endpoint> &e = endpoints[address];
+		if (!e)
+		{
+			e.reset(new Endpoint(this, address));
+		}
+		return e.get();
+	}
+
+	// 节点上线或下线（例如模拟崩溃）：下线的节点不再收到请求，它发出的请求也到不了对端
+	void setUp(const std::string &address, bool up)
+	{
+		auto it = peers.find(address);
+		if (it != peers.end())
+		{
+			it->second.up = up;
+		}
+	}
+
+	void setLink(const std::string &a, const std::string &b, const Link &link)
+	{
+		links[linkKey(a, b)] = link;
+	}
+
+	// 仿真器自身的随机数，与网络共用一个种子，调用方据此生成的负载同样是确定的
+	std::mt19937_64 &random()
+	{
+		return rng;
+	}
+
+	// 执行时间不晚于 until_us 的所有事件，之后虚拟时间停在 until_us
+	void runUntil(int64_t until_us)
+	{
+		while (!queue.empty() && queue.front().at <= until_us)
+		{
+			std::pop_heap(queue.begin(), queue.end(), Later());
+			Event e = std::move(queue.back());
+			queue.pop_back();
+			now = e.at;
+			stats_.events++;
+			e.fn();
+		}
+		now = std::max(now, until_us);
+	}
+
+	// 尚未执行的事件数
+	size_t pending()
+	{
+		return queue.size();
+	}
+
+	Stats stats()
+	{
+		return stats_;
+	}
+
+private:
+	void attach(const std::string &address, LocalPeer *peer)
+	{
+		peers[address] = Peer{peer, true};
+	}
+
+	void push(int64_t at, std::function<void()> fn)
+	{
+		queue.push_back(Event{at, next_seq++, std::move(fn)});
+		std::push_heap(queue.begin(), queue.end(), Later());
+	}
+
+	static std::pair<std::string, std::string> linkKey(const std::string &a, const std::string &b)
+	{
+		std::string x = endpointOf(a), y = endpointOf(b);
+		return x < y ? std::make_pair(x, y) : std::make_pair(y, x);
+	}
+
+	// 链路的固定时延和丢失率：没有覆盖时由两端的地址和种子算出，两个方向相同
+	Link link(const std::string &a, const std::string &b)
+	{
+		std::pair<std::string, std::string> key = linkKey(a, b);
+		if (!links.empty())
+		{
+			auto it = links.find(key);
+			if (it != links.end())
+			{
+				return it->second;
+			}
+		}
+		uint64_t h = std::hash<std::string>()(key.first) * 0x9e3779b97f4a7c15ULL ^ std::hash<std::string>()(key.second) ^ opts.seed;
+		h = (h ^ (h >> 31)) * 0xbf58476d1ce4e5b9ULL;
+		return Link{opts.latency_us + (int64_t)((h >> 16) % (uint64_t)(opts.latency_spread_us + 1)), opts.loss};
+	}
+
+	int64_t travel(const Link &l)
+	{
+		return l.latency_us + (opts.jitter_us > 0 ? (int64_t)(rng() % (uint64_t)(opts.jitter_us + 1)) : 0);
+	}
+
+	bool lose(const Link &l)
+	{
+		return l.loss > 0 && std::uniform_real_distribution<double>(0, 1)(rng) < l.loss;
+	}
+
+	bool isUp(const std::string &address)
+	{
+		auto it = peers.find(address);
+		return it != peers.end() && it->second.up;
+	}
+
+	void timeout(int64_t deadline, Transport::Done done)
+	{
+		stats_.timeouts++;
+		push(deadline, [done]
+			 { done(grpc::Status(grpc::StatusCode::DEADLINE_EXCEEDED, "sim: deadline exceeded")); });
+	}
+
+	/*
+	 * 一次调用：请求经过一次链路时延到达对端，在到达的时刻由对端处理，应答再经过一次链路时延回到发送方。
+	 * 请求或应答丢失、对端不在线、或者应答赶不上截止时间时，调用在截止时间以超时失败
+	 */
+	void deliver(const std::string &from, const std::string &to, KadMethod method,
+				 const google::protobuf::Message *request, google::protobuf::Message *response, Transport::Done done)
+	{
+		stats_.sent[(int)method]++;
+		int64_t deadline = now + opts.timeout_ms * 1000;
+		if (!isUp(from) || !isUp(to))
+		{
+			stats_.unreachable++;
+			timeout(deadline, std::move(done));
+			return;
+		}
+		Link l = link(from, to);
+		if (lose(l))
+		{
+			stats_.lost++;
+			timeout(deadline, std::move(done));
+			return;
+		}
+		int64_t arrive = now + travel(l);
+		if (arrive >= deadline)
+		{
+			timeout(deadline, std::move(done));
+			return;
+		}
+		stats_.messages++;
+		push(arrive, [this, to, l, method, request, response, deadline, done]() mutable
+			 {
+				 // 请求在途中时对端下线
+				 auto it = peers.find(to);
+				 if (it == peers.end() || !it->second.up)
+				 {
+					 stats_.unreachable++;
+					 timeout(deadline, std::move(done));
+					 return;
+				 }
+				 grpc::Status status = it->second.peer->serveLocal(method, request, response);
+				 if (lose(l))
+				 {
+					 stats_.lost++;
+					 timeout(deadline, std::move(done));
+					 return;
+				 }
+				 int64_t back = now + travel(l);
+				 if (back >= deadline)
+				 {
+					 timeout(deadline, std::move(done));
+					 return;
+				 }
+				 stats_.messages++;
+				 push(back, [done, status]
+					  { done(status); }); });
+	}
+};
+
+#endif /* INCLUDE_SIMNETWORK_HPP_ */
@@ -0,0 +1,101 @@
+/*
+ * transport.hpp
+ *
+ * 节点之间一元 RPC 的传输层接口。KadRpc 默认经 gRPC 的完成队列发送；设置了传输层后，
+ * 传输层能送达的地址（例如同一进程中的节点）改由它投递，其余地址仍走 gRPC。
+ * 请求和应答以 proto 消息对象的形式传递，传输层不必序列化。
+ */
+
+#ifndef INCLUDE_TRANSPORT_HPP_
+#define INCLUDE_TRANSPORT_HPP_
+
+#include <functional>
+#include <string>
+
+#include <stdint.h>
+
+#include <grpcpp/support/status.h>
+
+#include "proto/dhash.pb.h"
+
+// 一元 RPC 方法，与 proto 中 KadImpl 的一元方法一一对应
+enum class KadMethod
+{
+	FIND_NODE,
+	FIND_VALUE,
+	STORE,
+	EXIT,
+	STORE_BATCH,
+	FIND_VALUE_BATCH,
+	STATS,
+	PING
+};
+
+/*
+ * Scheduler
+ * 时钟和定时器。默认使用真实时间；仿真网络等自带虚拟时间的环境实现它，
+ * 交给 KadRpc 后，超时重试、仲裁超时、存活探测等定时操作都按它的时间推进
+ */
+class Scheduler
+{
+public:
+	virtual ~Scheduler() {}
+	// 当前时间（微秒），只用于计算间隔
+	virtual int64_t nowUs() = 0;
+	// us 微秒后调用 fn
+	virtual void after(int64_t us, std::function<void()> fn) = 0;
+};
+
+/*
+ * LocalPeer
+ * 可以在本进程内直接处理请求的节点。request / response 是 method 对应的 proto 类型
+ */
+class LocalPeer
+{
+public:
+	virtual ~LocalPeer() {}
+	virtual grpc::Status serveLocal(KadMethod method, const google::protobuf::Message *request,
+									google::protobuf::Message *response) = 0;
+};
+
+class Transport
+{
+public:
+	using Done = std::function<void(const grpc::Status &)>;
+
+	virtual ~Transport() {}
+
+	// 把本进程中监听 address 的节点登记到传输层，之后发往 address 的请求由传输层交给 peer。
+	// 传输层收不到发往 address 的请求（例如没能绑定这个地址）时返回 false，不登记
+	virtual bool attach(const std::string &address, LocalPeer *peer) = 0;
+
+	// 注销 address，之后发往它的请求改走 gRPC；已经投递的请求仍会被处理
+	virtual void detach(const std::string &address) = 0;
+
+	// 是否能把发往 address 的 method 请求送达，用于在准备请求之前快速判断
+	virtual bool reaches(const std::string &address, KadMethod method) = 0;
+
+	/*
+	 * 把 request 交给 address 上的节点处理，应答写入 response，完成后在传输层的线程中调用 done。
+	 * request 和 response 归调用方所有，在 done 被调用之前必须保持有效，传输层只传递它们的指针。
+	 * address 不能送达（例如刚被注销）时返回 false，不调用 done。done 中不应阻塞
+	 */
+	virtual bool send(const std::string &address, KadMethod method, const google::protobuf::Message *request,
+					  google::protobuf::Message *response, Done done) = 0;
+
+	/*
+	 * 传输层接受了请求但无法完成（例如应答太大、重传后仍没有应答）时，以这个状态调用 done，
+	 * 调用方应改经 gRPC 重发同一个请求
+	 */
+	static grpc::Status fallback()
+	{
+		return grpc::Status(grpc::StatusCode::UNIMPLEMENTED, "transport: fall back to grpc");
+	}
+
+	static bool isFallback(const grpc::Status &status)
+	{
+		return status.error_code() == grpc::StatusCode::UNIMPLEMENTED && status.error_message() == "transport: fall back to grpc";
+	}
+};
+
+#endif /* INCLUDE_TRANSPORT_HPP_ */
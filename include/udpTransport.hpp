@@ -0,0 +1,644 @@
+/*
+ * udpTransport.hpp
+ *
+ * 数据报传输：find_node、find_value 和 ping 这类小请求经 UDP 收发，省去 HTTP/2 的帧、流控和每次调用的流建立。
+ * 每个监听地址（host:port）一个 UdpTransport，在与 gRPC 相同的 ip:port 上绑定 UDP 套接字，
+ * 由一个专用的反应器线程用 sendmmsg / recvmmsg 成批收发，既发出本进程节点的请求，也直接处理对端发来的请求。
+ * 每个数据报是一个 16 字节的定长头加上 proto 序列化的消息体：
+ *   magic(2) version(1) type(1) method(1) status(1) vnode(2) request_id(8)，多字节字段按网络字节序。
+ * 请求按 retry_ms 重传，attempts 次都没有应答时以 Transport::fallback() 完成，由 KadRpc 改走 gRPC，
+ * 并在 silent_ms 内不再经 UDP 发往这个地址（例如对端没有开启 UDP）；
+ * 应答装不进 max_datagram 字节（例如较大的值）时对端回复 fallback 类型的数据报，同样改走 gRPC。
+ * store 和批量方法不经 UDP。只支持数字形式的 IPv4 地址，其余地址由 reaches 拒绝，仍走 gRPC。
+ */
+
+#ifndef INCLUDE_UDPTRANSPORT_HPP_
+#define INCLUDE_UDPTRANSPORT_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <endian.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "channelPool.hpp"
+#include "localTransport.hpp"
+#include "logger.hpp"
+#include "transport.hpp"
+
+class UdpTransport : public Transport
+{
+public:
+	struct Options
+	{
+		int64_t retry_ms = 20;		// 没有应答时的重传间隔
+		int attempts = 3;			// 包括第一次在内的发送次数，之后改走 gRPC
+		size_t max_datagram = 1400; // 数据报的最大字节数（含头），应答更大时改走 gRPC
+		int batch = 64;				// 一次 sendmmsg / recvmmsg 的数据报数
+		int64_t silent_ms = 5000;	// 重传后仍没有应答的地址在这段时间内直接走 gRPC
+	};
+
+	struct Stats
+	{
+		uint64_t packets_sent;	   // 发出的数据报数，含重传和应答
+		uint64_t packets_received; // 收到的数据报数
+		uint64_t served;		   // 处理的对端请求数
+		uint64_t retransmits;	   // 重传次数
+		uint64_t fallbacks;		   // 改走 gRPC 的请求数
+	};
+
+private:
+	static constexpr uint16_t magic = 0x4448; // "DH"
+	static constexpr uint8_t version = 1;
+	static constexpr size_t header_size = 16;
+	static constexpr int spins = 64;
+
+	enum Type : uint8_t
+	{
+		REQUEST = 0,
+		RESPONSE = 1,
+		FALLBACK = 2 // 对端不能经 UDP 应答，请求方改走 gRPC
+	};
+
+	struct Header
+	{
+		uint8_t type;
+		uint8_t method;
+		uint8_t status; // 应答的 grpc::StatusCode
+		uint16_t vnode;
+		uint64_t id;
+	};
+
+	// 一个在途的请求，由发送方创建，反应器线程完成后释放
+	struct Pending : MpscQueue::Item
+	{
+		uint64_t id;
+		sockaddr_in to;
+		std::string datagram; // 头加请求体，重传时原样再发
+		google::protobuf::Message *response;
+		Done done;
+		int sent = 0;		  // 已发送次数
+		int64_t last_us = 0;  // 最近一次发送的时间
+	};
+
+	Options opts;
+	std::string endpoint; // 绑定的 host:port
+	int fd = -1;
+	bool is_bound = false; // 是否绑定在 endpoint 上，没有时不能接收对端的请求
+	int wake_fd = -1;
+
+	std::shared_mutex mu; // 保护 peers
+	std::unordered_map<uint16_t, LocalPeer *> peers; // 按虚拟节点序号
+
+	std::mutex silent_mu; // 保护 silent
+	std::unordered_map<uint64_t, int64_t> silent; // (ip << 16 | port) -> 恢复经 UDP 发送的时间（微秒）
+	std::atomic<size_t> num_silent{0};
+
+	MpscQueue queue; // 待发出的请求
+	std::atomic<uint64_t> next_id{1};
+	std::atomic<bool> sleeping{false};
+	std::atomic<bool> stopping{false};
+	std::thread reactor;
+
+	std::atomic<uint64_t> packets_sent{0};
+	std::atomic<uint64_t> packets_received{0};
+	std::atomic<uint64_t> served{0};
+	std::atomic<uint64_t> retransmits{0};
+	std::atomic<uint64_t> fallbacks{0};
+
+	// 以下只由反应器线程访问
+	std::unordered_map<uint64_t, Pending *> inflight;
+	std::vector<mmsghdr> out_msgs;
+	std::vector<iovec> out_iov;
+	std::vector<sockaddr_in> out_addrs;
+	std::vector<std::string> replies; // 本批应答的数据报
+	size_t num_out = 0;
+	std::vector<mmsghdr> in_msgs;
+	std::vector<iovec> in_iov;
+	std::vector<sockaddr_in> in_addrs;
+	std::vector<char> in_buf;
+	size_t in_size;
+	IDKey request;
+	NodeList node_list;
+	KV_Node_Wrapper kv_node;
+	IDKey ack;
+
+public:
+	/*
+	 * 在 endpoint（host:port，与 gRPC 服务端的监听地址相同）上绑定 UDP 套接字并启动反应器线程。
+	 * 绑定失败时 bound() 为 false，attach 拒绝登记节点，调用方由 NodeKadImpl::setTransport 的返回值得知
+	 */
+	UdpTransport(const std::string &address, const Options &options)
+		: opts(options), endpoint(endpointOf(address))
+	{
+		opts.attempts = std::max(opts.attempts, 1);
+		opts.batch = std::max(opts.batch, 1);
+		opts.max_datagram = std::max(opts.max_datagram, header_size + 64);
+		fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		int buf = 4 << 20;
+		setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &buf, sizeof(buf));
+		setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &buf, sizeof(buf));
+		sockaddr_in addr;
+		uint16_t vnode;
+		if (!parse(endpoint, addr, vnode))
+		{
+			DLOG(ERROR, "udp transport cannot bind %s: not a numeric IPv4 host:port", endpoint.c_str());
+		}
+		else if (bind(fd, (sockaddr *)&addr, sizeof(addr)) != 0)
+		{
+			DLOG(ERROR, "udp transport cannot bind %s: %s", endpoint.c_str(), strerror(errno));
+		}
+		else
+		{
+			is_bound = true;
+		}
+		wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		out_msgs.resize(opts.batch);
+		out_iov.resize(opts.batch);
+		out_addrs.resize(opts.batch);
+		replies.resize(opts.batch);
+		in_size = std::max<size_t>(opts.max_datagram, 2048);
+		in_msgs.resize(opts.batch);
+		in_iov.resize(opts.batch);
+		in_addrs.resize(opts.batch);
+		in_buf.resize(in_size * opts.batch);
+		reactor = std::thread([this]
+							  { run(); });
+	}
+
+	// 停止反应器，还没有完成的请求以 CANCELLED 完成
+	~UdpTransport()
+	{
+		stopping.store(true);
+		wake();
+		reactor.join();
+		while (Pending *p = static_cast<Pending *>(queue.pop()))
+		{
+			inflight[p->id] = p;
+		}
+		for (auto &kv : inflight)
+		{
+			kv.second->done(grpc::Status(grpc::StatusCode::CANCELLED, "udp transport closed"));
+			delete kv.second;
+		}
+		close(fd);
+		close(wake_fd);
+	}
+
+	UdpTransport(const UdpTransport &) = delete;
+	UdpTransport &operator=(const UdpTransport &) = delete;
+
+	// 只接受监听地址与本传输层相同的虚拟节点，其余地址以及没能绑定时返回 false
+	bool attach(const std::string &address, LocalPeer *peer) override
+	{
+		sockaddr_in addr;
+		uint16_t vnode;
+		if (!is_bound || endpointOf(address) != endpoint || !parse(address, addr, vnode))
+		{
+			return false;
+		}
+		std::unique_lock<std::shared_mutex> lock(mu);
+		peers[vnode] = peer;
+		return true;
+	}
+
+	void detach(const std::string &address) override
+	{
+		sockaddr_in addr;
+		uint16_t vnode;
+		if (endpointOf(address) == endpoint && parse(address, addr, vnode))
+		{
+			std::unique_lock<std::shared_mutex> lock(mu);
+			peers.erase(vnode);
+		}
+	}
+
+	bool reaches(const std::string &address, KadMethod method) override
+	{
+		if (method != KadMethod::FIND_NODE && method != KadMethod::FIND_VALUE && method != KadMethod::PING)
+		{
+			return false;
+		}
+		sockaddr_in addr;
+		uint16_t vnode;
+		return parse(address, addr, vnode) && !isSilent(addr);
+	}
+
+	bool send(const std::string &address, KadMethod method, const google::protobuf::Message *request,
+			  google::protobuf::Message *response, Done done) override
+	{
+		Pending *p = new Pending();
+		uint16_t vnode;
+		size_t body = request->ByteSizeLong();
+		if (!parse(address, p->to, vnode) || header_size + body > opts.max_datagram)
+		{
+			delete p;
+			return false;
+		}
+		p->id = next_id.fetch_add(1, std::memory_order_relaxed);
+		p->datagram.resize(header_size + body);
+		writeHeader(&p->datagram[0], Header{REQUEST, (uint8_t)method, 0, vnode, p->id});
+		request->SerializeWithCachedSizesToArray((uint8_t *)&p->datagram[header_size]);
+		p->response = response;
+		p->done = std::move(done);
+		queue.push(p);
+		if (sleeping.load(std::memory_order_seq_cst))
+		{
+			wake();
+		}
+		return true;
+	}
+
+	bool bound()
+	{
+		return is_bound;
+	}
+
+	Stats stats()
+	{
+		Stats s;
+		s.packets_sent = packets_sent.load(std::memory_order_relaxed);
+		s.packets_received = packets_received.load(std::memory_order_relaxed);
+		s.served = served.load(std::memory_order_relaxed);
+		s.retransmits = retransmits.load(std::memory_order_relaxed);
+		s.fallbacks = fallbacks.load(std::memory_order_relaxed);
+		return s;
+	}
+
+private:
+	static int64_t nowUs()
+	{
+		return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	// 解析 a.b.c.d:port[#vnode]，不是数字形式的 IPv4 地址时返回 false
+	static bool parse(const std::string &address, sockaddr_in &addr, uint16_t &vnode)
+	{
+		size_t hash = address.rfind('#');
+		size_t colon = address.rfind(':', hash);
+		if (colon == std::string::npos || colon == 0)
+		{
+			return false;
+		}
+		char host[INET_ADDRSTRLEN];
+		if (colon >= sizeof(host))
+		{
+			return false;
+		}
+		memcpy(host, address.data(), colon);
+		host[colon] = '\0';
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		if (inet_pton(AF_INET, host, &addr.sin_addr) != 1)
+		{
+			return false;
+		}
+		addr.sin_port = htons((uint16_t)atoi(address.c_str() + colon + 1));
+		vnode = hash == std::string::npos ? 0 : (uint16_t)atoi(address.c_str() + hash + 1);
+		return true;
+	}
+
+	static uint64_t keyOf(const sockaddr_in &addr)
+	{
+		return (uint64_t)addr.sin_addr.s_addr << 16 | addr.sin_port;
+	}
+
+	static void writeHeader(char *out, const Header &h)
+	{
+		uint16_t m = htons(magic), v = htons(h.vnode);
+		uint64_t id = htobe64(h.id);
+		memcpy(out, &m, 2);
+		out[2] = version;
+		out[3] = h.type;
+		out[4] = h.method;
+		out[5] = h.status;
+		memcpy(out + 6, &v, 2);
+		memcpy(out + 8, &id, 8);
+	}
+
+	static bool readHeader(const char *in, size_t len, Header &h)
+	{
+		uint16_t m, v;
+		uint64_t id;
+		if (len < header_size)
+		{
+			return false;
+		}
+		memcpy(&m, in, 2);
+		if (ntohs(m) != magic || (uint8_t)in[2] != version)
+		{
+			return false;
+		}
+		memcpy(&v, in + 6, 2);
+		memcpy(&id, in + 8, 8);
+		h = Header{(uint8_t)in[3], (uint8_t)in[4], (uint8_t)in[5], ntohs(v), be64toh(id)};
+		return true;
+	}
+
+	bool isSilent(const sockaddr_in &addr)
+	{
+		if (num_silent.load(std::memory_order_relaxed) == 0)
+		{
+			return false;
+		}
+		std::lock_guard<std::mutex> guard(silent_mu);
+		auto it = silent.find(keyOf(addr));
+		if (it == silent.end())
+		{
+			return false;
+		}
+		if (it->second > nowUs())
+		{
+			return true;
+		}
+		silent.erase(it);
+		num_silent.store(silent.size(), std::memory_order_relaxed);
+		return false;
+	}
+
+	void markSilent(const sockaddr_in &addr)
+	{
+		std::lock_guard<std::mutex> guard(silent_mu);
+		silent[keyOf(addr)] = nowUs() + opts.silent_ms * 1000;
+		num_silent.store(silent.size(), std::memory_order_relaxed);
+	}
+
+	void wake()
+	{
+		uint64_t one = 1;
+		ssize_t n = write(wake_fd, &one, sizeof(one));
+		(void)n;
+	}
+
+	// 把一个数据报加入本批，批满时立即发出
+	void enqueue(const sockaddr_in &to, const char *data, size_t len)
+	{
+		out_addrs[num_out] = to;
+		out_iov[num_out].iov_base = (void *)data;
+		out_iov[num_out].iov_len = len;
+		memset(&out_msgs[num_out], 0, sizeof(mmsghdr));
+		out_msgs[num_out].msg_hdr.msg_name = &out_addrs[num_out];
+		out_msgs[num_out].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+		out_msgs[num_out].msg_hdr.msg_iov = &out_iov[num_out];
+		out_msgs[num_out].msg_hdr.msg_iovlen = 1;
+		if (++num_out == out_msgs.size())
+		{
+			flush();
+		}
+	}
+
+	// 发出本批的数据报；发送缓冲区满时丢弃剩余的，请求由重传补上，应答由对端重传请求补上
+	void flush()
+	{
+		size_t done = 0;
+		while (done < num_out)
+		{
+			int n = sendmmsg(fd, &out_msgs[done], num_out - done, 0);
+			if (n <= 0)
+			{
+				if (n < 0 && errno == EINTR)
+				{
+					continue;
+				}
+				break;
+			}
+			done += n;
+		}
+		packets_sent.fetch_add(done, std::memory_order_relaxed);
+		num_out = 0;
+	}
+
+	void complete(Pending *p, const grpc::Status &status)
+	{
+		if (Transport::isFallback(status))
+		{
+			fallbacks.fetch_add(1, std::memory_order_relaxed);
+		}
+		p->done(status);
+		delete p;
+	}
+
+	// 处理对端的请求，应答写进 reply
+	void serve(const Header &h, const char *body, size_t len, std::string &reply)
+	{
+		LocalPeer *peer = NULL;
+		{
+			std::shared_lock<std::shared_mutex> lock(mu);
+			auto it = peers.find(h.vnode);
+			if (it != peers.end())
+			{
+				peer = it->second;
+			}
+		}
+		google::protobuf::Message *response = NULL;
+		switch ((KadMethod)h.method)
+		{
+		case KadMethod::FIND_NODE:
+			response = &node_list;
+			break;
+		case KadMethod::FIND_VALUE:
+			response = &kv_node;
+			break;
+		case KadMethod::PING:
+			response = &ack;
+			break;
+		default:
+			break;
+		}
+		Header out{FALLBACK, h.method, 0, h.vnode, h.id};
+		reply.resize(header_size);
+		if (peer != NULL && response != NULL && request.ParseFromArray(body, len))
+		{
+			response->Clear();
+			grpc::Status status = peer->serveLocal((KadMethod)h.method, &request, response);
+			served.fetch_add(1, std::memory_order_relaxed);
+			size_t size = status.ok() ? response->ByteSizeLong() : 0;
+			if (header_size + size <= opts.max_datagram)
+			{
+				out.type = RESPONSE;
+				out.status = (uint8_t)status.error_code();
+				reply.resize(header_size + size);
+				if (size > 0)
+				{
+					response->SerializeWithCachedSizesToArray((uint8_t *)&reply[header_size]);
+				}
+			}
+		}
+		writeHeader(&reply[0], out);
+	}
+
+	// 对端的应答：按请求 ID 找到在途的请求并完成，重复或迟到的应答直接丢弃
+	void answer(const Header &h, const sockaddr_in &from, const char *body, size_t len)
+	{
+		auto it = inflight.find(h.id);
+		if (it == inflight.end() || keyOf(it->second->to) != keyOf(from))
+		{
+			return;
+		}
+		Pending *p = it->second;
+		inflight.erase(it);
+		if (h.type == FALLBACK)
+		{
+			complete(p, Transport::fallback());
+		}
+		else if (h.status != grpc::StatusCode::OK)
+		{
+			complete(p, grpc::Status((grpc::StatusCode)h.status, "udp peer error"));
+		}
+		else if (!p->response->ParseFromArray(body, len))
+		{
+			complete(p, Transport::fallback());
+		}
+		else
+		{
+			complete(p, grpc::Status::OK);
+		}
+	}
+
+	// 一次 recvmmsg，返回收到的数据报数
+	int receive()
+	{
+		for (int i = 0; i < opts.batch; i++)
+		{
+			in_iov[i].iov_base = &in_buf[i * in_size];
+			in_iov[i].iov_len = in_size;
+			memset(&in_msgs[i], 0, sizeof(mmsghdr));
+			in_msgs[i].msg_hdr.msg_name = &in_addrs[i];
+			in_msgs[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+			in_msgs[i].msg_hdr.msg_iov = &in_iov[i];
+			in_msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+		int n = recvmmsg(fd, in_msgs.data(), opts.batch, MSG_DONTWAIT, NULL);
+		if (n <= 0)
+		{
+			return 0;
+		}
+		packets_received.fetch_add(n, std::memory_order_relaxed);
+		// 应答先全部写好再成批发出，replies 在 flush 之前不能被覆盖
+		size_t num_replies = 0;
+		for (int i = 0; i < n; i++)
+		{
+			const char *data = &in_buf[i * in_size];
+			size_t len = in_msgs[i].msg_len;
+			Header h;
+			if ((in_msgs[i].msg_hdr.msg_flags & MSG_TRUNC) || !readHeader(data, len, h))
+			{
+				continue;
+			}
+			if (h.type == REQUEST)
+			{
+				std::string &reply = replies[num_replies++];
+				serve(h, data + header_size, len - header_size, reply);
+				enqueue(in_addrs[i], reply.data(), reply.size());
+			}
+			else
+			{
+				answer(h, in_addrs[i], data + header_size, len - header_size);
+			}
+		}
+		flush();
+		return n;
+	}
+
+	// 重传超过 retry_ms 没有应答的请求，发送次数用完的以 fallback 完成
+	void retry(int64_t now)
+	{
+		std::vector<Pending *> expired;
+		for (auto &kv : inflight)
+		{
+			Pending *p = kv.second;
+			if (now - p->last_us < opts.retry_ms * 1000)
+			{
+				continue;
+			}
+			if (p->sent < opts.attempts)
+			{
+				p->sent++;
+				p->last_us = now;
+				retransmits.fetch_add(1, std::memory_order_relaxed);
+				enqueue(p->to, p->datagram.data(), p->datagram.size());
+			}
+			else
+			{
+				expired.push_back(p);
+			}
+		}
+		flush();
+		for (Pending *p : expired)
+		{
+			inflight.erase(p->id);
+			markSilent(p->to);
+			complete(p, Transport::fallback());
+		}
+	}
+
+	void run()
+	{
+		int64_t scan_us = std::max<int64_t>(opts.retry_ms * 1000 / 4, 1000);
+		int64_t next_scan = nowUs() + scan_us;
+		int idle = 0;
+		while (!stopping.load())
+		{
+			bool busy = false;
+			while (Pending *p = static_cast<Pending *>(queue.pop()))
+			{
+				p->sent = 1;
+				p->last_us = nowUs();
+				inflight[p->id] = p;
+				enqueue(p->to, p->datagram.data(), p->datagram.size());
+				busy = true;
+			}
+			flush();
+			if (receive() > 0)
+			{
+				busy = true;
+			}
+			int64_t now = nowUs();
+			if (now >= next_scan)
+			{
+				retry(now);
+				next_scan = now + scan_us;
+			}
+			if (busy)
+			{
+				idle = 0;
+				continue;
+			}
+			if (++idle < spins)
+			{
+				std::this_thread::yield();
+				continue;
+			}
+			// 与 send 中的 sleeping 检查配合：入队后要么在这里看到新请求，要么经 eventfd 被唤醒
+			sleeping.store(true, std::memory_order_seq_cst);
+			if (queue.empty() && !stopping.load())
+			{
+				pollfd fds[2] = {{fd, POLLIN, 0}, {wake_fd, POLLIN, 0}};
+				int64_t wait_ms = inflight.empty() ? 100 : std::max<int64_t>((next_scan - now) / 1000, 1);
+				poll(fds, 2, (int)wait_ms);
+			}
+			sleeping.store(false, std::memory_order_relaxed);
+			uint64_t count;
+			ssize_t n = read(wake_fd, &count, sizeof(count));
+			(void)n;
+			idle = 0;
+		}
+	}
+};
+
+#endif /* INCLUDE_UDPTRANSPORT_HPP_ */
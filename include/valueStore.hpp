@@ -0,0 +1,504 @@
+/*
+ * valueStore.hpp
+ *
+ * 任意长度字节键值的本地存储：键按 keyId 映射到 64 位 ID 空间，
+ * 记录（键 + 值）放在按大小分级的 slab 内存池中，ShardedKVStore 只保存 ID 到记录链的索引。
+ */
+
+#ifndef INCLUDE_VALUESTORE_HPP_
+#define INCLUDE_VALUESTORE_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "kvStore.hpp"
+#include "logger.hpp"
+
+/*
+ * uint64_t keyId(std::string_view key)
+ * 键在 ID 空间中的位置。8 字节的键直接解释为 64 位整数，与节点 ID 的编码方式一致，
+ * 其他长度的键按 8 字节一组做乘法哈希。
+ */
+inline uint64_t keyId(std::string_view key)
+{
+	uint64_t w;
+	if (key.size() == sizeof(uint64_t))
+	{
+		memcpy(&w, key.data(), sizeof(uint64_t));
+		return w;
+	}
+	uint64_t h = 0x9e3779b97f4a7c15ULL ^ key.size();
+	size_t i = 0;
+	for (; i + 8 <= key.size(); i += 8)
+	{
+		memcpy(&w, key.data() + i, 8);
+		h = (h ^ w) * 0xff51afd7ed558ccdULL;
+		h ^= h >> 32;
+	}
+	w = 0;
+	memcpy(&w, key.data() + i, key.size() - i);
+	h = (h ^ w) * 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 29;
+	h *= 0xbf58476d1ce4e5b9ULL;
+	h ^= h >> 32;
+	return h;
+}
+
+/*
+ * 字节键值存储接口：gRPC 处理线程和本地 put/get 会并发调用，实现必须是线程安全的
+ */
+class ValueStore
+{
+public:
+	virtual ~ValueStore() {}
+	// 找到时把值写入 *value（覆盖原内容，可以直接传入待发送消息中的字段）并返回 true
+	virtual bool get(std::string_view key, std::string *value) = 0;
+	// 记录无法存放（例如超过最大长度或内存不足）时返回 false，存储不变
+	virtual bool put(std::string_view key, std::string_view value) = 0;
+	virtual bool erase(std::string_view key) = 0;
+	virtual uint64_t size() = 0;
+	// 遍历所有键值对，回调中的 string_view 只在本次回调内有效
+	virtual void forEach(const std::function<void(std::string_view, std::string_view)> &fn) = 0;
+	// 存储分成的段数，forEachIn 只遍历其中第 part 段，依次遍历所有段与 forEach 相同。
+	// 供需要分步遍历、每一步只占用少量时间的调用方（如 transfer_range）使用，默认整个存储是一段
+	virtual uint64_t partitions()
+	{
+		return 1;
+	}
+	virtual void forEachIn(uint64_t part, const std::function<void(std::string_view, std::string_view)> &fn)
+	{
+		forEach(fn);
+	}
+	// 存储占用的内存：已向系统申请的字节数和实际存放数据的字节数，不统计时都为 0
+	virtual void memoryStats(uint64_t &reserved, uint64_t &used)
+	{
+		reserved = used = 0;
+	}
+};
+
+/*
+ * SlabArena
+ * 按 2 的幂分级的内存池：每一级从 1MB（或块本身更大时按块大小）的匿名映射页中切块，
+ * 释放的块放回本级的空闲列表，之后只被同一级复用，内存在析构前不归还系统。
+ * 因此一个块地址始终属于同一级，即使已被释放，读取它也不会越界。
+ */
+class SlabArena
+{
+public:
+	static const int num_classes = 26;	   // 32B .. 1GB
+	static const uint64_t min_block = 32;
+	static constexpr uint64_t page_bytes = 1 << 20; // constexpr 隐含 inline，std::max 按引用取用时不需要类外定义
+
+private:
+	struct alignas(64) SizeClass
+	{
+		pthread_mutex_t mu = PTHREAD_MUTEX_INITIALIZER;
+		std::vector<char *> free_blocks;
+		char *cursor = nullptr; // 当前页中尚未切出的部分
+		uint64_t left = 0;
+	};
+
+	SizeClass classes[num_classes];
+	pthread_mutex_t pages_mu = PTHREAD_MUTEX_INITIALIZER;
+	std::vector<std::pair<void *, uint64_t>> pages;
+	std::atomic<uint64_t> reserved{0}; // 已映射的字节数
+	std::atomic<uint64_t> used{0};	   // 已分配出去的块的字节数
+
+public:
+	SlabArena() {}
+
+	~SlabArena()
+	{
+		for (auto &page : pages)
+		{
+			munmap(page.first, page.second);
+		}
+	}
+
+	SlabArena(const SlabArena &) = delete;
+	SlabArena &operator=(const SlabArena &) = delete;
+
+	// 能容纳 n 字节的最小级别，超过最大级别时返回 -1
+	static int classOf(uint64_t n)
+	{
+		int cls = 0;
+		while (cls < num_classes && blockSize(cls) < n)
+		{
+			cls++;
+		}
+		return cls < num_classes ? cls : -1;
+	}
+
+	static uint64_t blockSize(int cls)
+	{
+		return min_block << cls;
+	}
+
+	// 新页中的块内容全为 0；复用的块保留上一次的内容
+	char *alloc(int cls)
+	{
+		SizeClass &c = classes[cls];
+		uint64_t size = blockSize(cls);
+		char *block = nullptr;
+		pthread_mutex_lock(&c.mu);
+		if (!c.free_blocks.empty())
+		{
+			block = c.free_blocks.back();
+			c.free_blocks.pop_back();
+		}
+		else
+		{
+			if (c.left < size)
+			{
+				uint64_t bytes = std::max<uint64_t>(page_bytes, size);
+				void *page = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+				if (page == MAP_FAILED)
+				{
+					int err = errno;
+					pthread_mutex_unlock(&c.mu);
+					DLOG_SAMPLED(ERROR, 1, "arena: mapping %lu bytes failed: %s", bytes, strerror(err));
+					return nullptr;
+				}
+				pthread_mutex_lock(&pages_mu);
+				pages.push_back(std::make_pair(page, bytes));
+				pthread_mutex_unlock(&pages_mu);
+				reserved.fetch_add(bytes, std::memory_order_relaxed);
+				// 页尾不足一块的部分直接丢弃
+				c.cursor = (char *)page;
+				c.left = bytes;
+			}
+			block = c.cursor;
+			c.cursor += size;
+			c.left -= size;
+		}
+		pthread_mutex_unlock(&c.mu);
+		used.fetch_add(size, std::memory_order_relaxed);
+		return block;
+	}
+
+	void free(char *block, int cls)
+	{
+		SizeClass &c = classes[cls];
+		pthread_mutex_lock(&c.mu);
+		c.free_blocks.push_back(block);
+		pthread_mutex_unlock(&c.mu);
+		used.fetch_sub(blockSize(cls), std::memory_order_relaxed);
+	}
+
+	uint64_t reservedBytes()
+	{
+		return reserved.load(std::memory_order_relaxed);
+	}
+
+	uint64_t usedBytes()
+	{
+		return used.load(std::memory_order_relaxed);
+	}
+};
+
+/*
+ * ArenaValueStore
+ * 每个键值对是 SlabArena 中的一条记录，发布后不再修改：覆盖时写入新记录、在链上替换后释放旧记录。
+ * 索引按 keyId 保存链头，keyId 相同的不同键（8 字节的键可以被有意构造出碰撞）串在同一条链上，按完整的键区分。
+ * 写者按 keyId 分条加锁；读者不加锁，沿链逐条用记录头部的序列号做乐观校验：
+ * 记录被摘下（覆盖或删除）时推进序列号并打上标记，读者遇到被摘下的记录就从链头重新开始，
+ * 读到的值直接从记录拷贝到调用方给出的字符串中（例如待发送的应答），中间没有临时对象。
+ */
+class ArenaValueStore : public ValueStore
+{
+	static const int num_stripes = 64;
+
+	struct Record
+	{
+		std::atomic<uint64_t> seq;		  // 奇数表示正在写入
+		std::atomic<uint32_t> key_len;
+		std::atomic<uint32_t> value_len;
+		std::atomic<uint32_t> cls;		  // 所在的 slab 级别，同一地址不变
+		std::atomic<uint32_t> unlinked;	  // 已从链上摘下
+		std::atomic<Record *> next;		  // keyId 相同的下一条记录
+		char data[];					  // 键，紧跟着值
+	};
+
+	ShardedKVStore index; // keyId -> 链头记录的地址
+	SlabArena arena;
+	pthread_mutex_t stripes[num_stripes];
+	std::atomic<uint64_t> count{0}; // 键数，链上可能不止一个键
+
+public:
+	ArenaValueStore()
+	{
+		for (int i = 0; i < num_stripes; i++)
+		{
+			pthread_mutex_init(&stripes[i], NULL);
+		}
+	}
+
+	ArenaValueStore(const ArenaValueStore &) = delete;
+	ArenaValueStore &operator=(const ArenaValueStore &) = delete;
+
+	bool get(std::string_view key, std::string *value) override
+	{
+		uint64_t id = keyId(key);
+		while (true)
+		{
+			uint64_t handle;
+			if (!index.get(id, handle))
+			{
+				value->clear();
+				return false;
+			}
+			bool retry = false;
+			Record *from = nullptr; // 指向 r 的上一条记录，nullptr 表示 r 是链头
+			uint64_t from_seq = 0;
+			for (Record *r = (Record *)handle; r != nullptr;)
+			{
+				uint64_t s1 = r->seq.load(std::memory_order_acquire);
+				if (s1 & 1)
+				{
+					retry = true;
+					break;
+				}
+				uint64_t key_len = r->key_len.load(std::memory_order_relaxed);
+				uint64_t value_len = r->value_len.load(std::memory_order_relaxed);
+				bool match = false;
+				// 记录可能已被释放并复用，长度不可信时只做校验不拷贝
+				if (sizeof(Record) + key_len + value_len <= SlabArena::blockSize(r->cls.load(std::memory_order_relaxed)))
+				{
+					match = key_len == key.size() && memcmp(r->data, key.data(), key_len) == 0;
+					if (match)
+					{
+						value->assign(r->data + key_len, value_len);
+					}
+				}
+				Record *next = r->next.load(std::memory_order_relaxed);
+				std::atomic_thread_fence(std::memory_order_acquire);
+				// 键不同时 r 可能已被释放并复用为别的链上的记录，要确认指向它的链接仍然有效才能沿 next 继续或判定不存在
+				bool linked = match || (from == nullptr ? index.get(id, handle) && handle == (uint64_t)r
+														: from->next.load(std::memory_order_acquire) == r &&
+															  from->unlinked.load(std::memory_order_relaxed) == 0 &&
+															  from->seq.load(std::memory_order_relaxed) == from_seq);
+				if (!linked || r->unlinked.load(std::memory_order_relaxed) != 0 || r->seq.load(std::memory_order_relaxed) != s1)
+				{
+					retry = true;
+					break;
+				}
+				if (match)
+				{
+					return true;
+				}
+				from = r;
+				from_seq = s1;
+				r = next;
+			}
+			if (!retry)
+			{
+				value->clear();
+				return false;
+			}
+		}
+	}
+
+	bool put(std::string_view key, std::string_view value) override
+	{
+		uint64_t id = keyId(key);
+		int cls = SlabArena::classOf(sizeof(Record) + key.size() + value.size());
+		if (cls < 0)
+		{
+			DLOG_SAMPLED(WARN, 10, "value store: record of %lu bytes is too large", key.size() + value.size());
+			return false;
+		}
+		Record *r = (Record *)arena.alloc(cls);
+		if (r == nullptr)
+		{
+			return false;
+		}
+		// 复用的块可能仍有读者在校验，先把序列号推进为奇数再改内容
+		writeBegin(r);
+		r->cls.store(cls, std::memory_order_relaxed);
+		r->key_len.store(key.size(), std::memory_order_relaxed);
+		r->value_len.store(value.size(), std::memory_order_relaxed);
+		r->unlinked.store(0, std::memory_order_relaxed);
+		r->next.store(nullptr, std::memory_order_relaxed);
+		memcpy(r->data, key.data(), key.size());
+		memcpy(r->data + key.size(), value.data(), value.size());
+		writeEnd(r);
+
+		pthread_mutex_t *stripe = stripeOf(id);
+		pthread_mutex_lock(stripe);
+		uint64_t head = 0;
+		Record *prev = nullptr, *old = nullptr;
+		if (index.get(id, head))
+		{
+			old = find((Record *)head, key, prev);
+		}
+		if (old == nullptr)
+		{
+			// 新键放在链头，发布链头时 release 保证读者看到完整的记录
+			r->next.store((Record *)head, std::memory_order_relaxed);
+			index.put(id, (uint64_t)r);
+			count.fetch_add(1, std::memory_order_relaxed);
+		}
+		else
+		{
+			r->next.store(old->next.load(std::memory_order_relaxed), std::memory_order_relaxed);
+			if (prev == nullptr)
+			{
+				index.put(id, (uint64_t)r);
+			}
+			else
+			{
+				prev->next.store(r, std::memory_order_release);
+			}
+			retire(old, id, prev == nullptr ? 0 : head);
+		}
+		pthread_mutex_unlock(stripe);
+		return true;
+	}
+
+	bool erase(std::string_view key) override
+	{
+		uint64_t id = keyId(key);
+		pthread_mutex_t *stripe = stripeOf(id);
+		bool erased = false;
+		pthread_mutex_lock(stripe);
+		uint64_t head = 0;
+		Record *prev = nullptr, *r = nullptr;
+		if (index.get(id, head))
+		{
+			r = find((Record *)head, key, prev);
+		}
+		if (r != nullptr)
+		{
+			Record *next = r->next.load(std::memory_order_relaxed);
+			if (prev != nullptr)
+			{
+				prev->next.store(next, std::memory_order_release);
+			}
+			else if (next != nullptr)
+			{
+				index.put(id, (uint64_t)next);
+			}
+			else
+			{
+				index.erase(id);
+			}
+			retire(r, id, prev == nullptr ? 0 : head);
+			count.fetch_sub(1, std::memory_order_relaxed);
+			erased = true;
+		}
+		pthread_mutex_unlock(stripe);
+		return erased;
+	}
+
+	uint64_t size() override
+	{
+		return count.load(std::memory_order_relaxed);
+	}
+
+	// 遍历期间持有索引分片的锁，摘下记录的写者在释放前要经过同一把锁（见 retire），回调中的记录不会被释放
+	void forEach(const std::function<void(std::string_view, std::string_view)> &fn) override
+	{
+		index.forEach([&fn](uint64_t id, uint64_t handle)
+					  { forEachInChain(handle, fn); });
+	}
+
+	// 每个索引分片是一段
+	uint64_t partitions() override
+	{
+		return index.shardCount();
+	}
+
+	void forEachIn(uint64_t part, const std::function<void(std::string_view, std::string_view)> &fn) override
+	{
+		index.forEachInShard(part, [&fn](uint64_t id, uint64_t handle)
+							 { forEachInChain(handle, fn); });
+	}
+
+	// slab 已映射的字节数和记录实际占用的字节数
+	void memoryStats(uint64_t &reserved, uint64_t &used) override
+	{
+		reserved = arena.reservedBytes();
+		used = arena.usedBytes();
+	}
+
+private:
+	static void forEachInChain(uint64_t handle, const std::function<void(std::string_view, std::string_view)> &fn)
+	{
+		for (Record *r = (Record *)handle; r != nullptr; r = r->next.load(std::memory_order_acquire))
+		{
+			fn(keyOf(r), valueOf(r));
+		}
+	}
+
+	static std::string_view keyOf(Record *r)
+	{
+		return std::string_view(r->data, r->key_len.load(std::memory_order_relaxed));
+	}
+
+	static std::string_view valueOf(Record *r)
+	{
+		uint32_t key_len = r->key_len.load(std::memory_order_relaxed);
+		return std::string_view(r->data + key_len, r->value_len.load(std::memory_order_relaxed));
+	}
+
+	// 持有分条锁时在链上按完整的键查找，prev 为它的前一条记录（链头时为空）
+	static Record *find(Record *head, std::string_view key, Record *&prev)
+	{
+		prev = nullptr;
+		for (Record *r = head; r != nullptr; r = r->next.load(std::memory_order_relaxed))
+		{
+			if (keyOf(r) == key)
+			{
+				return r;
+			}
+			prev = r;
+		}
+		return nullptr;
+	}
+
+	pthread_mutex_t *stripeOf(uint64_t id)
+	{
+		return &stripes[(id * 0x9e3779b97f4a7c15ULL) >> 58];
+	}
+
+	/*
+	 * 释放已从链上摘下的记录：先标记并推进序列号，让正停在它上面的读者从链头重来。
+	 * 摘下链头时已经改过索引（head 为 0）；否则索引没有变化，再写一次当前链头 head，
+	 * 两种情况都经过了索引分片的锁，正在遍历该分片的 forEach 结束后才会释放
+	 */
+	void retire(Record *r, uint64_t id, uint64_t head)
+	{
+		writeBegin(r);
+		r->unlinked.store(1, std::memory_order_relaxed);
+		writeEnd(r);
+		if (head != 0)
+		{
+			index.put(id, head);
+		}
+		arena.free((char *)r, r->cls.load(std::memory_order_relaxed));
+	}
+
+	static void writeBegin(Record *r)
+	{
+		r->seq.store(r->seq.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+	}
+
+	static void writeEnd(Record *r)
+	{
+		r->seq.store(r->seq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+};
+
+#endif /* INCLUDE_VALUESTORE_HPP_ */
@@ -0,0 +1,193 @@
+/*
+ * virtualHost.hpp
+ *
+ * 一个进程承载多个虚拟节点：每个虚拟节点有自己的 ID、路由表和指标，但共用一个 gRPC 服务、
+ * 一个存储引擎和一个通道池。第 i 个虚拟节点的地址是 host:port#i，请求按 dhash-vnode 元数据
+ * 分派到对应的虚拟节点，路由和 find_value 都以它的 ID 为准。
+ * 每个进程在 ID 空间中占据多个随机位置，分到的键和请求比单个 ID 均匀得多。
+ */
+
+#ifndef INCLUDE_VIRTUALHOST_HPP_
+#define INCLUDE_VIRTUALHOST_HPP_
+
+#include <string>
+#include <vector>
+
+#include "nodeKadImpl.hpp"
+
+class VirtualHost : public KadImpl::Service
+{
+	using ServerContext = grpc::ServerContext;
+	using Status = grpc::Status;
+
+	std::vector<NodeKadImpl *> nodes; // 按序号排列，0 号是主节点，负责退出时移交键
+
+public:
+	/*
+	 * 在 address 上承载 count 个虚拟节点，0 号的 ID 为 base_id，其余由 vnodeId 导出。
+	 * channels / store 为空时各自新建，所有虚拟节点共用它们
+	 */
+	VirtualHost(const std::string &address, const NodeID &base_id, size_t count, uint64_t k = 2,
+				ChannelPool *channels = nullptr, ValueStore *store = nullptr)
+	{
+		ChannelPool *pool = channels ? channels : new ChannelPool();
+		ValueStore *shared = store ? store : new ArenaValueStore();
+		count = std::max<size_t>(count, 1);
+		vector<NodeID> ids;
+		for (size_t i = 0; i < count; i++)
+		{
+			ids.push_back(vnodeId(base_id, i));
+			nodes.push_back(new NodeKadImpl(vnodeAddress(address, i), ids[i], k, pool, shared));
+		}
+		for (size_t i = 0; i < count; i++)
+		{
+			vector<NodeID> siblings;
+			for (size_t j = 0; j < count; j++)
+			{
+				if (j != i)
+				{
+					siblings.push_back(ids[j]);
+				}
+			}
+			nodes[i]->setSiblings(siblings, i == 0);
+		}
+	}
+
+	VirtualHost(const VirtualHost &) = delete;
+	VirtualHost &operator=(const VirtualHost &) = delete;
+
+	// 第 i 个虚拟节点的 ID：0 号保持原 ID，其余用 splitmix64 打散到整个 ID 空间
+	static NodeID vnodeId(const NodeID &base_id, size_t i)
+	{
+		if (i == 0)
+		{
+			return base_id;
+		}
+		return NodeID::fromSeed(base_id.hash() + i * 0x9e3779b97f4a7c15ULL);
+	}
+
+	size_t size()
+	{
+		return nodes.size();
+	}
+
+	NodeKadImpl *node(size_t i)
+	{
+		return nodes[i];
+	}
+
+	const std::vector<NodeKadImpl *> &vnodes()
+	{
+		return nodes;
+	}
+
+	// 供异步服务端按序号分派
+	std::vector<KadCore *> cores()
+	{
+		return std::vector<KadCore *>(nodes.begin(), nodes.end());
+	}
+
+	/*
+	 * 依次让每个虚拟节点加入网络，后加入的虚拟节点也能通过种子认识先加入的兄弟节点。
+	 * 所有虚拟节点都加入成功时返回 true
+	 */
+	bool join(const vector<std::string> &seeds)
+	{
+		bool ok = true;
+		for (NodeKadImpl *node : nodes)
+		{
+			ok = node->join(seeds) && ok;
+		}
+		return ok;
+	}
+
+	// 主节点先把共用存储中的键移交出去，其余虚拟节点只通知邻居
+	void exit()
+	{
+		for (NodeKadImpl *node : nodes)
+		{
+			node->exit();
+		}
+	}
+
+	// 共用存储中的键数
+	uint64_t storeSize()
+	{
+		return nodes[0]->storeSize();
+	}
+
+	// 所有虚拟节点处理过的请求数之和
+	uint64_t requestsServed()
+	{
+		uint64_t n = 0;
+		for (NodeKadImpl *node : nodes)
+		{
+			n += node->requestsServed();
+		}
+		return n;
+	}
+
+	// 同步服务端：按请求元数据中的序号转给对应的虚拟节点
+	Status find_node(ServerContext *context, const IDKey *request, NodeList *response) override
+	{
+		return route(context)->find_node(context, request, response);
+	}
+
+	Status find_value(ServerContext *context, const IDKey *request, KV_Node_Wrapper *response) override
+	{
+		return route(context)->find_value(context, request, response);
+	}
+
+	Status store(ServerContext *context, const KeyValue *request, IDKey *response) override
+	{
+		return route(context)->store(context, request, response);
+	}
+
+	Status exit(ServerContext *context, const IDKey *request, IDKey *response) override
+	{
+		return route(context)->exit(context, request, response);
+	}
+
+	Status store_batch(ServerContext *context, const KeyValueBatch *request, BatchAck *response) override
+	{
+		return route(context)->store_batch(context, request, response);
+	}
+
+	Status find_value_batch(ServerContext *context, const IDKeyBatch *request, KeyValueBatch *response) override
+	{
+		return route(context)->find_value_batch(context, request, response);
+	}
+
+	Status store_stream(ServerContext *context, grpc::ServerReaderWriter<BatchAck, KeyValueBatch> *stream) override
+	{
+		return route(context)->store_stream(context, stream);
+	}
+
+	Status find_value_stream(ServerContext *context, grpc::ServerReaderWriter<KeyValueBatch, IDKeyBatch> *stream) override
+	{
+		return route(context)->find_value_stream(context, stream);
+	}
+
+	Status stats(ServerContext *context, const StatsRequest *request, StatsReply *response) override
+	{
+		return route(context)->stats(context, request, response);
+	}
+
+	Status transfer_range(ServerContext *context, const RangeRequest *request, grpc::ServerWriter<KeyValueBatch> *writer) override
+	{
+		return route(context)->transfer_range(context, request, writer);
+	}
+
+	Status ping(ServerContext *context, const IDKey *request, IDKey *response) override
+	{
+		return route(context)->ping(context, request, response);
+	}
+
+private:
+	NodeKadImpl *route(ServerContext *context)
+	{
+		return nodes[vnodeOf(context, nodes.size())];
+	}
+};
+
+#endif /* INCLUDE_VIRTUALHOST_HPP_ */
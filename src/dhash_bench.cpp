@@ -0,0 +1,1069 @@
+/*
+ * dhash_bench.cpp
+ *
+ * YCSB 风格的端到端负载生成器：在一个进程中启动若干节点组成网络，预先写入 keys 个键，
+ * 再由多个客户端线程按给定的键分布和读写比例并发读写，先预热、再测量，
+ * 输出吞吐以及按对数分桶直方图统计的 p50 / p99 / p999 延迟，以及各节点分到的键和请求的比例，可选输出 JSON。
+ * --analyze 时不启动网络，只按节点 ID 集合和键流离线计算各放置策略下每个节点分到的键数和不均衡系数。
+ * --depth 时每个客户端线程通过 async_get / async_put 保持给定个数的请求在途，依次测量每个深度下的吞吐和延迟。
+ * --local-transport 时节点之间的一元 RPC 经进程内传输直接调用对端，不经过序列化和回环网络。
+ * --udp 时 find_node / find_value / ping 经 UDP 数据报收发，其余方法和大的应答仍走 gRPC；
+ * --lookups 在加载之前测量节点查找的延迟，与不加 --udp 的结果对比即为两种传输在回环上的差别。
+ *
+ * 用法：dhash-bench [--nodes N] [--threads N] [--keys N] [--dist uniform|zipfian|latest] [--theta F]
+ *                   [--read-pct N] [--value-size N] [--warmup-s N] [--duration-s N] [--async]
+ *                   [--replicas R] [--write-quorum W] [--read-quorum N] [--path-cache-ttl-ms N]
+ *                   [--location-cache N] [--hedge-pct P] [--vnodes V] [--port N] [--json FILE|-]
+ *                   [--placement hash|identity] [--sequential-keys]
+ *                   [--depth N[,N...]] [--rpc-threads N] [--local-transport N]
+ *                   [--udp] [--lookups N]
+ *                   [--analyze [--ids FILE] [--key-file FILE]]
+ */
+
+#include <getopt.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <grpc/grpc.h>
+#include <grpcpp/server_builder.h>
+
+#include "nodeKadImpl.hpp"
+#include "kadServer.hpp"
+#include "localTransport.hpp"
+#include "placement.hpp"
+#include "udpTransport.hpp"
+#include "virtualHost.hpp"
+
+// 基准配置，由命令行参数设置
+struct bench_config
+{
+	int nodes = 4;				   // 进程内启动的节点数，第一个节点作为其他节点加入的种子
+	int threads = 4;			   // 客户端线程数，轮流绑定到各个节点
+	uint64_t keys = 100000;		   // 预先写入的键数
+	std::string dist = "zipfian";  // 键分布：uniform / zipfian / latest
+	double theta = 0.99;		   // zipfian 分布的偏斜参数
+	uint64_t read_pct = 95;		   // 读操作的百分比，其余为写（latest 分布下为插入新键）
+	uint64_t value_size = 64;	   // 值的字节数，至少 8 字节
+	double warmup_s = 2;		   // 预热时长，期间的操作不计入结果
+	double duration_s = 10;		   // 测量时长
+	bool async = false;			   // 使用异步（完成队列）服务端
+	uint64_t replicas = 1;		   // 每个键的副本数
+	uint64_t write_quorum = 1;	   // 写仲裁
+	uint64_t read_quorum = 1;	   // 读仲裁
+	int64_t path_cache_ttl_ms = 0; // 路径缓存的基准有效期，0 表示关闭
+	int64_t location_cache = -1;   // 键位置缓存容量，-1 表示使用默认值
+	double hedge_pct = 0;		   // find_value 对冲延迟取的延迟分位数（百分比），0 表示不对冲
+	int vnodes = 1;				   // 每个节点承载的虚拟节点数
+	int port = 7900;			   // 第 i 个节点监听 127.0.0.1:(port + i)
+	std::string json;			   // JSON 结果的输出文件，"-" 表示标准输出（可读的结果改写到标准错误）
+	std::string placement = "hash"; // 键的放置策略：hash / identity
+	bool sequential_keys = false;  // 第 index 个键直接编码 index，不打散
+	bool analyze = false;		   // 只做离线的放置分析，不启动网络
+	std::string ids_file;		   // 离线分析用的节点 ID 文件，每行一个（十进制或 0x 开头的十六进制，可以宽于 64 位）
+	std::string key_file;		   // 离线分析用的键文件，每行一个键
+	std::vector<int> depths;	   // 每个客户端线程保持的在途请求数，依次测量；为空时使用阻塞的 get / put
+	int rpc_threads = 1;		   // 每个节点的 RPC 客户端轮询线程数
+	int local_transport = 0;	   // 进程内传输的工作线程数，0 表示节点之间都走 gRPC
+	bool udp = false;			   // find_node / find_value / ping 经 UDP 收发，与 --local-transport 互斥
+	uint64_t lookups = 0;		   // 加载前依次执行的节点查找次数，用于测量查找延迟
+} config;
+
+// splitmix64：把序号打散成均匀分布的 64 位 ID，使键和节点在 ID 空间中分布均匀
+static inline uint64_t mix(uint64_t x)
+{
+	x += 0x9e3779b97f4a7c15ULL;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
+}
+
+// xorshift64*，每个线程一个状态
+static inline uint64_t next_rand(uint64_t &s)
+{
+	s ^= s >> 12;
+	s ^= s << 25;
+	s ^= s >> 27;
+	return s * 2685821657736338717ULL;
+}
+
+static inline double next_double(uint64_t &s)
+{
+	return (next_rand(s) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// 第 index 个键：打散后的 8 字节编码，--sequential-keys 时直接编码 index
+std::string make_key(uint64_t index)
+{
+	uint64_t id = config.sequential_keys ? index : mix(index);
+	return std::string((const char *)&id, sizeof(uint64_t));
+}
+
+// 值的前 8 字节是键的序号，读到后可以校验，之后补足到 value_size 字节
+std::string make_value(uint64_t index)
+{
+	std::string value((const char *)&index, sizeof(uint64_t));
+	value.resize(std::max<uint64_t>(config.value_size, sizeof(uint64_t)), 'v');
+	return value;
+}
+
+/*
+ * Zipfian
+ * YCSB 使用的 zipfian 生成器（Gray 等人的算法）：返回 [0, n) 中的排名，排名越小越热。
+ * zeta(n) 只在构造时计算一次，之后每次生成只需要一次 pow。
+ */
+class Zipfian
+{
+	uint64_t n;
+	double theta, alpha, zetan, eta;
+
+public:
+	Zipfian(uint64_t items, double t)
+	{
+		n = std::max<uint64_t>(items, 1);
+		theta = t;
+		double zeta2 = 1 + pow(0.5, theta);
+		zetan = 0;
+		for (uint64_t i = 1; i <= n; i++)
+		{
+			zetan += 1 / pow((double)i, theta);
+		}
+		alpha = 1 / (1 - theta);
+		eta = (1 - pow(2.0 / n, 1 - theta)) / (1 - zeta2 / zetan);
+	}
+
+	uint64_t next(uint64_t &s)
+	{
+		double u = next_double(s);
+		double uz = u * zetan;
+		if (uz < 1)
+		{
+			return 0;
+		}
+		if (uz < 1 + pow(0.5, theta))
+		{
+			return std::min<uint64_t>(1, n - 1);
+		}
+		return std::min<uint64_t>((uint64_t)(n * pow(eta * u - eta + 1, alpha)), n - 1);
+	}
+};
+
+/*
+ * LatencyHistogram
+ * 按对数分桶的延迟直方图（纳秒）：每个 2 的幂区间再线性分成 16 个子桶，相对误差不超过 1/16。
+ * 每个线程各自记录，结束后再合并，记录时没有任何同步。
+ */
+class LatencyHistogram
+{
+	static const int sub_bits = 4;
+	static const int sub_buckets = 1 << sub_bits;
+	static const int num_buckets = sub_buckets + (64 - sub_bits) * sub_buckets;
+
+	uint64_t counts[num_buckets] = {0};
+	uint64_t total = 0;
+	uint64_t sum = 0;
+	uint64_t max_ns = 0;
+
+	static int indexOf(uint64_t v)
+	{
+		if (v < sub_buckets)
+		{
+			return v;
+		}
+		int e = 63 - __builtin_clzll(v);
+		return sub_buckets + (e - sub_bits) * sub_buckets + ((v >> (e - sub_bits)) & (sub_buckets - 1));
+	}
+
+	// 桶的中点
+	static uint64_t valueOf(int i)
+	{
+		if (i < sub_buckets)
+		{
+			return i;
+		}
+		int e = (i - sub_buckets) / sub_buckets + sub_bits;
+		uint64_t sub = (i - sub_buckets) % sub_buckets;
+		uint64_t width = 1ULL << (e - sub_bits);
+		return (sub_buckets + sub) * width + width / 2;
+	}
+
+public:
+	void record(uint64_t ns)
+	{
+		counts[indexOf(ns)]++;
+		total++;
+		sum += ns;
+		max_ns = std::max(max_ns, ns);
+	}
+
+	void merge(const LatencyHistogram &other)
+	{
+		for (int i = 0; i < num_buckets; i++)
+		{
+			counts[i] += other.counts[i];
+		}
+		total += other.total;
+		sum += other.sum;
+		max_ns = std::max(max_ns, other.max_ns);
+	}
+
+	uint64_t count() const
+	{
+		return total;
+	}
+
+	// 第 p（0..1）分位的延迟，单位微秒
+	double percentileUs(double p) const
+	{
+		if (total == 0)
+		{
+			return 0;
+		}
+		uint64_t rank = std::max<uint64_t>((uint64_t)ceil(p * total), 1);
+		uint64_t seen = 0;
+		for (int i = 0; i < num_buckets; i++)
+		{
+			seen += counts[i];
+			if (seen >= rank)
+			{
+				return std::min(valueOf(i), max_ns) / 1000.0;
+			}
+		}
+		return max_ns / 1000.0;
+	}
+
+	double meanUs() const
+	{
+		return total ? sum / 1000.0 / total : 0;
+	}
+
+	double maxUs() const
+	{
+		return max_ns / 1000.0;
+	}
+};
+
+enum Phase
+{
+	WARMUP,
+	MEASURE,
+	STOP
+};
+
+std::atomic<int> phase{WARMUP};
+std::atomic<uint64_t> next_insert{0}; // latest 分布下下一个插入的键序号
+std::atomic<uint64_t> inserted{0};	  // latest 分布下已写完的键数，序号为 [0, inserted) 的键都可以读到
+
+struct client_para
+{
+	NodeKadImpl *node;
+	uint64_t seed;
+	uint64_t load_begin, load_end; // 预写阶段负责的键序号区间
+	Zipfian *zipf;
+	int depth = 0; // 在途请求数，0 表示阻塞调用
+	LatencyHistogram reads, writes;
+	uint64_t misses = 0; // 读到不存在的键
+	uint64_t errors = 0; // 读到的值与键不符
+};
+
+// 一个深度下的测量结果
+struct depth_result
+{
+	int depth;
+	double secs;
+	LatencyHistogram all;
+	uint64_t misses, errors;
+};
+
+pthread_barrier_t barrier;
+
+// 按配置的分布选出要读写的键序号
+uint64_t pick_key(client_para *p, uint64_t &s)
+{
+	if (config.dist == "uniform")
+	{
+		return next_rand(s) % config.keys;
+	}
+	uint64_t rank = p->zipf->next(s);
+	if (config.dist == "latest")
+	{
+		// 最近写入的键最热
+		uint64_t n = inserted.load(std::memory_order_acquire);
+		return n - 1 - rank % n;
+	}
+	return rank;
+}
+
+/*
+ * 流水线客户端：一个线程通过 async_get / async_put 保持 depth 个请求在途，
+ * 每完成一个再发起下一个。完成回调在 RPC 轮询线程中执行，延迟统计由 window.mu 保护
+ */
+void run_pipelined(client_para *p, uint64_t &s)
+{
+	struct Window
+	{
+		std::mutex mu;
+		std::condition_variable cv;
+		int inflight = 0;
+	} window;
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(window.mu);
+			window.cv.wait(lock, [&]
+						   { return window.inflight < p->depth; });
+			window.inflight++;
+		}
+		int ph = phase.load(std::memory_order_relaxed);
+		if (ph == STOP)
+		{
+			std::lock_guard<std::mutex> guard(window.mu);
+			window.inflight--;
+			break;
+		}
+		bool is_read = next_rand(s) % 100 < config.read_pct;
+		uint64_t index = pick_key(p, s);
+		auto start = std::chrono::steady_clock::now();
+		auto complete = [p, &window, ph, is_read, start](bool miss, bool error)
+		{
+			uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+			std::lock_guard<std::mutex> guard(window.mu);
+			if (ph == MEASURE)
+			{
+				(is_read ? p->reads : p->writes).record(ns);
+				p->misses += miss;
+				p->errors += error;
+			}
+			window.inflight--;
+			window.cv.notify_one();
+		};
+		if (is_read)
+		{
+			p->node->async_get(make_key(index), [complete, index](bool found, std::string &value)
+							   { complete(!found, found && (value.size() < sizeof(uint64_t) || memcmp(value.data(), &index, sizeof(uint64_t)) != 0)); });
+		}
+		else
+		{
+			p->node->async_put(make_key(index), make_value(index), [complete](bool ok)
+							   { complete(false, false); });
+		}
+	}
+	// 等所有在途请求完成后 window 才能释放
+	std::unique_lock<std::mutex> lock(window.mu);
+	window.cv.wait(lock, [&]
+				   { return window.inflight == 0; });
+}
+
+void *run_client(void *para)
+{
+	client_para *p = (client_para *)para;
+	uint64_t s = p->seed;
+
+	// 预写阶段：每个线程用批量写入自己负责的区间
+	vector<std::pair<std::string, std::string>> kvs;
+	for (uint64_t i = p->load_begin; i < p->load_end; i++)
+	{
+		kvs.push_back(std::make_pair(make_key(i), make_value(i)));
+		if (kvs.size() == 4096 || i + 1 == p->load_end)
+		{
+			p->node->multi_put(kvs);
+			kvs.clear();
+		}
+	}
+	pthread_barrier_wait(&barrier);
+	if (p->depth > 0)
+	{
+		run_pipelined(p, s);
+		return NULL;
+	}
+
+	std::string value;
+	while (true)
+	{
+		int ph = phase.load(std::memory_order_relaxed);
+		if (ph == STOP)
+		{
+			break;
+		}
+		bool is_read = next_rand(s) % 100 < config.read_pct;
+		uint64_t index = 0;
+		if (is_read || config.dist != "latest")
+		{
+			index = pick_key(p, s);
+		}
+		auto start = std::chrono::steady_clock::now();
+		if (is_read)
+		{
+			if (!p->node->get(make_key(index), value))
+			{
+				p->misses += ph == MEASURE;
+			}
+			else if (value.size() < sizeof(uint64_t) || memcmp(value.data(), &index, sizeof(uint64_t)) != 0)
+			{
+				p->errors += ph == MEASURE;
+			}
+		}
+		else if (config.dist == "latest")
+		{
+			// latest 分布下的写是插入新键。写完后按序号顺序发布，读者不会读到尚未写完的键
+			index = next_insert.fetch_add(1, std::memory_order_relaxed);
+			p->node->put(make_key(index), make_value(index));
+			uint64_t expected = index;
+			while (!inserted.compare_exchange_weak(expected, index + 1, std::memory_order_release))
+			{
+				expected = index;
+				sched_yield();
+			}
+		}
+		else
+		{
+			p->node->put(make_key(index), make_value(index));
+		}
+		uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+		if (ph == MEASURE)
+		{
+			(is_read ? p->reads : p->writes).record(ns);
+		}
+	}
+	return NULL;
+}
+
+// 以 JSON 对象输出一组延迟统计
+void print_latency(FILE *out, const char *name, const LatencyHistogram &h, double secs, bool last)
+{
+	fprintf(out, "    \"%s\": {\"ops\": %lu, \"ops_per_sec\": %.1f, \"mean_us\": %.1f, \"p50_us\": %.1f, "
+				 "\"p99_us\": %.1f, \"p999_us\": %.1f, \"max_us\": %.1f}%s\n",
+			name, h.count(), h.count() / secs, h.meanUs(), h.percentileUs(0.5), h.percentileUs(0.99),
+			h.percentileUs(0.999), h.maxUs(), last ? "" : ",");
+}
+
+// 每个值与平均值之比的最小值和最大值
+void share_range(const std::vector<double> &values, double &lo, double &hi)
+{
+	double sum = 0;
+	for (double v : values)
+	{
+		sum += v;
+	}
+	double mean = sum / values.size();
+	lo = hi = 1;
+	if (mean > 0)
+	{
+		lo = *std::min_element(values.begin(), values.end()) / mean;
+		hi = *std::max_element(values.begin(), values.end()) / mean;
+	}
+}
+
+// 十进制或 0x 开头的十六进制 ID；超过 16 位的十六进制数按大端字节串解析
+NodeID parse_id(const std::string &text)
+{
+	if (text.size() > 18 && text.compare(0, 2, "0x") == 0)
+	{
+		std::string hex = text.substr(2);
+		hex.erase(std::remove_if(hex.begin(), hex.end(), [](char c)
+								 { return !isxdigit((unsigned char)c); }),
+				  hex.end());
+		if (hex.size() % 2)
+		{
+			hex.insert(hex.begin(), '0');
+		}
+		std::string bytes;
+		for (size_t i = 0; i < hex.size(); i += 2)
+		{
+			bytes.push_back((char)strtoul(hex.substr(i, 2).c_str(), NULL, 16));
+		}
+		return NodeID::fromBytes(bytes);
+	}
+	return NodeID::fromU64(strtoull(text.c_str(), NULL, 0));
+}
+
+/*
+ * 离线放置分析：节点 ID 取自 --ids 文件，或者与网络运行时相同的 nodes x vnodes 个 ID；
+ * 键取自 --key-file，或者与预写阶段相同的 keys 个键。对每种放置策略按 replicas 个最近节点
+ * 统计每个节点（进程）分到的键数，输出不均衡系数（最大值 / 平均值）等
+ */
+int analyze()
+{
+	std::vector<NodeID> ids;
+	std::vector<size_t> groups;
+	if (!config.ids_file.empty())
+	{
+		std::ifstream in(config.ids_file);
+		if (!in)
+		{
+			perror(config.ids_file.c_str());
+			return 1;
+		}
+		std::string line;
+		while (std::getline(in, line))
+		{
+			if (!line.empty() && line[0] != '#')
+			{
+				ids.push_back(parse_id(line));
+			}
+		}
+	}
+	else
+	{
+		for (int i = 0; i < config.nodes; i++)
+		{
+			for (int j = 0; j < config.vnodes; j++)
+			{
+				ids.push_back(VirtualHost::vnodeId(NodeID::fromSeed(1000 + i), j));
+				groups.push_back(i);
+			}
+		}
+	}
+	std::vector<std::string> keys;
+	if (!config.key_file.empty())
+	{
+		std::ifstream in(config.key_file);
+		if (!in)
+		{
+			perror(config.key_file.c_str());
+			return 1;
+		}
+		std::string line;
+		while (std::getline(in, line))
+		{
+			keys.push_back(std::move(line));
+		}
+	}
+	else
+	{
+		for (uint64_t i = 0; i < config.keys; i++)
+		{
+			keys.push_back(make_key(i));
+		}
+	}
+	if (ids.empty() || keys.empty())
+	{
+		fprintf(stderr, "no node ids or no keys to analyze\n");
+		return 1;
+	}
+	std::vector<std::string_view> views(keys.begin(), keys.end());
+	std::vector<NodeID> positions(keys.size());
+
+	printf("placement analysis: %lu node ids in %lu groups, %lu keys, %lu replicas\n",
+		   ids.size(), groups.empty() ? ids.size() : (size_t)config.nodes, keys.size(), config.replicas);
+	printf("%10s %10s %10s %10s %10s %12s %10s\n", "placement", "imbalance", "min", "cv", "mean", "hottest", "keys");
+	for (const char *name : {"identity", "hash"})
+	{
+		std::unique_ptr<Placement> placement(Placement::create(name));
+		auto start = std::chrono::steady_clock::now();
+		placement->placeBatch(views.data(), views.size(), positions.data());
+		double place_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+		LoadReport report = analyzeLoad(ids, groups, positions.data(), positions.size(), config.replicas);
+		printf("%10s %10.3f %10.3f %10.3f %10.1f %12lu %10lu  (%.1f ns/key)\n", name, report.imbalance, report.min_share,
+			   report.cv, report.mean, report.hottest, report.counts[report.hottest], place_ns / keys.size());
+	}
+	return 0;
+}
+
+void usage(const char *prog)
+{
+	printf("usage: %s [--nodes N] [--threads N] [--keys N] [--dist uniform|zipfian|latest] [--theta F]\n"
+		   "          [--read-pct N] [--value-size N] [--warmup-s N] [--duration-s N] [--async]\n"
+		   "          [--replicas R] [--write-quorum W] [--read-quorum N] [--path-cache-ttl-ms N]\n"
+		   "          [--location-cache N] [--hedge-pct P] [--vnodes V] [--port N] [--json FILE|-]\n"
+		   "          [--placement hash|identity] [--sequential-keys]\n"
+		   "          [--depth N[,N...]] [--rpc-threads N] [--local-transport N]\n"
+		   "          [--udp] [--lookups N]\n"
+		   "          [--analyze [--ids FILE] [--key-file FILE]]\n",
+		   prog);
+}
+
+int main(int argc, char **argv)
+{
+	static struct option long_options[] = {
+		{"nodes", required_argument, NULL, 'n'},
+		{"threads", required_argument, NULL, 't'},
+		{"keys", required_argument, NULL, 'k'},
+		{"dist", required_argument, NULL, 'd'},
+		{"theta", required_argument, NULL, 'z'},
+		{"read-pct", required_argument, NULL, 'r'},
+		{"value-size", required_argument, NULL, 'v'},
+		{"warmup-s", required_argument, NULL, 'u'},
+		{"duration-s", required_argument, NULL, 's'},
+		{"async", no_argument, NULL, 'a'},
+		{"replicas", required_argument, NULL, 'R'},
+		{"write-quorum", required_argument, NULL, 'W'},
+		{"read-quorum", required_argument, NULL, 'Q'},
+		{"path-cache-ttl-ms", required_argument, NULL, 'H'},
+		{"location-cache", required_argument, NULL, 'L'},
+		{"hedge-pct", required_argument, NULL, 'E'},
+		{"vnodes", required_argument, NULL, 'V'},
+		{"port", required_argument, NULL, 'p'},
+		{"json", required_argument, NULL, 'j'},
+		{"placement", required_argument, NULL, 'P'},
+		{"sequential-keys", no_argument, NULL, 'q'},
+		{"analyze", no_argument, NULL, 'A'},
+		{"ids", required_argument, NULL, 'I'},
+		{"key-file", required_argument, NULL, 'K'},
+		{"depth", required_argument, NULL, 'D'},
+		{"rpc-threads", required_argument, NULL, 'T'},
+		{"local-transport", required_argument, NULL, 'X'},
+		{"udp", no_argument, NULL, 'U'},
+		{"lookups", required_argument, NULL, 'O'},
+		{"help", no_argument, NULL, 'h'},
+		{NULL, 0, NULL, 0}};
+	int opt;
+	while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1)
+	{
+		switch (opt)
+		{
+		case 'n':
+			config.nodes = std::max(atoi(optarg), 1);
+			break;
+		case 't':
+			config.threads = std::max(atoi(optarg), 1);
+			break;
+		case 'k':
+			config.keys = std::max<uint64_t>(strtoull(optarg, NULL, 10), 1);
+			break;
+		case 'd':
+			config.dist = optarg;
+			break;
+		case 'z':
+			config.theta = atof(optarg);
+			break;
+		case 'r':
+			config.read_pct = std::min<uint64_t>(strtoull(optarg, NULL, 10), 100);
+			break;
+		case 'v':
+			config.value_size = strtoull(optarg, NULL, 10);
+			break;
+		case 'u':
+			config.warmup_s = atof(optarg);
+			break;
+		case 's':
+			config.duration_s = atof(optarg);
+			break;
+		case 'a':
+			config.async = true;
+			break;
+		case 'R':
+			config.replicas = strtoull(optarg, NULL, 10);
+			break;
+		case 'W':
+			config.write_quorum = strtoull(optarg, NULL, 10);
+			break;
+		case 'Q':
+			config.read_quorum = strtoull(optarg, NULL, 10);
+			break;
+		case 'H':
+			config.path_cache_ttl_ms = atoll(optarg);
+			break;
+		case 'L':
+			config.location_cache = atoll(optarg);
+			break;
+		case 'E':
+			config.hedge_pct = atof(optarg);
+			break;
+		case 'V':
+			config.vnodes = std::max(atoi(optarg), 1);
+			break;
+		case 'p':
+			config.port = atoi(optarg);
+			break;
+		case 'j':
+			config.json = optarg;
+			break;
+		case 'P':
+			config.placement = optarg;
+			break;
+		case 'q':
+			config.sequential_keys = true;
+			break;
+		case 'A':
+			config.analyze = true;
+			break;
+		case 'I':
+			config.ids_file = optarg;
+			break;
+		case 'K':
+			config.key_file = optarg;
+			break;
+		case 'D':
+			// 逗号分隔的深度列表，例如 1,16,256,4096
+			for (char *tok = strtok(optarg, ","); tok != NULL; tok = strtok(NULL, ","))
+			{
+				config.depths.push_back(std::max(atoi(tok), 1));
+			}
+			break;
+		case 'T':
+			config.rpc_threads = std::max(atoi(optarg), 1);
+			break;
+		case 'X':
+			config.local_transport = std::max(atoi(optarg), 0);
+			break;
+		case 'U':
+			config.udp = true;
+			break;
+		case 'O':
+			config.lookups = strtoull(optarg, NULL, 10);
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+	std::unique_ptr<Placement> placement(Placement::create(config.placement));
+	// latest 分布的插入要按序号顺序发布，流水线客户端不支持
+	if ((config.dist != "uniform" && config.dist != "zipfian" && config.dist != "latest") || !placement ||
+		(config.dist == "latest" && !config.depths.empty()) || (config.udp && config.local_transport > 0))
+	{
+		usage(argv[0]);
+		return 1;
+	}
+	if (config.analyze)
+	{
+		return analyze();
+	}
+	// --json - 时标准输出只留给 JSON，可读的结果表改写到标准错误
+	FILE *report = config.json == "-" ? stderr : stdout;
+
+	// 启动节点：每个节点一个 gRPC 服务器，承载 vnodes 个共用存储的虚拟节点，所有节点共享一个通道池
+	ChannelPool *pool = new ChannelPool();
+	LocalTransport *transport = config.local_transport > 0 ? new LocalTransport(config.local_transport) : NULL;
+	std::vector<UdpTransport *> udps; // --udp 时每个节点一个，与节点的监听地址相同
+	std::vector<VirtualHost *> hosts;
+	std::vector<NodeKadImpl *> nodes; // 所有虚拟节点
+	std::vector<std::unique_ptr<grpc::Server>> servers;
+	std::vector<KadAsyncServer *> async_servers;
+	for (int i = 0; i < config.nodes; i++)
+	{
+		std::string address = "127.0.0.1:" + std::to_string(config.port + i);
+		VirtualHost *host = new VirtualHost(address, NodeID::fromSeed(1000 + i), config.vnodes, 2, pool);
+		if (config.udp)
+		{
+			udps.push_back(new UdpTransport(address, UdpTransport::Options()));
+		}
+		for (NodeKadImpl *node : host->vnodes())
+		{
+			node->setReplication(config.replicas, config.write_quorum, config.read_quorum);
+			node->setPathCache(config.path_cache_ttl_ms);
+			node->setHedge(config.hedge_pct / 100);
+			node->setPlacement(Placement::create(config.placement));
+			node->setRpcThreads(config.rpc_threads);
+			if (!node->setTransport(config.udp ? (Transport *)udps.back() : transport))
+			{
+				fprintf(stderr, "failed to serve %s over the transport\n", address.c_str());
+				return 1;
+			}
+			if (config.location_cache >= 0)
+			{
+				LocationCache::Options opts;
+				opts.capacity = config.location_cache;
+				node->setLocationCache(opts);
+			}
+		}
+		grpc::ServerBuilder builder;
+		builder.AddListeningPort(address, grpc::InsecureServerCredentials());
+		builder.SetMaxReceiveMessageSize(-1);
+		KadAsyncServer *async_server = NULL;
+		if (config.async)
+		{
+			async_server = new KadAsyncServer(host->cores(), KadAsyncServer::Options());
+			async_server->registerWith(builder);
+		}
+		else
+		{
+			builder.RegisterService(host);
+		}
+		servers.push_back(builder.BuildAndStart());
+		if (servers.back() == nullptr)
+		{
+			fprintf(stderr, "failed to listen on %s\n", address.c_str());
+			return 1;
+		}
+		if (async_server)
+		{
+			async_server->start();
+			async_servers.push_back(async_server);
+		}
+		hosts.push_back(host);
+		nodes.insert(nodes.end(), host->vnodes().begin(), host->vnodes().end());
+	}
+	// 依次加入第一个节点，join 中的自查找和桶刷新让后加入的节点认识先加入的节点。
+	// 第一个节点的 0 号虚拟节点是种子，其余虚拟节点都要加入
+	double join_ms_sum = 0, join_ms_max = 0;
+	uint64_t table_sum = 0;
+	for (size_t i = 1; i < nodes.size(); i++)
+	{
+		nodes[i]->join("127.0.0.1:" + std::to_string(config.port));
+		NodeKadImpl::JoinStats js = nodes[i]->joinStats();
+		join_ms_sum += js.total_ms;
+		join_ms_max = std::max(join_ms_max, js.total_ms);
+		table_sum += js.table_size;
+	}
+	double join_ms_avg = nodes.size() > 1 ? join_ms_sum / (nodes.size() - 1) : 0;
+	if (nodes.size() > 1)
+	{
+		fprintf(stderr, "join to full routing table: avg %.2f ms, max %.2f ms, avg table size %.1f\n",
+				join_ms_avg, join_ms_max, (double)table_sum / (nodes.size() - 1));
+	}
+	// 全部加入后每个节点再查找一次自己，让先加入的节点也认识后加入的节点，预写时才能算出正确的副本节点
+	for (NodeKadImpl *node : nodes)
+	{
+		node->lookup(node->nodeId(), KadLookup::FIND_NODE);
+	}
+
+	// 节点查找的延迟：每次换一个发起节点，查找一个随机的 ID
+	LatencyHistogram lookups;
+	double lookup_s = 0, lookup_pps = 0;
+	if (config.lookups > 0)
+	{
+		uint64_t packets = 0;
+		for (UdpTransport *udp : udps)
+		{
+			UdpTransport::Stats us = udp->stats();
+			packets -= us.packets_sent + us.packets_received;
+		}
+		auto lookup_start = std::chrono::steady_clock::now();
+		for (uint64_t i = 0; i < config.lookups; i++)
+		{
+			auto t0 = std::chrono::steady_clock::now();
+			nodes[i % nodes.size()]->lookup(NodeID::fromSeed(mix(i) + 1), KadLookup::FIND_NODE);
+			lookups.record(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t0).count());
+		}
+		lookup_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - lookup_start).count();
+		for (UdpTransport *udp : udps)
+		{
+			UdpTransport::Stats us = udp->stats();
+			packets += us.packets_sent + us.packets_received;
+		}
+		lookup_pps = packets / lookup_s;
+		fprintf(report, "lookups %lu in %.2f s over %s: mean %.1f us, p50 %.1f us, p99 %.1f us, p999 %.1f us",
+				lookups.count(), lookup_s, config.udp ? "udp" : "grpc", lookups.meanUs(), lookups.percentileUs(0.5),
+				lookups.percentileUs(0.99), lookups.percentileUs(0.999));
+		if (config.udp)
+		{
+			fprintf(report, ", %.0f packets/s", lookup_pps);
+		}
+		fprintf(report, "\n");
+	}
+
+	fprintf(stderr, "%d nodes x %d vnodes, %d threads, %lu %s keys, %s, %lu%% reads, %lu-byte values, %s placement\n",
+			config.nodes, config.vnodes, config.threads, config.keys, config.sequential_keys ? "sequential" : "mixed",
+			config.dist.c_str(), config.read_pct, config.value_size, placement->name());
+
+	// 预写阶段与 zipfian 的 zeta 计算
+	auto load_start = std::chrono::steady_clock::now();
+	Zipfian zipf(config.keys, config.theta);
+	next_insert.store(config.keys);
+	inserted.store(config.keys);
+	// 每个深度测量一轮，第一轮的客户端线程同时负责预写；不指定 --depth 时只有一轮阻塞调用
+	std::vector<int> depths = config.depths.empty() ? std::vector<int>{0} : config.depths;
+	std::vector<depth_result> sweep;
+	double load_s = 0, secs = 0;
+	LatencyHistogram reads, writes, all;
+	uint64_t misses = 0, errors = 0, total_errors = 0;
+	for (size_t round = 0; round < depths.size(); round++)
+	{
+		std::vector<client_para> clients(config.threads);
+		std::vector<pthread_t> tids(config.threads);
+		phase.store(WARMUP);
+		pthread_barrier_init(&barrier, NULL, config.threads + 1);
+		for (int i = 0; i < config.threads; i++)
+		{
+			client_para &p = clients[i];
+			p.node = hosts[i % config.nodes]->node(0);
+			p.seed = 0x9e3779b97f4a7c15ULL * (i + 1) + round;
+			p.load_begin = round == 0 ? config.keys * i / config.threads : 0;
+			p.load_end = round == 0 ? config.keys * (i + 1) / config.threads : 0;
+			p.zipf = &zipf;
+			p.depth = depths[round];
+			pthread_create(&tids[i], NULL, run_client, (void *)&p);
+		}
+		pthread_barrier_wait(&barrier);
+		if (round == 0)
+		{
+			load_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - load_start).count();
+			fprintf(stderr, "loaded in %.2f s, ", load_s);
+		}
+		if (depths[round] > 0)
+		{
+			fprintf(stderr, "depth %d (%d in flight), ", depths[round], depths[round] * config.threads);
+		}
+		fprintf(stderr, "warming up for %.1f s\n", config.warmup_s);
+
+		usleep(config.warmup_s * 1e6);
+		auto start = std::chrono::steady_clock::now();
+		phase.store(MEASURE);
+		usleep(config.duration_s * 1e6);
+		phase.store(STOP);
+		secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		for (int i = 0; i < config.threads; i++)
+		{
+			pthread_join(tids[i], NULL);
+		}
+		pthread_barrier_destroy(&barrier);
+
+		reads = writes = all = LatencyHistogram();
+		misses = errors = 0;
+		for (client_para &p : clients)
+		{
+			reads.merge(p.reads);
+			writes.merge(p.writes);
+			misses += p.misses;
+			errors += p.errors;
+		}
+		all.merge(reads);
+		all.merge(writes);
+		total_errors += errors;
+		if (depths[round] > 0)
+		{
+			sweep.push_back(depth_result{depths[round], secs, all, misses, errors});
+		}
+	}
+
+	if (sweep.empty())
+	{
+		fprintf(report, "throughput %.0f ops/s (%lu ops in %.2f s), misses %lu, errors %lu\n", all.count() / secs, all.count(), secs, misses, errors);
+	}
+	else
+	{
+		// 吞吐随在途请求数的变化，深度是每个客户端线程的在途请求数
+		fprintf(report, "%6s %10s %12s %10s %10s %10s %10s %8s\n", "depth", "inflight", "ops/s", "mean(us)", "p50(us)", "p99(us)", "p999(us)", "misses");
+		for (const depth_result &r : sweep)
+		{
+			fprintf(report, "%6d %10d %12.0f %10.1f %10.1f %10.1f %10.1f %8lu\n", r.depth, r.depth * config.threads, r.all.count() / r.secs,
+					r.all.meanUs(), r.all.percentileUs(0.5), r.all.percentileUs(0.99), r.all.percentileUs(0.999), r.misses);
+		}
+	}
+	uint64_t hedged = 0, store_retries = 0;
+	for (NodeKadImpl *node : nodes)
+	{
+		NodeKadImpl::RetryStats rs = node->retryStats();
+		hedged += rs.hedged;
+		store_retries += rs.store_retries;
+	}
+	if (config.hedge_pct > 0 || store_retries > 0)
+	{
+		fprintf(report, "hedged requests %lu, store retries %lu\n", hedged, store_retries);
+	}
+	if (transport != NULL)
+	{
+		LocalTransport::Stats ts = transport->stats();
+		fprintf(report, "local transport: %lu requests delivered in process to %lu nodes\n", ts.delivered, ts.peers);
+	}
+	if (!udps.empty())
+	{
+		UdpTransport::Stats total = {0, 0, 0, 0, 0};
+		for (UdpTransport *udp : udps)
+		{
+			UdpTransport::Stats us = udp->stats();
+			total.packets_sent += us.packets_sent;
+			total.packets_received += us.packets_received;
+			total.served += us.served;
+			total.retransmits += us.retransmits;
+			total.fallbacks += us.fallbacks;
+		}
+		fprintf(report, "udp transport: %lu packets sent, %lu received, %lu requests served, %lu retransmits, %lu fell back to grpc\n",
+				total.packets_sent, total.packets_received, total.served, total.retransmits, total.fallbacks);
+	}
+	// 各节点（进程）分到的键和处理的请求占平均值的比例，越接近 100% 越均匀
+	double key_min, key_max, req_min, req_max;
+	{
+		std::vector<double> keys, requests;
+		for (VirtualHost *host : hosts)
+		{
+			keys.push_back(host->storeSize());
+			requests.push_back(host->requestsServed());
+		}
+		share_range(keys, key_min, key_max);
+		share_range(requests, req_min, req_max);
+	}
+	fprintf(report, "load share of mean per node: keys min %.0f%% max %.0f%%, requests min %.0f%% max %.0f%%\n",
+			key_min * 100, key_max * 100, req_min * 100, req_max * 100);
+	if (sweep.empty())
+	{
+		fprintf(report, "%6s %10s %10s %10s %10s %10s %10s\n", "op", "ops", "mean(us)", "p50(us)", "p99(us)", "p999(us)", "max(us)");
+		const char *names[] = {"read", "write", "all"};
+		const LatencyHistogram *hists[] = {&reads, &writes, &all};
+		for (int i = 0; i < 3; i++)
+		{
+			const LatencyHistogram &h = *hists[i];
+			fprintf(report, "%6s %10lu %10.1f %10.1f %10.1f %10.1f %10.1f\n", names[i], h.count(), h.meanUs(),
+					h.percentileUs(0.5), h.percentileUs(0.99), h.percentileUs(0.999), h.maxUs());
+		}
+	}
+
+	if (!config.json.empty())
+	{
+		FILE *out = config.json == "-" ? stdout : fopen(config.json.c_str(), "w");
+		if (out == NULL)
+		{
+			perror(config.json.c_str());
+			return 1;
+		}
+		fprintf(out, "{\n  \"config\": {\"nodes\": %d, \"threads\": %d, \"keys\": %lu, \"dist\": \"%s\", \"theta\": %.3f, "
+					 "\"read_pct\": %lu, \"value_size\": %lu, \"warmup_s\": %.1f, \"duration_s\": %.1f, \"async\": %s, "
+					 "\"replicas\": %lu, \"write_quorum\": %lu, \"read_quorum\": %lu, \"path_cache_ttl_ms\": %ld, "
+					 "\"hedge_pct\": %.1f, \"vnodes\": %d, \"placement\": \"%s\", \"sequential_keys\": %s, \"rpc_threads\": %d, "
+					 "\"local_transport\": %d, \"udp\": %s},\n",
+				config.nodes, config.threads, config.keys, config.dist.c_str(), config.theta, config.read_pct,
+				config.value_size, config.warmup_s, config.duration_s, config.async ? "true" : "false",
+				config.replicas, config.write_quorum, config.read_quorum, config.path_cache_ttl_ms, config.hedge_pct,
+				config.vnodes, placement->name(), config.sequential_keys ? "true" : "false", config.rpc_threads,
+				config.local_transport, config.udp ? "true" : "false");
+		fprintf(out, "  \"join_ms_avg\": %.3f,\n  \"join_ms_max\": %.3f,\n", join_ms_avg, join_ms_max);
+		fprintf(out, "  \"key_share\": {\"min\": %.3f, \"max\": %.3f},\n  \"request_share\": {\"min\": %.3f, \"max\": %.3f},\n",
+				key_min, key_max, req_min, req_max);
+		fprintf(out, "  \"load_s\": %.3f,\n  \"measured_s\": %.3f,\n  \"throughput_ops\": %.1f,\n  \"misses\": %lu,\n  \"errors\": %lu,\n",
+				load_s, secs, all.count() / secs, misses, errors);
+		// 深度扫描时，上面的吞吐和下面的延迟是最后一个深度的结果
+		if (!sweep.empty())
+		{
+			fprintf(out, "  \"depth_sweep\": [\n");
+			for (size_t i = 0; i < sweep.size(); i++)
+			{
+				const depth_result &r = sweep[i];
+				fprintf(out, "    {\"depth\": %d, \"inflight\": %d, \"ops_per_sec\": %.1f, \"mean_us\": %.1f, \"p50_us\": %.1f, "
+							 "\"p99_us\": %.1f, \"p999_us\": %.1f, \"misses\": %lu, \"errors\": %lu}%s\n",
+						r.depth, r.depth * config.threads, r.all.count() / r.secs, r.all.meanUs(), r.all.percentileUs(0.5),
+						r.all.percentileUs(0.99), r.all.percentileUs(0.999), r.misses, r.errors, i + 1 == sweep.size() ? "" : ",");
+			}
+			fprintf(out, "  ],\n");
+		}
+		if (config.lookups > 0)
+		{
+			fprintf(out, "  \"lookup\": {\"lookups\": %lu, \"seconds\": %.3f, \"mean_us\": %.1f, \"p50_us\": %.1f, "
+						 "\"p99_us\": %.1f, \"p999_us\": %.1f, \"packets_per_sec\": %.1f},\n",
+					lookups.count(), lookup_s, lookups.meanUs(), lookups.percentileUs(0.5), lookups.percentileUs(0.99),
+					lookups.percentileUs(0.999), lookup_pps);
+		}
+		fprintf(out, "  \"latency\": {\n");
+		print_latency(out, "read", reads, secs, false);
+		print_latency(out, "write", writes, secs, false);
+		print_latency(out, "all", all, secs, true);
+		fprintf(out, "  }\n}\n");
+		if (out != stdout)
+		{
+			fclose(out);
+		}
+	}
+
+	for (auto &server : servers)
+	{
+		server->Shutdown();
+	}
+	for (KadAsyncServer *async_server : async_servers)
+	{
+		async_server->shutdown();
+	}
+	return total_errors == 0 ? 0 : 2;
+}
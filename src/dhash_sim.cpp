@@ -0,0 +1,803 @@
+/*
+ * dhash_sim.cpp
+ *
+ * 确定性的大规模仿真：在一个线程中用 SimNetwork 把成千上万个节点连成网络，
+ * 所有 RPC、超时和定时器都是按虚拟时间执行的离散事件，同样的参数和种子得到完全相同的结果。
+ * 节点按 --join-rate 依次加入（每个节点向一个已加入的随机节点询问），之后稳定 --settle-s 秒，
+ * 再在 --duration-s 秒内按泊松过程从随机节点向随机目标发起查找，同时按 --churn-per-min 让节点崩溃并由新节点替换。
+ * 输出查找的成功率（找到真正最近的节点）、最近 k 个的召回率、跳数分布、虚拟延迟、每次查找的消息数，
+ * 以及路由表的收敛时间：已加入的节点中至少 --converge-pct% 的路由表包含离自己最近的 min(k, 桶容量) 个在线节点。
+ * --k、--alpha、--bucket-size 可以是逗号分隔的列表，依次仿真每种组合；每种组合在单独的子进程中运行，互不影响。
+ *
+ * 用法：dhash-sim [--nodes N] [--k N[,N...]] [--alpha N[,N...]] [--bucket-size N[,N...]]
+ *                 [--join-rate R] [--settle-s S] [--duration-s S] [--lookup-rate R] [--churn-per-min P]
+ *                 [--latency-ms MS] [--latency-spread-ms MS] [--jitter-ms MS] [--loss F] [--rpc-timeout-ms MS]
+ *                 [--seed N] [--sample-ms MS] [--converge-pct P] [--json FILE|-]
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "nodeKadImpl.hpp"
+#include "simNetwork.hpp"
+
+// 仿真配置，由命令行参数设置
+struct sim_config
+{
+	int nodes = 1000;				 // 引导阶段加入的节点数，崩溃的节点由新节点替换，总数不变
+	std::vector<int> ks;			 // 查找返回的最近节点数，为空时为 20
+	std::vector<int> alphas;		 // 查找的并发数，为空时为 3
+	std::vector<int> bucket_sizes;	 // 路由表每个桶的容量，0 表示与 k 相同
+	double join_rate = 200;			 // 引导阶段每虚拟秒加入的节点数
+	double settle_s = 30;			 // 引导结束后、开始测量前等待的虚拟时间
+	double duration_s = 60;			 // 测量的虚拟时长
+	double lookup_rate = 100;		 // 测量期间每虚拟秒发起的查找数
+	double churn_per_min = 0;		 // 测量期间每虚拟分钟崩溃（并由新节点替换）的节点百分比
+	double latency_ms = 20;			 // 单向时延的基准
+	double latency_spread_ms = 30;	 // 每条链路在基准之上固定增加的最大时延
+	double jitter_ms = 2;			 // 每个消息的最大随机抖动
+	double loss = 0;				 // 每个请求和应答的丢失率
+	int64_t rpc_timeout_ms = 2000;	 // 丢失或没有应答的调用在这么久后超时
+	uint64_t seed = 1;				 // 随机数种子
+	int64_t sample_ms = 1000;		 // 检查路由表收敛情况的间隔（虚拟时间）
+	double converge_pct = 99;		 // 认为已收敛的节点百分比
+	std::string json;				 // JSON 结果的输出文件，"-" 表示标准输出
+} config;
+
+static const int max_hops = 16; // 跳数直方图的桶数，最后一个桶包含更深的查找
+
+// 一种 (k, alpha, 桶容量) 组合的结果，由子进程经管道整块传回，只包含定长的字段
+struct sim_result
+{
+	int k, alpha, bucket_size;
+	uint64_t lookups;				// 完成的查找数
+	uint64_t succeeded;				// 找到真正最近的在线节点的查找数
+	double recall;					// 找到的最近 k 个在线节点的平均比例
+	uint64_t hops[max_hops];		// 跳数直方图，第 i 个桶是 i + 1 跳
+	uint64_t rpcs;					// 查找发出的 RPC 总数
+	uint64_t rpc_failures;			// 其中失败或超时的
+	double latency_mean_ms, latency_p50_ms, latency_p99_ms;
+	uint64_t joins;					// 完成加入的节点数（含替换崩溃节点的新节点）
+	uint64_t join_retries;			// 种子没有应答而重新加入的次数
+	uint64_t crashes;				// 测量期间崩溃的节点数
+	double join_ms_mean, join_ms_max;
+	double bootstrap_s;				// 引导阶段的节点全部加入所用的虚拟时间，-1 表示没有全部加入
+	double converge_s;				// 从第一个节点加入到达到收敛比例的虚拟时间，-1 表示没有达到
+	double converged_bootstrap;		// 引导结束时已收敛的节点比例
+	double converged_min;			// 测量期间最低的收敛比例
+	double converged_final;			// 测量结束时的收敛比例
+	double stale_final;				// 测量结束时路由表中已崩溃节点的比例
+	uint64_t boot_sent[SimNetwork::num_methods];	// 引导和稳定阶段按方法统计的请求数
+	uint64_t measure_sent[SimNetwork::num_methods]; // 测量阶段按方法统计的请求数（含替换节点的加入和存活探测）
+	uint64_t measure_messages;		// 测量阶段的请求和应答数
+	uint64_t lost, unreachable, timeouts;
+	uint64_t events;				// 执行的事件数
+	double wall_s;					// 仿真所用的真实时间
+};
+
+static const char *method_names[SimNetwork::num_methods] = {"find_node", "find_value", "store", "exit",
+															"store_batch", "find_value_batch", "stats", "ping"};
+
+// 第 i 个节点的监听地址，只用作仿真网络中的名字
+std::string address_of(int i)
+{
+	char buf[32];
+	snprintf(buf, sizeof(buf), "10.%d.%d.%d:7000", ((i + 1) >> 16) & 255, ((i + 1) >> 8) & 255, (i + 1) & 255);
+	return buf;
+}
+
+/*
+ * Simulation
+ * 一种组合的仿真：节点、在线节点的有序 ID（用于计算真正的最近节点）和各阶段的统计。
+ * 所有方法都在事件循环中执行，不需要加锁；节点不释放，子进程结束时一起回收
+ */
+class Simulation
+{
+	struct sim_node
+	{
+		NodeKadImpl *node;
+		std::string address;
+		NodeID id;
+		bool up;
+		bool initial;		// 引导阶段加入的节点
+		int slot;			// 在 active 中的下标，-1 表示尚未加入或已崩溃
+		int64_t spawned_us; // 开始加入的虚拟时间
+	};
+
+	int k, alpha, bucket_size;
+	SimNetwork net;
+	ChannelPool *pool; // 仿真中不会建立连接，所有节点共享一个空的通道池
+	std::vector<sim_node> nodes;
+	std::vector<NodeID> live;			 // 在线节点（含正在加入的）的 ID，升序
+	std::unordered_set<NodeID> crashed;	 // 已崩溃节点的 ID
+	std::vector<int> active;			 // 已加入且在线的节点，查找的发起者和崩溃的对象从中随机选取
+	int initial_joined = 0;
+	int64_t boot_done_us = -1;
+	bool generating = false; // 测量期间继续产生查找和崩溃
+	bool measuring = false;
+	uint64_t outstanding = 0; // 在途的查找数
+	std::vector<int64_t> latencies;
+	double join_ms_sum = 0;
+	sim_result r;
+
+public:
+	Simulation(int k_, int alpha_, int bucket_, const SimNetwork::Options &opts)
+		: k(k_), alpha(alpha_), bucket_size(bucket_), net(opts), pool(new ChannelPool())
+	{
+		memset(&r, 0, sizeof(r));
+		r.k = k;
+		r.alpha = alpha;
+		r.bucket_size = bucket_size;
+		r.bootstrap_s = -1;
+		r.converge_s = -1;
+		r.converged_min = 1;
+	}
+
+	sim_result run()
+	{
+		auto wall = std::chrono::steady_clock::now();
+		// 引导：第 i 个节点在 i / join_rate 秒时开始加入
+		for (int i = 0; i < config.nodes; i++)
+		{
+			net.after((int64_t)(i * 1e6 / config.join_rate), [this]
+					  { join(spawn(true)); });
+		}
+		net.after(0, [this]
+				  { sample(); });
+		int64_t limit = (int64_t)((config.nodes / config.join_rate + 600) * 1e6);
+		while (initial_joined < config.nodes && net.nowUs() < limit)
+		{
+			net.runUntil(net.nowUs() + 100000);
+		}
+		r.bootstrap_s = initial_joined == config.nodes ? boot_done_us / 1e6 : -1;
+		r.converged_bootstrap = converged(NULL);
+		net.runUntil(net.nowUs() + (int64_t)(config.settle_s * 1e6));
+		SimNetwork::Stats boot = net.stats();
+		memcpy(r.boot_sent, boot.sent, sizeof(r.boot_sent));
+
+		// 测量：查找和崩溃各是一个泊松过程
+		int64_t start = net.nowUs();
+		generating = true;
+		measuring = true;
+		nextLookup();
+		if (config.churn_per_min > 0)
+		{
+			nextCrash();
+		}
+		net.runUntil(start + (int64_t)(config.duration_s * 1e6));
+		generating = false;
+		// 等在途的查找结束，最多再等 60 秒
+		int64_t drain = net.nowUs() + 60000000;
+		while (outstanding > 0 && net.nowUs() < drain)
+		{
+			net.runUntil(net.nowUs() + 100000);
+		}
+		measuring = false;
+		r.converged_final = converged(&r.stale_final);
+		r.converged_min = std::min(r.converged_min, r.converged_final);
+
+		SimNetwork::Stats end = net.stats();
+		for (int m = 0; m < SimNetwork::num_methods; m++)
+		{
+			r.measure_sent[m] = end.sent[m] - boot.sent[m];
+		}
+		r.measure_messages = end.messages - boot.messages;
+		r.lost = end.lost;
+		r.unreachable = end.unreachable;
+		r.timeouts = end.timeouts;
+		r.events = end.events;
+		if (r.joins > 0)
+		{
+			r.join_ms_mean = join_ms_sum / r.joins;
+		}
+		if (!latencies.empty())
+		{
+			std::sort(latencies.begin(), latencies.end());
+			double sum = 0;
+			for (int64_t l : latencies)
+			{
+				sum += l;
+			}
+			r.latency_mean_ms = sum / latencies.size() / 1000;
+			r.latency_p50_ms = latencies[(latencies.size() - 1) / 2] / 1000.0;
+			r.latency_p99_ms = latencies[(size_t)((latencies.size() - 1) * 0.99)] / 1000.0;
+		}
+		if (r.lookups > 0)
+		{
+			r.recall /= r.lookups;
+		}
+		r.wall_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - wall).count();
+		return r;
+	}
+
+private:
+	uint64_t rand64()
+	{
+		return net.random()();
+	}
+
+	// 泊松过程中下一个事件的间隔（微秒）
+	int64_t interval(double per_sec)
+	{
+		return std::max<int64_t>((int64_t)(std::exponential_distribution<double>(per_sec)(net.random()) * 1e6), 1);
+	}
+
+	int spawn(bool initial)
+	{
+		int i = (int)nodes.size();
+		sim_node n;
+		n.address = address_of(i);
+		n.id = NodeID::fromSeed(rand64());
+		n.up = true;
+		n.initial = initial;
+		n.slot = -1;
+		n.spawned_us = net.nowUs();
+		n.node = new NodeKadImpl(n.address, n.id, k, pool);
+		if (bucket_size != k)
+		{
+			n.node->setBucketSize(bucket_size);
+		}
+		n.node->setAlpha(alpha);
+		n.node->setScheduler(&net);
+		n.node->setTransport(net.endpoint(n.address));
+		live.insert(std::upper_bound(live.begin(), live.end(), n.id), n.id);
+		nodes.push_back(n);
+		return i;
+	}
+
+	// 向一个已加入的随机节点询问；第一个节点直接算作已加入，种子没有应答时 1 秒后换一个种子重试
+	void join(int i)
+	{
+		if (!nodes[i].up)
+		{
+			return;
+		}
+		if (active.empty())
+		{
+			joined(i);
+			return;
+		}
+		const std::string &seed = nodes[active[rand64() % active.size()]].address;
+		nodes[i].node->async_join(vector<std::string>{seed}, [this, i](bool ok)
+								  {
+									  if (ok)
+									  {
+										  joined(i);
+										  return;
+									  }
+									  r.join_retries++;
+									  net.after(1000000, [this, i]
+												{ join(i); }); });
+	}
+
+	void joined(int i)
+	{
+		sim_node &n = nodes[i];
+		if (!n.up)
+		{
+			return;
+		}
+		n.slot = (int)active.size();
+		active.push_back(i);
+		double ms = (net.nowUs() - n.spawned_us) / 1000.0;
+		r.joins++;
+		join_ms_sum += ms;
+		r.join_ms_max = std::max(r.join_ms_max, ms);
+		if (n.initial && ++initial_joined == config.nodes)
+		{
+			boot_done_us = net.nowUs();
+		}
+	}
+
+	// 让一个已加入的随机节点崩溃，并启动一个新节点替换它
+	void crash()
+	{
+		if (active.empty())
+		{
+			return;
+		}
+		int i = active[rand64() % active.size()];
+		sim_node &n = nodes[i];
+		n.up = false;
+		net.setUp(n.address, false);
+		int last = active.back();
+		active[n.slot] = last;
+		nodes[last].slot = n.slot;
+		active.pop_back();
+		n.slot = -1;
+		live.erase(std::lower_bound(live.begin(), live.end(), n.id));
+		crashed.insert(n.id);
+		r.crashes++;
+		join(spawn(false));
+	}
+
+	void nextCrash()
+	{
+		if (!generating)
+		{
+			return;
+		}
+		net.after(interval(config.churn_per_min / 100 * config.nodes / 60), [this]
+				  {
+					  if (generating)
+					  {
+						  crash();
+					  }
+					  nextCrash(); });
+	}
+
+	void nextLookup()
+	{
+		if (!generating)
+		{
+			return;
+		}
+		net.after(interval(config.lookup_rate), [this]
+				  {
+					  if (generating && !active.empty())
+					  {
+						  lookup();
+					  }
+					  nextLookup(); });
+	}
+
+	// 从一个已加入的随机节点查找随机目标，结束时与当时在线节点中真正最近的 k 个比较
+	void lookup()
+	{
+		int i = active[rand64() % active.size()];
+		NodeID target = NodeID::fromSeed(rand64());
+		int64_t start = net.nowUs();
+		outstanding++;
+		nodes[i].node->async_lookup(target, KadLookup::FIND_NODE, [this, target, start](KadLookup::Result &result)
+									{
+										outstanding--;
+										std::vector<NodeID> want = closestLive(target, k);
+										std::vector<NodeID> got;
+										for (const Node &node : result.closest)
+										{
+											got.push_back(nodeIdOf(node));
+										}
+										r.lookups++;
+										if (!got.empty() && !want.empty() && got[0] == want[0])
+										{
+											r.succeeded++;
+										}
+										std::sort(got.begin(), got.end());
+										size_t found = 0;
+										for (const NodeID &id : want)
+										{
+											found += std::binary_search(got.begin(), got.end(), id);
+										}
+										r.recall += want.empty() ? 1 : (double)found / want.size();
+										r.hops[std::min<uint64_t>(std::max<uint64_t>(result.hops, 1), max_hops) - 1]++;
+										r.rpcs += result.contacted;
+										r.rpc_failures += result.failed;
+										latencies.push_back(net.nowUs() - start); });
+	}
+
+	/*
+	 * 在线节点中离 target 最近的 n 个，按距离升序。
+	 * 与 target 共享的前缀越长越近：逐位缩小到共享前缀的区间，直到再缩小就不足 n 个，只需在这个区间中排序
+	 */
+	std::vector<NodeID> closestLive(const NodeID &target, size_t n)
+	{
+		auto lo = live.begin(), hi = live.end();
+		for (int b = 1; b <= NodeID::bits && (size_t)(hi - lo) > n; b++)
+		{
+			NodeID p = target.prefix(b);
+			auto sub_lo = std::partition_point(lo, hi, [&](const NodeID &id)
+											   { return id.prefix(b) < p; });
+			auto sub_hi = std::partition_point(sub_lo, hi, [&](const NodeID &id)
+											   { return !(p < id.prefix(b)); });
+			if ((size_t)(sub_hi - sub_lo) < n)
+			{
+				break;
+			}
+			lo = sub_lo;
+			hi = sub_hi;
+		}
+		std::vector<NodeID> out(lo, hi);
+		closestK(out, target, n, [](const NodeID &id) -> const NodeID &
+				 { return id; });
+		return out;
+	}
+
+	/*
+	 * 已加入的节点中，路由表包含离自己最近的 min(k, 桶容量) 个在线节点（不含自己）的比例；
+	 * stale 非空时写入路由表中已崩溃节点所占的比例
+	 */
+	double converged(double *stale)
+	{
+		size_t want_n = (size_t)std::min(k, bucket_size);
+		uint64_t ok = 0, contacts = 0, dead = 0;
+		for (int i : active)
+		{
+			std::vector<NodeID> ids;
+			for (const RoutingTable::Contact &c : nodes[i].node->contacts())
+			{
+				ids.push_back(c.id);
+				dead += crashed.count(c.id);
+			}
+			contacts += ids.size();
+			std::sort(ids.begin(), ids.end());
+			bool all = true;
+			for (const NodeID &id : closestLive(nodes[i].id, want_n + 1))
+			{
+				if (id != nodes[i].id && !std::binary_search(ids.begin(), ids.end(), id))
+				{
+					all = false;
+					break;
+				}
+			}
+			ok += all;
+		}
+		if (stale != NULL)
+		{
+			*stale = contacts > 0 ? (double)dead / contacts : 0;
+		}
+		return active.empty() ? 0 : (double)ok / active.size();
+	}
+
+	// 定期检查收敛情况：引导阶段全部加入之后第一次达到收敛比例的时间即为收敛时间
+	void sample()
+	{
+		double c = converged(NULL);
+		if (r.converge_s < 0 && boot_done_us >= 0 && c * 100 >= config.converge_pct)
+		{
+			r.converge_s = net.nowUs() / 1e6;
+		}
+		if (measuring)
+		{
+			r.converged_min = std::min(r.converged_min, c);
+		}
+		net.after(config.sample_ms * 1000, [this]
+				  { sample(); });
+	}
+};
+
+// 在子进程中仿真一种组合，结果经管道传回；子进程异常退出时返回 false
+bool run_isolated(int k, int alpha, int bucket_size, sim_result &out)
+{
+	int fds[2];
+	if (pipe(fds) != 0)
+	{
+		perror("pipe");
+		return false;
+	}
+	fflush(stdout);
+	pid_t pid = fork();
+	if (pid < 0)
+	{
+		perror("fork");
+		return false;
+	}
+	if (pid == 0)
+	{
+		close(fds[0]);
+		// 日志的后台线程在子进程中创建；加入失败等警告已计入结果，只输出错误
+		Logger::instance().setLevel(DHASH_LOG_ERROR);
+		SimNetwork::Options opts;
+		opts.latency_us = (int64_t)(config.latency_ms * 1000);
+		opts.latency_spread_us = (int64_t)(config.latency_spread_ms * 1000);
+		opts.jitter_us = (int64_t)(config.jitter_ms * 1000);
+		opts.loss = config.loss;
+		opts.timeout_ms = config.rpc_timeout_ms;
+		opts.seed = config.seed;
+		Simulation sim(k, alpha, bucket_size, opts);
+		sim_result r = sim.run();
+		Logger::instance().flush();
+		ssize_t n = write(fds[1], &r, sizeof(r));
+		_exit(n == (ssize_t)sizeof(r) ? 0 : 1);
+	}
+	close(fds[1]);
+	size_t got = 0;
+	while (got < sizeof(out))
+	{
+		ssize_t n = read(fds[0], (char *)&out + got, sizeof(out) - got);
+		if (n <= 0)
+		{
+			break;
+		}
+		got += n;
+	}
+	close(fds[0]);
+	int status = 0;
+	waitpid(pid, &status, 0);
+	return got == sizeof(out) && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+// 跳数直方图的分位数
+uint64_t hops_percentile(const sim_result &r, double p)
+{
+	uint64_t seen = 0, rank = (uint64_t)(r.lookups * p);
+	for (int i = 0; i < max_hops; i++)
+	{
+		seen += r.hops[i];
+		if (seen > rank)
+		{
+			return i + 1;
+		}
+	}
+	return max_hops;
+}
+
+double hops_mean(const sim_result &r)
+{
+	double sum = 0;
+	for (int i = 0; i < max_hops; i++)
+	{
+		sum += (double)(i + 1) * r.hops[i];
+	}
+	return r.lookups > 0 ? sum / r.lookups : 0;
+}
+
+void print_result(const sim_result &r)
+{
+	double n = std::max<uint64_t>(r.lookups, 1);
+	printf("%4d %5d %6d %8lu %7.2f%% %7.2f%% %5.2f %3lu %3lu %8.1f %8.1f %8.1f %8.1f %8.1f %7.1f %7.2f%% %7.2f%% %7.2f%% %10lu %7.1f\n",
+		   r.k, r.alpha, r.bucket_size, r.lookups, r.succeeded * 100.0 / n, r.recall * 100, hops_mean(r),
+		   hops_percentile(r, 0.5), hops_percentile(r, 0.99), r.latency_p50_ms, r.latency_p99_ms, r.rpcs / n,
+		   r.join_ms_mean, r.bootstrap_s, r.converge_s, r.converged_final * 100, r.converged_min * 100,
+		   r.stale_final * 100, r.events, r.wall_s);
+	printf("     hops:");
+	for (int i = 0; i < max_hops; i++)
+	{
+		if (r.hops[i] > 0)
+		{
+			printf(" %d%s:%lu", i + 1, i + 1 == max_hops ? "+" : "", r.hops[i]);
+		}
+	}
+	printf("\n     bootstrap requests:");
+	for (int m = 0; m < SimNetwork::num_methods; m++)
+	{
+		if (r.boot_sent[m] > 0)
+		{
+			printf(" %s %lu", method_names[m], r.boot_sent[m]);
+		}
+	}
+	printf("\n     measured requests:");
+	for (int m = 0; m < SimNetwork::num_methods; m++)
+	{
+		if (r.measure_sent[m] > 0)
+		{
+			printf(" %s %lu", method_names[m], r.measure_sent[m]);
+		}
+	}
+	printf(" (%.1f messages per lookup), %lu crashes, %lu join retries, %lu lost, %lu unreachable, %lu timeouts\n",
+		   r.measure_messages / n, r.crashes, r.join_retries, r.lost, r.unreachable, r.timeouts);
+	fflush(stdout);
+}
+
+void print_json(FILE *out, const std::vector<sim_result> &results)
+{
+	fprintf(out, "{\n  \"config\": {\"nodes\": %d, \"join_rate\": %.1f, \"settle_s\": %.1f, \"duration_s\": %.1f, "
+				 "\"lookup_rate\": %.1f, \"churn_per_min\": %.2f, \"latency_ms\": %.1f, \"latency_spread_ms\": %.1f, "
+				 "\"jitter_ms\": %.1f, \"loss\": %.4f, \"rpc_timeout_ms\": %ld, \"seed\": %lu, \"sample_ms\": %ld, "
+				 "\"converge_pct\": %.1f, \"id_bits\": %d},\n",
+			config.nodes, config.join_rate, config.settle_s, config.duration_s, config.lookup_rate, config.churn_per_min,
+			config.latency_ms, config.latency_spread_ms, config.jitter_ms, config.loss, config.rpc_timeout_ms,
+			config.seed, config.sample_ms, config.converge_pct, NodeID::bits);
+	fprintf(out, "  \"runs\": [\n");
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		const sim_result &r = results[i];
+		double n = std::max<uint64_t>(r.lookups, 1);
+		fprintf(out, "    {\"k\": %d, \"alpha\": %d, \"bucket_size\": %d, \"lookups\": %lu, \"success\": %.4f, "
+					 "\"recall\": %.4f, \"hops_mean\": %.3f, \"hops_p50\": %lu, \"hops_p99\": %lu, \"hops\": [",
+				r.k, r.alpha, r.bucket_size, r.lookups, r.succeeded / n, r.recall, hops_mean(r),
+				hops_percentile(r, 0.5), hops_percentile(r, 0.99));
+		for (int h = 0; h < max_hops; h++)
+		{
+			fprintf(out, "%lu%s", r.hops[h], h + 1 == max_hops ? "" : ", ");
+		}
+		fprintf(out, "], \"rpcs_per_lookup\": %.2f, \"rpc_failures\": %lu, \"latency_ms\": {\"mean\": %.1f, \"p50\": %.1f, "
+					 "\"p99\": %.1f}, \"joins\": %lu, \"join_retries\": %lu, \"crashes\": %lu, \"join_ms_mean\": %.1f, "
+					 "\"join_ms_max\": %.1f, \"bootstrap_s\": %.3f, \"converge_s\": %.3f, \"converged_bootstrap\": %.4f, "
+					 "\"converged_min\": %.4f, \"converged_final\": %.4f, \"stale_final\": %.4f, ",
+				r.rpcs / n, r.rpc_failures, r.latency_mean_ms, r.latency_p50_ms, r.latency_p99_ms, r.joins,
+				r.join_retries, r.crashes, r.join_ms_mean, r.join_ms_max, r.bootstrap_s, r.converge_s,
+				r.converged_bootstrap, r.converged_min, r.converged_final, r.stale_final);
+		fprintf(out, "\"bootstrap_requests\": {");
+		for (int m = 0; m < SimNetwork::num_methods; m++)
+		{
+			fprintf(out, "\"%s\": %lu%s", method_names[m], r.boot_sent[m], m + 1 == SimNetwork::num_methods ? "" : ", ");
+		}
+		fprintf(out, "}, \"measured_requests\": {");
+		for (int m = 0; m < SimNetwork::num_methods; m++)
+		{
+			fprintf(out, "\"%s\": %lu%s", method_names[m], r.measure_sent[m], m + 1 == SimNetwork::num_methods ? "" : ", ");
+		}
+		fprintf(out, "}, \"messages_per_lookup\": %.2f, \"lost\": %lu, \"unreachable\": %lu, \"timeouts\": %lu, "
+					 "\"events\": %lu, \"wall_s\": %.3f}%s\n",
+				r.measure_messages / n, r.lost, r.unreachable, r.timeouts, r.events, r.wall_s,
+				i + 1 == results.size() ? "" : ",");
+	}
+	fprintf(out, "  ]\n}\n");
+}
+
+// 逗号分隔的正整数列表，例如 8,20,32
+bool parse_list(char *arg, std::vector<int> &out, int min)
+{
+	for (char *tok = strtok(arg, ","); tok != NULL; tok = strtok(NULL, ","))
+	{
+		int v = atoi(tok);
+		if (v < min)
+		{
+			return false;
+		}
+		out.push_back(v);
+	}
+	return !out.empty();
+}
+
+void usage(const char *prog)
+{
+	printf("usage: %s [--nodes N] [--k N[,N...]] [--alpha N[,N...]] [--bucket-size N[,N...]]\n"
+		   "          [--join-rate R] [--settle-s S] [--duration-s S] [--lookup-rate R] [--churn-per-min P]\n"
+		   "          [--latency-ms MS] [--latency-spread-ms MS] [--jitter-ms MS] [--loss F] [--rpc-timeout-ms MS]\n"
+		   "          [--seed N] [--sample-ms MS] [--converge-pct P] [--json FILE|-]\n",
+		   prog);
+}
+
+int main(int argc, char **argv)
+{
+	static struct option long_options[] = {
+		{"nodes", required_argument, NULL, 'n'},
+		{"k", required_argument, NULL, 'k'},
+		{"alpha", required_argument, NULL, 'a'},
+		{"bucket-size", required_argument, NULL, 'b'},
+		{"join-rate", required_argument, NULL, 'J'},
+		{"settle-s", required_argument, NULL, 'S'},
+		{"duration-s", required_argument, NULL, 's'},
+		{"lookup-rate", required_argument, NULL, 'r'},
+		{"churn-per-min", required_argument, NULL, 'c'},
+		{"latency-ms", required_argument, NULL, 'l'},
+		{"latency-spread-ms", required_argument, NULL, 'L'},
+		{"jitter-ms", required_argument, NULL, 'j'},
+		{"loss", required_argument, NULL, 'x'},
+		{"rpc-timeout-ms", required_argument, NULL, 't'},
+		{"seed", required_argument, NULL, 'e'},
+		{"sample-ms", required_argument, NULL, 'm'},
+		{"converge-pct", required_argument, NULL, 'p'},
+		{"json", required_argument, NULL, 'o'},
+		{"help", no_argument, NULL, 'h'},
+		{NULL, 0, NULL, 0}};
+	int opt;
+	bool ok = true;
+	while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1)
+	{
+		switch (opt)
+		{
+		case 'n':
+			config.nodes = std::max(atoi(optarg), 2);
+			break;
+		case 'k':
+			ok = ok && parse_list(optarg, config.ks, 1);
+			break;
+		case 'a':
+			ok = ok && parse_list(optarg, config.alphas, 1);
+			break;
+		case 'b':
+			ok = ok && parse_list(optarg, config.bucket_sizes, 0);
+			break;
+		case 'J':
+			config.join_rate = atof(optarg);
+			break;
+		case 'S':
+			config.settle_s = std::max(atof(optarg), 0.0);
+			break;
+		case 's':
+			config.duration_s = std::max(atof(optarg), 0.0);
+			break;
+		case 'r':
+			config.lookup_rate = atof(optarg);
+			break;
+		case 'c':
+			config.churn_per_min = std::max(atof(optarg), 0.0);
+			break;
+		case 'l':
+			config.latency_ms = std::max(atof(optarg), 0.0);
+			break;
+		case 'L':
+			config.latency_spread_ms = std::max(atof(optarg), 0.0);
+			break;
+		case 'j':
+			config.jitter_ms = std::max(atof(optarg), 0.0);
+			break;
+		case 'x':
+			config.loss = std::min(std::max(atof(optarg), 0.0), 1.0);
+			break;
+		case 't':
+			config.rpc_timeout_ms = std::max(atoll(optarg), 1LL);
+			break;
+		case 'e':
+			config.seed = strtoull(optarg, NULL, 0);
+			break;
+		case 'm':
+			config.sample_ms = std::max(atoll(optarg), 1LL);
+			break;
+		case 'p':
+			config.converge_pct = atof(optarg);
+			break;
+		case 'o':
+			config.json = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (!ok || config.join_rate <= 0 || config.lookup_rate <= 0)
+	{
+		usage(argv[0]);
+		return 1;
+	}
+	if (config.ks.empty())
+	{
+		config.ks.push_back(20);
+	}
+	if (config.alphas.empty())
+	{
+		config.alphas.push_back(3);
+	}
+	if (config.bucket_sizes.empty())
+	{
+		config.bucket_sizes.push_back(0);
+	}
+
+	printf("simulating %d nodes (%d-bit ids), join %.0f/s, settle %.0fs, measure %.0fs at %.0f lookups/s, churn %.1f%%/min, "
+		   "latency %.0f+%.0fms jitter %.0fms, loss %.2f%%, seed %lu\n",
+		   config.nodes, NodeID::bits, config.join_rate, config.settle_s, config.duration_s, config.lookup_rate,
+		   config.churn_per_min, config.latency_ms, config.latency_spread_ms, config.jitter_ms, config.loss * 100,
+		   config.seed);
+	printf("%4s %5s %6s %8s %8s %8s %5s %3s %3s %8s %8s %8s %8s %8s %7s %8s %8s %8s %10s %7s\n", "k", "alpha", "bucket",
+		   "lookups", "success", "recall", "hops", "p50", "p99", "p50(ms)", "p99(ms)", "rpcs", "join(ms)", "boot(s)",
+		   "conv(s)", "conv", "conv-min", "stale", "events", "wall(s)");
+	std::vector<sim_result> results;
+	int failed = 0;
+	for (int k : config.ks)
+	{
+		for (int alpha : config.alphas)
+		{
+			for (int bucket : config.bucket_sizes)
+			{
+				sim_result r;
+				if (!run_isolated(k, alpha, bucket > 0 ? bucket : k, r))
+				{
+					fprintf(stderr, "simulation k=%d alpha=%d bucket=%d failed\n", k, alpha, bucket > 0 ? bucket : k);
+					failed++;
+					continue;
+				}
+				print_result(r);
+				results.push_back(r);
+			}
+		}
+	}
+
+	if (!config.json.empty())
+	{
+		FILE *out = config.json == "-" ? stdout : fopen(config.json.c_str(), "w");
+		if (out == NULL)
+		{
+			perror(config.json.c_str());
+			return 1;
+		}
+		print_json(out, results);
+		if (out != stdout)
+		{
+			fclose(out);
+		}
+	}
+	return failed > 0 ? 1 : 0;
+}
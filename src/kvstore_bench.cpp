@@ -0,0 +1,189 @@
+/*
+ * kvstore_bench.cpp
+ *
+ * 存储引擎微基准：对比原来的 unordered_map（并发下只能整体加一把锁）与节点实际使用的 ArenaValueStore
+ * 在不同线程数、不同读写比例下的吞吐。键是 8 字节的序号，值的长度可以指定。
+ *
+ * 用法：kvstore-bench [键数量] [每线程操作数] [写比例百分比] [最大线程数] [值字节数]
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "valueStore.hpp"
+
+// 原实现中 _db 的类型，加一把全局锁后才能被多个线程安全访问
+class LockedMapStore : public ValueStore
+{
+	std::unordered_map<std::string, std::string> db;
+	pthread_mutex_t mu = PTHREAD_MUTEX_INITIALIZER;
+
+public:
+	bool get(std::string_view key, std::string *value) override
+	{
+		pthread_mutex_lock(&mu);
+		auto iter = db.find(std::string(key));
+		bool found = iter != db.end();
+		if (found)
+		{
+			*value = iter->second;
+		}
+		pthread_mutex_unlock(&mu);
+		return found;
+	}
+
+	bool put(std::string_view key, std::string_view value) override
+	{
+		pthread_mutex_lock(&mu);
+		db.insert_or_assign(std::string(key), std::string(value));
+		pthread_mutex_unlock(&mu);
+		return true;
+	}
+
+	bool erase(std::string_view key) override
+	{
+		pthread_mutex_lock(&mu);
+		bool erased = db.erase(std::string(key)) > 0;
+		pthread_mutex_unlock(&mu);
+		return erased;
+	}
+
+	uint64_t size() override
+	{
+		pthread_mutex_lock(&mu);
+		uint64_t n = db.size();
+		pthread_mutex_unlock(&mu);
+		return n;
+	}
+
+	void forEach(const std::function<void(std::string_view, std::string_view)> &fn) override
+	{
+		pthread_mutex_lock(&mu);
+		for (auto &kv : db)
+		{
+			fn(kv.first, kv.second);
+		}
+		pthread_mutex_unlock(&mu);
+	}
+};
+
+struct worker_para
+{
+	ValueStore *store;
+	uint64_t num_keys;
+	uint64_t num_ops;
+	uint64_t write_pct;
+	uint64_t value_size;
+	uint64_t seed;
+	uint64_t hits;
+};
+
+pthread_barrier_t barrier;
+
+// xorshift64*，避免基准被 rand() 的全局锁拖慢
+static inline uint64_t next_rand(uint64_t &s)
+{
+	s ^= s >> 12;
+	s ^= s << 25;
+	s ^= s >> 27;
+	return s * 2685821657736338717ULL;
+}
+
+// 第 index 个键：序号的 8 字节编码，与节点使用的键格式相同
+static inline std::string_view make_key(uint64_t &buf, uint64_t index)
+{
+	buf = index;
+	return std::string_view((const char *)&buf, sizeof(buf));
+}
+
+void *run_worker(void *para)
+{
+	struct worker_para *p = (struct worker_para *)para;
+	uint64_t s = p->seed;
+	uint64_t hits = 0;
+	uint64_t key_buf;
+	// 值的前 8 字节写入操作序号，其余补足到 value_size 字节
+	std::string value(std::max<uint64_t>(p->value_size, sizeof(uint64_t)), 'v');
+	std::string out;
+	pthread_barrier_wait(&barrier);
+	for (uint64_t i = 0; i < p->num_ops; i++)
+	{
+		uint64_t r = next_rand(s);
+		std::string_view key = make_key(key_buf, r % p->num_keys);
+		if ((r >> 40) % 100 < p->write_pct)
+		{
+			memcpy(&value[0], &i, sizeof(i));
+			p->store->put(key, value);
+		}
+		else
+		{
+			hits += p->store->get(key, &out);
+		}
+	}
+	p->hits = hits;
+	return NULL;
+}
+
+// 返回每秒操作数
+double run(ValueStore *store, int num_threads, uint64_t num_keys, uint64_t num_ops, uint64_t write_pct, uint64_t value_size)
+{
+	std::vector<pthread_t> tid(num_threads);
+	std::vector<worker_para> p(num_threads);
+	pthread_barrier_init(&barrier, NULL, num_threads + 1);
+	for (int i = 0; i < num_threads; i++)
+	{
+		p[i] = {store, num_keys, num_ops, write_pct, value_size, 0x9e3779b97f4a7c15ULL * (i + 1), 0};
+		pthread_create(&tid[i], NULL, run_worker, (void *)&p[i]);
+	}
+	auto start = std::chrono::steady_clock::now();
+	pthread_barrier_wait(&barrier);
+	for (int i = 0; i < num_threads; i++)
+	{
+		pthread_join(tid[i], NULL);
+	}
+	double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	pthread_barrier_destroy(&barrier);
+	return num_threads * num_ops / secs;
+}
+
+int main(int argc, char **argv)
+{
+	uint64_t num_keys = std::max<uint64_t>(argc > 1 ? strtoull(argv[1], NULL, 10) : 1000000, 1);
+	uint64_t num_ops = argc > 2 ? strtoull(argv[2], NULL, 10) : 2000000;
+	uint64_t write_pct = argc > 3 ? strtoull(argv[3], NULL, 10) : 5;
+	int max_threads = argc > 4 ? atoi(argv[4]) : sysconf(_SC_NPROCESSORS_ONLN);
+	uint64_t value_size = argc > 5 ? strtoull(argv[5], NULL, 10) : 64;
+
+	printf("keys %lu, ops/thread %lu, writes %lu%%, %lu-byte values\n", num_keys, num_ops, write_pct, value_size);
+	printf("%8s %18s %18s %8s\n", "threads", "locked map ops/s", "arena ops/s", "speedup");
+	for (int t = 1; t <= max_threads; t *= 2)
+	{
+		LockedMapStore locked;
+		ArenaValueStore arena;
+		std::string value(std::max<uint64_t>(value_size, sizeof(uint64_t)), 'v');
+		uint64_t key_buf;
+		for (uint64_t k = 0; k < num_keys; k++)
+		{
+			locked.put(make_key(key_buf, k), value);
+			arena.put(make_key(key_buf, k), value);
+		}
+		double a = run(&locked, t, num_keys, num_ops, write_pct, value_size);
+		double b = run(&arena, t, num_keys, num_ops, write_pct, value_size);
+		printf("%8d %18.0f %18.0f %7.2fx\n", t, a, b, b / a);
+		if (t < max_threads && t * 2 > max_threads)
+		{
+			t = max_threads / 2;
+		}
+	}
+	return 0;
+}
@@ -2,13 +2,21 @@
  * node.cpp
  */
 
+#include <getopt.h>
 #include <pthread.h>
+#include <stdlib.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include <grpc/grpc.h>
 #include <grpcpp/server_builder.h>
 
 #include "nodeKadImpl.hpp"
+#include "kadServer.hpp"
+#include "kvPersist.hpp"
+#include "localTransport.hpp"
+#include "udpTransport.hpp"
+#include "virtualHost.hpp"
 
 char ip_port[20] = "127.0.0.1:6900";
 pthread_mutex_t exit_lock_ = PTHREAD_MUTEX_INITIALIZER;
@@ -20,11 +28,57 @@ struct para
 	bool client;
 };
 
+// 服务端配置，由命令行参数设置
+struct server_config
+{
+	bool async = false;					// 使用异步（完成队列）服务端
+	KadAsyncServer::Options async_opts; // 异步服务端的完成队列和轮询线程配置
+	int sync_cqs = 0;					// 同步服务端的完成队列数，0 表示使用 gRPC 默认值
+	int sync_min_pollers = 0;			// 同步服务端的最少轮询线程数
+	int sync_max_pollers = 0;			// 同步服务端的最多轮询线程数
+	bool batch = false;					// 客户端使用 multi_put / multi_get 批量读写
+	std::string data_dir;				// 持久化数据的根目录，为空时不持久化
+	DurableKVStore::Options persist;	// WAL 和快照配置
+	uint64_t replicas = 1;				// 每个键的副本数
+	uint64_t write_quorum = 1;			// 写仲裁
+	uint64_t read_quorum = 1;			// 读仲裁
+	uint64_t value_size = 8;			// 客户端写入的值的字节数，至少 8 字节
+	LocationCache::Options locations;	// 键位置缓存配置
+	HotCache::Options hot;				// 热点值缓存配置
+	int64_t path_cache_ttl_ms = 0;		// 路径缓存的基准有效期，0 表示关闭
+	bool metrics = false;				// 结束前通过 stats RPC 取回并输出 Prometheus 格式的指标
+	uint64_t transfer_bytes_per_sec = 0; // 加入时拉取和退出时移交键的限速，0 表示不限速
+	vector<std::string> seeds;			 // 客户端节点加入时询问的种子节点，为空时使用 127.0.0.1:6900
+	NodeKadImpl::Deadlines deadlines;	 // 客户端 RPC 的超时和副本写入的重试次数
+	double hedge_pct = 0;				 // find_value 对冲延迟取的延迟分位数（百分比），0 表示不对冲
+	int vnodes = 1;						 // 每个服务端承载的虚拟节点数，共用一个存储
+	std::string placement = "hash";		 // 键的放置策略：hash 把键打散到 ID 空间，identity 直接使用键
+	int local_transport = 0;			 // 进程内传输的工作线程数，0 表示同一进程中的节点之间也走 gRPC
+	bool udp = false;					 // find_node / find_value / ping 经 UDP 收发，与 --local-transport 互斥
+} config;
+
+// 同一进程中所有服务端共用的进程内传输，未开启时为空
+LocalTransport *transport = NULL;
+
 pthread_barrier_t barrier;
 
 void *run_server(void *para);
 void *run_client(void *para);
 
+// 键是 64 位整数的 8 字节编码，在 ID 空间中的位置由放置策略决定（identity 时就是该整数）
+std::string make_key(uint64_t key)
+{
+	return std::string((const char *)&key, sizeof(uint64_t));
+}
+
+// 值的前 8 字节是 v，之后补足到 value_size 字节
+std::string make_value(uint64_t v)
+{
+	std::string value((const char *)&v, sizeof(uint64_t));
+	value.resize(std::max<uint64_t>(config.value_size, sizeof(uint64_t)), 'v');
+	return value;
+}
+
 void *run_server(void *para)
 {
 	// 解析参数结构体
@@ -36,46 +90,174 @@ void *run_server(void *para)
 	std::string str(p->address);
 	// 将地址添加到 gRPC 服务器构建器并使用不安全的服务器凭据
 	builder.AddListeningPort(str, grpc::InsecureServerCredentials());
+	// 批量写入的请求可能超过默认 4MB 的接收上限
+	builder.SetMaxReceiveMessageSize(-1);
 
-	// 创建分布式哈希存储节点对象
-	NodeKadImpl *node = new NodeKadImpl(str, id);
-	// 注册节点服务到 gRPC 服务器
-	builder.RegisterService(node);
+	// 配置了数据目录时，每个节点在其下的 node-<id> 目录中持久化，并在启动时恢复
+	DurableKVStore *durable = NULL;
+	if (!config.data_dir.empty())
+	{
+		DurableKVStore::Options opts = config.persist;
+		opts.dir = config.data_dir + "/node-" + std::to_string(id);
+		durable = new DurableKVStore(new ArenaValueStore(), opts);
+		DurableKVStore::RecoveryStats rs = durable->recoveryStats();
+		DLOG(INFO, "%lu recovered %lu keys from snapshot in %.1f ms, %lu wal records from %lu segments in %.1f ms, total %.1f ms",
+			 id, rs.snapshot_keys, rs.snapshot_ms, rs.wal_records, rs.wal_segments, rs.replay_ms, rs.total_ms);
+	}
+
+	// 创建分布式哈希存储节点对象：一个服务端承载 vnodes 个虚拟节点，0 号的 ID 为 id，客户端操作由它发起
+	VirtualHost *host = new VirtualHost(str, NodeID::fromU64(id), config.vnodes, 2, NULL, durable);
+	// UDP 传输绑定在与 gRPC 相同的地址上，由这个服务端的所有虚拟节点共用
+	Transport *node_transport = config.udp ? (Transport *)new UdpTransport(str, UdpTransport::Options()) : transport;
+	for (NodeKadImpl *vnode : host->vnodes())
+	{
+		vnode->setReplication(config.replicas, config.write_quorum, config.read_quorum);
+		vnode->setLocationCache(config.locations);
+		vnode->setHotCache(config.hot);
+		vnode->setPathCache(config.path_cache_ttl_ms);
+		vnode->setTransfer(config.transfer_bytes_per_sec);
+		vnode->setDeadlines(config.deadlines);
+		vnode->setHedge(config.hedge_pct / 100);
+		vnode->setPlacement(Placement::create(config.placement));
+		if (!vnode->setTransport(node_transport))
+		{
+			DLOG(ERROR, "%lu cannot serve %s over the transport", id, str.c_str());
+			exit(1);
+		}
+	}
+	NodeKadImpl *node = host->node(0);
+	KadAsyncServer *async_server = NULL;
+	if (config.async)
+	{
+		// 异步模式：由绑定到 CPU 核心的少量轮询线程处理所有请求
+		async_server = new KadAsyncServer(host->cores(), config.async_opts);
+		async_server->registerWith(builder);
+	}
+	else
+	{
+		// 同步模式：注册节点服务到 gRPC 服务器，每个请求占用一个同步线程
+		builder.RegisterService(host);
+		if (config.sync_cqs > 0)
+		{
+			builder.SetSyncServerOption(grpc::ServerBuilder::SyncServerOption::NUM_CQS, config.sync_cqs);
+		}
+		if (config.sync_min_pollers > 0)
+		{
+			builder.SetSyncServerOption(grpc::ServerBuilder::SyncServerOption::MIN_POLLERS, config.sync_min_pollers);
+		}
+		if (config.sync_max_pollers > 0)
+		{
+			builder.SetSyncServerOption(grpc::ServerBuilder::SyncServerOption::MAX_POLLERS, config.sync_max_pollers);
+		}
+	}
 
 	// 创建并启动 gRPC 服务器
 	std::unique_ptr<grpc::Server> server(builder.BuildAndStart());
+	if (async_server)
+	{
+		async_server->start();
+	}
 	// 输出服务器的启动信息
-	std::cout << "start " << str << " " << id << std::endl;
+	DLOG(INFO, "start %s %lu", str.c_str(), id);
 
 	// 如果节点是客户端
 	if (p->client)
 	{
-		// 将节点加入到分布式哈希存储网络
-		node->join("127.0.0.1:6900");
+		// 将节点（所有虚拟节点）加入到分布式哈希存储网络
+		if (host->join(config.seeds))
+		{
+			NodeKadImpl::JoinStats js = node->joinStats();
+			DLOG(INFO, "%lu routing table full in %.2f ms (seeds %.2f, self lookup %.2f, %lu buckets refreshed %.2f), %lu nodes, pulled keys in %.2f ms",
+				 id, js.total_ms, js.seed_ms, js.self_lookup_ms, js.buckets_refreshed, js.refresh_ms, js.table_size, js.pull_ms);
+		}
 	}
 
 	// 使用线程屏障等待其他线程就绪
 	pthread_barrier_wait(&barrier);
-	std::cout << "join done" << std::endl; // 输出加入网络完成的信息
+	DLOG(INFO, "%lu join done", id); // 输出加入网络完成的信息
 
 	// 运行客户端代码
 	run_client((void *)node);
 
+	// 输出通道池的命中情况
+	ChannelPool::Stats ps = node->poolStats();
+	DLOG(INFO, "%lu channel pool hits %lu misses %lu reconnects %lu evictions %lu",
+		 id, ps.hits, ps.misses, ps.reconnects, ps.evictions);
+	// 输出查找的平均跳数和联系的节点数
+	uint64_t num_lookups;
+	double avg_hops, avg_contacted;
+	node->lookupStats(num_lookups, avg_hops, avg_contacted);
+	DLOG(INFO, "%lu lookups %lu avg hops %.3f avg contacted %.3f", id, num_lookups, avg_hops, avg_contacted);
+	// 输出副本仲裁的统计
+	NodeKadImpl::ReplicationStats rs = node->replicationStats();
+	DLOG(INFO, "%lu quorum timeouts %lu failures %lu stale reads %lu replica lag avg %.3f ms max %.3f ms",
+		 id, rs.quorum_timeouts, rs.quorum_failures, rs.stale_reads, rs.avg_lag_ms, rs.max_lag_ms);
+	// 输出重试和对冲的次数
+	NodeKadImpl::RetryStats retry = node->retryStats();
+	DLOG(INFO, "%lu store retries %lu hedged requests %lu (delay %.3f ms)", id, retry.store_retries, retry.hedged, retry.hedge_delay_ms);
+	// 输出存活探测和替换缓存的统计
+	NodeKadImpl::LivenessStats live = node->livenessStats();
+	DLOG(INFO, "%lu pings %lu failed %lu coalesced %lu evicted %lu promoted %lu replacement cache %lu",
+		 id, live.pings, live.ping_failures, live.coalesced, live.evicted, live.promoted, live.spares);
+	// 输出键位置缓存的命中情况
+	LocationCache::Stats ls = node->locationStats();
+	DLOG(INFO, "%lu location cache hits %lu misses %lu invalidations %lu expirations %lu evictions %lu size %lu",
+		 id, ls.hits, ls.misses, ls.invalidations, ls.expirations, ls.evictions, ls.size);
+	// 输出热点缓存的统计和命中最多的键
+	HotCache::Stats hs = node->hotCacheStats();
+	DLOG(INFO, "%lu path cache stores %lu hot cache hits %lu misses %lu inserts %lu evictions %lu expirations %lu entries %lu bytes %lu",
+		 id, node->pathCacheStores(), hs.hits, hs.misses, hs.inserts, hs.evictions, hs.expirations, hs.entries, hs.bytes);
+	for (const HotCache::HotKey &hk : node->hotKeys(3))
+	{
+		DLOG(INFO, "%lu hot key %lu hits %lu rate %.2f/s", id, str2u64(hk.key), hk.hits, hk.rate);
+	}
+	// 像外部采集程序一样通过 stats RPC 读取本节点的指标
+	if (config.metrics)
+	{
+		std::unique_ptr<KadImpl::Stub> stub = KadImpl::NewStub(grpc::CreateChannel(str, grpc::InsecureChannelCredentials()));
+		grpc::ClientContext context;
+		StatsRequest request;
+		StatsReply reply;
+		request.set_prometheus(true);
+		grpc::Status status = stub->stats(&context, request, &reply);
+		if (status.ok())
+		{
+			// 多行的指标文本是程序的输出而不是日志，先写出已缓冲的日志再直接写到 stdout
+			Logger::instance().flush();
+			fwrite(reply.prometheus().data(), 1, reply.prometheus().size(), stdout);
+		}
+		else
+		{
+			DLOG(ERROR, "%lu stats failed: %s", id, status.error_message().c_str());
+		}
+	}
+
 	// 如果节点是客户端
 	if (p->client)
 	{
 		pthread_mutex_lock(&exit_lock_);					  // 锁住互斥锁
-		std::cout << id << " prepare to leave " << std::endl; // 输出节点准备离开的信息
-		// 从分布式哈希存储网络中移除节点
-		node->exit();
-		std::cout << id << " exit" << std::endl; // 输出节点已经离开的信息
+		DLOG(INFO, "%lu prepare to leave", id);			  // 输出节点准备离开的信息
+		// 从分布式哈希存储网络中移除节点（所有虚拟节点）
+		host->exit();
+		DLOG(INFO, "%lu exit", id);		 // 输出节点已经离开的信息
 		sleep(1);								 // 休眠1秒，确保其他节点有足够的时间感知节点的离开
 		pthread_mutex_unlock(&exit_lock_);		 // 解锁互斥锁
 	}
 
 	// 使用线程屏障等待其他线程完成
 	pthread_barrier_wait(&barrier);
-	printf("done\n"); // 输出完成的信息
+	// 退出的节点已把键移交出去，留下的节点应持有全部的键
+	uint64_t pulled, handed_off;
+	node->transferStats(pulled, handed_off);
+	DLOG(INFO, "%lu done, store keys %lu pulled %lu handed off %lu, requests served %lu by %lu vnodes",
+		 id, host->storeSize(), pulled, handed_off, host->requestsServed(), host->size());
+
+	// 所有节点都已完成，异步服务端需要先关闭服务器再关闭完成队列
+	if (async_server)
+	{
+		server->Shutdown();
+		async_server->shutdown();
+	}
 
 	// 返回指向节点对象的指针
 	return (void *)node;
@@ -86,46 +268,277 @@ void *run_client(void *para)
 	// 每个客户端要插入的键值对数量
 	uint64_t num_kv = 10000;
 	NodeKadImpl *node = (NodeKadImpl *)para; // 获取分布式哈希存储节点对象
-	uint64_t id = node->nodeId();			 // 获取节点的ID
+	uint64_t id = node->nodeId().low64();	 // 获取节点的ID（这里的节点 ID 都是小整数）
 
 	// 插入键值对到分布式哈希存储
-	for (uint64_t i = 0; i < num_kv; i++)
+	if (config.batch)
+	{
+		vector<std::pair<std::string, std::string>> kvs;
+		for (uint64_t i = 0; i < num_kv; i++)
+		{
+			uint64_t key = i * 2 + id + 1;
+			kvs.push_back(std::make_pair(make_key(key), make_value(key + 1)));
+		}
+		node->multi_put(kvs);
+	}
+	else
 	{
-		uint64_t key = i * 2 + id + 1;
-		node->put(key, key + 1);
-		// std::cout << "put key " << key << std::endl;
+		for (uint64_t i = 0; i < num_kv; i++)
+		{
+			uint64_t key = i * 2 + id + 1;
+			node->put(make_key(key), make_value(key + 1));
+		}
 	}
 
 	// 使用线程屏障等待其他线程完成插入操作
 	pthread_barrier_wait(&barrier);
-	std::cout << "put done" << std::endl; // 输出插入完成的信息
+	DLOG(INFO, "%lu put done", id); // 输出插入完成的信息
 
 	// 查询插入的键值对
-	for (uint64_t i = 0; i < num_kv; i++)
+	if (config.batch)
+	{
+		vector<std::string> keys;
+		map<std::string, std::string> values;
+		for (uint64_t i = 0; i < num_kv; i++)
+		{
+			keys.push_back(make_key(i * 2 + id + 2));
+		}
+		node->multi_get(keys, values);
+		for (auto &kv : values)
+		{
+			if (kv.second != make_value(str2u64(kv.first) + 1))
+			{
+				DLOG(ERROR, "%lu error: wrong value for key %lu", id, str2u64(kv.first));
+			}
+		}
+	}
+	for (uint64_t i = 0; !config.batch && i < num_kv; i++)
 	{
 		uint64_t key = i * 2 + id + 2;
-		uint64_t ret = 0;
+		std::string ret;
 		// 查询键值对，并将结果存储在 ret 中
-		if (node->get(key, ret) && ret != (key + 1))
+		if (node->get(make_key(key), ret) && ret != make_value(key + 1))
 		{
-			printf("error\n"); // 如果查询到的值不正确，输出错误信息
+			DLOG(ERROR, "%lu error: wrong value for key %lu", id, key); // 如果查询到的值不正确，输出错误信息
 		}
-		//	std::cout << "get key " << key << std::endl;
 	}
 
 	// 使用线程屏障等待其他线程完成查询操作
 	pthread_barrier_wait(&barrier);
-	std::cout << "get done" << std::endl; // 输出查询完成的信息
+	DLOG(INFO, "%lu get done", id); // 输出查询完成的信息
 
 	return NULL; // 返回空指针
 }
 
+void usage(const char *prog)
+{
+	printf("usage: %s [--async] [--cqs N] [--pollers N] [--no-pin]\n"
+		   "          [--sync-cqs N] [--sync-min-pollers N] [--sync-max-pollers N] [--batch]\n"
+		   "          [--data-dir DIR] [--fsync-ms N] [--sync-writes] [--snapshot-ms N]\n"
+		   "          [--replicas R] [--write-quorum W] [--read-quorum N] [--value-size N]\n"
+		   "          [--location-cache N] [--location-ttl-ms N] [--location-prefix-bits N]\n"
+		   "          [--path-cache-ttl-ms N] [--hot-cache-mb N] [--metrics] [--transfer-mb-per-sec N]\n"
+		   "          [--seed ADDR[,ADDR...]] [--rpc-timeout-ms N] [--store-retries N] [--hedge-pct P]\n"
+		   "          [--ping-timeout-ms N] [--vnodes V] [--placement hash|identity] [--local-transport N]\n"
+		   "          [--udp]\n"
+		   "          [--log-level trace|debug|info|warn|error] [address]\n",
+		   prog);
+}
+
 int main(int argc, char **argv)
 {
+	static struct option long_options[] = {
+		{"async", no_argument, NULL, 'a'},
+		{"cqs", required_argument, NULL, 'c'},
+		{"pollers", required_argument, NULL, 'p'},
+		{"no-pin", no_argument, NULL, 'n'},
+		{"sync-cqs", required_argument, NULL, 'C'},
+		{"sync-min-pollers", required_argument, NULL, 'm'},
+		{"sync-max-pollers", required_argument, NULL, 'M'},
+		{"batch", no_argument, NULL, 'b'},
+		{"data-dir", required_argument, NULL, 'd'},
+		{"fsync-ms", required_argument, NULL, 'f'},
+		{"sync-writes", no_argument, NULL, 'w'},
+		{"snapshot-ms", required_argument, NULL, 's'},
+		{"replicas", required_argument, NULL, 'r'},
+		{"write-quorum", required_argument, NULL, 'W'},
+		{"read-quorum", required_argument, NULL, 'R'},
+		{"value-size", required_argument, NULL, 'v'},
+		{"location-cache", required_argument, NULL, 'L'},
+		{"location-ttl-ms", required_argument, NULL, 'T'},
+		{"location-prefix-bits", required_argument, NULL, 'P'},
+		{"path-cache-ttl-ms", required_argument, NULL, 'H'},
+		{"hot-cache-mb", required_argument, NULL, 'B'},
+		{"metrics", no_argument, NULL, 'x'},
+		{"transfer-mb-per-sec", required_argument, NULL, 't'},
+		{"seed", required_argument, NULL, 'S'},
+		{"rpc-timeout-ms", required_argument, NULL, 'O'},
+		{"store-retries", required_argument, NULL, 'Y'},
+		{"hedge-pct", required_argument, NULL, 'E'},
+		{"ping-timeout-ms", required_argument, NULL, 'G'},
+		{"vnodes", required_argument, NULL, 'V'},
+		{"placement", required_argument, NULL, 'k'},
+		{"local-transport", required_argument, NULL, 'I'},
+		{"udp", no_argument, NULL, 'U'},
+		{"log-level", required_argument, NULL, 'l'},
+		{"help", no_argument, NULL, 'h'},
+		{NULL, 0, NULL, 0}};
+	int opt;
+	while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1)
+	{
+		switch (opt)
+		{
+		case 'a':
+			config.async = true;
+			break;
+		case 'c':
+			config.async_opts.num_cqs = atoi(optarg);
+			break;
+		case 'p':
+			config.async_opts.pollers_per_cq = atoi(optarg);
+			break;
+		case 'n':
+			config.async_opts.pin_cores = false;
+			break;
+		case 'C':
+			config.sync_cqs = atoi(optarg);
+			break;
+		case 'm':
+			config.sync_min_pollers = atoi(optarg);
+			break;
+		case 'M':
+			config.sync_max_pollers = atoi(optarg);
+			break;
+		case 'b':
+			config.batch = true;
+			break;
+		case 'd':
+			config.data_dir = optarg;
+			mkdir(optarg, 0755);
+			break;
+		case 'f':
+			config.persist.sync_interval_ms = atoll(optarg);
+			break;
+		case 'w':
+			config.persist.wait_for_sync = true;
+			break;
+		case 's':
+			config.persist.snapshot_interval_ms = atoll(optarg);
+			break;
+		case 'r':
+			config.replicas = strtoull(optarg, NULL, 10);
+			break;
+		case 'W':
+			config.write_quorum = strtoull(optarg, NULL, 10);
+			break;
+		case 'R':
+			config.read_quorum = strtoull(optarg, NULL, 10);
+			break;
+		case 'v':
+			config.value_size = strtoull(optarg, NULL, 10);
+			break;
+		case 'L':
+			config.locations.capacity = strtoull(optarg, NULL, 10);
+			break;
+		case 'T':
+			config.locations.ttl_ms = atoll(optarg);
+			break;
+		case 'P':
+			config.locations.prefix_bits = atoi(optarg);
+			break;
+		case 'H':
+			config.path_cache_ttl_ms = atoll(optarg);
+			break;
+		case 'B':
+			config.hot.capacity_bytes = strtoull(optarg, NULL, 10) << 20;
+			break;
+		case 'x':
+			config.metrics = true;
+			break;
+		case 't':
+			config.transfer_bytes_per_sec = strtoull(optarg, NULL, 10) << 20;
+			break;
+		case 'O':
+			config.deadlines.find_ms = config.deadlines.store_ms = atoll(optarg);
+			break;
+		case 'Y':
+			config.deadlines.store_retries = strtoull(optarg, NULL, 10);
+			break;
+		case 'E':
+			config.hedge_pct = atof(optarg);
+			break;
+		case 'G':
+			config.deadlines.ping_ms = atoll(optarg);
+			break;
+		case 'V':
+			config.vnodes = std::max(atoi(optarg), 1);
+			break;
+		case 'k':
+			config.placement = optarg;
+			if (config.placement != "hash" && config.placement != "identity")
+			{
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'I':
+			config.local_transport = std::max(atoi(optarg), 0);
+			break;
+		case 'U':
+			config.udp = true;
+			break;
+		case 'S':
+		{
+			// 逗号分隔的多个地址，也可以重复指定
+			std::string list = optarg;
+			size_t begin = 0;
+			while (begin <= list.size())
+			{
+				size_t end = std::min(list.find(',', begin), list.size());
+				if (end > begin)
+				{
+					config.seeds.push_back(list.substr(begin, end - begin));
+				}
+				begin = end + 1;
+			}
+			break;
+		}
+		case 'l':
+		{
+			// 运行时只能提高级别，低于编译期级别（默认 info）的日志已经不存在
+			const char *levels[] = {"trace", "debug", "info", "warn", "error"};
+			int level = std::find(levels, levels + 5, std::string(optarg)) - levels;
+			if (level == 5)
+			{
+				usage(argv[0]);
+				return 1;
+			}
+			Logger::instance().setLevel(level);
+			break;
+		}
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if (config.seeds.empty())
+	{
+		config.seeds.push_back("127.0.0.1:6900");
+	}
 	char *address = ip_port;
-	if (argc == 2)
+	if (optind < argc)
+	{
+		address = argv[optind];
+	}
+	if (config.udp && config.local_transport > 0)
+	{
+		usage(argv[0]);
+		return 1;
+	}
+	if (config.local_transport > 0)
 	{
-		address = argv[1];
+		transport = new LocalTransport(config.local_transport);
 	}
 	int max_server = 4;
 	int num_server = 4;
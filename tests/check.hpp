@@ -0,0 +1,43 @@
+/*
+ * check.hpp
+ *
+ * 单元测试共用的断言：失败时打印位置和表达式并计数，不中断后续检查。
+ * main 最后返回 checkResult()，有失败时进程退出码非 0，供 ctest 判断。
+ */
+
+#ifndef TESTS_CHECK_HPP_
+#define TESTS_CHECK_HPP_
+
+#include <atomic>
+
+#include <stdio.h>
+
+inline std::atomic<int> &checkFailures()
+{
+	static std::atomic<int> failures{0};
+	return failures;
+}
+
+#define CHECK(cond)                                                          \
+	do                                                                       \
+	{                                                                        \
+		if (!(cond))                                                         \
+		{                                                                    \
+			fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+			checkFailures()++;                                               \
+		}                                                                    \
+	} while (0)
+
+inline int checkResult(const char *name)
+{
+	int failures = checkFailures().load();
+	if (failures != 0)
+	{
+		fprintf(stderr, "%s: %d check(s) failed\n", name, failures);
+		return 1;
+	}
+	printf("%s: ok\n", name);
+	return 0;
+}
+
+#endif /* TESTS_CHECK_HPP_ */
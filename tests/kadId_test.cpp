@@ -0,0 +1,151 @@
+/*
+ * kadId_test.cpp
+ *
+ * KadId 的字节编码、比较、前导零和桶距离，以及 closestK 与完整排序的结果一致。
+ * 各个位宽都在同一个程序里实例化，重点是跨字且最高字有填充位的 160 位和 256 位
+ */
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "kadId.hpp"
+#include "check.hpp"
+
+template <int Bits>
+static void testBytes()
+{
+	using Id = KadId<Bits>;
+	for (uint64_t seed = 0; seed < 1000; seed++)
+	{
+		Id id = Id::fromSeed(seed);
+		std::string bytes = id.toBytes();
+		CHECK(bytes.size() == (size_t)Id::num_bytes);
+		CHECK(Id::fromBytes(bytes) == id);
+		// 填充位恒为 0，最高位落在第 Bits - 1 位以内
+		CHECK(id.leadingZeros() >= 0 && id.leadingZeros() <= Bits);
+	}
+	// 不足定长时高位补 0
+	CHECK(Id::fromBytes(std::string("\x01\x02", 2)) == Id::fromU64(0x0102));
+	Id one = Id::fromU64(1);
+	CHECK(one.leadingZeros() == Bits - 1);
+	CHECK(Id().leadingZeros() == Bits);
+	CHECK(Id().isZero() && !one.isZero());
+
+	// 最高位：字节串的第一个字节是 0x80
+	std::string top(Id::num_bytes, '\0');
+	top[0] = (char)0x80;
+	Id high = Id::fromBytes(top);
+	CHECK(high.leadingZeros() == 0);
+	CHECK(high.high64() == 1ULL << 63);
+	CHECK(one < high && !(high < one));
+	CHECK(high.prefix(1) == high && high.prefix(0).isZero());
+}
+
+template <int Bits>
+static void testBucketDistance()
+{
+	using Id = KadId<Bits>;
+	Id fill = Id::fromSeed(42);
+	for (int i = 0; i < Bits; i++)
+	{
+		// 第 i 个桶覆盖最高位为第 i 位的距离
+		Id d = Id::bucketDistance(i, fill);
+		CHECK(d.leadingZeros() == Bits - 1 - i);
+	}
+}
+
+template <int Bits>
+static void testCompare()
+{
+	using Id = KadId<Bits>;
+	std::vector<Id> ids;
+	for (uint64_t seed = 0; seed < 200; seed++)
+	{
+		ids.push_back(Id::fromSeed(seed * 7919));
+	}
+	Id target = Id::fromSeed(12345);
+	for (const Id &a : ids)
+	{
+		for (const Id &b : ids)
+		{
+			// closer 与先求距离再比较一致，< 与字节串的字典序一致
+			CHECK(Id::closer(a, b, target) == ((a ^ target) < (b ^ target)));
+			CHECK((a < b) == (a.toBytes() < b.toBytes()));
+		}
+	}
+}
+
+template <int Bits>
+static void checkClosestK(std::vector<KadId<Bits>> ids, const KadId<Bits> &target, size_t n)
+{
+	using Id = KadId<Bits>;
+	std::vector<Id> expected = ids;
+	std::sort(expected.begin(), expected.end(), [&](const Id &a, const Id &b)
+			  { return Id::closer(a, b, target); });
+	expected.resize(std::min(n, expected.size()));
+	closestK(ids, target, n, [](const Id &id) -> const Id &
+			 { return id; });
+	CHECK(ids.size() == expected.size());
+	for (size_t i = 0; i < ids.size() && i < expected.size(); i++)
+	{
+		CHECK(ids[i] == expected[i]);
+	}
+}
+
+template <int Bits>
+static void testClosestK()
+{
+	using Id = KadId<Bits>;
+	std::vector<Id> ids;
+	for (uint64_t seed = 0; seed < 2000; seed++)
+	{
+		ids.push_back(Id::fromSeed(seed));
+	}
+	for (uint64_t t = 0; t < 20; t++)
+	{
+		Id target = Id::fromSeed(1000000 + t);
+		checkClosestK<Bits>(ids, target, 20);
+		checkClosestK<Bits>(ids, target, 1);
+		checkClosestK<Bits>(ids, target, 5000);
+	}
+
+	/*
+	 * 最高 64 位相同、只在低位不同的 ID：closestK 先按最高 64 位选出候选，
+	 * 与第 n 个前缀相同的项都必须留下并按完整距离排序
+	 */
+	std::vector<Id> same_prefix;
+	std::string bytes(Id::num_bytes, '\x5a');
+	for (int i = 0; i < 300; i++)
+	{
+		Id low = Id::fromSeed(i);
+		std::string tail = low.toBytes();
+		std::string mixed = bytes.substr(0, 8) + tail.substr(8);
+		same_prefix.push_back(Id::fromBytes(mixed));
+	}
+	checkClosestK<Bits>(same_prefix, Id::fromBytes(bytes), 20);
+	checkClosestK<Bits>(same_prefix, Id::fromSeed(7), 20);
+
+	std::vector<Id> empty;
+	closestK(empty, Id(), 20, [](const Id &id) -> const Id &
+			 { return id; });
+	CHECK(empty.empty());
+}
+
+template <int Bits>
+static void testAll()
+{
+	testBytes<Bits>();
+	testBucketDistance<Bits>();
+	testCompare<Bits>();
+	testClosestK<Bits>();
+}
+
+int main()
+{
+	testAll<64>();
+	testAll<128>();
+	testAll<160>();
+	testAll<256>();
+	return checkResult("kadId_test");
+}
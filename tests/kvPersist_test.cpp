@@ -0,0 +1,229 @@
+/*
+ * kvPersist_test.cpp
+ *
+ * DurableKVStore 的恢复：只有 WAL、快照加 WAL、覆盖和删除的重放，以及 WAL 尾部被截断时丢弃不完整的记录
+ */
+
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "kvPersist.hpp"
+#include "check.hpp"
+
+static std::string makeDir()
+{
+	char tmpl[] = "/tmp/dhash-kvpersist-XXXXXX";
+	char *dir = mkdtemp(tmpl);
+	CHECK(dir != NULL);
+	return dir != NULL ? dir : "";
+}
+
+static void removeDir(const std::string &dir)
+{
+	DIR *d = opendir(dir.c_str());
+	if (d == NULL)
+	{
+		return;
+	}
+	while (struct dirent *e = readdir(d))
+	{
+		std::string name = e->d_name;
+		if (name != "." && name != "..")
+		{
+			unlink((dir + "/" + name).c_str());
+		}
+	}
+	closedir(d);
+	rmdir(dir.c_str());
+}
+
+static std::vector<std::string> walFiles(const std::string &dir)
+{
+	std::vector<std::string> files;
+	DIR *d = opendir(dir.c_str());
+	while (d != NULL)
+	{
+		struct dirent *e = readdir(d);
+		if (e == NULL)
+		{
+			closedir(d);
+			break;
+		}
+		std::string name = e->d_name;
+		if (name.compare(0, 4, "wal-") == 0)
+		{
+			files.push_back(dir + "/" + name);
+		}
+	}
+	return files;
+}
+
+static DurableKVStore::Options options(const std::string &dir)
+{
+	DurableKVStore::Options opts;
+	opts.dir = dir;
+	opts.sync_interval_ms = 1;
+	opts.snapshot_interval_ms = 0; // 快照只在测试中显式触发
+	opts.snapshot_wal_bytes = 0;
+	return opts;
+}
+
+static std::string key(int i)
+{
+	return "key-" + std::to_string(i);
+}
+
+static std::string value(int i, int version)
+{
+	return std::string(1 + i % 300, 'a' + version % 26) + std::to_string(i);
+}
+
+// 期望的内容：i < n 中，erased 的被删除，其余是第 version 版的值
+static void checkContents(ValueStore *store, int n, int version, bool (*erased)(int))
+{
+	std::string v;
+	uint64_t expected = 0;
+	for (int i = 0; i < n; i++)
+	{
+		bool found = store->get(key(i), &v);
+		if (erased(i))
+		{
+			CHECK(!found);
+			continue;
+		}
+		expected++;
+		CHECK(found && v == value(i, version));
+	}
+	CHECK(store->size() == expected);
+}
+
+static bool noneErased(int)
+{
+	return false;
+}
+
+static bool everyThird(int i)
+{
+	return i % 3 == 0;
+}
+
+// 所有修改只在 WAL 中，重启后重放
+static void testWalRecovery()
+{
+	std::string dir = makeDir();
+	{
+		ArenaValueStore inner;
+		DurableKVStore store(&inner, options(dir));
+		for (int i = 0; i < 2000; i++)
+		{
+			CHECK(store.put(key(i), value(i, 0)));
+		}
+		for (int i = 0; i < 2000; i++)
+		{
+			CHECK(store.put(key(i), value(i, 1)));
+		}
+		for (int i = 0; i < 2000; i += 3)
+		{
+			CHECK(store.erase(key(i)));
+		}
+	}
+	{
+		ArenaValueStore inner;
+		DurableKVStore store(&inner, options(dir));
+		DurableKVStore::RecoveryStats stats = store.recoveryStats();
+		CHECK(stats.snapshot_keys == 0);
+		CHECK(stats.wal_records == 2000 + 2000 + 667);
+		checkContents(&store, 2000, 1, everyThird);
+	}
+	removeDir(dir);
+}
+
+// 快照之前的修改从快照加载，之后的从 WAL 重放，覆盖和删除都要生效
+static void testSnapshotRecovery()
+{
+	std::string dir = makeDir();
+	{
+		ArenaValueStore inner;
+		DurableKVStore store(&inner, options(dir));
+		for (int i = 0; i < 3000; i++)
+		{
+			CHECK(store.put(key(i), value(i, 0)));
+		}
+		store.snapshot();
+		CHECK(store.snapshotCount() == 1);
+		for (int i = 0; i < 3000; i++)
+		{
+			CHECK(store.put(key(i), value(i, 2)));
+		}
+		for (int i = 0; i < 3000; i += 3)
+		{
+			CHECK(store.erase(key(i)));
+		}
+	}
+	{
+		ArenaValueStore inner;
+		DurableKVStore store(&inner, options(dir));
+		DurableKVStore::RecoveryStats stats = store.recoveryStats();
+		CHECK(stats.snapshot_keys == 3000);
+		CHECK(stats.wal_records == 3000 + 1000);
+		checkContents(&store, 3000, 2, everyThird);
+
+		// 恢复后的存储继续写入，再次重启仍然一致
+		for (int i = 0; i < 3000; i++)
+		{
+			CHECK(store.put(key(i), value(i, 3)));
+		}
+	}
+	{
+		ArenaValueStore inner;
+		DurableKVStore store(&inner, options(dir));
+		checkContents(&store, 3000, 3, noneErased);
+	}
+	removeDir(dir);
+}
+
+// WAL 尾部只写了一半的记录（进程在写盘中途退出）在恢复时被丢弃，之前的记录都保留
+static void testTruncatedWal()
+{
+	std::string dir = makeDir();
+	{
+		ArenaValueStore inner;
+		DurableKVStore store(&inner, options(dir));
+		for (int i = 0; i < 100; i++)
+		{
+			CHECK(store.put(key(i), value(i, 0)));
+		}
+	}
+	std::vector<std::string> files = walFiles(dir);
+	CHECK(!files.empty());
+	for (const std::string &file : files)
+	{
+		struct stat st;
+		if (stat(file.c_str(), &st) == 0 && st.st_size > 8)
+		{
+			CHECK(truncate(file.c_str(), st.st_size - 8) == 0);
+		}
+	}
+	{
+		ArenaValueStore inner;
+		DurableKVStore store(&inner, options(dir));
+		CHECK(store.recoveryStats().wal_records == 99);
+		std::string v;
+		CHECK(!store.get(key(99), &v));
+		checkContents(&store, 99, 0, noneErased);
+	}
+	removeDir(dir);
+}
+
+int main()
+{
+	testWalRecovery();
+	testSnapshotRecovery();
+	testTruncatedWal();
+	return checkResult("kvPersist_test");
+}
@@ -0,0 +1,201 @@
+/*
+ * valueStore_test.cpp
+ *
+ * ArenaValueStore：覆盖写（跨 slab 级别）、删除、keyId 冲突的键，以及并发读写时读到的值完整
+ */
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "valueStore.hpp"
+#include "check.hpp"
+
+// 与 key 的 keyId 相同的另一个键：8 字节的键直接取自 keyId
+static std::string collider(const std::string &key)
+{
+	uint64_t id = keyId(key);
+	return std::string((const char *)&id, sizeof(id));
+}
+
+// 长度随 i 变化的值，首字节是 tag，末尾是 i，读者据此检查值没有被截断或混入其他记录
+static std::string makeValue(char tag, uint64_t i)
+{
+	std::string suffix = std::to_string(i);
+	std::string value(1 + (i * 37) % 700, tag);
+	return value + "#" + suffix;
+}
+
+static bool validValue(const std::string &value, char tag)
+{
+	size_t pos = value.rfind('#');
+	if (pos == std::string::npos || pos == 0 || value[0] != tag)
+	{
+		return false;
+	}
+	uint64_t i = strtoull(value.c_str() + pos + 1, NULL, 10);
+	return value == makeValue(tag, i);
+}
+
+static void testOverwrite()
+{
+	ArenaValueStore store;
+	std::string value;
+	CHECK(!store.get("k", &value));
+	CHECK(store.put("k", "small"));
+	CHECK(store.get("k", &value) && value == "small");
+	// 变大到更高的 slab 级别，再变回很小，旧记录都要被替换掉
+	std::string big(5000, 'b');
+	CHECK(store.put("k", big));
+	CHECK(store.get("k", &value) && value == big);
+	CHECK(store.put("k", ""));
+	CHECK(store.get("k", &value) && value.empty());
+	CHECK(store.size() == 1);
+
+	// 超过最大级别的记录没有可用的级别，put 据此拒绝；不真的构造这么大的值
+	CHECK(SlabArena::classOf(SlabArena::blockSize(SlabArena::num_classes - 1)) == SlabArena::num_classes - 1);
+	CHECK(SlabArena::classOf(SlabArena::blockSize(SlabArena::num_classes - 1) + 1) == -1);
+}
+
+static void testErase()
+{
+	ArenaValueStore store;
+	std::string value;
+	for (int i = 0; i < 1000; i++)
+	{
+		CHECK(store.put("key" + std::to_string(i), makeValue('v', i)));
+	}
+	CHECK(store.size() == 1000);
+	for (int i = 0; i < 1000; i += 2)
+	{
+		CHECK(store.erase("key" + std::to_string(i)));
+	}
+	CHECK(!store.erase("key0"));
+	CHECK(store.size() == 500);
+	for (int i = 0; i < 1000; i++)
+	{
+		bool found = store.get("key" + std::to_string(i), &value);
+		CHECK(found == (i % 2 == 1));
+		CHECK(!found || value == makeValue('v', i));
+	}
+	uint64_t visited = 0;
+	store.forEach([&](std::string_view key, std::string_view)
+				  { visited++; });
+	CHECK(visited == 500);
+}
+
+static void testCollision()
+{
+	ArenaValueStore store;
+	std::string value;
+	std::string a = "a key longer than eight bytes";
+	std::string b = collider(a);
+	CHECK(keyId(a) == keyId(b) && a != b);
+
+	CHECK(store.put(a, "A"));
+	CHECK(!store.get(b, &value));
+	CHECK(store.put(b, "B"));
+	CHECK(store.size() == 2);
+	CHECK(store.get(a, &value) && value == "A");
+	CHECK(store.get(b, &value) && value == "B");
+
+	CHECK(store.put(a, "A2"));
+	CHECK(store.get(a, &value) && value == "A2");
+	CHECK(store.get(b, &value) && value == "B");
+
+	CHECK(store.erase(a));
+	CHECK(!store.get(a, &value));
+	CHECK(store.get(b, &value) && value == "B");
+	CHECK(store.size() == 1);
+}
+
+/*
+ * 两个写线程反复覆盖一对冲突的键（值的长度不断变化，记录在 slab 级别之间迁移），
+ * 并插入后删除临时键让块被复用；读线程要求每次都能读到完整的值，遍历只看到完整的值
+ */
+static void testConcurrentGet()
+{
+	ArenaValueStore store;
+	std::string a = "concurrent key";
+	std::string b = collider(a);
+	store.put(a, makeValue('a', 0));
+	store.put(b, makeValue('b', 0));
+
+	std::atomic<bool> stop{false};
+	std::atomic<int> bad{0};
+	std::vector<std::thread> readers;
+	for (int r = 0; r < 3; r++)
+	{
+		readers.emplace_back([&]
+							 {
+								 std::string value;
+								 while (!stop.load())
+								 {
+									 if (!store.get(a, &value) || !validValue(value, 'a'))
+									 {
+										 bad++;
+									 }
+									 if (!store.get(b, &value) || !validValue(value, 'b'))
+									 {
+										 bad++;
+									 }
+								 } });
+	}
+	std::thread scanner([&]
+						{
+							while (!stop.load())
+							{
+								store.forEach([&](std::string_view key, std::string_view value)
+											  {
+												  if (key == a && !validValue(std::string(value), 'a'))
+												  {
+													  bad++;
+												  }
+											  });
+							} });
+
+	std::vector<std::thread> writers;
+	for (int w = 0; w < 2; w++)
+	{
+		writers.emplace_back([&, w]
+							 {
+								 const std::string &key = w == 0 ? a : b;
+								 char tag = w == 0 ? 'a' : 'b';
+								 for (uint64_t i = 1; i <= 200000; i++)
+								 {
+									 store.put(key, makeValue(tag, i));
+									 if (i % 4 == 0)
+									 {
+										 std::string tmp = "tmp" + std::to_string(w) + ":" + std::to_string(i % 64);
+										 store.put(tmp, makeValue('t', i));
+										 store.erase(tmp);
+									 }
+								 } });
+	}
+	for (std::thread &t : writers)
+	{
+		t.join();
+	}
+	stop = true;
+	for (std::thread &t : readers)
+	{
+		t.join();
+	}
+	scanner.join();
+
+	CHECK(bad.load() == 0);
+	CHECK(store.size() == 2);
+	std::string value;
+	CHECK(store.get(a, &value) && value == makeValue('a', 200000));
+	CHECK(store.get(b, &value) && value == makeValue('b', 200000));
+}
+
+int main()
+{
+	testOverwrite();
+	testErase();
+	testCollision();
+	testConcurrentGet();
+	return checkResult("valueStore_test");
+}